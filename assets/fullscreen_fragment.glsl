@@ -16,11 +16,12 @@
 
 precision highp float;
 uniform sampler2D s_Texture;
+uniform vec2 u_TexCoordMax;     // Last texel centers rendered to, so filtering stays inside them
 
 varying vec2 v_TexCoord;
 
 void main()
 {
-    gl_FragColor = texture2D(s_Texture, v_TexCoord);
+    gl_FragColor = texture2D(s_Texture, min(v_TexCoord, u_TexCoordMax));
     //gl_FragColor = vec4(v_TexCoord,1.0,1.0);
 }
@@ -16,10 +16,12 @@
 attribute vec4 a_Position;
 attribute vec2 a_TexCoord;
 
+uniform vec2 u_TexCoordScale;   // Part of the texture that was rendered to
+
 varying vec2 v_TexCoord;
 
 void main()
 {
-    v_TexCoord = a_TexCoord;
+    v_TexCoord = a_TexCoord*u_TexCoordScale;
     gl_Position = a_Position;
 }
@@ -0,0 +1,14 @@
+/** INSTANCED=1 reads the world matrix from per-instance attributes instead
+ *  of the u_World uniform, so a batch of models is one draw
+ */
+#ifndef INSTANCED
+#define INSTANCED 0
+#endif
+
+#if INSTANCED
+attribute mat4 a_World;
+#define WORLD_MATRIX a_World
+#else
+uniform mat4 u_World;
+#define WORLD_MATRIX u_World
+#endif
@@ -0,0 +1,28 @@
+/** View space lights for forward shading. GLSL ES 3.00 reads them from the
+ *  Lights uniform block, which holds MAX_BLOCK_LIGHTS, otherwise MAX_LIGHTS
+ *  are uniform arrays. Access them through the LIGHT_ARRAY_* macros.
+ */
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 64
+#endif
+
+#if __VERSION__ >= 300
+#define MAX_BLOCK_LIGHTS 256
+layout(std140) uniform Lights
+{
+    highp vec4  u_LightPositionSizes[MAX_BLOCK_LIGHTS];    /* xyz: position, w: size */
+    highp vec4  u_LightColors[MAX_BLOCK_LIGHTS];
+    highp int   u_NumLights;
+};
+#define LIGHT_ARRAY_POSITION(ii)    u_LightPositionSizes[ii].xyz
+#define LIGHT_ARRAY_COLOR(ii)       u_LightColors[ii].rgb
+#define LIGHT_ARRAY_SIZE(ii)        u_LightPositionSizes[ii].w
+#else
+uniform vec3    u_LightPositions[MAX_LIGHTS];
+uniform vec3    u_LightColors[MAX_LIGHTS];
+uniform float   u_LightSizes[MAX_LIGHTS];
+uniform int     u_NumLights;
+#define LIGHT_ARRAY_POSITION(ii)    u_LightPositions[ii]
+#define LIGHT_ARRAY_COLOR(ii)       u_LightColors[ii]
+#define LIGHT_ARRAY_SIZE(ii)        u_LightSizes[ii]
+#endif
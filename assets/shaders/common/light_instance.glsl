@@ -0,0 +1,23 @@
+/** The light being shaded. INSTANCED=1 passes it from per-instance
+ *  attributes through varyings, so every light volume is one draw,
+ *  otherwise it comes from uniforms set per light.
+ */
+#ifndef INSTANCED
+#define INSTANCED 0
+#endif
+
+#if INSTANCED
+varying vec3    v_LightPosition;    /* View space */
+varying vec3    v_LightColor;
+varying float   v_LightSize;
+#define LIGHT_POSITION  v_LightPosition
+#define LIGHT_COLOR     v_LightColor
+#define LIGHT_SIZE      v_LightSize
+#else
+uniform vec3    u_LightPosition;    /* View space */
+uniform vec3    u_LightColor;
+uniform float   u_LightSize;
+#define LIGHT_POSITION  u_LightPosition
+#define LIGHT_COLOR     u_LightColor
+#define LIGHT_SIZE      u_LightSize
+#endif
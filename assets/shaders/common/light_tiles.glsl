@@ -0,0 +1,42 @@
+/** Lights binned into screen tiles or 3D clusters, GLSL ES 3.00 only. See
+ *  light_tiles.h for the texture layouts. TILE_SIZE, DEPTH_SLICES,
+ *  LIGHT_INDEX_WIDTH and LIGHT_DATA_WIDTH come from `light_tile_defines`.
+ */
+precision highp int;    /* Index lists outgrow mediump */
+
+uniform highp usampler2D s_LightTiles;
+uniform highp usampler2D s_LightIndices;
+uniform highp sampler2D s_LightData;
+#if DEPTH_SLICES > 1
+uniform highp vec2 u_LightSliceParams;  /* log(view depth) to slice scale and bias */
+#endif
+
+ivec2 light_tile_texel(int index, int width)
+{
+    return ivec2(index % width, index / width);
+}
+/** @return First index and light count of the tile holding the fragment */
+ivec2 light_tile_range(vec2 frag_coord, float view_depth)
+{
+    ivec2 tile = ivec2(frag_coord) / TILE_SIZE;
+#if DEPTH_SLICES > 1
+    int tiles_y = (int(u_Viewport.y) + TILE_SIZE - 1) / TILE_SIZE;
+    int slice = clamp(int(log(view_depth)*u_LightSliceParams.x + u_LightSliceParams.y), 0, DEPTH_SLICES - 1);
+    tile.y += slice*tiles_y;
+#endif
+    uvec2 range = texelFetch(s_LightTiles, tile, 0).rg;
+    return ivec2(range);
+}
+int light_tile_index(int ii)
+{
+    return int(texelFetch(s_LightIndices, light_tile_texel(ii, LIGHT_INDEX_WIDTH), 0).r);
+}
+/** View space position in xyz, size in w */
+vec4 light_tile_position_size(int light)
+{
+    return texelFetch(s_LightData, light_tile_texel(light*2, LIGHT_DATA_WIDTH), 0);
+}
+vec3 light_tile_color(int light)
+{
+    return texelFetch(s_LightData, light_tile_texel(light*2 + 1, LIGHT_DATA_WIDTH), 0).rgb;
+}
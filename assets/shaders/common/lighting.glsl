@@ -0,0 +1,4 @@
+float attenuate(float dist, float size)
+{
+    return 1.0 - pow( clamp(dist/size, 0.0, 1.0), 2.0);
+}
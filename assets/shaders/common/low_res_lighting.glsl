@@ -0,0 +1,76 @@
+/** Lighting accumulated at 1/u_LightDivisor of the resolution, see
+ *  low_res_lighting.h. GLSL ES 3.00 only.
+ *
+ *  s_LowResDepth holds each block's min and max view depth and the
+ *  octahedral normal of the one lit, the min on even checkerboard texels
+ *  and the max on odd ones.
+ */
+#include "shaders/common/normal_encoding.glsl"
+#include "shaders/common/per_frame.glsl"
+
+#if __VERSION__ >= 300
+#define UPSAMPLE_DEPTH_FALLOFF  16.0    /* Weight lost per relative depth difference */
+#define UPSAMPLE_NORMAL_POWER   8.0
+
+uniform sampler2D   s_LowResLight;
+uniform sampler2D   s_LowResDepth;
+uniform int         u_LightDivisor;
+
+/** @return The view depth a low resolution texel was lit at */
+float low_res_depth(ivec2 texel, vec4 depth_normal)
+{
+    return ((texel.x + texel.y) & 1) == 0 ? depth_normal.r : depth_normal.g;
+}
+/** @return The view depth of a depth buffer value at a [0..1] screen coordinate */
+float view_depth(vec2 screen_coord, float depth)
+{
+    vec4 view_pos = u_InvProj * vec4(screen_coord*2.0-1.0, depth*2.0-1.0, 1.0);
+    return view_pos.z/view_pos.w;
+}
+/** @return The view space position at a [0..1] screen coordinate and view depth */
+vec3 view_position(vec2 screen_coord, float z)
+{
+    vec4 ray = u_InvProj * vec4(screen_coord*2.0-1.0, 1.0, 1.0);
+    return ray.xyz*(z/ray.z);
+}
+
+/** Bilateral upsample: the four nearest texels are weighted bilinearly,
+ *  scaled down by how far their depth is from `z`, relative to it, and by
+ *  how far their normal turns from `normal`. Where none match, such as a
+ *  thin object lost in the reduction, the texel closest in depth is used.
+ */
+vec3 upsample_lighting(vec2 frag_coord, float z, vec3 normal)
+{
+    float divisor = float(u_LightDivisor);
+    vec2 coord = frag_coord/divisor - 0.5;
+    vec2 f = fract(coord);
+    ivec2 base = ivec2(floor(coord));
+    ivec2 last = ivec2(ceil(u_Viewport/divisor)) - 1;
+
+    vec3 total = vec3(0.0);
+    float total_weight = 0.0;
+    vec3 closest = vec3(0.0);
+    float closest_dist = 1e30;
+
+    for(int ii = 0; ii < 4; ++ii) {
+        ivec2 offset = ivec2(ii & 1, ii >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), last);
+        vec4 depth_normal = texelFetch(s_LowResDepth, texel, 0);
+        vec3 light = texelFetch(s_LowResLight, texel, 0).rgb;
+
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float dist = abs(low_res_depth(texel, depth_normal) - z)/abs(z);
+        float depth_weight = max(1.0 - dist*UPSAMPLE_DEPTH_FALLOFF, 0.0);
+        float normal_weight = pow(max(dot(decode_octahedral(depth_normal.ba), normal), 0.0), UPSAMPLE_NORMAL_POWER);
+        float weight = bilinear.x*bilinear.y*depth_weight*normal_weight;
+
+        total += light*weight;
+        total_weight += weight;
+        if(dist < closest_dist) {
+            closest_dist = dist;
+            closest = light;
+        }
+    }
+    return total_weight > 1e-4 ? total/total_weight : closest;
+}
+#endif
@@ -0,0 +1,39 @@
+/** Spheremap transform, packs a view space normal into two channels */
+vec4 encode(vec3 normal)
+{
+    float p = sqrt(normal.z*8.0+8.0);
+    return vec4(normal.xy/p + 0.5,0,0);
+}
+vec3 decode(vec2 encoded)
+{
+    vec2 fenc = encoded*4.0 - 2.0;
+    float f = dot(fenc,fenc);
+    float g = sqrt(1.0 - f/4.0);
+    vec3 normal;
+    normal.xy = fenc*g;
+    normal.z = 1.0 - f/2.0;
+    return normal;
+}
+
+/** Octahedral encoding, folds the unit sphere onto [0,1]^2 with even
+ *  precision in every direction
+ */
+vec2 sign_not_zero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+vec2 encode_octahedral(vec3 normal)
+{
+    vec2 p = normal.xy/(abs(normal.x) + abs(normal.y) + abs(normal.z));
+    if(normal.z < 0.0)
+        p = (1.0 - abs(p.yx))*sign_not_zero(p);
+    return p*0.5 + 0.5;
+}
+vec3 decode_octahedral(vec2 encoded)
+{
+    vec2 p = encoded*2.0 - 1.0;
+    vec3 normal = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+    if(normal.z < 0.0)
+        normal.xy = (1.0 - abs(normal.yx))*sign_not_zero(normal.xy);
+    return normalize(normal);
+}
@@ -0,0 +1,19 @@
+/** NORMAL_MAP=0 skips the normal texture and uses the interpolated normal */
+#ifndef NORMAL_MAP
+#define NORMAL_MAP 1
+#endif
+
+vec3 surface_normal(sampler2D normal_map, vec2 tex_coord, vec3 normal_vs, vec3 tangent_vs, vec3 bitangent_vs)
+{
+    vec3 N = normalize(normal_vs);
+#if NORMAL_MAP
+    vec3 normal = normalize(texture2D(normal_map, tex_coord).rgb*2.0 - 1.0);
+    vec3 T = normalize(tangent_vs);
+    vec3 B = normalize(bitangent_vs);
+
+    mat3 TBN = mat3(T, B, N);
+    return normalize(TBN*normal);
+#else
+    return N;
+#endif
+}
@@ -0,0 +1,21 @@
+/** Camera constants, the PerFrame uniform block on GLSL ES 3.00. Members
+ *  are highp so the block matches between the vertex and fragment shader.
+ *  u_Viewport is the size rendered to, u_TargetScale the fraction of the
+ *  render targets it covers from the bottom left.
+ */
+#if __VERSION__ >= 300
+layout(std140) uniform PerFrame
+{
+    highp mat4  u_Projection;
+    highp mat4  u_View;
+    highp mat4  u_InvProj;
+    highp vec2  u_Viewport;
+    highp vec2  u_TargetScale;
+};
+#else
+uniform mat4    u_Projection;
+uniform mat4    u_View;
+uniform mat4    u_InvProj;
+uniform vec2    u_Viewport;
+uniform vec2    u_TargetScale;
+#endif
@@ -0,0 +1,13 @@
+/** Material constants, the PerMaterial uniform block on GLSL ES 3.00 */
+#if __VERSION__ >= 300
+layout(std140) uniform PerMaterial
+{
+    highp vec3  u_SpecularColor;
+    highp float u_SpecularPower;
+    highp float u_SpecularCoefficient;
+};
+#else
+uniform vec3    u_SpecularColor;
+uniform float   u_SpecularPower;
+uniform float   u_SpecularCoefficient;
+#endif
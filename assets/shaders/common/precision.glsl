@@ -0,0 +1,5 @@
+/** Default float precision, override with PRECISION=mediump */
+#ifndef PRECISION
+#define PRECISION highp
+#endif
+precision PRECISION float;
@@ -0,0 +1,9 @@
+#include "shaders/common/precision.glsl"
+
+/** Light volume stencil marking for the deferred and light pre-pass
+ *  renderers, only the depth test results matter and color writes are masked
+ */
+void main(void)
+{
+    gl_FragColor = vec4(0.0);
+}
@@ -0,0 +1,24 @@
+#include "shaders/common/precision.glsl"
+#include "shaders/deferred/gbuffer.glsl"
+#include "shaders/common/per_frame.glsl"
+#include "shaders/common/low_res_lighting.glsl"
+
+/** Upsamples the lighting accumulated at low resolution and applies the
+ *  albedo, a fullscreen triangle from tiledvertex.glsl. GLSL ES 3.00 only.
+ */
+uniform sampler2D s_GBuffer[3];
+
+void main(void)
+{
+    /** Load texture values
+     */
+    vec2 screen_coord = gl_FragCoord.xy/u_Viewport; // map to [0..1]
+    vec2 tex_coord = screen_coord*u_TargetScale;
+
+    vec3 albedo = texture2D(s_GBuffer[0], tex_coord).rgb;
+    vec3 normal = decode_gbuffer_normal(texture2D(s_GBuffer[1], tex_coord));
+    float depth = texture2D(s_GBuffer[2], tex_coord).r;
+
+    vec3 light = upsample_lighting(gl_FragCoord.xy, view_depth(screen_coord, depth), normal);
+    gl_FragColor = vec4(light*albedo, 1.0);
+}
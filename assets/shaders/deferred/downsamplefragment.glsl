@@ -0,0 +1,44 @@
+#include "shaders/common/precision.glsl"
+#include "shaders/deferred/gbuffer.glsl"
+#include "shaders/common/per_frame.glsl"
+#include "shaders/common/low_res_lighting.glsl"
+
+/** Reduces each u_LightDivisor square block of the G-buffer to its min and
+ *  max view depth and the normal of the sample `low_res_depth` picks for
+ *  the texel, a fullscreen triangle from tiledvertex.glsl. Also used by the
+ *  deferred lighting renderer, whose normals match GBUFFER_LAYOUT 0. GLSL
+ *  ES 3.00 only.
+ */
+uniform sampler2D s_Normals;
+uniform sampler2D s_Depth;
+
+void main(void)
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 last = ivec2(u_Viewport) - 1;
+    bool lit_at_max = ((texel.x + texel.y) & 1) != 0;
+    float min_z = 1e30;
+    float max_z = -1e30;
+    ivec2 lit = texel*u_LightDivisor;
+
+    for(int y = 0; y < u_LightDivisor; ++y) {
+        for(int x = 0; x < u_LightDivisor; ++x) {
+            ivec2 sample_texel = min(texel*u_LightDivisor + ivec2(x, y), last);
+            vec2 screen_coord = (vec2(sample_texel) + 0.5)/u_Viewport;
+            float z = view_depth(screen_coord, texelFetch(s_Depth, sample_texel, 0).r);
+            if(z < min_z) {
+                min_z = z;
+                if(!lit_at_max)
+                    lit = sample_texel;
+            }
+            if(z > max_z) {
+                max_z = z;
+                if(lit_at_max)
+                    lit = sample_texel;
+            }
+        }
+    }
+
+    vec3 normal = decode_gbuffer_normal(texelFetch(s_Normals, lit, 0));
+    gl_FragColor = vec4(min_z, max_z, encode_octahedral(normal));
+}
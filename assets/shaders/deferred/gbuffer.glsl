@@ -0,0 +1,54 @@
+/** GBuffer layouts, selected with GBUFFER_LAYOUT to match GBufferLayout
+ *
+ *  All [0] RGBA8:      Albedo
+ *  0:  [1] RG16F:      VS Normal, spheremap encoded
+ *      [2] DEPTH32F:   Depth
+ *  1:  [1] RGBA8:      VS Normal, octahedral encoded, 16 bits per axis
+ *      [2] DEPTH24:    Depth
+ *  2:  [1] RGB10_A2:   VS Normal, octahedral encoded, 10 bits per axis
+ *      [2] DEPTH24:    Depth
+ *  3:  [1] RG8:        VS Normal, octahedral encoded, 8 bits per axis
+ *      [2] DEPTH24:    Depth
+ */
+#ifndef GBUFFER_LAYOUT
+#define GBUFFER_LAYOUT 0
+#endif
+
+#include "shaders/common/normal_encoding.glsl"
+
+#if GBUFFER_LAYOUT == 1
+/** Splits a [0,1] value over two 8 bit channels */
+vec2 pack_unorm16(float value)
+{
+    float v = floor(clamp(value, 0.0, 1.0)*65535.0 + 0.5);
+    float high = floor(v/256.0);
+    return vec2(high, v - high*256.0)/255.0;
+}
+float unpack_unorm16(vec2 channels)
+{
+    vec2 bytes = floor(channels*255.0 + 0.5);
+    return (bytes.x*256.0 + bytes.y)/65535.0;
+}
+#endif
+
+vec4 encode_gbuffer_normal(vec3 normal)
+{
+#if GBUFFER_LAYOUT == 0
+    return encode(normal);
+#elif GBUFFER_LAYOUT == 1
+    vec2 encoded = encode_octahedral(normal);
+    return vec4(pack_unorm16(encoded.x), pack_unorm16(encoded.y));
+#else
+    return vec4(encode_octahedral(normal), 0.0, 0.0);
+#endif
+}
+vec3 decode_gbuffer_normal(vec4 value)
+{
+#if GBUFFER_LAYOUT == 0
+    return decode(value.rg);
+#elif GBUFFER_LAYOUT == 1
+    return decode_octahedral(vec2(unpack_unorm16(value.rg), unpack_unorm16(value.ba)));
+#else
+    return decode_octahedral(value.rg);
+#endif
+}
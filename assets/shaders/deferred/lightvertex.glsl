@@ -1,10 +1,38 @@
-uniform mat4 u_Projection;
-uniform mat4 u_View;
-uniform mat4 u_World;
+#include "shaders/common/light_instance.glsl"
+#include "shaders/common/per_frame.glsl"
+
+#ifndef FULLSCREEN
+#define FULLSCREEN 0
+#endif
 
 attribute vec4 a_Position;
 
+#if INSTANCED
+attribute vec3 a_LightPosition;     /* World space */
+attribute vec3 a_LightColor;
+attribute float a_LightSize;
+#else
+uniform mat4 u_World;
+#endif
+
 void main(void)
 {
+#if INSTANCED
+    v_LightPosition = vec3(u_View * vec4(a_LightPosition, 1.0));
+    v_LightColor = a_LightColor;
+    v_LightSize = a_LightSize;
+#endif
+#if FULLSCREEN
+    /* The quad is scissored to the light's bounds and sits at its far side,
+     * so the depth test passes the geometry in front of that
+     */
+    vec4 far_pos = u_Projection * vec4(0.0, 0.0, LIGHT_POSITION.z + LIGHT_SIZE, 1.0);
+    gl_Position = vec4(a_Position.xy, min(far_pos.z/far_pos.w, 1.0), 1.0);
+#elif INSTANCED
+    /* The unit volume is scaled by the light size and moved to the light */
+    vec4 world_pos = vec4(a_Position.xyz*a_LightSize + a_LightPosition, 1.0);
+    gl_Position = u_Projection * u_View * world_pos;
+#else
     gl_Position = u_Projection * u_View * u_World * a_Position;
+#endif
 }
@@ -0,0 +1,46 @@
+#include "shaders/common/precision.glsl"
+#include "shaders/common/lighting.glsl"
+#include "shaders/deferred/gbuffer.glsl"
+#include "shaders/common/per_frame.glsl"
+#include "shaders/common/light_tiles.glsl"
+
+/** Tiled deferred shading, GLSL ES 3.00 only. Each pixel reads the G-buffer
+ *  once and loops over the lights the CPU binned into its screen tile.
+ */
+uniform sampler2D s_GBuffer[3];
+
+void main(void)
+{
+    /** Load texture values
+     */
+    vec2 screen_coord = gl_FragCoord.xy/u_Viewport; // map to [0..1]
+    vec2 tex_coord = screen_coord*u_TargetScale;
+
+    vec3 albedo = texture2D(s_GBuffer[0], tex_coord).rgb;
+    vec3 normal = decode_gbuffer_normal(texture2D(s_GBuffer[1], tex_coord));
+    float depth = texture2D(s_GBuffer[2], tex_coord).r;
+
+    /* Calculate the pixel's position in view space */
+    vec4 view_pos = vec4(screen_coord*2.0-1.0, depth*2.0 - 1.0, 1.0);
+    view_pos = u_InvProj * view_pos;
+    view_pos /= view_pos.w;
+
+    ivec2 range = light_tile_range(gl_FragCoord.xy, view_pos.z);
+    vec3 final_lighting = vec3(0.0);
+
+    for(int ii = range.x; ii < range.x + range.y; ++ii) {
+        int light = light_tile_index(ii);
+        vec4 position_size = light_tile_position_size(light);
+
+        vec3 light_dir = position_size.xyz - view_pos.xyz;
+        float dist = length(light_dir);
+        float attenuation = attenuate(dist, position_size.w);
+        light_dir = normalize(light_dir);
+
+        /* Calculate diffuse lighting */
+        float n_dot_l = clamp(dot(light_dir, normal), 0.0, 1.0);
+        final_lighting += attenuation * light_tile_color(light) * n_dot_l;
+    }
+
+    gl_FragColor = vec4(final_lighting * albedo,1.0);
+}
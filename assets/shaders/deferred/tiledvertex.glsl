@@ -0,0 +1,9 @@
+/** A single clockwise triangle covering the screen, generated from the
+ *  vertex index. It sits on the far plane so a GL_GREATER depth test only
+ *  passes where the G-buffer has geometry.
+ */
+void main(void)
+{
+    vec2 position = vec2(float((gl_VertexID & 2) << 1), float((gl_VertexID & 1) << 2)) - 1.0;
+    gl_Position = vec4(position, 1.0, 1.0);
+}
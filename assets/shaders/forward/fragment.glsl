@@ -1,15 +1,24 @@
-precision highp float;
-uniform sampler2D s_Albedo;
-uniform sampler2D s_Normal;
+#include "shaders/common/precision.glsl"
+#include "shaders/common/lighting.glsl"
+#include "shaders/common/normal_mapping.glsl"
+#include "shaders/common/per_material.glsl"
 
-uniform vec3    u_LightPositions[64];
-uniform vec3    u_LightColors[64];
-uniform float   u_LightSizes[64];
-uniform int     u_NumLights;
+/** CLUSTERED=1 reads the lights binned into the fragment's view space
+ *  cluster (GLSL ES 3.00 only), otherwise it loops over the light array
+ */
+#ifndef CLUSTERED
+#define CLUSTERED 0
+#endif
 
-uniform vec3    u_SpecularColor;
-uniform float   u_SpecularPower;
-uniform float   u_SpecularCoefficient;
+#if CLUSTERED
+#include "shaders/common/per_frame.glsl"
+#include "shaders/common/light_tiles.glsl"
+#else
+#include "shaders/common/light_array.glsl"
+#endif
+
+uniform sampler2D s_Albedo;
+uniform sampler2D s_Normal;
 
 varying vec3 v_PositionVS;
 varying vec3 v_NormalVS;
@@ -17,39 +26,52 @@ varying vec3 v_TangentVS;
 varying vec3 v_BitangentVS;
 varying vec2 v_TexCoord;
 
+vec3 shade(vec3 albedo, vec3 normal, vec3 specular_color,
+           vec3 light_position, vec3 light_color, float light_size)
+{
+    vec3 light_dir = light_position - v_PositionVS;
+    float dist = length(light_dir);
+    float attenuation = attenuate(dist, light_size);
+    light_dir = normalize(light_dir);
+
+    /* Calculate diffuse lighting */
+    float n_dot_l = clamp(dot(light_dir, normal), 0.0, 1.0);
+    /* Calculate specular lighting */
+    vec3 reflection = reflect(vec3(0.0,0.0,-1.0), normal);
+    float r_dot_l = clamp(dot(reflection, -light_dir), 0.0, 1.0);
+    /* Calculate final colors */
+    vec3 diffuse = albedo * light_color * n_dot_l;
+    vec3 specular = specular_color * vec3(min(1.0, pow(r_dot_l, u_SpecularPower))) * light_color;
+
+    return attenuation * (diffuse + specular);
+}
+
 void main(void) {
     /** Load texture values
      */
     vec3 albedo = texture2D(s_Albedo, v_TexCoord).rgb;
-    vec3 normal = normalize(texture2D(s_Normal, v_TexCoord).rgb*2.0 - 1.0);
+    vec3 normal = surface_normal(s_Normal, v_TexCoord, v_NormalVS, v_TangentVS, v_BitangentVS);
     vec3 specular_color = u_SpecularCoefficient * u_SpecularColor;
 
-    vec3 N = normalize(v_NormalVS);
-    vec3 T = normalize(v_TangentVS);
-    vec3 B = normalize(v_BitangentVS);
-
-    mat3 TBN = mat3(T, B, N);
-    normal = normalize(TBN*normal);
-
     vec3 final_color = vec3(0);
-    for(int ii=0; ii < u_NumLights; ++ii) {
-        vec3 light_color = u_LightColors[ii];
-        vec3 light_dir = u_LightPositions[ii] - v_PositionVS;
-        float dist = length(light_dir);
-        float size = u_LightSizes[ii];
-        float attenuation = 1.0 - pow( clamp(dist/size, 0.0, 1.0), 2.0);
-        light_dir = normalize(light_dir);
-
-        /* Calculate diffuse lighting */
-        float n_dot_l = clamp(dot(light_dir, normal), 0.0, 1.0);
-        /* Calculate specular lighting */
-        vec3 reflection = reflect(vec3(0.0,0.0,-1.0), normal);
-        float r_dot_l = clamp(dot(reflection, -light_dir), 0.0, 1.0);
-        /* Calculate final colors */
-        vec3 diffuse = albedo * light_color * n_dot_l;
-        vec3 specular = specular_color * vec3(min(1.0, pow(r_dot_l, u_SpecularPower))) * light_color;
-
-        final_color += attenuation * (diffuse + specular);
+#if CLUSTERED
+    ivec2 range = light_tile_range(gl_FragCoord.xy, v_PositionVS.z);
+    for(int ii = range.x; ii < range.x + range.y; ++ii) {
+        int light = light_tile_index(ii);
+        vec4 position_size = light_tile_position_size(light);
+        final_color += shade(albedo, normal, specular_color,
+                             position_size.xyz, light_tile_color(light), position_size.w);
+    }
+#else
+    /* The loop runs to the MAX_LIGHTS constant so the compiler can unroll
+     * it, lights past u_NumLights are skipped
+     */
+    for(int ii=0; ii < MAX_LIGHTS; ++ii) {
+        if(ii >= u_NumLights)
+            break;
+        final_color += shade(albedo, normal, specular_color,
+                             LIGHT_ARRAY_POSITION(ii), LIGHT_ARRAY_COLOR(ii), LIGHT_ARRAY_SIZE(ii));
     }
+#endif
     gl_FragColor = vec4(final_color,1.0);
 }
@@ -1,7 +1,9 @@
-precision highp float;
-uniform sampler2D s_Normal;
+#include "shaders/common/precision.glsl"
+#include "shaders/common/normal_mapping.glsl"
+#include "shaders/common/normal_encoding.glsl"
+#include "shaders/common/per_material.glsl"
 
-uniform float   u_SpecularPower;
+uniform sampler2D s_Normal;
 
 varying vec3 v_NormalVS;
 varying vec3 v_TangentVS;
@@ -10,24 +12,11 @@ varying vec2 v_TexCoord;
 
 varying vec2 v_Depth;
 
-vec4 encode (vec3 normal)
-{
-    float p = sqrt(normal.z*8.0+8.0);
-    return vec4(normal.xy/p + 0.5,0,0);
-}
-
 void main(void)
 {
     /** Load texture values
      */
-    vec3 normal = normalize(texture2D(s_Normal, v_TexCoord).rgb*2.0 - 1.0);
-    
-    vec3 N = normalize(v_NormalVS);
-    vec3 T = normalize(v_TangentVS);
-    vec3 B = normalize(v_BitangentVS);
-
-    mat3 TBN = mat3(T, B, N);
-    normal = normalize(TBN*normal);
+    vec3 normal = surface_normal(s_Normal, v_TexCoord, v_NormalVS, v_TangentVS, v_BitangentVS);
 
     vec4 encoded = encode(normal);
     gl_FragColor = vec4(encoded.rgb, u_SpecularPower);
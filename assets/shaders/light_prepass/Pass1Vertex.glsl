@@ -1,6 +1,5 @@
-uniform mat4 u_Projection;
-uniform mat4 u_View;
-uniform mat4 u_World;
+#include "shaders/common/instancing.glsl"
+#include "shaders/common/per_frame.glsl"
 
 attribute vec4 a_Position;
 attribute vec3 a_Normal;
@@ -15,10 +14,10 @@ varying vec2 v_TexCoord;
 
 
 void main(void) {
-    mat3 world3 = mat3(u_World);
+    mat3 world3 = mat3(WORLD_MATRIX);
     mat3 view3 = mat3(u_View);
 
-    vec4 world_pos = u_World * a_Position;
+    vec4 world_pos = WORLD_MATRIX * a_Position;
     vec4 view_pos = u_View * world_pos;
 
     v_NormalVS = view3 * world3 * a_Normal;
@@ -26,5 +25,5 @@ void main(void) {
     v_BitangentVS = view3 * world3 * a_Bitangent;
     v_TexCoord = a_TexCoord;
 
-    gl_Position = u_Projection * u_View * u_World * a_Position;
+    gl_Position = u_Projection * u_View * WORLD_MATRIX * a_Position;
 }
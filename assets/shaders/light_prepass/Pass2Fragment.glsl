@@ -1,33 +1,34 @@
-precision highp float;
-uniform sampler2D s_GBuffer;
-uniform sampler2D s_Depth;
+#include "shaders/common/precision.glsl"
+#include "shaders/common/lighting.glsl"
+#include "shaders/common/normal_encoding.glsl"
+#include "shaders/common/light_instance.glsl"
+#include "shaders/common/per_frame.glsl"
+#include "shaders/common/low_res_lighting.glsl"
 
-uniform mat4    u_InvProj;
+#ifndef LOW_RES
+#define LOW_RES 0
+#endif
 
-uniform vec2    u_Viewport;
-
-uniform vec3    u_LightColor;
-uniform vec3    u_LightPosition;
-uniform float   u_LightSize;
+uniform sampler2D s_GBuffer;
+uniform sampler2D s_Depth;
 
 varying vec4    v_Position;
 
-vec3 decode(vec2 encoded)
-{
-    vec2 fenc = encoded*4.0 - 2.0;
-    float f = dot(fenc,fenc);
-    float g = sqrt(1.0 - f/4.0);
-    vec3 normal;
-    normal.xy = fenc*g;
-    normal.z = 1.0 - f/2.0;
-    return normal;
-}
-
 void main(void)
 {
+#if LOW_RES
+    /* Lit where the block was reduced to, see low_res_lighting.glsl */
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 depth_normal = texelFetch(s_LowResDepth, texel, 0);
+    vec2 screen_coord = gl_FragCoord.xy*float(u_LightDivisor)/u_Viewport;
+
+    vec3 normal = decode_octahedral(depth_normal.ba);
+    vec3 view_pos = view_position(screen_coord, low_res_depth(texel, depth_normal));
+#else
     /** Load texture values
      */
-    vec2 tex_coord = gl_FragCoord.xy/u_Viewport;
+    vec2 screen_coord = gl_FragCoord.xy/u_Viewport;
+    vec2 tex_coord = screen_coord*u_TargetScale;
 
     vec4 gbuffer_val = texture2D(s_GBuffer, tex_coord);
     vec3 normal = decode(gbuffer_val.rg);
@@ -35,19 +36,19 @@ void main(void)
     float depth = texture2D(s_Depth, tex_coord).r;
 
     /* Calculate the pixel's position in view space */
-    vec4 view_pos = vec4(tex_coord*2.0-1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 view_pos = vec4(screen_coord*2.0-1.0, depth * 2.0 - 1.0, 1.0);
     view_pos = u_InvProj * view_pos;
     view_pos /= view_pos.w;
+#endif
 
-    vec3 light_dir = u_LightPosition - view_pos.xyz;
+    vec3 light_dir = LIGHT_POSITION - view_pos.xyz;
     float dist = length(light_dir);
-    float size = u_LightSize;
-    float attenuation = 1.0 - pow( clamp(dist/size, 0.0, 1.0), 2.0);
+    float attenuation = attenuate(dist, LIGHT_SIZE);
     light_dir = normalize(light_dir);
 
     /* Calculate diffuse lighting */
     float n_dot_l = clamp(dot(light_dir, normal), 0.0, 1.0);
-    vec3 diffuse = u_LightColor * n_dot_l;
+    vec3 diffuse = LIGHT_COLOR * n_dot_l;
 
     vec3 final_color = attenuation * (diffuse);
 
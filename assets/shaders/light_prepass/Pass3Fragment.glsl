@@ -1,8 +1,16 @@
-precision highp float;
+#include "shaders/common/precision.glsl"
+#include "shaders/common/per_frame.glsl"
+#include "shaders/common/low_res_lighting.glsl"
+
+#ifndef LOW_RES
+#define LOW_RES 0
+#endif
+
 uniform sampler2D s_GBuffer;
 uniform sampler2D s_Albedo;
-
-uniform vec2 u_Viewport;
+#if LOW_RES
+uniform sampler2D s_Normals;
+#endif
 
 varying vec2 v_TexCoord;
 
@@ -15,8 +23,15 @@ void main(void)
 {
     /** Load texture values
      */
-    vec2 tex_coord = gl_FragCoord.xy/u_Viewport; // map to [0..1]
+    vec2 tex_coord = gl_FragCoord.xy/u_Viewport*u_TargetScale; // map to the rendered part of [0..1]
+#if LOW_RES
+    /* Upsampled to the depth test's depth and the pass 1 normal */
+    vec2 screen_coord = gl_FragCoord.xy/u_Viewport;
+    vec3 normal = decode(texture2D(s_Normals, tex_coord).rg);
+    vec3 light = upsample_lighting(gl_FragCoord.xy, view_depth(screen_coord, gl_FragCoord.z), normal);
+#else
     vec3 light = texture2D(s_GBuffer,tex_coord).rgb;
+#endif
     vec3 albedo = texture2D(s_Albedo, v_TexCoord).rgb;
     gl_FragColor = vec4(light*albedo,1.0);
 }
@@ -1,6 +1,5 @@
-uniform mat4 u_Projection;
-uniform mat4 u_View;
-uniform mat4 u_World;
+#include "shaders/common/instancing.glsl"
+#include "shaders/common/per_frame.glsl"
 
 attribute vec4 a_Position;
 attribute vec2 a_TexCoord;
@@ -10,5 +9,5 @@ varying vec2 v_TexCoord;
 void main(void)
 {
     v_TexCoord = a_TexCoord;
-    gl_Position = u_Projection * u_View * u_World * a_Position;
+    gl_Position = u_Projection * u_View * WORLD_MATRIX * a_Position;
 }
@@ -1,4 +1,5 @@
-precision highp float;
+#include "shaders/common/precision.glsl"
+
 uniform sampler2D s_Texture;
 
 uniform vec4 u_Color;
@@ -1,5 +1,4 @@
 uniform mat4 u_ViewProjection;
-uniform mat4 u_World;
 
 attribute vec4 a_Position;
 attribute vec2 a_TexCoord;
@@ -9,5 +8,5 @@ varying vec2 v_TexCoord;
 void main()
 {
     v_TexCoord = a_TexCoord;
-    gl_Position = u_ViewProjection * u_World * a_Position;
+    gl_Position = u_ViewProjection * a_Position;
 }
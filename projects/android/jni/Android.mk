@@ -10,6 +10,7 @@ CXX_STD = -std=c++98
 WARNINGS    +=
 
 LOCAL_MODULE    := libandroidinterface
+LOCAL_ARM_NEON  := true
 LOCAL_CFLAGS    := $(INCLUDES) $(WARNINGS) $(C_STD)
 LOCAL_CXXFLAGS  := $(INCLUDES) $(WARNINGS) $(CXX_STD)
 LOCAL_SRC_FILES := 	jni.c \
@@ -26,6 +27,16 @@ LOCAL_SRC_FILES := 	jni.c \
                     ../../../src/utility.c \
                     ../../../src/texture.c \
                     ../../../src/scene.cpp \
+                    ../../../src/compression.c \
+                    ../../../src/uniforms.c \
+                    ../../../src/culling.c \
+                    ../../../src/bvh.c \
+                    ../../../src/render_queue.c \
+                    ../../../src/stream_buffer.c \
+                    ../../../src/light_tiles.c \
+                    ../../../src/light_binning.c \
+                    ../../../src/light_volume.c \
+                    ../../../src/low_res_lighting.c \
                     ../../../external/stb_image.c
 LOCAL_LDLIBS := -lGLESv3 -lEGL -llog -landroid
 
@@ -1,12 +1,14 @@
 #include <jni.h>
 #include <sys/types.h>
 #include <android/asset_manager_jni.h>
+#include <string.h>
 #include "game.h"
 #include "system.h"
 
 #define UNUSED_PARAMETER(param) (void)sizeof((param))
 
 extern AAssetManager* _asset_manager;
+extern char _cache_directory[256];
 
 static Game* _game = NULL;
 
@@ -33,6 +35,14 @@ JNIEXPORT void JNICALL Java_com_intel_deferredgles_JNIWrapper_init_1asset_1manag
     UNUSED_PARAMETER(env);
     UNUSED_PARAMETER(obj);
 }
+JNIEXPORT void JNICALL Java_com_intel_deferredgles_JNIWrapper_init_1cache_1directory(JNIEnv * env, jobject obj, jstring path)
+{
+    const char* utf_path = (*env)->GetStringUTFChars(env, path, NULL);
+    strncpy(_cache_directory, utf_path, sizeof(_cache_directory)-1);
+    (*env)->ReleaseStringUTFChars(env, path, utf_path);
+
+    UNUSED_PARAMETER(obj);
+}
 JNIEXPORT void JNICALL Java_com_intel_deferredgles_JNIWrapper_frame(JNIEnv * env, jobject obj)
 {
     update_game(_game);
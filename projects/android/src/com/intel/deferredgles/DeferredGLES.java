@@ -55,6 +55,7 @@ public class DeferredGLES extends Activity
         /* Load asset manager */
         _asset_manager = getAssets();
         JNIWrapper.init_asset_manager(_asset_manager);
+        JNIWrapper.init_cache_directory(getCacheDir().getAbsolutePath());
     }
 
     @Override protected void onPause()
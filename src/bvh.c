@@ -0,0 +1,499 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "bvh.h"
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include "assert.h"
+
+/* Defines
+ */
+#define BVH_BINS            16
+#define BVH_MAX_LEAF_ITEMS  4
+#define BVH_MAX_DEPTH       64
+#define BVH_TRAVERSAL_COST  1.0f    /* Relative to testing one item */
+
+/* Types
+ */
+typedef struct BVHNode
+{
+    float   min[3];
+    int     offset;     /* First entry in `items` for leaves, right child otherwise */
+    float   max[3];
+    int     count;      /* Number of items in a leaf, 0 for interior nodes */
+} BVHNode;
+
+typedef struct BVHBin
+{
+    float   min[3];
+    float   max[3];
+    int     count;
+} BVHBin;
+
+struct BVH
+{
+    BVHNode*    nodes;
+    int*        parents;    /* Parent of each node, -1 for the root */
+    int*        items;      /* Item ids, grouped by leaf */
+    int*        item_leaf;  /* Leaf holding each item */
+    float*      item_min;   /* Three per item */
+    float*      item_max;
+    float*      centroids;  /* Only valid during the build */
+    int         num_nodes;
+    int         num_items;
+    int         depth;
+};
+
+/* Constants
+ */
+
+/* Variables
+ */
+
+/* Internal functions
+ */
+static void _empty_box(float* min, float* max)
+{
+    min[0] = min[1] = min[2] = FLT_MAX;
+    max[0] = max[1] = max[2] = -FLT_MAX;
+}
+static void _grow_box(float* min, float* max, const float* other_min, const float* other_max)
+{
+    int ii;
+    for(ii=0;ii<3;++ii) {
+        /* Plain compares, fminf/fmaxf become library calls without fast math */
+        min[ii] = other_min[ii] < min[ii] ? other_min[ii] : min[ii];
+        max[ii] = other_max[ii] > max[ii] ? other_max[ii] : max[ii];
+    }
+}
+static float _half_area(const float* min, const float* max)
+{
+    float dx = max[0] - min[0];
+    float dy = max[1] - min[1];
+    float dz = max[2] - min[2];
+    if(dx < 0.0f)
+        return 0.0f;
+    return dx*dy + dy*dz + dz*dx;
+}
+static void _fit_node(BVH* B, int node)
+{
+    BVHNode* N = &B->nodes[node];
+    _empty_box(N->min, N->max);
+    if(N->count) {
+        int ii;
+        for(ii=0;ii<N->count;++ii) {
+            int item = B->items[N->offset + ii];
+            _grow_box(N->min, N->max, B->item_min + item*3, B->item_max + item*3);
+        }
+    } else {
+        const BVHNode* left = &B->nodes[node+1];
+        const BVHNode* right = &B->nodes[N->offset];
+        _grow_box(N->min, N->max, left->min, left->max);
+        _grow_box(N->min, N->max, right->min, right->max);
+    }
+}
+static void _make_leaf(BVH* B, int node, int first, int count)
+{
+    int ii;
+    B->nodes[node].offset = first;
+    B->nodes[node].count = count;
+    for(ii=first;ii<first+count;++ii)
+        B->item_leaf[B->items[ii]] = node;
+}
+/** Finds the cheapest binned split of items [first, first+count), binning
+ *  all three axes in a single pass over the items
+ *  @return The SAH cost of the split, or FLT_MAX if the centroids coincide
+ */
+static float _find_split(const BVH* B, int first, int count,
+                         const float* centroid_min, const float* centroid_max,
+                         int* split_axis, float* split_position)
+{
+    BVHBin  bins[3][BVH_BINS];
+    float   scale[3];
+    float   best_cost = FLT_MAX;
+    int     axis, ii;
+
+    for(axis=0;axis<3;++axis) {
+        float extent = centroid_max[axis] - centroid_min[axis];
+        scale[axis] = extent > 0.0f ? BVH_BINS/extent : 0.0f;
+        for(ii=0;ii<BVH_BINS;++ii) {
+            _empty_box(bins[axis][ii].min, bins[axis][ii].max);
+            bins[axis][ii].count = 0;
+        }
+    }
+    for(ii=first;ii<first+count;++ii) {
+        int             item = B->items[ii];
+        const float*    centroid = B->centroids + item*3;
+        for(axis=0;axis<3;++axis) {
+            int bin = (int)((centroid[axis] - centroid_min[axis])*scale[axis]);
+            if(bin >= BVH_BINS)
+                bin = BVH_BINS-1;
+            bins[axis][bin].count++;
+            _grow_box(bins[axis][bin].min, bins[axis][bin].max, B->item_min + item*3, B->item_max + item*3);
+        }
+    }
+
+    for(axis=0;axis<3;++axis) {
+        float   right_area[BVH_BINS];
+        int     right_count[BVH_BINS];
+        float   left_min[3], left_max[3], right_min[3], right_max[3];
+        int     left_count = 0;
+
+        if(scale[axis] == 0.0f)
+            continue;
+
+        /* Sweep from the right to get the cost of everything above each plane */
+        _empty_box(right_min, right_max);
+        right_count[0] = 0;
+        for(ii=BVH_BINS-1;ii>0;--ii) {
+            _grow_box(right_min, right_max, bins[axis][ii].min, bins[axis][ii].max);
+            right_count[ii] = (ii < BVH_BINS-1 ? right_count[ii+1] : 0) + bins[axis][ii].count;
+            right_area[ii] = _half_area(right_min, right_max);
+        }
+        /* Then from the left, evaluating the plane below each bin */
+        _empty_box(left_min, left_max);
+        for(ii=1;ii<BVH_BINS;++ii) {
+            float cost;
+            _grow_box(left_min, left_max, bins[axis][ii-1].min, bins[axis][ii-1].max);
+            left_count += bins[axis][ii-1].count;
+            if(left_count == 0 || right_count[ii] == 0)
+                continue;
+            cost = left_count*_half_area(left_min, left_max) + right_count[ii]*right_area[ii];
+            if(cost < best_cost) {
+                best_cost = cost;
+                *split_axis = axis;
+                *split_position = centroid_min[axis] + ii/scale[axis];
+            }
+        }
+    }
+    return best_cost;
+}
+static void _build_node(BVH* B, int node, int first, int count, int depth)
+{
+    BVHNode*    N = &B->nodes[node];
+    float       centroid_min[3], centroid_max[3];
+    float       split_cost, leaf_cost;
+    float       split_position = 0.0f;
+    int         split_axis = 0;
+    int         mid, ii;
+
+    N->count = 0;
+    _empty_box(N->min, N->max);
+    _empty_box(centroid_min, centroid_max);
+    for(ii=first;ii<first+count;++ii) {
+        int item = B->items[ii];
+        _grow_box(N->min, N->max, B->item_min + item*3, B->item_max + item*3);
+        _grow_box(centroid_min, centroid_max, B->centroids + item*3, B->centroids + item*3);
+    }
+    if(depth > B->depth)
+        B->depth = depth;
+
+    if(count <= 1 || depth+1 >= BVH_MAX_DEPTH) {
+        _make_leaf(B, node, first, count);
+        return;
+    }
+    split_cost = _find_split(B, first, count, centroid_min, centroid_max, &split_axis, &split_position);
+    if(split_cost == FLT_MAX) {
+        /* Every centroid is the same, nothing to split on */
+        _make_leaf(B, node, first, count);
+        return;
+    }
+    leaf_cost = count*_half_area(N->min, N->max);
+    split_cost += BVH_TRAVERSAL_COST*_half_area(N->min, N->max);
+    if(count <= BVH_MAX_LEAF_ITEMS && leaf_cost <= split_cost) {
+        _make_leaf(B, node, first, count);
+        return;
+    }
+
+    /* Partition the items in place around the plane */
+    mid = first;
+    for(ii=first;ii<first+count;++ii) {
+        int item = B->items[ii];
+        if(B->centroids[item*3 + split_axis] < split_position) {
+            B->items[ii] = B->items[mid];
+            B->items[mid++] = item;
+        }
+    }
+    if(mid == first || mid == first+count)
+        mid = first + count/2;
+
+    /* Depth first, so the left child directly follows its parent */
+    {
+        int left = B->num_nodes++;
+        int right;
+        B->parents[left] = node;
+        _build_node(B, left, first, mid-first, depth+1);
+        right = B->num_nodes++;
+        B->parents[right] = node;
+        B->nodes[node].offset = right;
+        _build_node(B, right, mid, first+count-mid, depth+1);
+    }
+}
+/** Returns 0 if outside a plane, and clears the bits of planes the box is
+ *  completely inside of
+ */
+static int _box_in_frustum(const Frustum* F, const float* min, const float* max, int* plane_mask)
+{
+    float   cx = (max[0] + min[0])*0.5f;
+    float   cy = (max[1] + min[1])*0.5f;
+    float   cz = (max[2] + min[2])*0.5f;
+    float   ex = (max[0] - min[0])*0.5f;
+    float   ey = (max[1] - min[1])*0.5f;
+    float   ez = (max[2] - min[2])*0.5f;
+    int     ii;
+    for(ii=0;ii<6;++ii) {
+        Vec4    p = F->planes[ii];
+        float   d, r;
+        if((*plane_mask & (1 << ii)) == 0)
+            continue;
+        d = p.x*cx + p.y*cy + p.z*cz + p.w;
+        r = fabsf(p.x)*ex + fabsf(p.y)*ey + fabsf(p.z)*ez;
+        if(d + r < 0.0f)
+            return 0;
+        if(d - r >= 0.0f)
+            *plane_mask &= ~(1 << ii);
+    }
+    return 1;
+}
+static int _box_in_sphere(const float* min, const float* max, Vec3 center, float radius)
+{
+    float dx = fmaxf(fmaxf(min[0] - center.x, center.x - max[0]), 0.0f);
+    float dy = fmaxf(fmaxf(min[1] - center.y, center.y - max[1]), 0.0f);
+    float dz = fmaxf(fmaxf(min[2] - center.z, center.z - max[2]), 0.0f);
+    return dx*dx + dy*dy + dz*dz <= radius*radius;
+}
+/** Slab test, returning the entry distance or FLT_MAX on a miss */
+static float _ray_box(const float* min, const float* max, const float* origin, const float* inv_dir, float max_distance)
+{
+    float   t_near = 0.0f;
+    float   t_far = max_distance;
+    int     ii;
+    for(ii=0;ii<3;++ii) {
+        float t0 = (min[ii] - origin[ii])*inv_dir[ii];
+        float t1 = (max[ii] - origin[ii])*inv_dir[ii];
+        t_near = fmaxf(t_near, fminf(t0, t1));
+        t_far = fminf(t_far, fmaxf(t0, t1));
+    }
+    return t_near <= t_far ? t_near : FLT_MAX;
+}
+
+/* External functions
+ */
+BVH* create_bvh(const Bounds* bounds, int count)
+{
+    BVH*    B = (BVH*)calloc(1, sizeof(BVH));
+    int     max_nodes = count > 0 ? 2*count - 1 : 1;
+    int     ii;
+
+    B->nodes = (BVHNode*)calloc(max_nodes, sizeof(BVHNode));
+    B->parents = (int*)calloc(max_nodes, sizeof(int));
+    B->items = (int*)calloc(count + 1, sizeof(int));
+    B->item_leaf = (int*)calloc(count + 1, sizeof(int));
+    B->item_min = (float*)calloc(count*3 + 1, sizeof(float));
+    B->item_max = (float*)calloc(count*3 + 1, sizeof(float));
+    B->centroids = (float*)calloc(count*3 + 1, sizeof(float));
+    B->num_items = count;
+
+    for(ii=0;ii<count;++ii) {
+        const Bounds* b = &bounds[ii];
+        B->items[ii] = ii;
+        B->item_min[ii*3+0] = b->center.x - b->extents.x;
+        B->item_min[ii*3+1] = b->center.y - b->extents.y;
+        B->item_min[ii*3+2] = b->center.z - b->extents.z;
+        B->item_max[ii*3+0] = b->center.x + b->extents.x;
+        B->item_max[ii*3+1] = b->center.y + b->extents.y;
+        B->item_max[ii*3+2] = b->center.z + b->extents.z;
+        B->centroids[ii*3+0] = b->center.x;
+        B->centroids[ii*3+1] = b->center.y;
+        B->centroids[ii*3+2] = b->center.z;
+    }
+
+    B->num_nodes = 1;
+    B->parents[0] = -1;
+    _build_node(B, 0, 0, count, 0);
+
+    free(B->centroids);
+    B->centroids = NULL;
+    return B;
+}
+void destroy_bvh(BVH* B)
+{
+    free(B->nodes);
+    free(B->parents);
+    free(B->items);
+    free(B->item_leaf);
+    free(B->item_min);
+    free(B->item_max);
+    free(B);
+}
+void update_bvh_item(BVH* B, int item, const Bounds* bounds)
+{
+    int node;
+    assert(item >= 0 && item < B->num_items);
+    B->item_min[item*3+0] = bounds->center.x - bounds->extents.x;
+    B->item_min[item*3+1] = bounds->center.y - bounds->extents.y;
+    B->item_min[item*3+2] = bounds->center.z - bounds->extents.z;
+    B->item_max[item*3+0] = bounds->center.x + bounds->extents.x;
+    B->item_max[item*3+1] = bounds->center.y + bounds->extents.y;
+    B->item_max[item*3+2] = bounds->center.z + bounds->extents.z;
+
+    node = B->item_leaf[item];
+    while(node != -1) {
+        BVHNode old = B->nodes[node];
+        _fit_node(B, node);
+        if(memcmp(&old, &B->nodes[node], sizeof(old)) == 0)
+            break;
+        node = B->parents[node];
+    }
+}
+void refit_bvh(BVH* B)
+{
+    int ii;
+    /* Children always come after their parent */
+    for(ii=B->num_nodes-1;ii>=0;--ii)
+        _fit_node(B, ii);
+}
+int query_bvh_frustum(const BVH* B, const Frustum* F, int* items, int max_items)
+{
+    int stack[BVH_MAX_DEPTH*2];
+    int masks[BVH_MAX_DEPTH*2];
+    int stack_size = 0;
+    int num_items = 0;
+
+    if(B->num_items == 0)
+        return 0;
+    stack[stack_size] = 0;
+    masks[stack_size++] = 0x3f;
+    while(stack_size) {
+        int             node = stack[--stack_size];
+        int             mask = masks[stack_size];
+        const BVHNode*  N = &B->nodes[node];
+        int             ii;
+
+        if(mask && !_box_in_frustum(F, N->min, N->max, &mask))
+            continue;
+        if(N->count == 0) {
+            stack[stack_size] = N->offset;
+            masks[stack_size++] = mask;
+            stack[stack_size] = node+1;
+            masks[stack_size++] = mask;
+            continue;
+        }
+        for(ii=N->offset;ii<N->offset+N->count;++ii) {
+            int item = B->items[ii];
+            int item_mask = mask;
+            if(item_mask && !_box_in_frustum(F, B->item_min + item*3, B->item_max + item*3, &item_mask))
+                continue;
+            if(num_items < max_items)
+                items[num_items++] = item;
+        }
+    }
+    return num_items;
+}
+int query_bvh_sphere(const BVH* B, Vec3 center, float radius, int* items, int max_items)
+{
+    int stack[BVH_MAX_DEPTH*2];
+    int stack_size = 0;
+    int num_items = 0;
+
+    if(B->num_items == 0)
+        return 0;
+    stack[stack_size++] = 0;
+    while(stack_size) {
+        const BVHNode*  N = &B->nodes[stack[--stack_size]];
+        int             ii;
+
+        if(!_box_in_sphere(N->min, N->max, center, radius))
+            continue;
+        if(N->count == 0) {
+            stack[stack_size++] = N->offset;
+            stack[stack_size++] = (int)(N - B->nodes) + 1;
+            continue;
+        }
+        for(ii=N->offset;ii<N->offset+N->count;++ii) {
+            int item = B->items[ii];
+            if(!_box_in_sphere(B->item_min + item*3, B->item_max + item*3, center, radius))
+                continue;
+            if(num_items < max_items)
+                items[num_items++] = item;
+        }
+    }
+    return num_items;
+}
+int raycast_bvh(const BVH* B, Vec3 origin, Vec3 direction, float max_distance, float* distance)
+{
+    int     stack[BVH_MAX_DEPTH*2];
+    float   origin_array[3] = { origin.x, origin.y, origin.z };
+    float   inv_dir[3];
+    float   closest = max_distance;
+    int     hit = -1;
+    int     stack_size = 0;
+
+    if(B->num_items == 0)
+        return -1;
+    inv_dir[0] = 1.0f/direction.x;
+    inv_dir[1] = 1.0f/direction.y;
+    inv_dir[2] = 1.0f/direction.z;
+
+    stack[stack_size++] = 0;
+    while(stack_size) {
+        int             node = stack[--stack_size];
+        const BVHNode*  N = &B->nodes[node];
+        int             ii;
+
+        if(_ray_box(N->min, N->max, origin_array, inv_dir, closest) == FLT_MAX)
+            continue;
+        if(N->count == 0) {
+            /* Visit the nearer child first so the far one is more likely to be skipped */
+            const BVHNode*  left = &B->nodes[node+1];
+            const BVHNode*  right = &B->nodes[N->offset];
+            float           t_left = _ray_box(left->min, left->max, origin_array, inv_dir, closest);
+            float           t_right = _ray_box(right->min, right->max, origin_array, inv_dir, closest);
+            if(t_left <= t_right) {
+                if(t_right != FLT_MAX)
+                    stack[stack_size++] = N->offset;
+                if(t_left != FLT_MAX)
+                    stack[stack_size++] = node+1;
+            } else {
+                if(t_left != FLT_MAX)
+                    stack[stack_size++] = node+1;
+                stack[stack_size++] = N->offset;
+            }
+            continue;
+        }
+        for(ii=N->offset;ii<N->offset+N->count;++ii) {
+            int     item = B->items[ii];
+            float   t = _ray_box(B->item_min + item*3, B->item_max + item*3, origin_array, inv_dir, closest);
+            if(t != FLT_MAX && (hit == -1 || t < closest)) {
+                closest = t;
+                hit = item;
+            }
+        }
+    }
+    if(hit != -1 && distance)
+        *distance = closest;
+    return hit;
+}
+int bvh_node_count(const BVH* B)
+{
+    return B->num_nodes;
+}
+int bvh_depth(const BVH* B)
+{
+    return B->depth;
+}
@@ -0,0 +1,63 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __bvh_h__
+#define __bvh_h__
+
+#include "vec_math.h"
+#include "graphics_types.h"
+#include "culling.h"
+
+/** Bounding volume hierarchy over world space boxes. Nodes are stored depth
+ *  first in a flat array, so the left child of a node always follows it and
+ *  every child comes after its parent.
+ */
+typedef struct BVH BVH;
+
+/** @brief Builds the hierarchy with binned SAH splits
+ *  @param bounds World space bounds of each item, indexed by item id
+ */
+BVH* create_bvh(const Bounds* bounds, int count);
+void destroy_bvh(BVH* B);
+
+/** @brief Moves an item and refits the boxes on the path to the root,
+ *  stopping as soon as a box no longer changes
+ */
+void update_bvh_item(BVH* B, int item, const Bounds* bounds);
+/** @brief Refits every node bottom up, cheaper than `update_bvh_item` once
+ *  most items have moved
+ */
+void refit_bvh(BVH* B);
+
+/** @brief Collects the items whose boxes touch the frustum
+ *  @return The number of items written to `items`
+ */
+int query_bvh_frustum(const BVH* B, const Frustum* F, int* items, int max_items);
+/** @brief Collects the items whose boxes touch a sphere, such as a light's
+ *  area of influence
+ *  @return The number of items written to `items`
+ */
+int query_bvh_sphere(const BVH* B, Vec3 center, float radius, int* items, int max_items);
+/** @brief Finds the closest item box hit by a ray
+ *  @param distance Receives the distance along `direction` to the hit
+ *  @return The item, or -1 if nothing was hit within `max_distance`
+ */
+int raycast_bvh(const BVH* B, Vec3 origin, Vec3 direction, float max_distance, float* distance);
+
+int bvh_node_count(const BVH* B);
+int bvh_depth(const BVH* B);
+
+#endif /* include guard */
@@ -0,0 +1,440 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "compression.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "system.h"
+#include "timer.h"
+#include "assert.h"
+
+/* Defines
+ */
+#define LZ_MIN_MATCH        4
+#define LZ_LAST_LITERALS    5   /* The last bytes of a block are always literals */
+#define LZ_MATCH_LIMIT      12  /* No match may start this close to the end */
+#define LZ_MAX_OFFSET       65535
+#define LZ_HASH_BITS        12
+#define LZ_HASH_SIZE        (1 << LZ_HASH_BITS)
+#define LZ_STORED_BLOCK     0x80000000u
+#define LZ_HEADER_SIZE      16
+#define MAX_DECODE_THREADS  8
+
+/* Types
+ */
+typedef struct DecodeJob
+{
+    uint8_t*        dst;
+    const uint8_t*  src;
+    const uint32_t* block_sizes;
+    const size_t*   block_offsets;
+    size_t          raw_size;
+    uint32_t        block_size;
+    int             num_blocks;
+    volatile int    next_block;
+    volatile int    failed;
+} DecodeJob;
+
+/* Constants
+ */
+
+/* Variables
+ */
+
+/* Internal functions
+ */
+static uint32_t _read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+static uint32_t _read_le32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static void _write_le32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v);
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+static uint32_t _hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+/** Writes the 255-run continuation of a length that overflowed its 4 bit token field */
+static uint8_t* _write_length(uint8_t* op, const uint8_t* oend, size_t length)
+{
+    while(length >= 255) {
+        if(op >= oend)
+            return NULL;
+        *op++ = 255;
+        length -= 255;
+    }
+    if(op >= oend)
+        return NULL;
+    *op++ = (uint8_t)length;
+    return op;
+}
+static int _read_length(const uint8_t** ip, const uint8_t* iend, size_t* length)
+{
+    uint8_t b;
+    do {
+        if(*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        *length += b;
+    } while(b == 255);
+    return 0;
+}
+static uint8_t* _write_sequence(uint8_t* op, const uint8_t* oend,
+                                const uint8_t* literals, size_t num_literals,
+                                size_t offset, size_t match_length)
+{
+    uint8_t* token = op++;
+    size_t   match_code = match_length - LZ_MIN_MATCH;
+
+    if(token >= oend)
+        return NULL;
+
+    *token = (uint8_t)((num_literals < 15 ? num_literals : 15) << 4);
+    if(num_literals >= 15 && (op = _write_length(op, oend, num_literals - 15)) == NULL)
+        return NULL;
+    if((size_t)(oend - op) < num_literals)
+        return NULL;
+    memcpy(op, literals, num_literals);
+    op += num_literals;
+
+    if(match_length == 0) /* Last sequence, literals only */
+        return op;
+
+    if(oend - op < 2)
+        return NULL;
+    *op++ = (uint8_t)(offset);
+    *op++ = (uint8_t)(offset >> 8);
+    *token |= (uint8_t)(match_code < 15 ? match_code : 15);
+    if(match_code >= 15 && (op = _write_length(op, oend, match_code - 15)) == NULL)
+        return NULL;
+    return op;
+}
+static void* _decode_thread(void* arg)
+{
+    DecodeJob* job = (DecodeJob*)arg;
+    while(!job->failed) {
+        int      block = __sync_fetch_and_add(&job->next_block, 1);
+        size_t   dst_offset;
+        size_t   dst_size;
+        uint32_t src_size;
+        const uint8_t* src;
+
+        if(block >= job->num_blocks)
+            break;
+
+        dst_offset = (size_t)block * job->block_size;
+        dst_size = job->raw_size - dst_offset;
+        if(dst_size > job->block_size)
+            dst_size = job->block_size;
+        src = job->src + job->block_offsets[block];
+        src_size = job->block_sizes[block] & ~LZ_STORED_BLOCK;
+
+        if(job->block_sizes[block] & LZ_STORED_BLOCK) {
+            if(src_size != dst_size) {
+                job->failed = 1;
+                break;
+            }
+            memcpy(job->dst + dst_offset, src, src_size);
+        } else if(lz_decompress_block(job->dst + dst_offset, dst_size, src, src_size) != (int)dst_size) {
+            job->failed = 1;
+            break;
+        }
+    }
+    return NULL;
+}
+static int _num_cores(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cores < 1)
+        return 1;
+    if(cores > MAX_DECODE_THREADS)
+        return MAX_DECODE_THREADS;
+    return (int)cores;
+}
+
+/* External functions
+ */
+size_t lz_compress_block(void* dst, size_t dst_size, const void* src, size_t src_size)
+{
+    uint32_t        table[LZ_HASH_SIZE];
+    const uint8_t*  base = (const uint8_t*)src;
+    const uint8_t*  ip = base;
+    const uint8_t*  anchor = base;
+    const uint8_t*  iend = base + src_size;
+    const uint8_t*  match_limit;
+    uint8_t*        op = (uint8_t*)dst;
+    const uint8_t*  oend = op + dst_size;
+
+    memset(table, 0, sizeof(table));
+
+    if(src_size > LZ_MATCH_LIMIT) {
+        /* Only formed here, short inputs would point it before `src` */
+        match_limit = iend - LZ_MATCH_LIMIT;
+        while(ip < match_limit) {
+            uint32_t        sequence = _read32(ip);
+            uint32_t        h = _hash(sequence);
+            const uint8_t*  ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+
+            if(ref < ip && ip - ref <= LZ_MAX_OFFSET && _read32(ref) == sequence) {
+                size_t length = LZ_MIN_MATCH;
+                while(ip + length < iend - LZ_LAST_LITERALS && ip[length] == ref[length])
+                    ++length;
+                /* Extend the match backwards into pending literals */
+                while(ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                    --ip;
+                    --ref;
+                    ++length;
+                }
+                op = _write_sequence(op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), length);
+                if(op == NULL)
+                    return 0;
+                ip += length;
+                anchor = ip;
+            } else {
+                ++ip;
+            }
+        }
+    }
+    op = _write_sequence(op, oend, anchor, (size_t)(iend - anchor), 0, 0);
+    if(op == NULL || (size_t)(op - (uint8_t*)dst) >= src_size)
+        return 0;
+    return (size_t)(op - (uint8_t*)dst);
+}
+int lz_decompress_block(void* dst, size_t dst_size, const void* src, size_t src_size)
+{
+    const uint8_t*  ip = (const uint8_t*)src;
+    const uint8_t*  iend = ip + src_size;
+    uint8_t*        op = (uint8_t*)dst;
+    uint8_t*        oend = op + dst_size;
+
+    while(ip < iend) {
+        uint8_t         token = *ip++;
+        size_t          length = token >> 4;
+        size_t          offset;
+        const uint8_t*  match;
+
+        /* Literals */
+        if(length == 15 && _read_length(&ip, iend, &length) != 0)
+            return -1;
+        if(length > (size_t)(iend - ip) || length > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, length);
+        op += length;
+        ip += length;
+        if(ip == iend)
+            break; /* Last sequence has no match */
+
+        /* Match */
+        if(iend - ip < 2)
+            return -1;
+        offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if(offset == 0 || offset > (size_t)(op - (uint8_t*)dst))
+            return -1;
+        length = token & 15;
+        if(length == 15 && _read_length(&ip, iend, &length) != 0)
+            return -1;
+        length += LZ_MIN_MATCH;
+        if(length > (size_t)(oend - op))
+            return -1;
+
+        match = op - offset;
+        if(offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            /* Overlapping copy repeats the last `offset` bytes */
+            while(length--)
+                *op++ = *match++;
+        }
+    }
+    return (int)(op - (uint8_t*)dst);
+}
+size_t compress_stream_bound(size_t raw_size)
+{
+    size_t num_blocks = (raw_size + ASSET_STREAM_BLOCK_SIZE - 1) / ASSET_STREAM_BLOCK_SIZE;
+    return LZ_HEADER_SIZE + num_blocks*sizeof(uint32_t) + raw_size;
+}
+size_t compress_stream(void* dst, size_t dst_size, const void* src, size_t src_size)
+{
+    uint32_t        num_blocks = (uint32_t)((src_size + ASSET_STREAM_BLOCK_SIZE - 1) / ASSET_STREAM_BLOCK_SIZE);
+    uint8_t*        header = (uint8_t*)dst;
+    uint8_t*        table = header + LZ_HEADER_SIZE;
+    uint8_t*        op = table + num_blocks*sizeof(uint32_t);
+    const uint8_t*  ip = (const uint8_t*)src;
+    uint32_t        ii;
+
+    if(dst_size < compress_stream_bound(src_size))
+        return 0;
+
+    _write_le32(header + 0, ASSET_STREAM_MAGIC);
+    _write_le32(header + 4, ASSET_STREAM_BLOCK_SIZE);
+    _write_le32(header + 8, num_blocks);
+    _write_le32(header + 12, (uint32_t)src_size);
+
+    for(ii=0;ii<num_blocks;++ii) {
+        size_t block_size = src_size - (size_t)ii*ASSET_STREAM_BLOCK_SIZE;
+        size_t compressed_size;
+        if(block_size > ASSET_STREAM_BLOCK_SIZE)
+            block_size = ASSET_STREAM_BLOCK_SIZE;
+
+        compressed_size = lz_compress_block(op, block_size, ip, block_size);
+        if(compressed_size == 0) {
+            memcpy(op, ip, block_size);
+            _write_le32(table + ii*sizeof(uint32_t), (uint32_t)block_size | LZ_STORED_BLOCK);
+            op += block_size;
+        } else {
+            _write_le32(table + ii*sizeof(uint32_t), (uint32_t)compressed_size);
+            op += compressed_size;
+        }
+        ip += block_size;
+    }
+    return (size_t)(op - header);
+}
+int decompress_stream(void** data, size_t* data_size, const void* src, size_t src_size)
+{
+    const uint8_t*  header = (const uint8_t*)src;
+    pthread_t       threads[MAX_DECODE_THREADS];
+    DecodeJob       job;
+    uint32_t*       block_sizes = NULL;
+    size_t*         block_offsets = NULL;
+    size_t          offset;
+    int             num_threads;
+    int             ii;
+
+    if(!is_compressed_stream(src, src_size))
+        return -1;
+
+    memset(&job, 0, sizeof(job));
+    job.block_size = _read_le32(header + 4);
+    job.num_blocks = (int)_read_le32(header + 8);
+    job.raw_size = _read_le32(header + 12);
+    if(job.block_size == 0 || job.num_blocks < 0 ||
+       (size_t)job.num_blocks != (job.raw_size + job.block_size - 1) / job.block_size ||
+       LZ_HEADER_SIZE + (size_t)job.num_blocks*sizeof(uint32_t) > src_size)
+        return -1;
+
+    /* Resolve where each block starts so they can be decoded independently */
+    block_sizes = (uint32_t*)malloc((job.num_blocks+1)*sizeof(uint32_t));
+    block_offsets = (size_t*)malloc((job.num_blocks+1)*sizeof(size_t));
+    if(block_sizes == NULL || block_offsets == NULL) {
+        free(block_offsets);
+        free(block_sizes);
+        return -1;
+    }
+    offset = LZ_HEADER_SIZE + (size_t)job.num_blocks*sizeof(uint32_t);
+    for(ii=0;ii<job.num_blocks;++ii) {
+        block_sizes[ii] = _read_le32(header + LZ_HEADER_SIZE + ii*sizeof(uint32_t));
+        block_offsets[ii] = offset;
+        offset += block_sizes[ii] & ~LZ_STORED_BLOCK;
+    }
+    if(offset > src_size) {
+        free(block_offsets);
+        free(block_sizes);
+        return -1;
+    }
+
+    /* The extra byte keeps text assets NUL terminated */
+    job.dst = (uint8_t*)malloc(job.raw_size + 1);
+    if(job.dst == NULL) {
+        free(block_offsets);
+        free(block_sizes);
+        return -1;
+    }
+    job.dst[job.raw_size] = '\0';
+    job.src = header;
+    job.block_sizes = block_sizes;
+    job.block_offsets = block_offsets;
+
+    num_threads = _num_cores();
+    if(num_threads > job.num_blocks)
+        num_threads = job.num_blocks;
+    for(ii=1;ii<num_threads;++ii) {
+        if(pthread_create(&threads[ii], NULL, _decode_thread, &job) != 0)
+            break;
+    }
+    num_threads = ii;
+    _decode_thread(&job); /* The calling thread works too */
+    for(ii=1;ii<num_threads;++ii)
+        pthread_join(threads[ii], NULL);
+
+    free(block_offsets);
+    free(block_sizes);
+
+    if(job.failed) {
+        free(job.dst);
+        return -1;
+    }
+    *data = job.dst;
+    *data_size = job.raw_size;
+    return 0;
+}
+int is_compressed_stream(const void* data, size_t data_size)
+{
+    return data_size >= LZ_HEADER_SIZE && _read_le32((const uint8_t*)data) == ASSET_STREAM_MAGIC;
+}
+int load_asset_data(const char* filename, void** data, size_t* data_size)
+{
+    void*   file_data = NULL;
+    size_t  file_size = 0;
+    Timer*  timer;
+    double  seconds;
+    int     result;
+
+    result = load_file_data(filename, &file_data, &file_size);
+    if(result != 0)
+        return result;
+
+    if(!is_compressed_stream(file_data, file_size)) {
+        *data = file_data;
+        *data_size = file_size;
+        return 0;
+    }
+
+    timer = create_timer();
+    result = decompress_stream(data, data_size, file_data, file_size);
+    seconds = get_running_time(timer);
+    destroy_timer(timer);
+    free_file_data(file_data);
+
+    if(result != 0) {
+        system_log("Decompressing %s failed\n", filename);
+        return result;
+    }
+    system_log("Decompressed %s: %lu -> %lu bytes (%.2f:1) in %.2f ms, %.2f GB/s\n",
+               filename, (unsigned long)file_size, (unsigned long)*data_size,
+               *data_size/(double)file_size, seconds*1000.0,
+               seconds > 0.0 ? *data_size/seconds*1e-9 : 0.0);
+    return 0;
+}
+void free_asset_data(void* data)
+{
+    /* Decompressed streams are malloc'd just like file data on every platform */
+    free_file_data(data);
+}
@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __compression_h__
+#define __compression_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Compressed asset stream layout (all values little endian)
+ *
+ *  uint32  magic           "DLZ1"
+ *  uint32  block_size      Uncompressed size of every block but the last
+ *  uint32  num_blocks
+ *  uint32  raw_size        Total uncompressed size
+ *  uint32  block_sizes[num_blocks]
+ *                          Compressed size of each block. The high bit marks
+ *                          a block that is stored uncompressed.
+ *  ...     block data
+ *
+ *  Blocks never reference each other, so they can be decoded in any order.
+ */
+#define ASSET_STREAM_MAGIC          0x315a4c44 /* "DLZ1" */
+#define ASSET_STREAM_BLOCK_SIZE     (64*1024)
+
+/** @brief Compresses a single block with the LZ codec
+ *  @return The compressed size, or 0 if the block does not compress
+ */
+size_t lz_compress_block(void* dst, size_t dst_size, const void* src, size_t src_size);
+
+/** @return The decompressed size, or -1 if the block is malformed
+ */
+int lz_decompress_block(void* dst, size_t dst_size, const void* src, size_t src_size);
+
+/** @return The worst case size of a compressed stream for `raw_size` bytes */
+size_t compress_stream_bound(size_t raw_size);
+
+/** @brief Compresses `src` into a block compressed asset stream
+ *  @return The size of the stream written to `dst`
+ */
+size_t compress_stream(void* dst, size_t dst_size, const void* src, size_t src_size);
+
+/** @brief Decompresses an asset stream, spreading the blocks across all cores
+ *  @return 0 on success, -1 on failure
+ */
+int decompress_stream(void** data, size_t* data_size, const void* src, size_t src_size);
+
+/** @return Non-zero if `data` starts with an asset stream header */
+int is_compressed_stream(const void* data, size_t data_size);
+
+/** @brief Loads a file, transparently decompressing it if it is an asset stream
+ *  @return 0 on success, -1 on failure
+ */
+int load_asset_data(const char* filename, void** data, size_t* data_size);
+void free_asset_data(void* data);
+
+#endif /* include guard */
@@ -0,0 +1,290 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "culling.h"
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define CULL_SSE
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    #include <arm_neon.h>
+    #define CULL_NEON
+#endif
+
+/* Defines
+ */
+
+/* Types
+ */
+
+/* Constants
+ */
+
+/* Variables
+ */
+
+/* Internal functions
+ */
+static Vec4 _normalize_plane(Vec4 p)
+{
+    float length = sqrtf(p.x*p.x + p.y*p.y + p.z*p.z);
+    return vec4_div_scalar(p, length);
+}
+static int _box_visible(const Frustum* F, float cx, float cy, float cz, float ex, float ey, float ez)
+{
+    int ii;
+    for(ii=0;ii<6;++ii) {
+        Vec4 p = F->planes[ii];
+        float d = p.x*cx + p.y*cy + p.z*cz + p.w;
+        float r = fabsf(p.x)*ex + fabsf(p.y)*ey + fabsf(p.z)*ez;
+        if(d + r < 0.0f)
+            return 0;
+    }
+    return 1;
+}
+static int _sphere_visible(const Frustum* F, float cx, float cy, float cz, float r)
+{
+    int ii;
+    for(ii=0;ii<6;++ii) {
+        Vec4 p = F->planes[ii];
+        if(p.x*cx + p.y*cy + p.z*cz + p.w + r < 0.0f)
+            return 0;
+    }
+    return 1;
+}
+
+/* External functions
+ */
+Frustum frustum_from_matrix(Mat4 m)
+{
+    /* Row vectors, so clip = v*m and the planes come from the columns */
+    Vec4 c0 = { m.r0.x, m.r1.x, m.r2.x, m.r3.x };
+    Vec4 c1 = { m.r0.y, m.r1.y, m.r2.y, m.r3.y };
+    Vec4 c2 = { m.r0.z, m.r1.z, m.r2.z, m.r3.z };
+    Vec4 c3 = { m.r0.w, m.r1.w, m.r2.w, m.r3.w };
+    Frustum F;
+
+    /* The near plane uses GL's -w <= z clip range, which is conservative for
+     * the 0 <= z projection produced by mat4_perspective_fov
+     */
+    F.planes[0] = _normalize_plane(vec4_add(c3, c0)); /* left */
+    F.planes[1] = _normalize_plane(vec4_sub(c3, c0)); /* right */
+    F.planes[2] = _normalize_plane(vec4_add(c3, c1)); /* bottom */
+    F.planes[3] = _normalize_plane(vec4_sub(c3, c1)); /* top */
+    F.planes[4] = _normalize_plane(vec4_add(c3, c2)); /* near */
+    F.planes[5] = _normalize_plane(vec4_sub(c3, c2)); /* far */
+    return F;
+}
+Bounds transform_bounds(const Bounds* bounds, Mat4 world)
+{
+    Vec3    c = bounds->center;
+    Vec3    e = bounds->extents;
+    float   scale_sq;
+    Bounds  out;
+
+    out.center.x = c.x*world.r0.x + c.y*world.r1.x + c.z*world.r2.x + world.r3.x;
+    out.center.y = c.x*world.r0.y + c.y*world.r1.y + c.z*world.r2.y + world.r3.y;
+    out.center.z = c.x*world.r0.z + c.y*world.r1.z + c.z*world.r2.z + world.r3.z;
+
+    out.extents.x = fabsf(world.r0.x)*e.x + fabsf(world.r1.x)*e.y + fabsf(world.r2.x)*e.z;
+    out.extents.y = fabsf(world.r0.y)*e.x + fabsf(world.r1.y)*e.y + fabsf(world.r2.y)*e.z;
+    out.extents.z = fabsf(world.r0.z)*e.x + fabsf(world.r1.z)*e.y + fabsf(world.r2.z)*e.z;
+
+    /* The sphere grows with the largest axis scale */
+    scale_sq = vec3_length_sq(vec3_from_vec4(world.r0));
+    scale_sq = fmaxf(scale_sq, vec3_length_sq(vec3_from_vec4(world.r1)));
+    scale_sq = fmaxf(scale_sq, vec3_length_sq(vec3_from_vec4(world.r2)));
+    out.radius = bounds->radius * sqrtf(scale_sq);
+    return out;
+}
+int cull_boxes_scalar(const Frustum* F,
+                      const float* center_x, const float* center_y, const float* center_z,
+                      const float* extent_x, const float* extent_y, const float* extent_z,
+                      int count, uint8_t* visible)
+{
+    int num_visible = 0;
+    int ii;
+    for(ii=0;ii<count;++ii) {
+        visible[ii] = (uint8_t)_box_visible(F, center_x[ii], center_y[ii], center_z[ii],
+                                            extent_x[ii], extent_y[ii], extent_z[ii]);
+        num_visible += visible[ii];
+    }
+    return num_visible;
+}
+int cull_boxes(const Frustum* F,
+               const float* center_x, const float* center_y, const float* center_z,
+               const float* extent_x, const float* extent_y, const float* extent_z,
+               int count, uint8_t* visible)
+{
+    int num_visible = 0;
+    int ii = 0;
+#if defined(CULL_SSE)
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128  nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+    int     jj;
+
+    for(jj=0;jj<6;++jj) {
+        nx[jj] = _mm_set1_ps(F->planes[jj].x);
+        ny[jj] = _mm_set1_ps(F->planes[jj].y);
+        nz[jj] = _mm_set1_ps(F->planes[jj].z);
+        nw[jj] = _mm_set1_ps(F->planes[jj].w);
+        ax[jj] = _mm_and_ps(nx[jj], abs_mask);
+        ay[jj] = _mm_and_ps(ny[jj], abs_mask);
+        az[jj] = _mm_and_ps(nz[jj], abs_mask);
+    }
+    for(;ii+4<=count;ii+=4) {
+        __m128  cx = _mm_loadu_ps(center_x+ii);
+        __m128  cy = _mm_loadu_ps(center_y+ii);
+        __m128  cz = _mm_loadu_ps(center_z+ii);
+        __m128  ex = _mm_loadu_ps(extent_x+ii);
+        __m128  ey = _mm_loadu_ps(extent_y+ii);
+        __m128  ez = _mm_loadu_ps(extent_z+ii);
+        __m128  inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        int     mask;
+        for(jj=0;jj<6;++jj) {
+            /* dot(n, c) + w + dot(|n|, e) >= 0 */
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, nx[jj]), _mm_mul_ps(cy, ny[jj])),
+                                  _mm_add_ps(_mm_mul_ps(cz, nz[jj]), nw[jj]));
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ax[jj]), _mm_mul_ps(ey, ay[jj])),
+                                  _mm_mul_ps(ez, az[jj]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+        }
+        mask = _mm_movemask_ps(inside);
+        visible[ii+0] = (uint8_t)((mask >> 0) & 1);
+        visible[ii+1] = (uint8_t)((mask >> 1) & 1);
+        visible[ii+2] = (uint8_t)((mask >> 2) & 1);
+        visible[ii+3] = (uint8_t)((mask >> 3) & 1);
+        num_visible += visible[ii+0] + visible[ii+1] + visible[ii+2] + visible[ii+3];
+    }
+#elif defined(CULL_NEON)
+    float32x4_t nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+    int         jj;
+
+    for(jj=0;jj<6;++jj) {
+        nx[jj] = vdupq_n_f32(F->planes[jj].x);
+        ny[jj] = vdupq_n_f32(F->planes[jj].y);
+        nz[jj] = vdupq_n_f32(F->planes[jj].z);
+        nw[jj] = vdupq_n_f32(F->planes[jj].w);
+        ax[jj] = vabsq_f32(nx[jj]);
+        ay[jj] = vabsq_f32(ny[jj]);
+        az[jj] = vabsq_f32(nz[jj]);
+    }
+    for(;ii+4<=count;ii+=4) {
+        float32x4_t cx = vld1q_f32(center_x+ii);
+        float32x4_t cy = vld1q_f32(center_y+ii);
+        float32x4_t cz = vld1q_f32(center_z+ii);
+        float32x4_t ex = vld1q_f32(extent_x+ii);
+        float32x4_t ey = vld1q_f32(extent_y+ii);
+        float32x4_t ez = vld1q_f32(extent_z+ii);
+        uint32x4_t  inside = vdupq_n_u32(0xffffffff);
+        for(jj=0;jj<6;++jj) {
+            float32x4_t d = vmlaq_f32(vmlaq_f32(vmlaq_f32(nw[jj], cx, nx[jj]), cy, ny[jj]), cz, nz[jj]);
+            d = vmlaq_f32(vmlaq_f32(vmlaq_f32(d, ex, ax[jj]), ey, ay[jj]), ez, az[jj]);
+            inside = vandq_u32(inside, vcgeq_f32(d, vdupq_n_f32(0.0f)));
+        }
+        visible[ii+0] = (uint8_t)(vgetq_lane_u32(inside, 0) & 1);
+        visible[ii+1] = (uint8_t)(vgetq_lane_u32(inside, 1) & 1);
+        visible[ii+2] = (uint8_t)(vgetq_lane_u32(inside, 2) & 1);
+        visible[ii+3] = (uint8_t)(vgetq_lane_u32(inside, 3) & 1);
+        num_visible += visible[ii+0] + visible[ii+1] + visible[ii+2] + visible[ii+3];
+    }
+#endif
+    /* Remainder, or everything without SIMD */
+    num_visible += cull_boxes_scalar(F, center_x+ii, center_y+ii, center_z+ii,
+                                     extent_x+ii, extent_y+ii, extent_z+ii,
+                                     count-ii, visible+ii);
+    return num_visible;
+}
+int cull_spheres_scalar(const Frustum* F,
+                        const float* center_x, const float* center_y, const float* center_z,
+                        const float* radius, int count, uint8_t* visible)
+{
+    int num_visible = 0;
+    int ii;
+    for(ii=0;ii<count;++ii) {
+        visible[ii] = (uint8_t)_sphere_visible(F, center_x[ii], center_y[ii], center_z[ii], radius[ii]);
+        num_visible += visible[ii];
+    }
+    return num_visible;
+}
+int cull_spheres(const Frustum* F,
+                 const float* center_x, const float* center_y, const float* center_z,
+                 const float* radius, int count, uint8_t* visible)
+{
+    int num_visible = 0;
+    int ii = 0;
+#if defined(CULL_SSE)
+    __m128  nx[6], ny[6], nz[6], nw[6];
+    int     jj;
+
+    for(jj=0;jj<6;++jj) {
+        nx[jj] = _mm_set1_ps(F->planes[jj].x);
+        ny[jj] = _mm_set1_ps(F->planes[jj].y);
+        nz[jj] = _mm_set1_ps(F->planes[jj].z);
+        nw[jj] = _mm_set1_ps(F->planes[jj].w);
+    }
+    for(;ii+4<=count;ii+=4) {
+        __m128  cx = _mm_loadu_ps(center_x+ii);
+        __m128  cy = _mm_loadu_ps(center_y+ii);
+        __m128  cz = _mm_loadu_ps(center_z+ii);
+        __m128  r = _mm_loadu_ps(radius+ii);
+        __m128  inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        int     mask;
+        for(jj=0;jj<6;++jj) {
+            /* dot(n, c) + w + r >= 0 */
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, nx[jj]), _mm_mul_ps(cy, ny[jj])),
+                                  _mm_add_ps(_mm_mul_ps(cz, nz[jj]), nw[jj]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+        }
+        mask = _mm_movemask_ps(inside);
+        visible[ii+0] = (uint8_t)((mask >> 0) & 1);
+        visible[ii+1] = (uint8_t)((mask >> 1) & 1);
+        visible[ii+2] = (uint8_t)((mask >> 2) & 1);
+        visible[ii+3] = (uint8_t)((mask >> 3) & 1);
+        num_visible += visible[ii+0] + visible[ii+1] + visible[ii+2] + visible[ii+3];
+    }
+#elif defined(CULL_NEON)
+    float32x4_t nx[6], ny[6], nz[6], nw[6];
+    int         jj;
+
+    for(jj=0;jj<6;++jj) {
+        nx[jj] = vdupq_n_f32(F->planes[jj].x);
+        ny[jj] = vdupq_n_f32(F->planes[jj].y);
+        nz[jj] = vdupq_n_f32(F->planes[jj].z);
+        nw[jj] = vdupq_n_f32(F->planes[jj].w);
+    }
+    for(;ii+4<=count;ii+=4) {
+        float32x4_t cx = vld1q_f32(center_x+ii);
+        float32x4_t cy = vld1q_f32(center_y+ii);
+        float32x4_t cz = vld1q_f32(center_z+ii);
+        float32x4_t r = vld1q_f32(radius+ii);
+        uint32x4_t  inside = vdupq_n_u32(0xffffffff);
+        for(jj=0;jj<6;++jj) {
+            float32x4_t d = vmlaq_f32(vmlaq_f32(vmlaq_f32(nw[jj], cx, nx[jj]), cy, ny[jj]), cz, nz[jj]);
+            inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(d, r), vdupq_n_f32(0.0f)));
+        }
+        visible[ii+0] = (uint8_t)(vgetq_lane_u32(inside, 0) & 1);
+        visible[ii+1] = (uint8_t)(vgetq_lane_u32(inside, 1) & 1);
+        visible[ii+2] = (uint8_t)(vgetq_lane_u32(inside, 2) & 1);
+        visible[ii+3] = (uint8_t)(vgetq_lane_u32(inside, 3) & 1);
+        num_visible += visible[ii+0] + visible[ii+1] + visible[ii+2] + visible[ii+3];
+    }
+#endif
+    num_visible += cull_spheres_scalar(F, center_x+ii, center_y+ii, center_z+ii,
+                                       radius+ii, count-ii, visible+ii);
+    return num_visible;
+}
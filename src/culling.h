@@ -0,0 +1,68 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __culling_h__
+#define __culling_h__
+
+#include <stdint.h>
+#include "vec_math.h"
+#include "graphics_types.h"
+
+/** Frustum planes in world space, (x,y,z) is the inward facing unit normal
+ *  and w the distance, so points inside have dot(n,p) + w >= 0
+ */
+typedef struct Frustum
+{
+    Vec4    planes[6];
+} Frustum;
+
+/** @brief Extracts the frustum planes of a view-projection matrix */
+Frustum frustum_from_matrix(Mat4 view_proj);
+
+/** @brief Transforms local bounds into world space. The box stays axis
+ *  aligned, so it grows to enclose the rotated box.
+ */
+Bounds transform_bounds(const Bounds* bounds, Mat4 world);
+
+/** @brief Tests axis aligned boxes, given as arrays of centers and half
+ *  extents, against the frustum four at a time using SSE or NEON
+ *  @param visible Receives 1 for each box that touches the frustum, else 0
+ *  @return The number of visible boxes
+ */
+int cull_boxes(const Frustum* F,
+               const float* center_x, const float* center_y, const float* center_z,
+               const float* extent_x, const float* extent_y, const float* extent_z,
+               int count, uint8_t* visible);
+/** @brief Scalar version of `cull_boxes`, kept for validation and benchmarks */
+int cull_boxes_scalar(const Frustum* F,
+                      const float* center_x, const float* center_y, const float* center_z,
+                      const float* extent_x, const float* extent_y, const float* extent_z,
+                      int count, uint8_t* visible);
+
+/** @brief Tests spheres, given as arrays of centers and radii, against the
+ *  frustum four at a time
+ *  @param visible Receives 1 for each sphere that touches the frustum, else 0
+ *  @return The number of visible spheres
+ */
+int cull_spheres(const Frustum* F,
+                 const float* center_x, const float* center_y, const float* center_z,
+                 const float* radius, int count, uint8_t* visible);
+/** @brief Scalar version of `cull_spheres` */
+int cull_spheres_scalar(const Frustum* F,
+                        const float* center_x, const float* center_y, const float* center_z,
+                        const float* radius, int count, uint8_t* visible);
+
+#endif /* include guard */
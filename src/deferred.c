@@ -15,15 +15,20 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "deferred.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include "gl_include.h"
 #include "mesh.h"
 #include "scene.h"
 #include "graphics.h"
 #include "program.h"
+#include "uniforms.h"
+#include "light_tiles.h"
+#include "low_res_lighting.h"
+#include "light_volume.h"
 
 /* Defines
  */
-#define GetUniformLocation(R, pass, program, uniform) R->pass.uniform = glGetUniformLocation(R->pass.program, #uniform)
 #define GBUFFER_SIZE 2
 
 /* Types
@@ -32,103 +37,244 @@ struct DeferredRenderer
 {
     int width;
     int height;
+    int target_width;   /* Size of the G-buffer, rendered to from the bottom left */
+    int target_height;
 
-    GLuint  cube_vertex_buffer;
-    GLuint  cube_index_buffer;
+    LightVolume*    volume;
 
+    GBufferLayout   layout;
+    int     float_targets;  /* Non-zero if kGBufferRG16F can be rendered to */
     GLuint  gbuffer_framebuffer;
     GLuint  gbuffer[GBUFFER_SIZE];
     GLuint  depth_buffer;
+    float   gbuffer_traffic;    /* Estimated G-buffer bytes written and read last frame */
 
     struct {
-        GLuint  program;
+        GLuint          program;
+        UniformTable*   uniforms;
+    } geometry[2], light, fullscreen, stencil, tiled,
+      low_res_light, low_res_fullscreen, downsample, composite; /* geometry: [normal map] */
 
-        GLuint  u_World;
-        GLuint  u_View;
-        GLuint  u_Projection;
+    LightTiles* tiles;  /* Lights binned per screen tile for tiled shading */
+    LowResLighting* low_res;    /* NULL without float render targets */
+    int     light_divisor;      /* Lights accumulate at 1/light_divisor of the resolution */
 
-        GLuint  s_Albedo;
-        GLuint  s_Normal;
-    } geometry;
+    int     stencil_lights;         /* Non-zero to mask large light volumes with the stencil */
+    int     num_stencil_lights;     /* Drawn with a stencil pass last frame */
+    int     num_light_classes[MAX_LIGHT_CLASSES];   /* Drawn per LightClass last frame */
 
-    struct {
-        GLuint  program;
-
-        GLuint  u_World;
-        GLuint  u_View;
-        GLuint  u_Projection;
-
-        GLuint  u_InvProj;
-        GLuint  u_Viewport;
-
-        GLuint  u_LightColor;
-        GLuint  u_LightPosition;
-        GLuint  u_LightSize;
-
-        GLuint  s_GBuffer;
-    } light;
+    int     programs_ready;
 };
 
 /* Constants
  */
-/* cube vertices
- *
- *               5---------4
- *              /|        /|
- *             / |       / |
- *            1---------0  |
- *            |  |      |  |
- *            |  6------|--7
- *            | /       | /
- *            |/        |/
- *            2---------3
- *
- *   front: { 0, 2, 1 }, { 0, 3, 2 }
- *   right: { 4, 3, 0 }, { 4, 7, 3 }
- *     top: { 4, 1, 5 }, { 4, 0, 1 }
- *    left: { 1, 6, 5 }, { 1, 2, 6 }
- *  bottom: { 3, 6, 2 }, { 3, 7, 6 }
- *    back: { 5, 7, 4 }, { 5, 6, 7 }
- *
- */
-static const Vec3 kCubeVertices[] =
+/** Targets then depth of each GBufferLayout, matching gbuffer.glsl */
+static const struct {
+    GLenum  internal_format;
+    GLenum  format;
+    GLenum  type;
+    int     bytes;
+} kGBufferFormats[MAX_GBUFFER_LAYOUTS][GBUFFER_SIZE+1] =
 {
-    {  1.0f,  1.0f, -1.0f }, /* 0 */
-    { -1.0f,  1.0f, -1.0f }, /* 1 */
-    { -1.0f, -1.0f, -1.0f }, /* 2 */
-    {  1.0f, -1.0f, -1.0f }, /* 3 */
-    {  1.0f,  1.0f,  1.0f }, /* 4 */
-    { -1.0f,  1.0f,  1.0f }, /* 5 */
-    { -1.0f, -1.0f,  1.0f }, /* 6 */
-    {  1.0f, -1.0f,  1.0f }, /* 7 */
+    {   /* kGBufferRG16F */
+        { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+        { GL_RG16F, GL_RG, GL_FLOAT, 4 },
+        { GL_DEPTH32F_STENCIL8, GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV, 8 },
+    },
+    {   /* kGBufferRGBA8 */
+        { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+        { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+        { GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 4 },
+    },
+    {   /* kGBufferRGB10A2 */
+        { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+        { GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, 4 },
+        { GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 4 },
+    },
+    {   /* kGBufferRG8 */
+        { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+        { GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2 },
+        { GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 4 },
+    },
 };
+/* Variables
+ */
 
-static const uint16_t kCubeIndices[] =
+/* Internal functions
+ */
+/** Fills the G-buffer */
+static void _geometry_pass(DeferredRenderer* R, const RenderQueue* queue)
 {
-    0, 2, 1,   0, 3, 2,  /* front */
-    4, 3, 0,   4, 7, 3,  /* right */
-    4, 1, 5,   4, 0, 1,  /* top */
-    1, 6, 5,   1, 2, 6,  /* left */
-    3, 6, 2,   3, 7, 6,  /* bottom */
-    5, 7, 4,   5, 6, 7,  /* back */
-};
+    GLenum buffers[] = {
+        GL_COLOR_ATTACHMENT0,
+        GL_COLOR_ATTACHMENT1,
+    };
+    const Material* material = NULL;
+    const Mesh* mesh = NULL;
+    int current = -1;
+    int ii;
+    GLint framebuffer_status;
 
-/* Variables
+    ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, R->gbuffer_framebuffer));
+    framebuffer_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if(framebuffer_status != GL_FRAMEBUFFER_COMPLETE) {
+        system_log("%s:%d Framebuffer error: %s\n", __FILE__, __LINE__, _glStatusString(framebuffer_status));
+        assert(0);
+    }
+    ASSERT_GL(glDrawBuffers(GBUFFER_SIZE, buffers));
+    /* Nothing is loaded, everything is stored for the light pass to sample */
+    ASSERT_GL(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
+    ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT));
+    ASSERT_GL(glDepthMask(GL_TRUE));
+    ASSERT_GL(glDepthFunc(GL_LESS));
+    ASSERT_GL(glCullFace(GL_BACK));
+
+    /* Camera constants come from the PerFrame block, deferred is ES3 only */
+    for(ii=0;ii<queue->num_batches;++ii) {
+        const DrawBatch* batch = &queue->batches[ii];
+        const Model* model = batch->model;
+        int normal_map = model->material->normal != 0;
+        if(normal_map != current) {
+            current = normal_map;
+            ASSERT_GL(glUseProgram(R->geometry[current].program));
+        }
+        /* Material */
+        if(model->material != material) {
+            material = model->material;
+            ASSERT_GL(glActiveTexture(GL_TEXTURE0));
+            ASSERT_GL(glBindTexture(GL_TEXTURE_2D, material->albedo));
+            ASSERT_GL(glActiveTexture(GL_TEXTURE1));
+            ASSERT_GL(glBindTexture(GL_TEXTURE_2D, material->normal));
+        }
+        /* Mesh */
+        if(model->mesh != mesh) {
+            mesh = model->mesh;
+            bind_mesh(mesh);
+        }
+        draw_batch(queue, batch, R->geometry[current].uniforms);
+    }
+    unbind_mesh();
+}
+/** Binds the G-buffer textures on units 0 to GBUFFER_SIZE */
+static void _bind_gbuffer(DeferredRenderer* R)
+{
+    int ii;
+    for(ii=0;ii<GBUFFER_SIZE;++ii) {
+        ASSERT_GL(glActiveTexture(GL_TEXTURE0+ii));
+        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->gbuffer[ii]));
+    }
+    ASSERT_GL(glActiveTexture(GL_TEXTURE0+ii));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->depth_buffer));
+}
+/** Binds the light target with the G-buffer depth attached and the G-buffer
+ *  textures on units 0 to GBUFFER_SIZE
  */
+static void _begin_light_pass(DeferredRenderer* R, GLuint default_framebuffer)
+{
+    GLenum buffer = GL_COLOR_ATTACHMENT0;
 
-/* Internal functions
+    ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, default_framebuffer));
+    ASSERT_GL(glDrawBuffers(1, &buffer));
+    ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, R->depth_buffer, 0));
+    /* Only the G-buffer depth is loaded, for the depth and stencil tests */
+    ASSERT_GL(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
+    ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT));
+    _bind_gbuffer(R);
+}
+/** Reduces the G-buffer and binds the low resolution light buffer, with the
+ *  reduced depth on unit GBUFFER_SIZE+1 for the light shaders
  */
-static void _draw_point_light(DeferredRenderer* R)
+static void _begin_low_res_light_pass(DeferredRenderer* R)
 {
-    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, R->cube_vertex_buffer));
-    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, R->cube_index_buffer));
-    ASSERT_GL(glVertexAttribPointer(kPositionSlot, 3, GL_FLOAT, GL_FALSE, sizeof(Vec3), (void*)0));
-    ASSERT_GL(glDrawElements(GL_TRIANGLES, sizeof(kCubeIndices)/sizeof(kCubeIndices[0]), GL_UNSIGNED_SHORT, NULL));
+    _bind_gbuffer(R);
+    ASSERT_GL(glUseProgram(R->downsample.program));
+    set_uniform_int(R->downsample.uniforms, "u_LightDivisor", R->light_divisor);
+    commit_uniforms(R->downsample.uniforms);
+    begin_low_res_lighting(R->low_res, R->width, R->height, R->light_divisor, GBUFFER_SIZE+1);
 }
+/** Upsamples the low resolution lighting over the geometry in
+ *  `default_framebuffer` and applies the albedo. The triangle sits on the
+ *  far plane so the depth test skips pixels without geometry.
+ */
+static void _composite_low_res_lights(DeferredRenderer* R, GLuint default_framebuffer)
+{
+    _begin_light_pass(R, default_framebuffer);
+    bind_low_res_lighting(R->low_res, GBUFFER_SIZE+1);
+    ASSERT_GL(glViewport(0, 0, R->width, R->height));
+    ASSERT_GL(glEnable(GL_DEPTH_TEST));
+    ASSERT_GL(glDepthFunc(GL_GREATER));
+    ASSERT_GL(glDisable(GL_BLEND));
+    ASSERT_GL(glCullFace(GL_BACK));
 
-/* External functions
+    ASSERT_GL(glUseProgram(R->composite.program));
+    set_uniform_int(R->composite.uniforms, "u_LightDivisor", R->light_divisor);
+    commit_uniforms(R->composite.uniforms);
+    ASSERT_GL(glDrawArrays(GL_TRIANGLES, 0, 3));
+}
+/** @return -1 if any program failed to build */
+static int _finish_programs(DeferredRenderer* R)
+{
+    int ii;
+    for(ii=0;ii<2;++ii) {
+        if(finish_program(R->geometry[ii].program) != 0)
+            return -1;
+    }
+    if(finish_program(R->light.program) != 0 ||
+       finish_program(R->fullscreen.program) != 0 ||
+       finish_program(R->stencil.program) != 0 ||
+       finish_program(R->tiled.program) != 0)
+        return -1;
+    if(R->low_res && (finish_program(R->low_res_light.program) != 0 ||
+                      finish_program(R->low_res_fullscreen.program) != 0 ||
+                      finish_program(R->downsample.program) != 0 ||
+                      finish_program(R->composite.program) != 0))
+        return -1;
+    return 0;
+}
+static int _init_programs(DeferredRenderer* R)
+{
+    int i[] = {0,1,2};
+    int ii;
+
+    if(_finish_programs(R) != 0)
+        return -1;
+
+    for(ii=0;ii<2;++ii) {
+        R->geometry[ii].uniforms = create_uniform_table(R->geometry[ii].program);
+        set_uniform_int(R->geometry[ii].uniforms, "s_Albedo", 0);
+        set_uniform_int(R->geometry[ii].uniforms, "s_Normal", 1);
+    }
+    R->light.uniforms = create_uniform_table(R->light.program);
+    set_uniform_array(R->light.uniforms, "s_GBuffer", i, GBUFFER_SIZE+1);
+    R->fullscreen.uniforms = create_uniform_table(R->fullscreen.program);
+    set_uniform_array(R->fullscreen.uniforms, "s_GBuffer", i, GBUFFER_SIZE+1);
+    R->stencil.uniforms = create_uniform_table(R->stencil.program);
+    R->tiled.uniforms = create_uniform_table(R->tiled.program);
+    set_uniform_array(R->tiled.uniforms, "s_GBuffer", i, GBUFFER_SIZE+1);
+    set_uniform_int(R->tiled.uniforms, "s_LightTiles", GBUFFER_SIZE+1);
+    set_uniform_int(R->tiled.uniforms, "s_LightIndices", GBUFFER_SIZE+2);
+    set_uniform_int(R->tiled.uniforms, "s_LightData", GBUFFER_SIZE+3);
+    if(R->low_res) {
+        R->low_res_light.uniforms = create_uniform_table(R->low_res_light.program);
+        set_uniform_int(R->low_res_light.uniforms, "s_LowResDepth", GBUFFER_SIZE+1);
+        R->low_res_fullscreen.uniforms = create_uniform_table(R->low_res_fullscreen.program);
+        set_uniform_int(R->low_res_fullscreen.uniforms, "s_LowResDepth", GBUFFER_SIZE+1);
+        R->downsample.uniforms = create_uniform_table(R->downsample.program);
+        set_uniform_int(R->downsample.uniforms, "s_Normals", 1);
+        set_uniform_int(R->downsample.uniforms, "s_Depth", GBUFFER_SIZE);
+        R->composite.uniforms = create_uniform_table(R->composite.program);
+        set_uniform_array(R->composite.uniforms, "s_GBuffer", i, GBUFFER_SIZE+1);
+        set_uniform_int(R->composite.uniforms, "s_LowResLight", GBUFFER_SIZE+1);
+        set_uniform_int(R->composite.uniforms, "s_LowResDepth", GBUFFER_SIZE+2);
+    }
+    R->programs_ready = 1;
+    return 0;
+}
+
+/** Creates the programs for the current G-buffer layout
+ *  @return -1 if any failed to build
  */
-DeferredRenderer* create_deferred_renderer(Graphics* G)
+static int _create_programs(DeferredRenderer* R)
 {
     AttributeSlot geometry_slots[] = {
         kPositionSlot,
@@ -136,27 +282,113 @@ DeferredRenderer* create_deferred_renderer(Graphics* G)
         kTangentSlot,
         kBitangentSlot,
         kTexCoordSlot,
+        kWorldSlot,
         kEmptySlot
     };
     AttributeSlot light_slots[] = {
         kPositionSlot,
+        kLightPositionSlot,
+        kLightColorSlot,
+        kLightSizeSlot,
         kEmptySlot
     };
-    DeferredRenderer* R = (DeferredRenderer*)calloc(1, sizeof(DeferredRenderer));
-    int i[] = {0,1,2};
+    AttributeSlot tiled_slots[] = {
+        kEmptySlot
+    };
+    char        layout_define[32];
+    const char* light_defines[] = { layout_define, "INSTANCED=1", NULL };
+    const char* fullscreen_defines[] = { layout_define, "INSTANCED=1", "FULLSCREEN=1", NULL };
+    const char* low_res_light_defines[] = { layout_define, "INSTANCED=1", "LOW_RES=1", NULL };
+    const char* low_res_fullscreen_defines[] = { layout_define, "INSTANCED=1", "FULLSCREEN=1", "LOW_RES=1", NULL };
+    const char* layout_defines[] = { layout_define, NULL };
+    char        tile_defines[NUM_LIGHT_TILE_DEFINES][32];
+    const char* tiled_defines[] = { layout_define, tile_defines[0], tile_defines[1],
+                                    tile_defines[2], tile_defines[3], NULL };
     int ii;
 
-    /* Create vertex buffer */
-    ASSERT_GL(glGenBuffers(1, &R->cube_vertex_buffer));
-    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, R->cube_vertex_buffer));
-    ASSERT_GL(glBufferData(GL_ARRAY_BUFFER, sizeof(kCubeVertices), kCubeVertices, GL_STATIC_DRAW));
-    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    sprintf(layout_define, "GBUFFER_LAYOUT=%d", R->layout);
+    for(ii=0;ii<2;++ii) {
+        const char* defines[] = { layout_define, ii ? "NORMAL_MAP=1" : "NORMAL_MAP=0", "INSTANCED=1", NULL };
+        R->geometry[ii].program = create_program_variant("shaders/deferred/geometryvertex.glsl",
+                                                         "shaders/deferred/geometryfragment.glsl",
+                                                         geometry_slots, defines);
+    }
+    R->light.program = create_program_variant("shaders/deferred/lightvertex.glsl", "shaders/deferred/lightfragment.glsl",
+                                              light_slots, light_defines);
+    R->fullscreen.program = create_program_variant("shaders/deferred/lightvertex.glsl", "shaders/deferred/lightfragment.glsl",
+                                                   light_slots, fullscreen_defines);
+    R->stencil.program = create_program_variant("shaders/deferred/lightvertex.glsl", "shaders/common/stencil_fragment.glsl",
+                                                light_slots, light_defines);
+    light_tile_defines(R->tiles, tile_defines);
+    R->tiled.program = create_program_variant("shaders/deferred/tiledvertex.glsl", "shaders/deferred/tiledfragment.glsl",
+                                              tiled_slots, tiled_defines);
+    if(R->low_res) {
+        R->low_res_light.program = create_program_variant("shaders/deferred/lightvertex.glsl",
+                                                          "shaders/deferred/lightfragment.glsl",
+                                                          light_slots, low_res_light_defines);
+        R->low_res_fullscreen.program = create_program_variant("shaders/deferred/lightvertex.glsl",
+                                                               "shaders/deferred/lightfragment.glsl",
+                                                               light_slots, low_res_fullscreen_defines);
+        R->downsample.program = create_program_variant("shaders/deferred/tiledvertex.glsl",
+                                                       "shaders/deferred/downsamplefragment.glsl",
+                                                       tiled_slots, layout_defines);
+        R->composite.program = create_program_variant("shaders/deferred/tiledvertex.glsl",
+                                                      "shaders/deferred/compositefragment.glsl",
+                                                      tiled_slots, layout_defines);
+    }
 
-    /* Create index buffer */
-    ASSERT_GL(glGenBuffers(1, &R->cube_index_buffer));
-    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, R->cube_index_buffer));
-    ASSERT_GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(kCubeIndices), kCubeIndices, GL_STATIC_DRAW));
-    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+    /* Everything is submitted, so the programs still build in parallel.
+     * Waiting here lets the caller fall back while it still can.
+     */
+    return _finish_programs(R);
+}
+static void _destroy_programs(DeferredRenderer* R)
+{
+    int ii;
+    for(ii=0;ii<2;++ii) {
+        destroy_uniform_table(R->geometry[ii].uniforms);
+        destroy_program(R->geometry[ii].program);
+        R->geometry[ii].uniforms = NULL;
+    }
+    destroy_uniform_table(R->light.uniforms);
+    destroy_program(R->light.program);
+    destroy_uniform_table(R->fullscreen.uniforms);
+    destroy_program(R->fullscreen.program);
+    destroy_uniform_table(R->stencil.uniforms);
+    destroy_program(R->stencil.program);
+    destroy_uniform_table(R->tiled.uniforms);
+    destroy_program(R->tiled.program);
+    R->light.uniforms = R->fullscreen.uniforms = R->stencil.uniforms = R->tiled.uniforms = NULL;
+    if(R->low_res) {
+        destroy_uniform_table(R->low_res_light.uniforms);
+        destroy_program(R->low_res_light.program);
+        destroy_uniform_table(R->low_res_fullscreen.uniforms);
+        destroy_program(R->low_res_fullscreen.program);
+        destroy_uniform_table(R->downsample.uniforms);
+        destroy_program(R->downsample.program);
+        destroy_uniform_table(R->composite.uniforms);
+        destroy_program(R->composite.program);
+        R->low_res_light.uniforms = R->low_res_fullscreen.uniforms = NULL;
+        R->downsample.uniforms = R->composite.uniforms = NULL;
+    }
+    R->programs_ready = 0;
+}
+/** @return Non-zero if the layout's targets are color renderable. ES 3.0
+ *  can only render to float formats with an extension.
+ */
+static int _gbuffer_layout_supported(const DeferredRenderer* R, GBufferLayout layout)
+{
+    return layout != kGBufferRG16F || R->float_targets;
+}
+
+/* External functions
+ */
+DeferredRenderer* create_deferred_renderer(Graphics* G)
+{
+    DeferredRenderer* R = (DeferredRenderer*)calloc(1, sizeof(DeferredRenderer));
+    int ii;
+
+    R->volume = create_light_volume(1, graphics_max_lights(G));
 
     /** Create Gbuffer
      */
@@ -172,6 +404,9 @@ DeferredRenderer* create_deferred_renderer(Graphics* G)
         ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
         ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
     }
+    /* Tiled shading lists, sized with the screen */
+    R->tiles = create_light_tiles(LIGHT_TILE_SIZE, 1, graphics_max_lights(G));
+
     ASSERT_GL(glGenTextures(1, &R->depth_buffer));
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->depth_buffer));
     ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
@@ -180,95 +415,57 @@ DeferredRenderer* create_deferred_renderer(Graphics* G)
     ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, 0));
 
-    /** Geometry pass
-     */
-    R->geometry.program = create_program("shaders/deferred/geometryvertex.glsl",
-                                         "shaders/deferred/geometryfragment.glsl",
-                                         geometry_slots);
-
-    ASSERT_GL(GetUniformLocation(R, geometry, program, u_Projection));
-    ASSERT_GL(GetUniformLocation(R, geometry, program, u_View));
-    ASSERT_GL(GetUniformLocation(R, geometry, program, u_World));
-
-    ASSERT_GL(GetUniformLocation(R, geometry, program, s_Normal));
-    ASSERT_GL(GetUniformLocation(R, geometry, program, s_Albedo));
-
-    ASSERT_GL(glUseProgram(R->geometry.program));
-
-    ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kNormalSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kTangentSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kBitangentSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kTexCoordSlot));
-
-    ASSERT_GL(glUniform1i(R->geometry.s_Albedo, 0));
-    ASSERT_GL(glUniform1i(R->geometry.s_Normal, 1));
-    ASSERT_GL(glUseProgram(0));
-
-    /** Light pass
-     */
-    R->light.program = create_program("shaders/deferred/lightvertex.glsl", "shaders/deferred/lightfragment.glsl", light_slots);
-
-    ASSERT_GL(GetUniformLocation(R, light, program, u_Projection));
-    ASSERT_GL(GetUniformLocation(R, light, program, u_View));
-    ASSERT_GL(GetUniformLocation(R, light, program, u_World));
-
-    ASSERT_GL(GetUniformLocation(R, light, program, u_InvProj));
-    ASSERT_GL(GetUniformLocation(R, light, program, u_Viewport));
-
-    ASSERT_GL(GetUniformLocation(R, light, program, s_GBuffer));
-
+    /* Low resolution lighting, only with float render targets */
+    R->low_res = create_low_res_lighting(G);
+    R->light_divisor = 1;
 
-    ASSERT_GL(GetUniformLocation(R, light, program, u_LightColor));
-    ASSERT_GL(GetUniformLocation(R, light, program, u_LightPosition));
-    ASSERT_GL(GetUniformLocation(R, light, program, u_LightSize));
-
-    ASSERT_GL(glUseProgram(R->light.program));
-
-    ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
-
-    ASSERT_GL(glUniform1iv(R->light.s_GBuffer, GBUFFER_SIZE+1, i));
-    ASSERT_GL(glUseProgram(0));
-
-    if(R->geometry.program == 0 ||
-       R->light.program == 0) {
+    R->float_targets = graphics_supports_float_targets(G);
+    R->layout = _gbuffer_layout_supported(R, kGBufferRG16F) ? kGBufferRG16F : kGBufferRGBA8;
+    if(_create_programs(R) != 0) {
         /* Failed to create programs. Return NULL */
-        free(R);
+        destroy_deferred_renderer(R);
         return NULL;
     }
     return R;
 }
 void destroy_deferred_renderer(DeferredRenderer* R)
 {
-    destroy_program(R->geometry.program);
+    destroy_light_volume(R->volume);
+    _destroy_programs(R);
+    destroy_light_tiles(R->tiles);
+    destroy_low_res_lighting(R->low_res);
+    ASSERT_GL(glDeleteFramebuffers(1, &R->gbuffer_framebuffer));
+    ASSERT_GL(glDeleteTextures(GBUFFER_SIZE, R->gbuffer));
+    ASSERT_GL(glDeleteTextures(1, &R->depth_buffer));
     free(R);
 }
 void resize_deferred_renderer(DeferredRenderer* R, int width, int height)
 {
     GLenum framebuffer_status;
-    R->width = width;
-    R->height = height;
+    int ii;
+    R->width = R->target_width = width;
+    R->height = R->target_height = height;
 
-    /** GBuffer format
+    /** GBuffer format, see gbuffer.glsl
      *  [0] RGB: Albedo
-     *  [1] RG: VS Normal (encoded)
-     *  [2] R: Depth
+     *  [1] VS Normal (encoded)
+     *  [2] Depth, with the stencil used to mask light volumes
      */
-    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->gbuffer[0]));
-    ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0));
-
-    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->gbuffer[1]));
-    ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG, GL_FLOAT, 0));
+    for(ii=0;ii<=GBUFFER_SIZE;++ii) {
+        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, ii < GBUFFER_SIZE ? R->gbuffer[ii] : R->depth_buffer));
+        ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, kGBufferFormats[R->layout][ii].internal_format, width, height, 0,
+                               kGBufferFormats[R->layout][ii].format, kGBufferFormats[R->layout][ii].type, 0));
+    }
 
-    /* Depth texture */
-    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->depth_buffer));
-    ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0));
+    resize_light_tiles(R->tiles, width, height);
+    if(R->low_res)
+        resize_low_res_lighting(R->low_res, width, height);
 
     /* Framebuffer */
     ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, R->gbuffer_framebuffer));
     ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, R->gbuffer[0], 0));
     ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, R->gbuffer[1], 0));
-    ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, R->depth_buffer, 0));
+    ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, R->depth_buffer, 0));
 
     framebuffer_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
     if(framebuffer_status != GL_FRAMEBUFFER_COMPLETE) {
@@ -283,94 +480,65 @@ void resize_deferred_renderer(DeferredRenderer* R, int width, int height)
 
 void render_deferred(DeferredRenderer* R, GLuint default_framebuffer,
                      Mat4 proj_matrix, Mat4 view_matrix,
-                     const Model* models, int num_models,
+                     const RenderQueue* queue,
                      const Light* lights, int num_lights)
 {
-    GLenum buffers[] = {
-        GL_COLOR_ATTACHMENT0,
-        GL_COLOR_ATTACHMENT1,
-        GL_COLOR_ATTACHMENT2,
-    };
-    Mat4 inv_proj = mat4_inverse(proj_matrix);
-    float viewport[] = { R->width, R->height };
+    LightVolumeBatch batch;
+    int low_res = R->light_divisor > 1;
+    GLuint light_program = low_res ? R->low_res_light.program : R->light.program;
+    GLuint fullscreen_program = low_res ? R->low_res_fullscreen.program : R->fullscreen.program;
+    int width = R->width;
+    int height = R->height;
     int ii;
-    GLint framebuffer_status;
 
-    /** Geometry
-     */
-    ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, R->gbuffer_framebuffer));
-    framebuffer_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if(framebuffer_status != GL_FRAMEBUFFER_COMPLETE) {
-        system_log("%s:%d Framebuffer error: %s\n", __FILE__, __LINE__, _glStatusString(framebuffer_status));
-        assert(0);
-    }
-    ASSERT_GL(glDrawBuffers(GBUFFER_SIZE, buffers));
-    ASSERT_GL(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
-    ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
-    ASSERT_GL(glDepthMask(GL_TRUE));
-    ASSERT_GL(glDepthFunc(GL_LESS));
-    ASSERT_GL(glCullFace(GL_BACK));
+    R->num_stencil_lights = 0;
+    memset(R->num_light_classes, 0, sizeof(R->num_light_classes));
+    if(!R->programs_ready && _init_programs(R) != 0)
+        return;
 
-    ASSERT_GL(glUseProgram(R->geometry.program));
-    ASSERT_GL(glUniformMatrix4fv(R->geometry.u_Projection, 1, GL_FALSE, (float*)&proj_matrix));
-    ASSERT_GL(glUniformMatrix4fv(R->geometry.u_View, 1, GL_FALSE, (float*)&view_matrix));
+    _geometry_pass(R, queue);
 
-    for(ii=0;ii<num_models;++ii) {
-        Mat4 world_matrix = transform_get_matrix(models[ii].transform);
-        /* Material */
-        ASSERT_GL(glActiveTexture(GL_TEXTURE0));
-        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, models[ii].material->albedo));
-        ASSERT_GL(glActiveTexture(GL_TEXTURE1));
-        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, models[ii].material->normal));
-        /* Mesh */
-        ASSERT_GL(glUniformMatrix4fv(R->geometry.u_World, 1, GL_FALSE, (float*)&world_matrix));
-        draw_mesh(models[ii].mesh);
-    }
-
-
-    /** Light
+    /** Light, a volume per light. At low resolution they add up in their own
+     *  buffer without a depth test and are composited after.
      */
-    ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, default_framebuffer));
-    ASSERT_GL(glDrawBuffers(1, buffers));
-    ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, R->depth_buffer, 0));
-    ASSERT_GL(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
-    ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT));
-
+    if(low_res) {
+        _begin_low_res_light_pass(R);
+        low_res_lighting_size(R->low_res, &width, &height);
+        ASSERT_GL(glDisable(GL_DEPTH_TEST));
+        set_uniform_int(R->low_res_fullscreen.uniforms, "u_LightDivisor", R->light_divisor);
+        set_uniform_int(R->low_res_light.uniforms, "u_LightDivisor", R->light_divisor);
+    } else {
+        _begin_light_pass(R, default_framebuffer);
+    }
     ASSERT_GL(glEnable(GL_BLEND));
     ASSERT_GL(glBlendFunc(GL_ONE, GL_ONE));
     ASSERT_GL(glCullFace(GL_FRONT));
     ASSERT_GL(glDepthMask(GL_FALSE));
     ASSERT_GL(glDepthFunc(GL_GEQUAL));
 
-    ASSERT_GL(glUseProgram(R->light.program));
-    ASSERT_GL(glUniformMatrix4fv(R->light.u_Projection, 1, GL_FALSE, (float*)&proj_matrix));
-    ASSERT_GL(glUniformMatrix4fv(R->light.u_View, 1, GL_FALSE, (float*)&view_matrix));
-    ASSERT_GL(glUniformMatrix4fv(R->light.u_InvProj, 1, GL_FALSE, (float*)&inv_proj));
-    ASSERT_GL(glUniform2fv(R->light.u_Viewport, 1, viewport));
-
-    for(ii=0;ii<GBUFFER_SIZE;++ii) {
-        ASSERT_GL(glActiveTexture(GL_TEXTURE0+ii));
-        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->gbuffer[ii]));
+    ASSERT_GL(glUseProgram(fullscreen_program));
+    commit_uniforms(low_res ? R->low_res_fullscreen.uniforms : R->fullscreen.uniforms);
+    ASSERT_GL(glUseProgram(light_program));
+    commit_uniforms(low_res ? R->low_res_light.uniforms : R->light.uniforms);
+    batch = stream_light_volumes(R->volume, queue->stream, lights, num_lights, view_matrix, proj_matrix,
+                                 width, height);
+    for(ii=0;ii<LIGHT_VOLUME_LEVELS;++ii) {
+        if(batch.count[ii])
+            draw_light_volumes(R->volume, &batch, ii, batch.first[ii], batch.count[ii]);
+        R->num_light_classes[kLightOutside] += batch.count[ii];
     }
-    ASSERT_GL(glActiveTexture(GL_TEXTURE0+ii));
-    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->depth_buffer));
-
-    for(ii=0;ii<num_lights;++ii) {
-        float size = lights[ii].size;
-        Mat4 world = mat4_identity;
-        Vec4 position = vec4_zero;
-
-        world = mat4_scalef(size,size,size);
-        world.r3 = vec4_from_vec3(lights[ii].position,1.0f);
-
-        position = vec4_from_vec3(lights[ii].position, 1.0f);
-        position = mat4_mul_vector(position, view_matrix);
-
-        ASSERT_GL(glUniformMatrix4fv(R->light.u_World, 1, GL_FALSE, (float*)&world));
-        ASSERT_GL(glUniform3fv(R->light.u_LightPosition, 1, (float*)&position));
-        ASSERT_GL(glUniform3fv(R->light.u_LightColor, 1, (float*)&lights[ii].color));
-        ASSERT_GL(glUniform1f(R->light.u_LightSize, lights[ii].size));
-        _draw_point_light(R);
+    /* The low resolution light buffer has no stencil to mask with */
+    if(batch.num_scissored)
+        R->num_stencil_lights += draw_scissored_lights(R->volume, &batch, light_program, fullscreen_program,
+                                                       R->stencil_lights && !low_res ? R->stencil.program : 0,
+                                                       R->num_light_classes);
+    if(low_res) {
+        /* The G-buffer is read by the reduction and the composite instead */
+        ASSERT_GL(glEnable(GL_DEPTH_TEST));
+        _composite_low_res_lights(R, default_framebuffer);
+        R->gbuffer_traffic = 3.0f*R->width*R->height*gbuffer_bytes_per_pixel(R->layout);
+    } else {
+        R->gbuffer_traffic = ((float)R->width*R->height + batch.pixels)*gbuffer_bytes_per_pixel(R->layout);
     }
 
     ASSERT_GL(glActiveTexture(GL_TEXTURE0));
@@ -378,5 +546,103 @@ void render_deferred(DeferredRenderer* R, GLuint default_framebuffer,
     ASSERT_GL(glDepthMask(GL_TRUE));
     ASSERT_GL(glDepthFunc(GL_LESS));
     ASSERT_GL(glCullFace(GL_BACK));
+}
+void render_tiled_deferred(DeferredRenderer* R, GLuint default_framebuffer,
+                           Mat4 proj_matrix, Mat4 view_matrix,
+                           const RenderQueue* queue,
+                           const Light* lights, int num_lights,
+                           LightBinner* binner)
+{
+    if(!R->programs_ready && _init_programs(R) != 0)
+        return;
+
+    update_light_tiles(R->tiles, binner, lights, num_lights, view_matrix, proj_matrix);
+    _geometry_pass(R, queue);
+
+    /** Light, one pass over the screen. The triangle sits on the far plane
+     *  so the depth test skips pixels without geometry.
+     */
+    _begin_light_pass(R, default_framebuffer);
+    bind_light_tiles(R->tiles, GBUFFER_SIZE+1);
+    ASSERT_GL(glDepthMask(GL_FALSE));
+    ASSERT_GL(glDepthFunc(GL_GREATER));
 
+    ASSERT_GL(glUseProgram(R->tiled.program));
+    commit_uniforms(R->tiled.uniforms);
+    ASSERT_GL(glDrawArrays(GL_TRIANGLES, 0, 3));
+    R->gbuffer_traffic = 2.0f*R->width*R->height*gbuffer_bytes_per_pixel(R->layout);
+
+    ASSERT_GL(glActiveTexture(GL_TEXTURE0));
+    ASSERT_GL(glDepthMask(GL_TRUE));
+    ASSERT_GL(glDepthFunc(GL_LESS));
+}
+void set_deferred_viewport(DeferredRenderer* R, int width, int height)
+{
+    assert(width <= R->target_width && height <= R->target_height);
+    R->width = width;
+    R->height = height;
+    set_light_tiles_viewport(R->tiles, width, height);
+}
+void set_deferred_stencil_lights(DeferredRenderer* R, int enabled)
+{
+    R->stencil_lights = enabled;
+}
+int set_deferred_light_divisor(DeferredRenderer* R, int divisor)
+{
+    if(divisor < 1 || divisor > MAX_LIGHT_DIVISOR || (divisor > 1 && R->low_res == NULL))
+        return -1;
+    R->light_divisor = divisor;
+    return 0;
+}
+int deferred_light_divisor(const DeferredRenderer* R)
+{
+    return R->light_divisor;
+}
+int deferred_stencil_lights(const DeferredRenderer* R)
+{
+    return R->num_stencil_lights;
+}
+const int* deferred_light_classes(const DeferredRenderer* R)
+{
+    return R->num_light_classes;
+}
+int set_deferred_gbuffer_layout(DeferredRenderer* R, GBufferLayout layout)
+{
+    GBufferLayout previous = R->layout;
+    if(layout == R->layout)
+        return 0;
+    if(!_gbuffer_layout_supported(R, layout))
+        return -1;
+    _destroy_programs(R);
+    R->layout = layout;
+    if(_create_programs(R) != 0) {
+        system_log("G-buffer layout %d failed to build\n", layout);
+        _destroy_programs(R);
+        R->layout = previous;
+        _create_programs(R);
+        return -1;
+    }
+    if(R->target_width) {
+        int width = R->width;
+        int height = R->height;
+        resize_deferred_renderer(R, R->target_width, R->target_height);
+        set_deferred_viewport(R, width, height);
+    }
+    return 0;
+}
+GBufferLayout deferred_gbuffer_layout(const DeferredRenderer* R)
+{
+    return R->layout;
+}
+int deferred_gbuffer_traffic(const DeferredRenderer* R)
+{
+    return (int)(R->gbuffer_traffic/1024.0f);
+}
+int gbuffer_bytes_per_pixel(GBufferLayout layout)
+{
+    int bytes = 0;
+    int ii;
+    for(ii=0;ii<=GBUFFER_SIZE;++ii)
+        bytes += kGBufferFormats[layout][ii].bytes;
+    return bytes;
 }
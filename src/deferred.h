@@ -21,17 +21,59 @@
 #include "graphics.h"
 #include "scene.h"
 #include "mesh.h"
+#include "render_queue.h"
+#include "light_binning.h"
 
 typedef struct DeferredRenderer DeferredRenderer;
 
 DeferredRenderer* create_deferred_renderer(Graphics* G);
 void destroy_deferred_renderer(DeferredRenderer* R);
 void resize_deferred_renderer(DeferredRenderer* R, int width, int height);
+/** @brief Renders to the bottom left `width` by `height` pixels of the
+ *  targets from the last resize
+ */
+void set_deferred_viewport(DeferredRenderer* R, int width, int height);
 
 void render_deferred(DeferredRenderer* R, GLuint default_framebuffer,
                      Mat4 proj_matrix, Mat4 view_matrix,
-                     const Model* models, int num_models,
+                     const RenderQueue* queue,
                      const Light* lights, int num_lights);
+/** @brief Renders with tiled deferred shading: the lights are binned into
+ *  LIGHT_TILE_SIZE screen tiles on the CPU with `binner` and a single
+ *  fullscreen pass reads the G-buffer once per pixel, looping over its
+ *  tile's lights
+ */
+void render_tiled_deferred(DeferredRenderer* R, GLuint default_framebuffer,
+                           Mat4 proj_matrix, Mat4 view_matrix,
+                           const RenderQueue* queue,
+                           const Light* lights, int num_lights,
+                           LightBinner* binner);
+/** @brief Enables stencil masking of light volumes covering at least
+ *  LARGE_LIGHT_SIZE of the screen in `render_deferred`, so only pixels
+ *  with geometry inside a volume are shaded
+ */
+void set_deferred_stencil_lights(DeferredRenderer* R, int enabled);
+/** @return The number of lights drawn with a stencil pass last frame */
+int deferred_stencil_lights(const DeferredRenderer* R);
+/** @brief Accumulates the lights of `render_deferred` at 1/`divisor` of the
+ *  resolution, up to MAX_LIGHT_DIVISOR, and upsamples them over the
+ *  G-buffer. Stencil masking is skipped below full resolution.
+ *  @return 0 on success, -1 without float render targets
+ */
+int set_deferred_light_divisor(DeferredRenderer* R, int divisor);
+int deferred_light_divisor(const DeferredRenderer* R);
+/** @return The number of lights drawn per LightClass last frame */
+const int* deferred_light_classes(const DeferredRenderer* R);
 
+/** @brief Switches the G-buffer formats and normal encoding, rebuilding the
+ *  programs and targets
+ *  @return 0 on success, -1 if the layout can't be rendered to
+ */
+int set_deferred_gbuffer_layout(DeferredRenderer* R, GBufferLayout layout);
+GBufferLayout deferred_gbuffer_layout(const DeferredRenderer* R);
+/** @return The estimated G-buffer KB written and read last frame */
+int deferred_gbuffer_traffic(const DeferredRenderer* R);
+/** @return The G-buffer and depth bytes stored per pixel */
+int gbuffer_bytes_per_pixel(GBufferLayout layout);
 
 #endif /* include guard */
@@ -16,59 +16,58 @@
 
 #include "forward.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include "gl_include.h"
 #include "mesh.h"
 #include "scene.h"
 #include "graphics.h"
 #include "program.h"
+#include "uniforms.h"
+#include "light_tiles.h"
 
 /* Defines
  */
-#define GetUniformLocation(R, program, uniform) R->uniform = glGetUniformLocation(R->program, #uniform)
+#define NUM_LIGHT_BUCKETS 4
+#define MAX_FORWARD_LIGHTS 64 /* Matches the largest shader light array */
 
 /* Types
  */
+typedef struct ForwardProgram
+{
+    Program         program;
+    UniformTable*   uniforms;   /* Reflected on first use */
+} ForwardProgram;
+
 struct ForwardRenderer
 {
     int     width;
     int     height;
     int     major_version;
     int     minor_version;
+    int     light_buckets[NUM_LIGHT_BUCKETS];
 
-    GLuint  program;
-
-    GLuint  u_World;
-    GLuint  u_View;
-    GLuint  u_Projection;
-
-    GLuint  s_Albedo;
-    GLuint  s_Normal;
+    /* Every variant is submitted up front and finished on first use */
+    ForwardProgram  programs[NUM_LIGHT_BUCKETS][2]; /* [light bucket][normal map] */
+    ForwardProgram  clustered[2];                   /* [normal map], ES3 only */
 
-    GLuint  u_LightPositions;
-    GLuint  u_LightColors;
-    GLuint  u_LightSizes;
-    GLuint  u_NumLights;
-
-    GLuint  u_CameraPosition;
-
-    GLuint  u_SpecularColor;
-    GLuint  u_SpecularPower;
-    GLuint  u_SpecularCoefficient;
+    LightTiles*     clusters;   /* Lights binned per view space cluster, ES3 only */
 };
 
 /* Constants
  */
+/** Light array sizes compiled into the fragment shader, the smallest bucket
+ *  holding all visible lights is used. With ES3 the lights come from the
+ *  Lights uniform block and the last bucket grows to MAX_BLOCK_LIGHTS.
+ */
+static const int kLightBuckets[NUM_LIGHT_BUCKETS] = { 8, 16, 32, MAX_FORWARD_LIGHTS };
 
 /* Variables
  */
 
 /* Internal functions
  */
-
-/* External functions
- */
-
-ForwardRenderer* create_forward_renderer(Graphics* G, int major_version, int minor_version)
+static void _submit_clustered_program(ForwardRenderer* R, int normal_map)
 {
     AttributeSlot slots[] = {
         kPositionSlot,
@@ -76,70 +75,157 @@ ForwardRenderer* create_forward_renderer(Graphics* G, int major_version, int min
         kTangentSlot,
         kBitangentSlot,
         kTexCoordSlot,
+        kWorldSlot,
         kEmptySlot
     };
-    ForwardRenderer* R = (ForwardRenderer*)calloc(1,sizeof(*R));
-    R->major_version = major_version;
-    R->minor_version = minor_version;
-
-    R->program = create_program("shaders/forward/vertex.glsl", "shaders/forward/fragment.glsl", slots);
-
-    ASSERT_GL(GetUniformLocation(R, program, u_Projection));
-    ASSERT_GL(GetUniformLocation(R, program, u_View));
-    ASSERT_GL(GetUniformLocation(R, program, u_World));
-
-    ASSERT_GL(GetUniformLocation(R, program, s_Normal));
-    ASSERT_GL(GetUniformLocation(R, program, s_Albedo));
-
+    char        cluster_defines[NUM_LIGHT_TILE_DEFINES][32];
+    const char* defines[] = {
+        cluster_defines[0],
+        cluster_defines[1],
+        cluster_defines[2],
+        cluster_defines[3],
+        normal_map ? "NORMAL_MAP=1" : "NORMAL_MAP=0",
+        "INSTANCED=1",
+        "CLUSTERED=1",
+        NULL
+    };
 
-    ASSERT_GL(GetUniformLocation(R, program, u_LightPositions));
-    ASSERT_GL(GetUniformLocation(R, program, u_LightColors));
-    ASSERT_GL(GetUniformLocation(R, program, u_LightSizes));
-    ASSERT_GL(GetUniformLocation(R, program, u_NumLights));
+    light_tile_defines(R->clusters, cluster_defines);
+    R->clustered[normal_map].program = create_program_variant("shaders/forward/vertex.glsl",
+                                                              "shaders/forward/fragment.glsl",
+                                                              slots, defines);
+}
+static void _submit_program(ForwardRenderer* R, int bucket, int normal_map)
+{
+    AttributeSlot slots[] = {
+        kPositionSlot,
+        kNormalSlot,
+        kTangentSlot,
+        kBitangentSlot,
+        kTexCoordSlot,
+        kWorldSlot,
+        kEmptySlot
+    };
+    char        max_lights[32];
+    const char* defines[] = {
+        max_lights,
+        normal_map ? "NORMAL_MAP=1" : "NORMAL_MAP=0",
+        R->major_version >= 3 ? "INSTANCED=1" : "INSTANCED=0",
+        NULL
+    };
 
-    ASSERT_GL(GetUniformLocation(R, program, u_SpecularColor));
-    ASSERT_GL(GetUniformLocation(R, program, u_SpecularPower));
-    ASSERT_GL(GetUniformLocation(R, program, u_SpecularCoefficient));
+    /* ES2 has no instancing, so leave the world matrix slot unbound */
+    if(R->major_version < 3)
+        slots[5] = kEmptySlot;
+    snprintf(max_lights, sizeof(max_lights), "MAX_LIGHTS=%d", R->light_buckets[bucket]);
+    R->programs[bucket][normal_map].program = create_program_variant("shaders/forward/vertex.glsl",
+                                                                     "shaders/forward/fragment.glsl",
+                                                                     slots, defines);
+}
+/** @return NULL if the program failed to build */
+static ForwardProgram* _finish_program(ForwardProgram* P)
+{
+    if(P->uniforms)
+        return P;
+    if(finish_program(P->program) != 0)
+        return NULL;
 
-    ASSERT_GL(glUseProgram(R->program));
+    P->uniforms = create_uniform_table(P->program);
+    set_uniform_int(P->uniforms, "s_Albedo", 0);
+    set_uniform_int(P->uniforms, "s_Normal", 1);
+    set_uniform_int(P->uniforms, "s_LightTiles", 2);
+    set_uniform_int(P->uniforms, "s_LightIndices", 3);
+    set_uniform_int(P->uniforms, "s_LightData", 4);
+    return P;
+}
+static ForwardProgram* _get_program(ForwardRenderer* R, int bucket, int normal_map)
+{
+    return _finish_program(&R->programs[bucket][normal_map]);
+}
 
-    ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kNormalSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kTangentSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kBitangentSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kTexCoordSlot));
+/* External functions
+ */
 
-    ASSERT_GL(glUniform1i(R->s_Albedo, 0));
-    ASSERT_GL(glUniform1i(R->s_Normal, 1));
-    ASSERT_GL(glUseProgram(0));
+ForwardRenderer* create_forward_renderer(Graphics* G, int major_version, int minor_version)
+{
+    ForwardRenderer* R = (ForwardRenderer*)calloc(1,sizeof(*R));
+    int ii;
+    R->major_version = major_version;
+    R->minor_version = minor_version;
+    memcpy(R->light_buckets, kLightBuckets, sizeof(kLightBuckets));
+    if(major_version >= 3)
+        R->light_buckets[NUM_LIGHT_BUCKETS-1] = MAX_BLOCK_LIGHTS;
 
+    for(ii=0;ii<NUM_LIGHT_BUCKETS;++ii) {
+        _submit_program(R, ii, 0);
+        _submit_program(R, ii, 1);
+    }
+    if(major_version >= 3) {
+        R->clusters = create_light_tiles(LIGHT_CLUSTER_SIZE, LIGHT_CLUSTER_SLICES, graphics_max_lights(G));
+        _submit_clustered_program(R, 0);
+        _submit_clustered_program(R, 1);
+    }
     return R;
 }
 void destroy_forward_renderer(ForwardRenderer* R)
 {
-    destroy_program(R->program);
+    int ii, jj;
+    for(ii=0;ii<NUM_LIGHT_BUCKETS;++ii) {
+        for(jj=0;jj<2;++jj) {
+            destroy_uniform_table(R->programs[ii][jj].uniforms);
+            destroy_program(R->programs[ii][jj].program);
+        }
+    }
+    if(R->clusters) {
+        for(ii=0;ii<2;++ii) {
+            destroy_uniform_table(R->clustered[ii].uniforms);
+            destroy_program(R->clustered[ii].program);
+        }
+        destroy_light_tiles(R->clusters);
+    }
     free(R);
 }
 void resize_forward_renderer(ForwardRenderer* R, int width, int height)
 {
     R->width = width;
     R->height = height;
+    if(R->clusters)
+        resize_light_tiles(R->clusters, width, height);
+}
+void set_forward_viewport(ForwardRenderer* R, int width, int height)
+{
+    R->width = width;
+    R->height = height;
+    if(R->clusters)
+        set_light_tiles_viewport(R->clusters, width, height);
 }
 
 void render_forward(ForwardRenderer* R, GLuint default_framebuffer,
                     Mat4 proj_matrix, Mat4 view_matrix,
-                    const Model* models, int num_models,
+                    const RenderQueue* queue,
                     const Light* lights, int num_lights)
 {
     //Mat4    inv_view = mat4_inverse(view_matrix);
     //Mat4    inv_proj = mat4_inverse(proj_matrix);
-    Vec3    light_positions[MAX_LIGHTS];
-    Vec3    light_colors[MAX_LIGHTS];
-    float   light_sizes[MAX_LIGHTS];
+    Vec3    light_positions[MAX_FORWARD_LIGHTS];
+    Vec3    light_colors[MAX_FORWARD_LIGHTS];
+    float   light_sizes[MAX_FORWARD_LIGHTS];
+    ForwardProgram* current = NULL;
+    const Material* material = NULL;
+    const Mesh*     mesh = NULL;
+    int     bucket = 0;
     int     ii;
 
-    /* Fill out light buffer and transform to view space */
-    for(ii=0;ii<num_lights;++ii) {
+    /* Pick the smallest light bucket that fits */
+    if(num_lights > R->light_buckets[NUM_LIGHT_BUCKETS-1])
+        num_lights = R->light_buckets[NUM_LIGHT_BUCKETS-1];
+    while(R->light_buckets[bucket] < num_lights)
+        ++bucket;
+
+    /* Fill out light buffer and transform to view space, ES3 programs read
+     * the Lights block instead
+     */
+    for(ii=0;ii<num_lights && R->major_version < 3;++ii) {
         Vec4 position = vec4_from_vec3(lights[ii].position, 1.0f);
         position = mat4_mul_vector(position, view_matrix);
         light_positions[ii] = vec3_from_vec4(position);
@@ -152,26 +238,92 @@ void render_forward(ForwardRenderer* R, GLuint default_framebuffer,
     ASSERT_GL(glClearColor(0.0f, 0.0f, 0.0f, 0.0f));
     ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT));
 
-    ASSERT_GL(glUseProgram(R->program));
-    ASSERT_GL(glUniformMatrix4fv(R->u_Projection, 1, GL_FALSE, (float*)&proj_matrix));
-    ASSERT_GL(glUniformMatrix4fv(R->u_View, 1, GL_FALSE, (float*)&view_matrix));
-    ASSERT_GL(glUniform3fv(R->u_LightPositions, num_lights, (float*)light_positions));
-    ASSERT_GL(glUniform3fv(R->u_LightColors, num_lights, (float*)light_colors));
-    ASSERT_GL(glUniform1fv(R->u_LightSizes, num_lights, (float*)light_sizes));
-    ASSERT_GL(glUniform1i(R->u_NumLights, num_lights));
+    for(ii=0;ii<queue->num_batches;++ii) {
+        const DrawBatch* batch = &queue->batches[ii];
+        const Model* model = batch->model;
+        ForwardProgram* P = _get_program(R, bucket, model->material->normal != 0);
+        if(P == NULL)
+            continue; /* Already reported by finish_program */
+        if(P != current) {
+            current = P;
+            material = NULL;
+            ASSERT_GL(glUseProgram(P->program));
+            set_uniform(P->uniforms, "u_Projection", &proj_matrix);
+            set_uniform(P->uniforms, "u_View", &view_matrix);
+            set_uniform_array(P->uniforms, "u_LightPositions", light_positions, num_lights);
+            set_uniform_array(P->uniforms, "u_LightColors", light_colors, num_lights);
+            set_uniform_array(P->uniforms, "u_LightSizes", light_sizes, num_lights);
+            set_uniform_int(P->uniforms, "u_NumLights", num_lights);
+        }
+        /* Material, the uniforms only reach programs without the PerMaterial block */
+        if(model->material != material) {
+            material = model->material;
+            bind_material_block(queue, batch);
+            set_uniform(P->uniforms, "u_SpecularColor", &material->specular_color);
+            set_uniform_float(P->uniforms, "u_SpecularPower", material->specular_power);
+            set_uniform_float(P->uniforms, "u_SpecularCoefficient", material->specular_coefficient);
+            ASSERT_GL(glActiveTexture(GL_TEXTURE0));
+            ASSERT_GL(glBindTexture(GL_TEXTURE_2D, material->albedo));
+            ASSERT_GL(glActiveTexture(GL_TEXTURE1));
+            ASSERT_GL(glBindTexture(GL_TEXTURE_2D, material->normal));
+        }
+        /* Mesh */
+        if(model->mesh != mesh) {
+            mesh = model->mesh;
+            bind_mesh(mesh);
+        }
+        draw_batch(queue, batch, P->uniforms);
+    }
+    unbind_mesh();
+}
+void render_clustered_forward(ForwardRenderer* R, GLuint default_framebuffer,
+                              Mat4 proj_matrix, Mat4 view_matrix,
+                              const RenderQueue* queue,
+                              const Light* lights, int num_lights,
+                              LightBinner* binner)
+{
+    ForwardProgram* current = NULL;
+    const Material* material = NULL;
+    const Mesh*     mesh = NULL;
+    Vec2            slice_params;
+    int             ii;
+
+    update_light_tiles(R->clusters, binner, lights, num_lights, view_matrix, proj_matrix);
+    slice_params = light_tile_slice_params(R->clusters);
+
+    ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, default_framebuffer));
+    ASSERT_GL(glViewport(0, 0, R->width, R->height));
+    ASSERT_GL(glClearColor(0.0f, 0.0f, 0.0f, 0.0f));
+    ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT));
+    bind_light_tiles(R->clusters, 2);
 
-    for(ii=0;ii<num_models;++ii) {
-        Mat4 world_matrix = transform_get_matrix(models[ii].transform);
+    /* Camera, lights and materials all come from uniform blocks and textures */
+    for(ii=0;ii<queue->num_batches;++ii) {
+        const DrawBatch* batch = &queue->batches[ii];
+        const Model* model = batch->model;
+        ForwardProgram* P = _finish_program(&R->clustered[model->material->normal != 0]);
+        if(P == NULL)
+            continue; /* Already reported by finish_program */
+        if(P != current) {
+            current = P;
+            ASSERT_GL(glUseProgram(P->program));
+            set_uniform(P->uniforms, "u_LightSliceParams", &slice_params);
+        }
         /* Material */
-        ASSERT_GL(glUniform3fv(R->u_SpecularColor, 1, (float*)&models[ii].material->specular_color));
-        ASSERT_GL(glUniform1f(R->u_SpecularPower, models[ii].material->specular_power));
-        ASSERT_GL(glUniform1f(R->u_SpecularCoefficient, models[ii].material->specular_coefficient));
-        ASSERT_GL(glActiveTexture(GL_TEXTURE0));
-        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, models[ii].material->albedo));
-        ASSERT_GL(glActiveTexture(GL_TEXTURE1));
-        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, models[ii].material->normal));
+        if(model->material != material) {
+            material = model->material;
+            bind_material_block(queue, batch);
+            ASSERT_GL(glActiveTexture(GL_TEXTURE0));
+            ASSERT_GL(glBindTexture(GL_TEXTURE_2D, material->albedo));
+            ASSERT_GL(glActiveTexture(GL_TEXTURE1));
+            ASSERT_GL(glBindTexture(GL_TEXTURE_2D, material->normal));
+        }
         /* Mesh */
-        ASSERT_GL(glUniformMatrix4fv(R->u_World, 1, GL_FALSE, (float*)&world_matrix));
-        draw_mesh(models[ii].mesh);
+        if(model->mesh != mesh) {
+            mesh = model->mesh;
+            bind_mesh(mesh);
+        }
+        draw_batch(queue, batch, P->uniforms);
     }
+    unbind_mesh();
 }
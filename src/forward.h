@@ -20,16 +20,32 @@
 #include "graphics.h"
 #include "scene.h"
 #include "mesh.h"
+#include "render_queue.h"
+#include "light_binning.h"
 
 typedef struct ForwardRenderer ForwardRenderer;
 
 ForwardRenderer* create_forward_renderer(Graphics* G, int major_version, int minor_version);
 void destroy_forward_renderer(ForwardRenderer* R);
 void resize_forward_renderer(ForwardRenderer* R, int width, int height);
+/** @brief Renders to the bottom left `width` by `height` pixels of the
+ *  targets from the last resize
+ */
+void set_forward_viewport(ForwardRenderer* R, int width, int height);
 
 void render_forward(ForwardRenderer* R, GLuint default_framebuffer,
                     Mat4 proj_matrix, Mat4 view_matrix,
-                    const Model* models, int num_models,
+                    const RenderQueue* queue,
                     const Light* lights, int num_lights);
+/** @brief Renders with clustered forward shading: the lights are binned on
+ *  the CPU with `binner` into LIGHT_CLUSTER_SIZE screen tiles by
+ *  LIGHT_CLUSTER_SLICES exponential depth slices and each fragment only
+ *  loops over its cluster's lights. ES3 only.
+ */
+void render_clustered_forward(ForwardRenderer* R, GLuint default_framebuffer,
+                              Mat4 proj_matrix, Mat4 view_matrix,
+                              const RenderQueue* queue,
+                              const Light* lights, int num_lights,
+                              LightBinner* binner);
 
 #endif /* include guard */
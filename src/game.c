@@ -24,11 +24,13 @@
 #include "vec_math.h"
 #include "scene.h"
 #include "ui.h"
+#include "uniforms.h"
 #include "assert.h"
 
 /* Defines
  */
 #define NUM_LIGHTS 15
+#define FRAME_BUDGET (1.0f/60.0f)   /* Seconds, the resolution drops to keep to it */
 
 /* Types
  */
@@ -60,10 +62,16 @@ struct Game
     float       fps_time;
     int         fps_count;
     float       fps;
+    int         uniform_uploads;
+    int         uniform_skipped;
 };
 
 /* Constants
  */
+/** Indexed by GBufferLayout */
+static const char* kGBufferLayoutNames[] = { "RG16F", "RGBA8 oct", "RGB10A2 oct", "RG8 oct" };
+/* Fails to compile when a layout is added or removed without its name */
+typedef char _gbuffer_layout_names_check[sizeof(kGBufferLayoutNames)/sizeof(kGBufferLayoutNames[0]) == MAX_GBUFFER_LAYOUTS ? 1 : -1];
 
 /* Variables
  */
@@ -117,8 +125,9 @@ Game* create_game(void)
     int ii;
     Game* G = (Game*)calloc(1, sizeof(Game));
     G->timer = create_timer();
-    G->graphics = create_graphics();
+    G->graphics = create_graphics(NUM_LIGHTS + 1); /* And the sun */
     G->ui = create_ui(G->graphics);
+    set_frame_budget(G->graphics, FRAME_BUDGET);
 
     /* Set up camera */
     G->camera = transform_zero;
@@ -206,12 +215,18 @@ void update_game(Game* G)
     G->fps_count++;
 
     if(G->fps_time >= 1.0f) {
+        int uploads, skipped;
         G->fps = G->fps_count/G->fps_time;
         system_log("FPS: %f\n", G->fps);
+        uniform_upload_counts(&uploads, &skipped);
+        system_log("Uniforms: %d uploaded, %d unchanged\n", uploads - G->uniform_uploads, skipped - G->uniform_skipped);
+        G->uniform_uploads = uploads;
+        G->uniform_skipped = skipped;
         G->fps_time -= 1.0f;
         G->fps_count = 0;
     }
     {
+        GraphicsStats stats;
         int width, height;
         float scale = 50.0f;
         float x = -G->width/2.0f;
@@ -226,12 +241,67 @@ void update_game(Game* G)
         case kForward: add_string(G->ui, x, y, scale, "Forward renderer"); break;
         case kLightPrePass: add_string(G->ui, x, y, scale, "Deferred Lighting"); break;
         case kDeferred: add_string(G->ui, x, y, scale, "Deferred Shading"); break;
+        case kTiledDeferred: add_string(G->ui, x, y, scale, "Tiled Deferred Shading"); break;
+        case kClusteredForward: add_string(G->ui, x, y, scale, "Clustered Forward"); break;
         default: assert(!"Invalid renderer"); break;
         }
         y -= scale;
         // Resolution
         graphics_size(G->graphics, &width, &height);
-        sprintf(buffer, "%dx%d", width, height);
+        stats = graphics_stats(G->graphics);
+        sprintf(buffer, "%dx%d (%.0f%%, %.1f ms)", width, height, stats.render_scale*100.0f, stats.frame_time*1000.0f);
+        add_string(G->ui, x, y, scale, buffer);
+        y -= scale;
+        // Culling
+        sprintf(buffer, "Models: %d/%d", stats.models_visible, stats.models_submitted);
+        add_string(G->ui, x, y, scale, buffer);
+        y -= scale;
+        sprintf(buffer, "Lights: %d/%d", stats.lights_visible, stats.lights_submitted);
+        add_string(G->ui, x, y, scale, buffer);
+        y -= scale;
+        // Batching
+        sprintf(buffer, "Draws: %d, binds: %d mat, %d mesh", stats.draw_calls, stats.material_binds, stats.mesh_binds);
+        add_string(G->ui, x, y, scale, buffer);
+        y -= scale;
+        // Streaming
+        sprintf(buffer, "Stream: %d KB, %d waits%s", stats.stream_bytes/1024, stats.stream_waits,
+                stats.stream_orphaning ? " (orphaning)" : "");
+        add_string(G->ui, x, y, scale, buffer);
+        y -= scale;
+        // Light volumes
+        if(stats.stencil_lights < 0)
+            sprintf(buffer, "Stencil lights: off");
+        else
+            sprintf(buffer, "Stencil lights: %d", stats.stencil_lights);
+        add_string(G->ui, x, y, scale, buffer);
+        y -= scale;
+        sprintf(buffer, "Light paths: %d volume, %d inside, %d near", stats.light_classes[kLightOutside],
+                stats.light_classes[kLightInside], stats.light_classes[kLightNearPlane]);
+        add_string(G->ui, x, y, scale, buffer);
+        y -= scale;
+        // G-buffer
+        if(stats.gbuffer_layout < 0) {
+            sprintf(buffer, "G-buffer: none");
+        } else {
+            sprintf(buffer, "G-buffer: %s, %d B/px, %d KB", kGBufferLayoutNames[stats.gbuffer_layout],
+                    stats.gbuffer_bytes_per_pixel, stats.gbuffer_traffic_kb);
+        }
+        add_string(G->ui, x, y, scale, buffer);
+        y -= scale;
+        // Light resolution
+        if(stats.light_divisor == 0)
+            sprintf(buffer, "Light resolution: none");
+        else if(stats.light_divisor == 1)
+            sprintf(buffer, "Light resolution: full");
+        else
+            sprintf(buffer, "Light resolution: 1/%d", stats.light_divisor);
+        add_string(G->ui, x, y, scale, buffer);
+        y -= scale;
+        // Tile memory
+        if(stats.invalidated_attachments < 0)
+            sprintf(buffer, "Invalidated attachments: unsupported");
+        else
+            sprintf(buffer, "Invalidated attachments: %d", stats.invalidated_attachments);
         add_string(G->ui, x, y, scale, buffer);
     }
 }
@@ -290,16 +360,24 @@ void remove_touch_points(Game* G, int num_touch_points, TouchPoint* points)
         G->prev_double = avg;
     } else {
         if(G->tap_timer < 0.5f) {
-            if(G->prev_single.x < G->width/2) {
+            /* The screen is split into thirds across and halves down, each
+             * cell its own control. The bottom middle does nothing.
+             */
+            if(G->prev_single.x < G->width/3) {
                 if(G->prev_single.y < G->height/2) { // Top Left
                     cycle_renderers(G->graphics);
                 } else { // bottom left
                     G->dynamic_lights = !G->dynamic_lights;
                 }
-
+            } else if(G->prev_single.x < G->width*2/3) {
+                if(G->prev_single.y < G->height/2) { // Top middle
+                    cycle_light_resolution(G->graphics);
+                }
             } else {
                 if(G->prev_single.y < G->height/2) { // Top right
+                    toggle_stencil_lights(G->graphics);
                 } else { // bottom right
+                    cycle_gbuffer_layouts(G->graphics);
                 }
             }
         }
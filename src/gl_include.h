@@ -51,6 +51,27 @@ static const char* _glStatusString(GLenum error)
 }
 #undef STATUS_CASE
 
+/** @brief The context's major version, for modules that can't see Graphics'
+ *  `major_version`. GL_MAJOR_VERSION isn't queryable on ES2 contexts, so
+ *  this reads the "OpenGL ES N.M" version string once.
+ */
+static int gl_major_version(void)
+{
+    static int major_version = 0;
+    if(major_version == 0) {
+        const char* version = (const char*)glGetString(GL_VERSION);
+        const char* prefix = "OpenGL ES ";
+        while(version && *prefix && *version == *prefix) {
+            ++version;
+            ++prefix;
+        }
+        major_version = 2;
+        if(version && *prefix == '\0' && *version >= '3' && *version <= '9')
+            major_version = *version - '0';
+    }
+    return major_version;
+}
+
 /** @brief OpenGL Error checking wrapper
  */
 #ifndef ASSERT_GL
@@ -21,28 +21,66 @@
 #include "gl_include.h"
 #include "program.h"
 #include "vertex.h"
+#include "mesh.h"
+#include "culling.h"
+#include "render_queue.h"
+#include "uniforms.h"
+#include "stream_buffer.h"
+#include "timer.h"
+#include "light_binning.h"
 
 #include "forward.h"
 #include "light_prepass.h"
 #include "deferred.h"
+#include "low_res_lighting.h"
 
 /* Defines
  */
-#define MAX_RENDER_COMMANDS 1024
-#define STATIC_WIDTH 1280
-#define STATIC_HEIGHT 720
+#define MAX_RENDER_COMMANDS 8192
+#define NEAR_PLANE          1.0f
+#define FAR_PLANE           100.0f
+#define MIN_RENDER_SCALE    0.5f
+#define FRAME_QUERIES       4       /* GPU timer queries in flight */
+/** Dynamic resolution controller gains, per frame on the frame time error
+ *  as a fraction of the budget
+ */
+#define SCALE_KP            0.1f
+#define SCALE_KI            0.02f
+#define SCALE_KD            0.05f
+#define SCALE_DEADBAND      0.05f   /* Errors treated as noise */
+#define SCALE_HYSTERESIS    0.05f   /* Smallest render scale change applied */
+#define FRAME_TIME_SMOOTHING 0.1f
+#define MAX_FRAME_TIME      0.25f   /* Longer frames are stalls, not load */
+#ifndef GL_TIME_ELAPSED_EXT
+    #define GL_TIME_ELAPSED_EXT 0x88BF
+    #define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+#define STREAM_FRAME_SIZE (256*1024)  /* Initial, the stream grows to fit */
 
 /* Types
  */
 struct Graphics
 {
-    int width;
+    int width;          /* Rendered to, the bottom left of the targets */
     int height;
-    int real_width;
+    int real_width;     /* Screen and render target size */
     int real_height;
     int major_version;
     int minor_version;
-    int static_size;
+    int stencil_lights;
+    int light_divisor;  /* Of the light volume renderers */
+    int float_targets;  /* Non-zero if float color buffers can be rendered to */
+
+    /* Dynamic resolution */
+    float   frame_budget;       /* Seconds, 0 renders at full resolution */
+    float   frame_time;         /* Smoothed GPU time, or CPU time between frames */
+    float   scale_output;       /* Controller output before hysteresis */
+    float   scale_error[2];     /* Last two errors */
+    float   render_scale;
+    Timer*  frame_timer;
+    GLuint  frame_queries[FRAME_QUERIES];   /* Zero without GL_EXT_disjoint_timer_query */
+    int     next_query;
+    int     pending_queries;
 
     ForwardRenderer*        forward;
     LightPrepassRenderer*   light_prepass;
@@ -53,7 +91,10 @@ struct Graphics
     GLuint  fullscreen_program;
     GLuint  fullscreen_quad_vertex_buffer;
     GLuint  fullscreen_quad_index_buffer;
+    GLuint  fullscreen_quad_vertex_array;   /* ES3 only */
     GLuint  fullscreen_texture;
+    GLint   fullscreen_tex_coord_scale;
+    GLint   fullscreen_tex_coord_max;
 
     GLuint  framebuffer;
     GLuint  color_texture;
@@ -63,9 +104,41 @@ struct Graphics
     Mat4    view_matrix;
 
     Model   render_commands[MAX_RENDER_COMMANDS];
-    Light   lights[MAX_LIGHTS];
+    Light*  lights;             /* Every per-light array holds max_lights */
     int     num_render_commands;
+    int     num_culled_models;  /* Culled by the caller before being added */
     int     num_lights;
+    int     max_lights;
+
+    /* World space centers of the render commands, for sorting */
+    float   command_center[3][MAX_RENDER_COMMANDS];
+
+    /* Draw order of the render commands, sorted by key */
+    uint64_t    sort_keys[MAX_RENDER_COMMANDS];
+    uint64_t    sort_temp_keys[MAX_RENDER_COMMANDS];
+    int         draw_order[MAX_RENDER_COMMANDS];
+    int         sort_temp_order[MAX_RENDER_COMMANDS];
+
+    /* Batches of the sorted commands and their per-instance data */
+    Mat4        instance_matrices[MAX_RENDER_COMMANDS];
+    DrawBatch   batches[MAX_RENDER_COMMANDS];
+    int         num_batches;
+
+    /* Per-frame dynamic data, uniform blocks only with ES3 */
+    StreamBuffer*   stream;
+    int             uniform_alignment;
+    int             material_stride;
+    const Material* block_materials[MAX_RENDER_COMMANDS];  /* One PerMaterialBlock per material run */
+    int             num_material_blocks;
+
+    /* Light spheres, laid out for SIMD culling */
+    float*  light_center[3];
+    float*  light_radius;
+    uint8_t* light_visible;
+
+    LightBinner*    binner;     /* For the tiled renderers, created on first use */
+
+    GraphicsStats   stats;
 
     RendererType active_renderer;
 };
@@ -91,6 +164,53 @@ static const uint32_t kFullscreenIndices[] = {
 
 /* Internal functions
  */
+/** Marks attachments of the bound framebuffer as dead, so tiled GPUs don't
+ *  write them back when the pass ends. ES2 ignores it.
+ */
+static void _invalidate_attachments(Graphics* G, int count, const GLenum* attachments)
+{
+    if(G->major_version < 3)
+        return;
+    ASSERT_GL(glInvalidateFramebuffer(GL_FRAMEBUFFER, count, attachments));
+    G->stats.invalidated_attachments += count;
+}
+static LightBinner* _light_binner(Graphics* G)
+{
+    if(G->binner == NULL)
+        G->binner = create_light_binner(0);
+    return G->binner;
+}
+/** Allocates the lights and their culling arrays in one block */
+static void _allocate_lights(Graphics* G, int max_lights)
+{
+    size_t  light_size = sizeof(Light) + 4*sizeof(float) + sizeof(uint8_t);
+    char*   data;
+
+    if(max_lights > MAX_LIGHTS)
+        max_lights = MAX_LIGHTS;
+    data = (char*)malloc(max_lights*light_size + 1);
+    if(data == NULL) {
+        system_log("Allocating %d lights failed\n", max_lights);
+        max_lights = 0;
+    }
+    G->max_lights = max_lights;
+    G->lights = (Light*)data;
+    G->light_center[0] = (float*)(G->lights + max_lights);
+    G->light_center[1] = G->light_center[0] + max_lights;
+    G->light_center[2] = G->light_center[1] + max_lights;
+    G->light_radius = G->light_center[2] + max_lights;
+    G->light_visible = (uint8_t*)(G->light_radius + max_lights);
+}
+static void _setup_fullscreen_quad_layout(Graphics* G)
+{
+    float* ptr = 0;
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, G->fullscreen_quad_vertex_buffer));
+    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, G->fullscreen_quad_index_buffer));
+    ASSERT_GL(glVertexAttribPointer(kPositionSlot,    3, GL_FLOAT, GL_FALSE, sizeof(kFullscreenVertices[0]), (void*)(ptr+=0)));
+    ASSERT_GL(glVertexAttribPointer(kTexCoordSlot,    2, GL_FLOAT, GL_FALSE, sizeof(kFullscreenVertices[0]), (void*)(ptr+=3)));
+    ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
+    ASSERT_GL(glEnableVertexAttribArray(kTexCoordSlot));
+}
 static void _create_fullscreen_quad(Graphics* G)
 {
     AttributeSlot slots[] = {
@@ -99,11 +219,6 @@ static void _create_fullscreen_quad(Graphics* G)
         kEmptySlot
     };
     G->fullscreen_program = create_program("fullscreen_vertex.glsl", "fullscreen_fragment.glsl", slots);
-    ASSERT_GL(glUseProgram(G->fullscreen_program));
-    ASSERT_GL(G->fullscreen_texture = glGetUniformLocation(G->fullscreen_program, "s_Texture"));
-    ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kTexCoordSlot));
-    ASSERT_GL(glUseProgram(0));
 
     /* Create vertex buffer */
     ASSERT_GL(glGenBuffers(1, &G->fullscreen_quad_vertex_buffer));
@@ -116,23 +231,34 @@ static void _create_fullscreen_quad(Graphics* G)
     ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, G->fullscreen_quad_index_buffer));
     ASSERT_GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(kFullscreenIndices), kFullscreenIndices, GL_STATIC_DRAW));
     ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+
+    /* Create vertex array */
+    if(G->major_version >= 3) {
+        ASSERT_GL(glGenVertexArrays(1, &G->fullscreen_quad_vertex_array));
+        ASSERT_GL(glBindVertexArray(G->fullscreen_quad_vertex_array));
+        _setup_fullscreen_quad_layout(G);
+        ASSERT_GL(glBindVertexArray(0));
+        ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    }
 }
 static void _draw_fullscreen_quad(Graphics* G)
 {
-    float* ptr = 0;
-    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, G->fullscreen_quad_vertex_buffer));
-    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, G->fullscreen_quad_index_buffer));
-    ASSERT_GL(glVertexAttribPointer(kPositionSlot,    3, GL_FLOAT, GL_FALSE, sizeof(kFullscreenVertices[0]), (void*)(ptr+=0)));
-    ASSERT_GL(glVertexAttribPointer(kTexCoordSlot,    2, GL_FLOAT, GL_FALSE, sizeof(kFullscreenVertices[0]), (void*)(ptr+=3)));
-    ASSERT_GL(glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL));
+    if(G->fullscreen_quad_vertex_array) {
+        ASSERT_GL(glBindVertexArray(G->fullscreen_quad_vertex_array));
+        ASSERT_GL(glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL));
+        ASSERT_GL(glBindVertexArray(0));
+    } else {
+        _setup_fullscreen_quad_layout(G);
+        ASSERT_GL(glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL));
+    }
 }
 static void _create_framebuffer(Graphics* G)
 {
-    /* Color buffer */
+    /* Color buffer, filtered when scaled to the screen */
     ASSERT_GL(glGenTextures(1, &G->color_texture));
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, G->color_texture));
-    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
     ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
     ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
 
@@ -155,14 +281,14 @@ static void _resize_framebuffer(Graphics* G)
 
     /* Color buffer */
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, G->color_texture));
-    ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, G->width, G->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0));
+    ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, G->real_width, G->real_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0));
 
     /* Depth buffer */
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, G->depth_texture));
     if(G->major_version >= 3)
-        ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, G->width, G->height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0));
+        ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, G->real_width, G->real_height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0));
     else
-        ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, G->width, G->height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0));
+        ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, G->real_width, G->real_height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0));
 
     /* Framebuffer */
     ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, G->framebuffer));
@@ -179,16 +305,307 @@ static void _resize_framebuffer(Graphics* G)
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, 0));
 }
 
+/** Renders to the bottom left `render_scale` of the targets, without
+ *  reallocating them
+ */
+static void _apply_render_scale(Graphics* G)
+{
+    G->width = (int)(G->real_width*G->render_scale + 0.5f);
+    G->height = (int)(G->real_height*G->render_scale + 0.5f);
+    if(G->width < 1)
+        G->width = 1;
+    if(G->height < 1)
+        G->height = 1;
+    if(G->forward)
+        set_forward_viewport(G->forward, G->width, G->height);
+    if(G->light_prepass)
+        set_light_prepass_viewport(G->light_prepass, G->width, G->height);
+    if(G->deferred)
+        set_deferred_viewport(G->deferred, G->width, G->height);
+}
+/** @return The GPU seconds of the oldest timer query, 0 if it hasn't
+ *      finished or the timer was disjoint
+ */
+static float _read_frame_query(Graphics* G)
+{
+    int     oldest = (G->next_query - G->pending_queries + FRAME_QUERIES) % FRAME_QUERIES;
+    GLuint  available = 0;
+    GLuint  nanoseconds = 0;
+    GLint   disjoint = 0;
+
+    if(G->pending_queries == 0)
+        return 0.0f;
+    ASSERT_GL(glGetQueryObjectuiv(G->frame_queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available));
+    if(!available)
+        return 0.0f;
+    ASSERT_GL(glGetQueryObjectuiv(G->frame_queries[oldest], GL_QUERY_RESULT, &nanoseconds));
+    G->pending_queries--;
+    /* Reading the flag clears it */
+    ASSERT_GL(glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint));
+    return disjoint ? 0.0f : nanoseconds*1e-9f;
+}
+/** Dynamic resolution: an incremental PID controller drives the render scale
+ *  from the frame time error. Its output accumulates, so clamping it keeps
+ *  the integral from winding up. Small errors are ignored and the scale only
+ *  moves in SCALE_HYSTERESIS steps, so it doesn't hunt around the budget.
+ *
+ *  Without timer queries the CPU time between frames is used, which can't
+ *  see the headroom under vsync: the scale drops when frames are missed but
+ *  only recovers when they come in faster than the budget.
+ */
+static void _update_render_scale(Graphics* G)
+{
+    float   cpu_time = (float)get_delta_time(G->frame_timer);
+    float   frame_time = G->frame_queries[0] ? _read_frame_query(G) : cpu_time;
+    float   error;
+
+    if(G->frame_budget <= 0.0f || frame_time <= 0.0f || frame_time > MAX_FRAME_TIME)
+        return;
+    G->frame_time += (frame_time - G->frame_time)*FRAME_TIME_SMOOTHING;
+
+    error = (G->frame_budget - G->frame_time)/G->frame_budget;
+    if(fabsf(error) < SCALE_DEADBAND)
+        error = 0.0f;
+    G->scale_output += SCALE_KP*(error - G->scale_error[0])
+                     + SCALE_KI*error
+                     + SCALE_KD*(error - 2.0f*G->scale_error[0] + G->scale_error[1]);
+    if(G->scale_output < MIN_RENDER_SCALE)
+        G->scale_output = MIN_RENDER_SCALE;
+    else if(G->scale_output > 1.0f)
+        G->scale_output = 1.0f;
+    G->scale_error[1] = G->scale_error[0];
+    G->scale_error[0] = error;
+
+    if(fabsf(G->scale_output - G->render_scale) >= SCALE_HYSTERESIS ||
+       (G->scale_output != G->render_scale && (G->scale_output == 1.0f || G->scale_output == MIN_RENDER_SCALE))) {
+        G->render_scale = G->scale_output;
+        _apply_render_scale(G);
+    }
+}
+
+/** Finds the world bounds centers of the render commands, the commands
+ *  were culled by the caller
+ */
+static void _update_command_centers(Graphics* G)
+{
+    int     ii;
+
+    for(ii=0;ii<G->num_render_commands;++ii) {
+        const Model* model = &G->render_commands[ii];
+        Bounds  local = mesh_bounds(model->mesh);
+        Bounds  world = transform_bounds(&local, transform_get_matrix(model->transform));
+        G->command_center[0][ii] = world.center.x;
+        G->command_center[1][ii] = world.center.y;
+        G->command_center[2][ii] = world.center.z;
+    }
+    G->stats.models_submitted = G->num_render_commands + G->num_culled_models;
+    G->stats.models_visible = G->num_render_commands;
+}
+/** Orders the visible render commands by program, material, mesh, then
+ *  front to back
+ */
+static void _sort_render_commands(Graphics* G)
+{
+    Mat4    view = G->view_matrix;
+    int     ii;
+
+    for(ii=0;ii<G->num_render_commands;++ii) {
+        const Model* model = &G->render_commands[ii];
+        float   depth = G->command_center[0][ii]*view.r0.z + G->command_center[1][ii]*view.r1.z +
+                        G->command_center[2][ii]*view.r2.z + view.r3.z;
+        int     program = model->material->normal != 0;
+        G->sort_keys[ii] = render_sort_key(kOpaquePass, program, model->material->id,
+                                           mesh_id(model->mesh), depth/FAR_PLANE);
+        G->draw_order[ii] = ii;
+    }
+    radix_sort(G->sort_keys, G->draw_order, G->num_render_commands, G->sort_temp_keys, G->sort_temp_order);
+}
+/** Groups runs of sorted commands sharing a mesh and material into batches
+ *  and streams their world matrices for instancing
+ */
+static void _batch_render_commands(Graphics* G, RenderQueue* queue)
+{
+    const Material* prev_material = NULL;
+    const Mesh*     prev_mesh = NULL;
+    DrawBatch*      batch = NULL;
+    int             ii;
+
+    G->num_batches = 0;
+    G->num_material_blocks = 0;
+    G->stats.material_binds = 0;
+    G->stats.mesh_binds = 0;
+    for(ii=0;ii<G->num_render_commands;++ii) {
+        const Model* model = &G->render_commands[G->draw_order[ii]];
+        G->instance_matrices[ii] = transform_get_matrix(model->transform);
+        if(batch && model->material == prev_material && model->mesh == prev_mesh) {
+            batch->num_instances++;
+            continue;
+        }
+        if(model->material != prev_material) {
+            G->block_materials[G->num_material_blocks++] = model->material;
+            G->stats.material_binds++;
+        }
+        G->stats.mesh_binds += model->mesh != prev_mesh;
+        prev_material = model->material;
+        prev_mesh = model->mesh;
+
+        batch = &G->batches[G->num_batches++];
+        batch->model = model;
+        batch->first_instance = ii;
+        batch->num_instances = 1;
+        batch->material_block = G->num_material_blocks - 1;
+    }
+    G->stats.draw_calls = G->major_version >= 3 ? G->num_batches : G->num_render_commands;
+
+    queue->batches = G->batches;
+    queue->num_batches = G->num_batches;
+    queue->world_matrices = G->instance_matrices;
+    queue->instance_buffer = 0;
+    queue->instance_offset = 0;
+    if(G->major_version >= 3 && G->num_render_commands) {
+        queue->instance_offset = stream_data(G->stream, G->instance_matrices, G->num_render_commands*sizeof(Mat4),
+                                             sizeof(Vec4), &queue->instance_buffer);
+    }
+}
+/** Drops lights whose sphere of influence is outside the view frustum */
+static void _cull_lights(Graphics* G, const Frustum* frustum)
+{
+    int     num_visible = 0;
+    int     ii;
+
+    for(ii=0;ii<G->num_lights;++ii) {
+        G->light_center[0][ii] = G->lights[ii].position.x;
+        G->light_center[1][ii] = G->lights[ii].position.y;
+        G->light_center[2][ii] = G->lights[ii].position.z;
+        G->light_radius[ii] = G->lights[ii].size;
+    }
+    cull_spheres(frustum, G->light_center[0], G->light_center[1], G->light_center[2],
+                 G->light_radius, G->num_lights, G->light_visible);
+
+    for(ii=0;ii<G->num_lights;++ii) {
+        if(G->light_visible[ii])
+            G->lights[num_visible++] = G->lights[ii];
+    }
+    G->stats.lights_submitted = G->num_lights;
+    G->stats.lights_visible = num_visible;
+    G->num_lights = num_visible;
+}
+/** Streams the frame's camera, lights and materials once, every program
+ *  reads them through the shared binding points
+ */
+static void _update_uniform_buffers(Graphics* G, RenderQueue* queue)
+{
+    PerFrameBlock   frame;
+    LightsBlock*    lights;
+    uint8_t*        materials;
+    GLuint          buffer;
+    GLintptr        offset;
+    int             num_lights;
+    int             ii;
+
+    queue->material_buffer = 0;
+    queue->material_offset = 0;
+    queue->material_stride = G->material_stride;
+    if(G->major_version < 3)
+        return;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.projection = G->proj_matrix;
+    frame.view = G->view_matrix;
+    frame.inv_proj = mat4_inverse(G->proj_matrix);
+    frame.viewport[0] = (float)G->width;
+    frame.viewport[1] = (float)G->height;
+    frame.target_scale[0] = G->width/(float)G->real_width;
+    frame.target_scale[1] = G->height/(float)G->real_height;
+    offset = stream_data(G->stream, &frame, sizeof(frame), G->uniform_alignment, &buffer);
+    ASSERT_GL(glBindBufferRange(GL_UNIFORM_BUFFER, kPerFrameBlock, buffer, offset, sizeof(frame)));
+
+    /* Lights in view space, as forward shading wants them. The mapping is
+     * write only, nothing is read back from it.
+     */
+    num_lights = G->num_lights < MAX_BLOCK_LIGHTS ? G->num_lights : MAX_BLOCK_LIGHTS;
+    lights = (LightsBlock*)map_stream(G->stream, sizeof(*lights), G->uniform_alignment, &buffer, &offset);
+    if(lights == NULL)
+        return;
+    lights->num_lights = num_lights;
+    for(ii=0;ii<num_lights;++ii) {
+        Vec4 position = vec4_from_vec3(G->lights[ii].position, 1.0f);
+        position = mat4_mul_vector(position, G->view_matrix);
+        position.w = G->lights[ii].size;
+        lights->position_size[ii] = position;
+        lights->color[ii] = vec4_from_vec3(G->lights[ii].color, 1.0f);
+    }
+    unmap_stream(G->stream);
+    ASSERT_GL(glBindBufferRange(GL_UNIFORM_BUFFER, kLightsBlock, buffer, offset, sizeof(*lights)));
+
+    /* Materials are bound per batch, see bind_material_block */
+    if(G->num_material_blocks == 0)
+        return;
+    materials = (uint8_t*)map_stream(G->stream, G->num_material_blocks*G->material_stride, G->uniform_alignment,
+                                     &queue->material_buffer, &queue->material_offset);
+    if(materials == NULL)
+        return;
+    for(ii=0;ii<G->num_material_blocks;++ii) {
+        const Material* material = G->block_materials[ii];
+        PerMaterialBlock* block = (PerMaterialBlock*)(materials + ii*G->material_stride);
+        block->specular_color = material->specular_color;
+        block->specular_power = material->specular_power;
+        block->specular_coefficient = material->specular_coefficient;
+    }
+    unmap_stream(G->stream);
+}
+
+/** @brief Bounds a sphere along one screen axis, in NDC
+ *  @param x, z Center in the plane of the axis and the view direction
+ *  @param scale The projection's scale along the axis
+ *
+ *  The extremes are where lines from the eye touch the sphere, or where the
+ *  near plane cuts it when a touching point lies behind the near plane.
+ */
+static void _project_sphere_axis(float x, float z, float radius, float near_plane, float scale,
+                                 float* lo, float* hi)
+{
+    float   distance_sq = x*x + z*z;
+    float   points[4];
+    int     num_points = 0;
+    int     ii;
+
+    if(z - radius < near_plane) {
+        float chord = sqrtf(radius*radius - (near_plane - z)*(near_plane - z));
+        points[num_points++] = scale*(x - chord)/near_plane;
+        points[num_points++] = scale*(x + chord)/near_plane;
+    }
+    if(distance_sq > radius*radius) {
+        float tangent = sqrtf(distance_sq - radius*radius);
+        for(ii=-1;ii<=1;ii+=2) {
+            float tx = (tangent*x - ii*radius*z)*tangent/distance_sq;
+            float tz = (tangent*z + ii*radius*x)*tangent/distance_sq;
+            if(tz > near_plane)
+                points[num_points++] = scale*tx/tz;
+        }
+    }
+    *lo = 1.0f;
+    *hi = -1.0f;
+    for(ii=0;ii<num_points;++ii) {
+        *lo = points[ii] < *lo ? points[ii] : *lo;
+        *hi = points[ii] > *hi ? points[ii] : *hi;
+    }
+}
+
 /* External functions
  */
-Graphics* create_graphics(void)
+Graphics* create_graphics(int max_lights)
 {
     Graphics* G = NULL;
 
     /* Allocate graphics */
     G = (Graphics*)calloc(1, sizeof(Graphics));
-    G->width = 2;
-    G->height = 2;
+    _allocate_lights(G, max_lights > 0 ? max_lights : 1);
+    G->width = G->real_width = 2;
+    G->height = G->real_height = 2;
+    G->render_scale = G->scale_output = 1.0f;
+    G->light_divisor = 1;
+    G->frame_timer = create_timer();
 
     /* Set up OpenGL */
     ASSERT_GL(glClearColor(1.0f, 0.0f, 1.0f, 1.0f));
@@ -213,9 +630,26 @@ Graphics* create_graphics(void)
         system_log("%s\n", buffer);
     }
 
+    if(G->major_version >= 3 && strstr((const char*)glGetString(GL_EXTENSIONS), "GL_EXT_disjoint_timer_query"))
+        ASSERT_GL(glGenQueries(FRAME_QUERIES, G->frame_queries));
+    if(G->major_version >= 3) {
+        /* ES 3.0 can only render to float formats with an extension */
+        const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+        G->float_targets = extensions && (strstr(extensions, "GL_EXT_color_buffer_float") ||
+                                          strstr(extensions, "GL_EXT_color_buffer_half_float"));
+    }
+
     /* Set up self */
     _create_fullscreen_quad(G);
     _create_framebuffer(G);
+    G->stream = create_stream_buffer(STREAM_FRAME_SIZE, G->major_version >= 3);
+    if(G->major_version >= 3) {
+        GLint alignment = 0;
+        /* Uniform blocks are bound by range, so each starts on the alignment */
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        G->uniform_alignment = alignment < 1 ? 1 : alignment;
+        G->material_stride = (int)((sizeof(PerMaterialBlock) + G->uniform_alignment - 1)/G->uniform_alignment*G->uniform_alignment);
+    }
 
     /* Set up renderers */
     G->forward = create_forward_renderer(G, G->major_version, G->minor_version);
@@ -223,11 +657,24 @@ Graphics* create_graphics(void)
     if(G->major_version >= 3)
         G->deferred = create_deferred_renderer(G);
 
+    /* Every program has been submitted, wait for them all at once */
+    warm_up_programs();
+    ASSERT_GL(G->fullscreen_texture = glGetUniformLocation(G->fullscreen_program, "s_Texture"));
+    ASSERT_GL(G->fullscreen_tex_coord_scale = glGetUniformLocation(G->fullscreen_program, "u_TexCoordScale"));
+    ASSERT_GL(G->fullscreen_tex_coord_max = glGetUniformLocation(G->fullscreen_program, "u_TexCoordMax"));
+
+    { /* Report program cache */
+        ProgramCacheStats stats = program_cache_stats();
+        int total = stats.hits + stats.misses;
+        system_log("Program cache: %d/%d hits (%.0f%%), %d rejected, %.1f ms compiling, %.1f ms saved\n",
+                   stats.hits, total, total ? 100.0f*stats.hits/total : 0.0f, stats.rejected,
+                   stats.compile_time*1000.0f, stats.time_saved*1000.0f);
+    }
+
     if(G->deferred)
         G->active_renderer = kDeferred;
     else
         G->active_renderer = kLightPrePass;
-    G->static_size = 0;
 
     return G;
 }
@@ -237,72 +684,153 @@ void destroy_graphics(Graphics* G)
     destroy_light_prepass_renderer(G->light_prepass);
     destroy_forward_renderer(G->forward);
     destroy_program(G->fullscreen_program);
+    if(G->fullscreen_quad_vertex_array)
+        ASSERT_GL(glDeleteVertexArrays(1, &G->fullscreen_quad_vertex_array));
+    destroy_stream_buffer(G->stream);
+    if(G->frame_queries[0])
+        ASSERT_GL(glDeleteQueries(FRAME_QUERIES, G->frame_queries));
+    destroy_timer(G->frame_timer);
+    if(G->binner)
+        destroy_light_binner(G->binner);
+    free(G->lights);
     free(G);
 }
 void resize_graphics(Graphics* G, int width, int height)
 {
-    if(G->static_size) {
-        G->width = STATIC_WIDTH;// width;
-        G->height = STATIC_HEIGHT; //height;
-    } else {
-        G->width = width;
-        G->height = height;
-    }
     G->real_width = width;
     G->real_height = height;
 
-    G->proj_matrix = mat4_perspective_fov(kPiDiv2, width/(float)height, 1.0f, 100.0f);
+    G->proj_matrix = mat4_perspective_fov(kPiDiv2, width/(float)height, NEAR_PLANE, FAR_PLANE);
 
     ASSERT_GL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &G->default_framebuffer));
 
+    /* Targets are allocated at full size, dynamic resolution renders to
+     * part of them
+     */
     _resize_framebuffer(G);
     if(G->forward)
-        resize_forward_renderer(G->forward, G->width, G->height);
+        resize_forward_renderer(G->forward, width, height);
     if(G->light_prepass)
-        resize_light_prepass_renderer(G->light_prepass, G->width, G->height);
+        resize_light_prepass_renderer(G->light_prepass, width, height);
     if(G->deferred)
-        resize_deferred_renderer(G->deferred, G->width, G->height);
+        resize_deferred_renderer(G->deferred, width, height);
+    _apply_render_scale(G);
 
     system_log("Graphics resized: %d, %d\n", width, height);
 }
 void render_graphics(Graphics* G)
 {
-    GLint device_framebuffer;
+    GLint   device_framebuffer;
+    Frustum frustum;
+    RenderQueue queue;
+    StreamStats stream;
+    int     query;
     ASSERT_GL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &device_framebuffer));
 
+    /* Everything streamed last frame, UI included, has been submitted */
+    next_stream_frame(G->stream);
+    stream = stream_stats(G->stream);
+    G->stats.stream_bytes = stream.bytes;
+    G->stats.stream_waits = stream.waits;
+    G->stats.stream_orphaning = stream.orphaning;
+
+    _update_render_scale(G);
+    G->stats.render_scale = G->render_scale;
+    G->stats.frame_time = G->frame_time;
+    query = G->frame_queries[0] && G->pending_queries < FRAME_QUERIES;
+    if(query)
+        ASSERT_GL(glBeginQuery(GL_TIME_ELAPSED_EXT, G->frame_queries[G->next_query]));
+
     ASSERT_GL(glViewport(0, 0, G->width, G->height));
+    G->stats.invalidated_attachments = G->major_version >= 3 ? 0 : -1;
+
+    /* Renderers only see what is inside the view frustum */
+    frustum = graphics_frustum(G);
+    _update_command_centers(G);
+    _sort_render_commands(G);
+    queue.stream = G->stream;
+    _batch_render_commands(G, &queue);
+    _cull_lights(G, &frustum);
+    _update_uniform_buffers(G, &queue);
+
     /* Render scene */
     if(G->major_version >= 3 && G->deferred && G->active_renderer == kDeferred) {
         render_deferred(G->deferred, G->framebuffer,
-                        G->proj_matrix, G->view_matrix,
-                        G->render_commands, G->num_render_commands,
+                        G->proj_matrix, G->view_matrix, &queue,
                         G->lights, G->num_lights);
+    } else if(G->major_version >= 3 && G->deferred && G->active_renderer == kTiledDeferred) {
+        render_tiled_deferred(G->deferred, G->framebuffer,
+                              G->proj_matrix, G->view_matrix, &queue,
+                              G->lights, G->num_lights, _light_binner(G));
+    } else if(G->major_version >= 3 && G->active_renderer == kClusteredForward) {
+        render_clustered_forward(G->forward, G->framebuffer,
+                                 G->proj_matrix, G->view_matrix, &queue,
+                                 G->lights, G->num_lights, _light_binner(G));
     } else if(G->active_renderer == kForward) {
         render_forward(G->forward, G->framebuffer,
-                       G->proj_matrix, G->view_matrix,
-                       G->render_commands, G->num_render_commands,
+                       G->proj_matrix, G->view_matrix, &queue,
                        G->lights, G->num_lights);
     } else if(G->active_renderer == kLightPrePass) {
         render_light_prepass(G->light_prepass, G->framebuffer,
-                             G->proj_matrix, G->view_matrix,
-                             G->render_commands, G->num_render_commands,
+                             G->proj_matrix, G->view_matrix, &queue,
                              G->lights, G->num_lights);
     } else {
         assert(!"No Active Renderer");
     }
     G->num_render_commands = 0;
+    G->num_culled_models = 0;
     G->num_lights = 0;
 
+    /* Renderers finish in the intermediate framebuffer, only its color is
+     * read from here on
+     */
+    {
+        GLenum depth_attachments[] = { GL_DEPTH_ATTACHMENT, GL_STENCIL_ATTACHMENT };
+        _invalidate_attachments(G, 2, depth_attachments);
+    }
+
+    G->stats.stencil_lights = G->stencil_lights ? 0 : -1;
+    if(G->stencil_lights && G->active_renderer == kDeferred && G->deferred)
+        G->stats.stencil_lights = deferred_stencil_lights(G->deferred);
+    else if(G->stencil_lights && G->active_renderer == kLightPrePass)
+        G->stats.stencil_lights = light_prepass_stencil_lights(G->light_prepass);
+    memset(G->stats.light_classes, 0, sizeof(G->stats.light_classes));
+    if(G->active_renderer == kDeferred && G->deferred)
+        memcpy(G->stats.light_classes, deferred_light_classes(G->deferred), sizeof(G->stats.light_classes));
+    else if(G->active_renderer == kLightPrePass)
+        memcpy(G->stats.light_classes, light_prepass_light_classes(G->light_prepass), sizeof(G->stats.light_classes));
+    G->stats.light_divisor = 0;
+    if(G->active_renderer == kDeferred && G->deferred)
+        G->stats.light_divisor = deferred_light_divisor(G->deferred);
+    else if(G->active_renderer == kLightPrePass)
+        G->stats.light_divisor = light_prepass_light_divisor(G->light_prepass);
+    G->stats.gbuffer_layout = -1;
+    G->stats.gbuffer_bytes_per_pixel = 0;
+    G->stats.gbuffer_traffic_kb = 0;
+    if((G->active_renderer == kDeferred || G->active_renderer == kTiledDeferred) && G->deferred) {
+        G->stats.gbuffer_layout = deferred_gbuffer_layout(G->deferred);
+        G->stats.gbuffer_bytes_per_pixel = gbuffer_bytes_per_pixel(deferred_gbuffer_layout(G->deferred));
+        G->stats.gbuffer_traffic_kb = deferred_gbuffer_traffic(G->deferred);
+    }
+
     /* Bind default framebuffer and render to the screen */
     ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, device_framebuffer));
     ASSERT_GL(glViewport(0, 0, G->real_width, G->real_height));
     ASSERT_GL(glClearColor(1.0f, 0.0f, 1.0f, 1.0f));
     ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
     ASSERT_GL(glUseProgram(G->fullscreen_program));
+    ASSERT_GL(glUniform2f(G->fullscreen_tex_coord_scale, G->width/(float)G->real_width, G->height/(float)G->real_height));
+    ASSERT_GL(glUniform2f(G->fullscreen_tex_coord_max, (G->width - 0.5f)/G->real_width, (G->height - 0.5f)/G->real_height));
     ASSERT_GL(glActiveTexture(GL_TEXTURE0));
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, G->color_texture));
     _draw_fullscreen_quad(G);
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, 0));
+
+    if(query) {
+        ASSERT_GL(glEndQuery(GL_TIME_ELAPSED_EXT));
+        G->next_query = (G->next_query + 1) % FRAME_QUERIES;
+        G->pending_queries++;
+    }
 }
 
 void set_view_matrix(Graphics* G, Mat4 view)
@@ -315,11 +843,17 @@ void add_render_command(Graphics* G, Model model)
     assert(index <= MAX_RENDER_COMMANDS);
     G->render_commands[index] = model;
 }
+void add_culled_models(Graphics* G, int count)
+{
+    G->num_culled_models += count;
+}
 void add_light(Graphics* G, Light light)
 {
-    int index = G->num_lights++;
-    assert(index <= MAX_LIGHTS);
-    G->lights[index] = light;
+    if(G->num_lights == G->max_lights) {
+        assert(!"Light cap reached, raise create_graphics' max_lights");
+        return;
+    }
+    G->lights[G->num_lights++] = light;
 }
 RendererType renderer_type(const Graphics* G)
 {
@@ -328,19 +862,142 @@ RendererType renderer_type(const Graphics* G)
 void cycle_renderers(Graphics* G)
 {
     G->active_renderer++;
-    if(G->active_renderer == kDeferred && (G->major_version < 3 || G->deferred == NULL))
+    while((G->active_renderer == kDeferred || G->active_renderer == kTiledDeferred) &&
+          (G->major_version < 3 || G->deferred == NULL))
+        G->active_renderer++;
+    if(G->active_renderer == kClusteredForward && G->major_version < 3)
         G->active_renderer++;
 
     if(G->active_renderer == MAX_RENDERERS)
         G->active_renderer = 0;
 }
+int graphics_max_lights(const Graphics* G)
+{
+    return G->max_lights;
+}
+int graphics_supports_float_targets(const Graphics* G)
+{
+    return G->float_targets;
+}
 void graphics_size(const Graphics* G, int* width, int* height)
 {
     *width = G->width;
     *height = G->height;
 }
-void toggle_static_size(Graphics* G)
+GraphicsStats graphics_stats(const Graphics* G)
+{
+    return G->stats;
+}
+StreamBuffer* graphics_stream_buffer(const Graphics* G)
+{
+    return G->stream;
+}
+Frustum graphics_frustum(const Graphics* G)
 {
-    G->static_size = !G->static_size;
-    resize_graphics(G, G->real_width, G->real_height);
+    return frustum_from_matrix(mat4_multiply(G->view_matrix, G->proj_matrix));
+}
+void toggle_stencil_lights(Graphics* G)
+{
+    G->stencil_lights = !G->stencil_lights;
+    set_light_prepass_stencil_lights(G->light_prepass, G->stencil_lights);
+    if(G->deferred)
+        set_deferred_stencil_lights(G->deferred, G->stencil_lights);
+}
+void cycle_gbuffer_layouts(Graphics* G)
+{
+    GBufferLayout layout;
+    if(G->deferred == NULL)
+        return;
+    layout = deferred_gbuffer_layout(G->deferred);
+    do {
+        layout = (GBufferLayout)((layout + 1) % MAX_GBUFFER_LAYOUTS);
+    } while(set_deferred_gbuffer_layout(G->deferred, layout) != 0);
+}
+void cycle_light_resolution(Graphics* G)
+{
+    /* Both renderers have low resolution lighting exactly when float
+     * targets are supported, so the divisor can't be refused
+     */
+    int divisor = G->light_divisor*2;
+    if(divisor > MAX_LIGHT_DIVISOR || !G->float_targets)
+        divisor = 1;
+    G->light_divisor = divisor;
+    set_light_prepass_light_divisor(G->light_prepass, divisor);
+    if(G->deferred)
+        set_deferred_light_divisor(G->deferred, divisor);
+}
+void set_frame_budget(Graphics* G, float seconds)
+{
+    G->frame_budget = seconds;
+    G->frame_time = seconds;
+    G->scale_error[0] = G->scale_error[1] = 0.0f;
+    G->scale_output = 1.0f;
+    if(G->render_scale != 1.0f) {
+        G->render_scale = 1.0f;
+        _apply_render_scale(G);
+    }
+}
+Vec3 light_view_center(Light light, Mat4 view_matrix)
+{
+    return vec3_from_vec4(mat4_mul_vector(vec4_from_vec3(light.position, 1.0f), view_matrix));
+}
+float light_screen_size(Vec3 center, float size, Mat4 proj_matrix)
+{
+    float   radius = size*LIGHT_VOLUME_RADIUS;
+    float   distance_sq = vec3_length_sq(center);
+    float   screen_size;
+
+    if(distance_sq <= radius*radius)
+        return 1.0f;
+    screen_size = 0.5f*radius*proj_matrix.r1.y/sqrtf(distance_sq - radius*radius);
+    return screen_size < 1.0f ? screen_size : 1.0f;
+}
+LightClass classify_light(Vec3 center, float size, Mat4 proj_matrix)
+{
+    float   near_plane = -proj_matrix.r3.z/proj_matrix.r2.z;
+    float   radius = size*LIGHT_VOLUME_RADIUS;
+    float   dx = fabsf(center.x) - near_plane/proj_matrix.r0.x;
+    float   dy = fabsf(center.y) - near_plane/proj_matrix.r1.y;
+    float   dz = center.z - near_plane;
+
+    if(vec3_length_sq(center) <= size*size)
+        return kLightInside;
+    /* The volume's faces may be clipped even with the light sphere clear,
+     * but only where the volume crosses the visible part of the near plane
+     */
+    dx = dx > 0.0f ? dx : 0.0f;
+    dy = dy > 0.0f ? dy : 0.0f;
+    if(dx*dx + dy*dy + dz*dz < radius*radius)
+        return kLightNearPlane;
+    return kLightOutside;
+}
+int light_bounds(Vec3 center, float size, Mat4 proj_matrix, int width, int height, LightBounds* bounds)
+{
+    float   near_plane = -proj_matrix.r3.z/proj_matrix.r2.z;
+    float   radius = size;
+    float   left, right, bottom, top;
+    int     x1, y1;
+
+    if(center.z + radius <= near_plane)
+        return 0;
+    bounds->light_class = classify_light(center, size, proj_matrix);
+    if(bounds->light_class == kLightInside) {
+        left = bottom = -1.0f;
+        right = top = 1.0f;
+    } else {
+        _project_sphere_axis(center.x, center.z, radius, near_plane, proj_matrix.r0.x, &left, &right);
+        _project_sphere_axis(center.y, center.z, radius, near_plane, proj_matrix.r1.y, &bottom, &top);
+    }
+    if(left < -1.0f) left = -1.0f;
+    if(right > 1.0f) right = 1.0f;
+    if(bottom < -1.0f) bottom = -1.0f;
+    if(top > 1.0f) top = 1.0f;
+
+    bounds->x = (int)floorf((left*0.5f + 0.5f)*width);
+    bounds->y = (int)floorf((bottom*0.5f + 0.5f)*height);
+    x1 = (int)ceilf((right*0.5f + 0.5f)*width);
+    y1 = (int)ceilf((top*0.5f + 0.5f)*height);
+    bounds->width = x1 - bounds->x;
+    bounds->height = y1 - bounds->y;
+    return bounds->width > 0 && bounds->height > 0;
 }
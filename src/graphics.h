@@ -19,24 +19,98 @@
 
 #include "scene.h"
 #include "graphics_types.h"
+#include "culling.h"
+#include "stream_buffer.h"
 
-#define MAX_LIGHTS 128
+/** Largest light cap `create_graphics` accepts */
+#define MAX_LIGHTS 16384
+/** Lights whose volume covers at least this much of the screen height are
+ *  drawn one at a time, scissored to their bounds and optionally stencil
+ *  masked. On smaller lights the extra draws cost more than they save.
+ */
+#define LARGE_LIGHT_SIZE 0.15f
+/** Distance from a light to the furthest point of its coarsest volume, in
+ *  light sizes
+ */
+#define LIGHT_VOLUME_RADIUS 1.2584610f
 
 typedef enum {
     kForward,
     kLightPrePass,
     kDeferred,
-    
+    kTiledDeferred,
+    kClusteredForward,
+
     MAX_RENDERERS
 } RendererType;
 
-Graphics* create_graphics(void);
+/** Where a light's volume is relative to the camera, choosing how the
+ *  deferred renderers draw it
+ */
+typedef enum {
+    kLightOutside,      /* In front of the near plane, a depth tested volume */
+    kLightInside,       /* Around the camera, a quad at the light's far side */
+    kLightNearPlane,    /* Cut by the near plane, a quad without depth test */
+
+    MAX_LIGHT_CLASSES
+} LightClass;
+
+/** G-buffer formats of the deferred shading renderers, see gbuffer.glsl */
+typedef enum {
+    kGBufferRG16F,      /* Spheremap normals in RG16F, 32-bit float depth */
+    kGBufferRGBA8,      /* Octahedral normals at 16 bits per axis in RGBA8 */
+    kGBufferRGB10A2,    /* Octahedral normals at 10 bits per axis */
+    kGBufferRG8,        /* Octahedral normals at 8 bits per axis */
+
+    MAX_GBUFFER_LAYOUTS
+} GBufferLayout;
+
+/** Counters from the last `render_graphics` */
+typedef struct GraphicsStats
+{
+    int     models_submitted;
+    int     models_visible;     /* Render commands, what the scene didn't cull */
+    int     lights_submitted;
+    int     lights_visible;
+    int     material_binds;     /* Material and mesh changes in the sorted draw order */
+    int     mesh_binds;
+    int     draw_calls;         /* Geometry draws, one per batch when instancing */
+    int     stream_bytes;       /* Dynamic data streamed in the previous frame */
+    int     stream_waits;       /* Times the CPU waited for a stream buffer region */
+    int     stream_orphaning;   /* Non-zero if streaming orphans instead of mapping */
+    int     stencil_lights;     /* Light volumes drawn with a stencil pass, -1 when disabled */
+    int     light_classes[MAX_LIGHT_CLASSES];   /* Lights drawn per LightClass by the volume renderers */
+    int     gbuffer_layout;     /* GBufferLayout, -1 when not deferred shading */
+    int     gbuffer_bytes_per_pixel;
+    int     gbuffer_traffic_kb; /* Estimated G-buffer writes and light pass reads */
+    int     invalidated_attachments;    /* Dead attachments discarded, -1 on ES2 */
+    float   render_scale;       /* Fraction of the screen resolution rendered at */
+    float   frame_time;         /* Smoothed seconds the resolution is scaled by */
+    int     light_divisor;      /* Light volumes lit at 1/light_divisor of the resolution, 0 when unused */
+} GraphicsStats;
+
+/** Screen space bounds of a light's sphere */
+typedef struct LightBounds
+{
+    int     x, y, width, height;    /* Scissor rect in pixels */
+    LightClass light_class;
+} LightBounds;
+
+/** @param max_lights Most lights added per frame, up to MAX_LIGHTS. Every
+ *      per-light buffer is sized for this many, `add_light` drops the rest.
+ */
+Graphics* create_graphics(int max_lights);
 void destroy_graphics(Graphics* G);
 
 void resize_graphics(Graphics* G, int width, int height);
 
 void set_view_matrix(Graphics* G, Mat4 view);
+/** Render commands are expected to be inside `graphics_frustum` already */
 void add_render_command(Graphics* G, Model model);
+/** @brief Counts models the caller culled before adding render commands,
+ *  for the stats
+ */
+void add_culled_models(Graphics* G, int count);
 void add_light(Graphics* G, Light light);
 
 void render_graphics(Graphics* G);
@@ -44,8 +118,51 @@ void render_graphics(Graphics* G);
 RendererType renderer_type(const Graphics* G);
 void cycle_renderers(Graphics* G);
 
+int graphics_max_lights(const Graphics* G);
+/** @return Non-zero if float color buffers can be rendered to, ES3 with
+ *  GL_EXT_color_buffer_float or GL_EXT_color_buffer_half_float only
+ */
+int graphics_supports_float_targets(const Graphics* G);
+/** @brief Gets the resolution rendered at, see `set_frame_budget` */
 void graphics_size(const Graphics* G, int* width, int* height);
 
-void toggle_static_size(Graphics* G);
+/** @brief Scales the resolution rendered at to keep the frame time, GPU time
+ *  when GL_EXT_disjoint_timer_query is available, within `seconds`. The
+ *  result is scaled up to the screen. 0 renders at full resolution.
+ */
+void set_frame_budget(Graphics* G, float seconds);
+/** @brief Toggles stencil masking of large light volumes in the deferred
+ *  shading and deferred lighting renderers
+ */
+void toggle_stencil_lights(Graphics* G);
+/** @brief Switches the deferred shading renderers to the next supported
+ *  GBufferLayout
+ */
+void cycle_gbuffer_layouts(Graphics* G);
+/** @brief Switches the light volume renderers between lighting at full,
+ *  half and quarter resolution, where supported
+ */
+void cycle_light_resolution(Graphics* G);
+
+GraphicsStats graphics_stats(const Graphics* G);
+/** @return The buffer all per-frame dynamic data is streamed through */
+StreamBuffer* graphics_stream_buffer(const Graphics* G);
+/** @return The frustum of the current view and projection matrices */
+Frustum graphics_frustum(const Graphics* G);
+
+/** @return The light's position in view space, the `center` of the
+ *  functions below
+ */
+Vec3 light_view_center(Light light, Mat4 view_matrix);
+/** @return The radius of the light's volume on screen as a fraction of the
+ *  screen height, 1 when the camera is inside it
+ */
+float light_screen_size(Vec3 center, float size, Mat4 proj_matrix);
+LightClass classify_light(Vec3 center, float size, Mat4 proj_matrix);
+/** @brief Finds a conservative rect around the pixels a light's sphere can
+ *  touch in a `width` by `height` target
+ *  @return 0 if none of the sphere is in front of the near plane and on screen
+ */
+int light_bounds(Vec3 center, float size, Mat4 proj_matrix, int width, int height, LightBounds* bounds);
 
 #endif /* include guard */
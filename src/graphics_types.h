@@ -29,4 +29,12 @@ typedef struct Light
 
 typedef struct Mesh Mesh;
 
+/** Axis aligned box and enclosing sphere, sharing a center */
+typedef struct Bounds
+{
+    Vec3    center;
+    Vec3    extents;    /* Half size of the box */
+    float   radius;
+} Bounds;
+
 #endif /* include guard */
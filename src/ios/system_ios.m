@@ -16,6 +16,7 @@
 #include "system.h"
 #import <Foundation/Foundation.h>
 #include <stdlib.h>
+#include <string.h>
 #include "assert.h"
 
 /* Defines
@@ -33,6 +34,11 @@
 
 /* Internal functions
  */
+static NSString* _cache_path(const char* name)
+{
+    NSArray* paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+    return [[paths objectAtIndex:0] stringByAppendingPathComponent:[NSString stringWithUTF8String:name]];
+}
 
 /* External functions
  */
@@ -63,6 +69,22 @@ void free_file_data(void* data)
 {
     free(data);
 }
+int load_cache_data(const char* name, void** data, size_t* data_size)
+{
+    NSData* contents = [NSData dataWithContentsOfFile:_cache_path(name)];
+    if(contents == nil)
+        return -1;
+
+    *data_size = [contents length];
+    *data = malloc(*data_size);
+    memcpy(*data, [contents bytes], *data_size);
+    return 0;
+}
+int save_cache_data(const char* name, const void* data, size_t data_size)
+{
+    NSData* contents = [NSData dataWithBytes:data length:data_size];
+    return [contents writeToFile:_cache_path(name) atomically:YES] ? 0 : -1;
+}
 void system_log(const char* format, ...)
 {
     va_list args;
@@ -0,0 +1,762 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "light_binning.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define BIN_SSE
+#elif defined(__aarch64__)
+    #include <arm_neon.h>
+    #define BIN_NEON    /* vdivq_f32 is AArch64 only */
+#endif
+
+/* Defines
+ */
+#define MAX_BIN_THREADS     8
+#define BIN_LIGHT_CHUNK     1024    /* Lights per work item when finding ranges, a multiple of 4 */
+#define BIN_BAND_ROWS       4       /* Tile rows per slice binned as one work item */
+#define BIN_PARALLEL_LIGHTS 512     /* Fewer lights are binned on the calling thread */
+#define MIN_VIEW_DEPTH      0.01f   /* Spheres reaching closer than this cover the whole screen */
+
+/* Types
+ */
+typedef void (BinPhase)(LightBinner* B, int item);
+
+/** A band of rows in one slice, its clusters are contiguous in the output */
+typedef struct BinItem
+{
+    int         slice;
+    int         first_row;
+    int         last_row;
+    int         first_light;    /* Into item_lights */
+    int         num_lights;
+    uint32_t*   indices;        /* Binned privately, then gathered at `base` */
+    int         num_indices;
+    int         max_indices;
+    int         base;
+} BinItem;
+
+struct LightBinner
+{
+    /* Worker pool, the calling thread makes up the last worker */
+    pthread_t       threads[MAX_BIN_THREADS];
+    int             num_threads;    /* Started so far */
+    int             max_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t  start;
+    pthread_cond_t  done;
+    int             generation;
+    int             busy;
+    int             quit;
+    BinPhase*       phase;
+    int             num_items;
+    int             next_item;
+
+    /* Input */
+    LightGrid       grid;
+    const float*    x;
+    const float*    y;
+    const float*    z;
+    const float*    radius;
+    int             count;
+    int             tiles_x;
+    int             tiles_y;
+
+    /* View space cluster bounds, the column bounds are padded for 4 wide loads */
+    float*          bounds;
+    int             max_bounds;
+    float*          slice_near;
+    float*          slice_far;
+    float*          column_min;
+    float*          column_max;
+    float*          row_min;
+    float*          row_max;
+    int             column_stride;
+
+    /* First and last column, row and slice of each light */
+    int32_t*        ranges;
+    int             max_lights;
+    int32_t*        range[6];
+
+    BinItem*        items;
+    int             max_items;
+    int             num_bands;
+    uint32_t*       item_lights;
+    int             max_item_lights;
+
+    /* Output */
+    uint32_t*       clusters;
+    int             max_clusters;
+    uint32_t*       indices;
+    int             max_indices;
+};
+
+/* Constants
+ */
+
+/* Variables
+ */
+
+/* Internal functions
+ */
+static int _num_cores(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cores < 1)
+        return 1;
+    if(cores > MAX_BIN_THREADS)
+        return MAX_BIN_THREADS;
+    return (int)cores;
+}
+static void _run_items(LightBinner* B)
+{
+    for(;;) {
+        int item = __sync_fetch_and_add(&B->next_item, 1);
+        if(item >= B->num_items)
+            break;
+        B->phase(B, item);
+    }
+}
+static void* _worker_thread(void* arg)
+{
+    LightBinner* B = (LightBinner*)arg;
+    int generation = 0;
+
+    pthread_mutex_lock(&B->mutex);
+    for(;;) {
+        while(B->generation == generation && !B->quit)
+            pthread_cond_wait(&B->start, &B->mutex);
+        if(B->quit)
+            break;
+        generation = B->generation;
+        pthread_mutex_unlock(&B->mutex);
+
+        _run_items(B);
+
+        pthread_mutex_lock(&B->mutex);
+        if(--B->busy == 0)
+            pthread_cond_signal(&B->done);
+    }
+    pthread_mutex_unlock(&B->mutex);
+    return NULL;
+}
+static void _start_threads(LightBinner* B)
+{
+    int ii;
+    for(ii=B->num_threads;ii<B->max_threads;++ii) {
+        if(pthread_create(&B->threads[ii], NULL, _worker_thread, B) != 0)
+            break;
+    }
+    B->num_threads = ii;
+    B->max_threads = ii;
+}
+/** Runs `phase` over every item, on the pool if `parallel` */
+static void _run_phase(LightBinner* B, BinPhase* phase, int num_items, int parallel)
+{
+    int ii;
+    if(parallel && B->num_threads < B->max_threads)
+        _start_threads(B);
+    if(!parallel || B->num_threads <= 1 || num_items <= 1) {
+        for(ii=0;ii<num_items;++ii)
+            phase(B, ii);
+        return;
+    }
+    pthread_mutex_lock(&B->mutex);
+    B->phase = phase;
+    B->num_items = num_items;
+    B->next_item = 0;
+    B->busy = B->num_threads - 1;
+    B->generation++;
+    pthread_cond_broadcast(&B->start);
+    pthread_mutex_unlock(&B->mutex);
+
+    _run_items(B);
+
+    pthread_mutex_lock(&B->mutex);
+    while(B->busy)
+        pthread_cond_wait(&B->done, &B->mutex);
+    pthread_mutex_unlock(&B->mutex);
+}
+static void* _reserve(void* data, int* capacity, int count, size_t size)
+{
+    if(count <= *capacity)
+        return data;
+    *capacity = count;
+    return realloc(data, count*size);
+}
+/** Finds the slice depths and the view space box of every cluster. Boxes
+ *  are closed, so a point on a slice boundary belongs to both slices
+ *  whichever way the shader rounds.
+ */
+static void _setup_grid(LightBinner* B, const LightGrid* grid)
+{
+    const int   slices = grid->depth_slices;
+    float       ratio = grid->far_plane/grid->near_plane;
+    float*      bounds;
+    int         ii, jj;
+
+    B->grid = *grid;
+    B->tiles_x = (grid->width + grid->tile_size - 1)/grid->tile_size;
+    B->tiles_y = (grid->height + grid->tile_size - 1)/grid->tile_size;
+    B->column_stride = B->tiles_x + 3;
+
+    B->bounds = (float*)_reserve(B->bounds, &B->max_bounds,
+                                 slices*(2 + B->column_stride*2 + B->tiles_y*2), sizeof(float));
+    bounds = B->bounds;
+    B->slice_near = bounds;     bounds += slices;
+    B->slice_far = bounds;      bounds += slices;
+    B->column_min = bounds;     bounds += slices*B->column_stride;
+    B->column_max = bounds;     bounds += slices*B->column_stride;
+    B->row_min = bounds;        bounds += slices*B->tiles_y;
+    B->row_max = bounds;
+
+    for(ii=0;ii<slices;++ii) {
+        float near_z = ii ? grid->near_plane*powf(ratio, ii/(float)slices) : grid->near_plane;
+        B->slice_near[ii] = near_z;
+        if(ii)
+            B->slice_far[ii-1] = near_z;
+    }
+    B->slice_far[slices-1] = grid->far_plane;
+
+    for(ii=0;ii<slices;++ii) {
+        float   near_z = B->slice_near[ii];
+        float   far_z = B->slice_far[ii];
+        float*  column_min = B->column_min + ii*B->column_stride;
+        float*  column_max = B->column_max + ii*B->column_stride;
+        float*  row_min = B->row_min + ii*B->tiles_y;
+        float*  row_max = B->row_max + ii*B->tiles_y;
+
+        for(jj=0;jj<B->tiles_x;++jj) {
+            float a = ((jj*grid->tile_size)/(float)grid->width*2.0f - 1.0f)/grid->proj_x;
+            float b = (((jj+1)*grid->tile_size)/(float)grid->width*2.0f - 1.0f)/grid->proj_x;
+            column_min[jj] = a < 0.0f ? a*far_z : a*near_z;
+            column_max[jj] = b < 0.0f ? b*near_z : b*far_z;
+        }
+        for(;jj<B->column_stride;++jj) {
+            column_min[jj] = 1e30f;
+            column_max[jj] = -1e30f;
+        }
+        for(jj=0;jj<B->tiles_y;++jj) {
+            float a = ((jj*grid->tile_size)/(float)grid->height*2.0f - 1.0f)/grid->proj_y;
+            float b = (((jj+1)*grid->tile_size)/(float)grid->height*2.0f - 1.0f)/grid->proj_y;
+            row_min[jj] = a < 0.0f ? a*far_z : a*near_z;
+            row_max[jj] = b < 0.0f ? b*near_z : b*far_z;
+        }
+    }
+}
+/** Screen tile and slice range of one light. The sphere's view space box
+ *  is projected through its near and far depth, which bounds the sphere
+ *  without handling each side of the camera separately. The SIMD versions
+ *  below must match this operation for operation.
+ */
+static void _light_range(LightBinner* B, int ii)
+{
+    const LightGrid* grid = &B->grid;
+    float   r = B->radius[ii];
+    float   near_z = B->z[ii] - r;
+    float   far_z = B->z[ii] + r;
+    float   inv_near = 1.0f/(near_z > MIN_VIEW_DEPTH ? near_z : MIN_VIEW_DEPTH);
+    float   inv_far = 1.0f/(far_z > MIN_VIEW_DEPTH ? far_z : MIN_VIEW_DEPTH);
+    float   lo_x = B->x[ii] - r, hi_x = B->x[ii] + r;
+    float   lo_y = B->y[ii] - r, hi_y = B->y[ii] + r;
+    float   min_x, max_x, min_y, max_y, t;
+    int     slice_min = 0, slice_max = 0;
+    int     jj;
+
+    min_x = lo_x*(grid->proj_x*inv_near);  t = lo_x*(grid->proj_x*inv_far);  min_x = t < min_x ? t : min_x;
+    max_x = hi_x*(grid->proj_x*inv_near);  t = hi_x*(grid->proj_x*inv_far);  max_x = t > max_x ? t : max_x;
+    min_y = lo_y*(grid->proj_y*inv_near);  t = lo_y*(grid->proj_y*inv_far);  min_y = t < min_y ? t : min_y;
+    max_y = hi_y*(grid->proj_y*inv_near);  t = hi_y*(grid->proj_y*inv_far);  max_y = t > max_y ? t : max_y;
+    for(jj=1;jj<grid->depth_slices;++jj) {
+        slice_min += near_z >= B->slice_near[jj];
+        slice_max += far_z >= B->slice_near[jj];
+    }
+
+    if(far_z <= MIN_VIEW_DEPTH || near_z > grid->far_plane ||
+       (near_z > MIN_VIEW_DEPTH && (max_x < -1.0f || min_x > 1.0f || max_y < -1.0f || min_y > 1.0f))) {
+        B->range[0][ii] = B->range[2][ii] = B->range[4][ii] = 1;
+        B->range[1][ii] = B->range[3][ii] = B->range[5][ii] = 0;
+        return;
+    }
+    if(near_z <= MIN_VIEW_DEPTH) {
+        B->range[0][ii] = 0;
+        B->range[1][ii] = B->tiles_x - 1;
+        B->range[2][ii] = 0;
+        B->range[3][ii] = B->tiles_y - 1;
+    } else {
+        float scale_x = grid->width/(float)grid->tile_size;
+        float scale_y = grid->height/(float)grid->tile_size;
+        float last_x = (float)(B->tiles_x - 1);
+        float last_y = (float)(B->tiles_y - 1);
+        float t0, t1;
+
+        t0 = (min_x*0.5f + 0.5f)*scale_x;   t0 = t0 > 0.0f ? t0 : 0.0f;  t0 = t0 < last_x ? t0 : last_x;
+        t1 = (max_x*0.5f + 0.5f)*scale_x;   t1 = t1 > 0.0f ? t1 : 0.0f;  t1 = t1 < last_x ? t1 : last_x;
+        B->range[0][ii] = (int32_t)t0;
+        B->range[1][ii] = (int32_t)t1;
+        t0 = (min_y*0.5f + 0.5f)*scale_y;   t0 = t0 > 0.0f ? t0 : 0.0f;  t0 = t0 < last_y ? t0 : last_y;
+        t1 = (max_y*0.5f + 0.5f)*scale_y;   t1 = t1 > 0.0f ? t1 : 0.0f;  t1 = t1 < last_y ? t1 : last_y;
+        B->range[2][ii] = (int32_t)t0;
+        B->range[3][ii] = (int32_t)t1;
+    }
+    B->range[4][ii] = slice_min;
+    B->range[5][ii] = slice_max;
+}
+static void _light_ranges_scalar(LightBinner* B, int item)
+{
+    int last = (item+1)*BIN_LIGHT_CHUNK;
+    int ii;
+    if(last > B->count)
+        last = B->count;
+    for(ii=item*BIN_LIGHT_CHUNK;ii<last;++ii)
+        _light_range(B, ii);
+}
+static void _light_ranges(LightBinner* B, int item)
+{
+    const LightGrid* grid = &B->grid;
+    int ii = item*BIN_LIGHT_CHUNK;
+    int last = ii + BIN_LIGHT_CHUNK;
+    int jj;
+
+    if(last > B->count)
+        last = B->count;
+#if defined(BIN_SSE)
+    {
+        const __m128    min_depth = _mm_set1_ps(MIN_VIEW_DEPTH);
+        const __m128    far_plane = _mm_set1_ps(grid->far_plane);
+        const __m128    proj_x = _mm_set1_ps(grid->proj_x);
+        const __m128    proj_y = _mm_set1_ps(grid->proj_y);
+        const __m128    scale_x = _mm_set1_ps(grid->width/(float)grid->tile_size);
+        const __m128    scale_y = _mm_set1_ps(grid->height/(float)grid->tile_size);
+        const __m128    last_x = _mm_set1_ps((float)(B->tiles_x - 1));
+        const __m128    last_y = _mm_set1_ps((float)(B->tiles_y - 1));
+        const __m128    one = _mm_set1_ps(1.0f);
+        const __m128    minus_one = _mm_set1_ps(-1.0f);
+        const __m128    half = _mm_set1_ps(0.5f);
+        const __m128    zero = _mm_setzero_ps();
+        const __m128i   one_i = _mm_set1_epi32(1);
+
+        for(;ii+4<=last;ii+=4) {
+            __m128  r = _mm_loadu_ps(B->radius+ii);
+            __m128  cx = _mm_loadu_ps(B->x+ii);
+            __m128  cy = _mm_loadu_ps(B->y+ii);
+            __m128  cz = _mm_loadu_ps(B->z+ii);
+            __m128  near_z = _mm_sub_ps(cz, r);
+            __m128  far_z = _mm_add_ps(cz, r);
+            __m128  inv_near = _mm_div_ps(one, _mm_max_ps(near_z, min_depth));
+            __m128  inv_far = _mm_div_ps(one, _mm_max_ps(far_z, min_depth));
+            __m128  lo_x = _mm_sub_ps(cx, r), hi_x = _mm_add_ps(cx, r);
+            __m128  lo_y = _mm_sub_ps(cy, r), hi_y = _mm_add_ps(cy, r);
+            __m128  min_x, max_x, min_y, max_y, full, empty;
+            __m128i x0, x1, y0, y1, z0, z1, full_i, empty_i;
+
+            min_x = _mm_min_ps(_mm_mul_ps(lo_x, _mm_mul_ps(proj_x, inv_far)), _mm_mul_ps(lo_x, _mm_mul_ps(proj_x, inv_near)));
+            max_x = _mm_max_ps(_mm_mul_ps(hi_x, _mm_mul_ps(proj_x, inv_far)), _mm_mul_ps(hi_x, _mm_mul_ps(proj_x, inv_near)));
+            min_y = _mm_min_ps(_mm_mul_ps(lo_y, _mm_mul_ps(proj_y, inv_far)), _mm_mul_ps(lo_y, _mm_mul_ps(proj_y, inv_near)));
+            max_y = _mm_max_ps(_mm_mul_ps(hi_y, _mm_mul_ps(proj_y, inv_far)), _mm_mul_ps(hi_y, _mm_mul_ps(proj_y, inv_near)));
+
+            z0 = z1 = _mm_setzero_si128();
+            for(jj=1;jj<grid->depth_slices;++jj) {
+                __m128 bound = _mm_set1_ps(B->slice_near[jj]);
+                z0 = _mm_sub_epi32(z0, _mm_castps_si128(_mm_cmpge_ps(near_z, bound)));
+                z1 = _mm_sub_epi32(z1, _mm_castps_si128(_mm_cmpge_ps(far_z, bound)));
+            }
+
+            x0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(min_x, half), half), scale_x), zero), last_x));
+            x1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(max_x, half), half), scale_x), zero), last_x));
+            y0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(min_y, half), half), scale_y), zero), last_y));
+            y1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(max_y, half), half), scale_y), zero), last_y));
+
+            /* Spheres around the camera cover the screen, the rest may be off it */
+            full = _mm_cmple_ps(near_z, min_depth);
+            empty = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(max_x, minus_one), _mm_cmpgt_ps(min_x, one)),
+                              _mm_or_ps(_mm_cmplt_ps(max_y, minus_one), _mm_cmpgt_ps(min_y, one)));
+            empty = _mm_or_ps(_mm_andnot_ps(full, empty),
+                              _mm_or_ps(_mm_cmple_ps(far_z, min_depth), _mm_cmpgt_ps(near_z, far_plane)));
+            full_i = _mm_castps_si128(full);
+            empty_i = _mm_castps_si128(empty);
+
+            x0 = _mm_andnot_si128(full_i, x0);
+            x1 = _mm_or_si128(_mm_and_si128(full_i, _mm_set1_epi32(B->tiles_x - 1)), _mm_andnot_si128(full_i, x1));
+            y0 = _mm_andnot_si128(full_i, y0);
+            y1 = _mm_or_si128(_mm_and_si128(full_i, _mm_set1_epi32(B->tiles_y - 1)), _mm_andnot_si128(full_i, y1));
+
+            _mm_storeu_si128((__m128i*)(B->range[0]+ii), _mm_or_si128(_mm_and_si128(empty_i, one_i), _mm_andnot_si128(empty_i, x0)));
+            _mm_storeu_si128((__m128i*)(B->range[1]+ii), _mm_andnot_si128(empty_i, x1));
+            _mm_storeu_si128((__m128i*)(B->range[2]+ii), _mm_or_si128(_mm_and_si128(empty_i, one_i), _mm_andnot_si128(empty_i, y0)));
+            _mm_storeu_si128((__m128i*)(B->range[3]+ii), _mm_andnot_si128(empty_i, y1));
+            _mm_storeu_si128((__m128i*)(B->range[4]+ii), _mm_or_si128(_mm_and_si128(empty_i, one_i), _mm_andnot_si128(empty_i, z0)));
+            _mm_storeu_si128((__m128i*)(B->range[5]+ii), _mm_andnot_si128(empty_i, z1));
+        }
+    }
+#elif defined(BIN_NEON)
+    {
+        const float32x4_t   min_depth = vdupq_n_f32(MIN_VIEW_DEPTH);
+        const float32x4_t   far_plane = vdupq_n_f32(grid->far_plane);
+        const float32x4_t   proj_x = vdupq_n_f32(grid->proj_x);
+        const float32x4_t   proj_y = vdupq_n_f32(grid->proj_y);
+        const float32x4_t   scale_x = vdupq_n_f32(grid->width/(float)grid->tile_size);
+        const float32x4_t   scale_y = vdupq_n_f32(grid->height/(float)grid->tile_size);
+        const float32x4_t   last_x = vdupq_n_f32((float)(B->tiles_x - 1));
+        const float32x4_t   last_y = vdupq_n_f32((float)(B->tiles_y - 1));
+        const float32x4_t   one = vdupq_n_f32(1.0f);
+        const float32x4_t   minus_one = vdupq_n_f32(-1.0f);
+        const float32x4_t   half = vdupq_n_f32(0.5f);
+        const float32x4_t   zero = vdupq_n_f32(0.0f);
+        const int32x4_t     one_i = vdupq_n_s32(1);
+
+        for(;ii+4<=last;ii+=4) {
+            float32x4_t r = vld1q_f32(B->radius+ii);
+            float32x4_t cx = vld1q_f32(B->x+ii);
+            float32x4_t cy = vld1q_f32(B->y+ii);
+            float32x4_t cz = vld1q_f32(B->z+ii);
+            float32x4_t near_z = vsubq_f32(cz, r);
+            float32x4_t far_z = vaddq_f32(cz, r);
+            float32x4_t inv_near = vdivq_f32(one, vmaxq_f32(near_z, min_depth));
+            float32x4_t inv_far = vdivq_f32(one, vmaxq_f32(far_z, min_depth));
+            float32x4_t lo_x = vsubq_f32(cx, r), hi_x = vaddq_f32(cx, r);
+            float32x4_t lo_y = vsubq_f32(cy, r), hi_y = vaddq_f32(cy, r);
+            float32x4_t min_x, max_x, min_y, max_y;
+            uint32x4_t  full, empty;
+            int32x4_t   x0, x1, y0, y1, z0, z1;
+
+            min_x = vminq_f32(vmulq_f32(lo_x, vmulq_f32(proj_x, inv_far)), vmulq_f32(lo_x, vmulq_f32(proj_x, inv_near)));
+            max_x = vmaxq_f32(vmulq_f32(hi_x, vmulq_f32(proj_x, inv_far)), vmulq_f32(hi_x, vmulq_f32(proj_x, inv_near)));
+            min_y = vminq_f32(vmulq_f32(lo_y, vmulq_f32(proj_y, inv_far)), vmulq_f32(lo_y, vmulq_f32(proj_y, inv_near)));
+            max_y = vmaxq_f32(vmulq_f32(hi_y, vmulq_f32(proj_y, inv_far)), vmulq_f32(hi_y, vmulq_f32(proj_y, inv_near)));
+
+            z0 = z1 = vdupq_n_s32(0);
+            for(jj=1;jj<grid->depth_slices;++jj) {
+                float32x4_t bound = vdupq_n_f32(B->slice_near[jj]);
+                z0 = vsubq_s32(z0, vreinterpretq_s32_u32(vcgeq_f32(near_z, bound)));
+                z1 = vsubq_s32(z1, vreinterpretq_s32_u32(vcgeq_f32(far_z, bound)));
+            }
+
+            x0 = vcvtq_s32_f32(vminq_f32(vmaxq_f32(vmulq_f32(vaddq_f32(vmulq_f32(min_x, half), half), scale_x), zero), last_x));
+            x1 = vcvtq_s32_f32(vminq_f32(vmaxq_f32(vmulq_f32(vaddq_f32(vmulq_f32(max_x, half), half), scale_x), zero), last_x));
+            y0 = vcvtq_s32_f32(vminq_f32(vmaxq_f32(vmulq_f32(vaddq_f32(vmulq_f32(min_y, half), half), scale_y), zero), last_y));
+            y1 = vcvtq_s32_f32(vminq_f32(vmaxq_f32(vmulq_f32(vaddq_f32(vmulq_f32(max_y, half), half), scale_y), zero), last_y));
+
+            full = vcleq_f32(near_z, min_depth);
+            empty = vorrq_u32(vorrq_u32(vcltq_f32(max_x, minus_one), vcgtq_f32(min_x, one)),
+                              vorrq_u32(vcltq_f32(max_y, minus_one), vcgtq_f32(min_y, one)));
+            empty = vorrq_u32(vbicq_u32(empty, full),
+                              vorrq_u32(vcleq_f32(far_z, min_depth), vcgtq_f32(near_z, far_plane)));
+
+            x0 = vbslq_s32(full, vdupq_n_s32(0), x0);
+            x1 = vbslq_s32(full, vdupq_n_s32(B->tiles_x - 1), x1);
+            y0 = vbslq_s32(full, vdupq_n_s32(0), y0);
+            y1 = vbslq_s32(full, vdupq_n_s32(B->tiles_y - 1), y1);
+
+            vst1q_s32(B->range[0]+ii, vbslq_s32(empty, one_i, x0));
+            vst1q_s32(B->range[1]+ii, vbslq_s32(empty, vdupq_n_s32(0), x1));
+            vst1q_s32(B->range[2]+ii, vbslq_s32(empty, one_i, y0));
+            vst1q_s32(B->range[3]+ii, vbslq_s32(empty, vdupq_n_s32(0), y1));
+            vst1q_s32(B->range[4]+ii, vbslq_s32(empty, one_i, z0));
+            vst1q_s32(B->range[5]+ii, vbslq_s32(empty, vdupq_n_s32(0), z1));
+        }
+    }
+#endif
+    /* Remainder, or everything without SIMD */
+    for(;ii<last;++ii)
+        _light_range(B, ii);
+}
+/** Lists the lights overlapping each item, in light order */
+static void _assign_items(LightBinner* B)
+{
+    int         num_items;
+    int         total = 0;
+    int         pass, ii, z, band;
+
+    B->num_bands = (B->tiles_y + BIN_BAND_ROWS - 1)/BIN_BAND_ROWS;
+    num_items = B->grid.depth_slices*B->num_bands;
+    if(num_items > B->max_items) {
+        B->items = (BinItem*)realloc(B->items, num_items*sizeof(BinItem));
+        memset(B->items + B->max_items, 0, (num_items - B->max_items)*sizeof(BinItem));
+        B->max_items = num_items;
+    }
+    for(ii=0;ii<num_items;++ii) {
+        BinItem* I = &B->items[ii];
+        I->slice = ii/B->num_bands;
+        I->first_row = (ii%B->num_bands)*BIN_BAND_ROWS;
+        I->last_row = I->first_row + BIN_BAND_ROWS - 1;
+        if(I->last_row >= B->tiles_y)
+            I->last_row = B->tiles_y - 1;
+        I->num_lights = 0;
+    }
+
+    /* Count, offset, then fill */
+    for(pass=0;pass<2;++pass) {
+        for(ii=0;ii<B->count;++ii) {
+            if(B->range[0][ii] > B->range[1][ii])
+                continue;
+            for(z=B->range[4][ii];z<=B->range[5][ii];++z) {
+                for(band=B->range[2][ii]/BIN_BAND_ROWS;band<=B->range[3][ii]/BIN_BAND_ROWS;++band) {
+                    BinItem* I = &B->items[z*B->num_bands + band];
+                    if(pass)
+                        B->item_lights[I->first_light + I->num_lights] = (uint32_t)ii;
+                    I->num_lights++;
+                }
+            }
+        }
+        if(pass)
+            break;
+        total = 0;
+        for(ii=0;ii<num_items;++ii) {
+            B->items[ii].first_light = total;
+            total += B->items[ii].num_lights;
+            B->items[ii].num_lights = 0;
+        }
+        B->item_lights = (uint32_t*)_reserve(B->item_lights, &B->max_item_lights, total, sizeof(uint32_t));
+    }
+}
+static void _add_light(BinItem* I, uint32_t* tile, uint32_t light, int fill)
+{
+    if(fill)
+        I->indices[tile[0] + tile[1]] = light;
+    tile[1]++;
+}
+/** Tests the item's lights against each of its clusters, counting on the
+ *  first pass and writing indices on the second
+ */
+static void _bin_item(LightBinner* B, int item, int simd)
+{
+    BinItem*    I = &B->items[item];
+    const int   z = I->slice;
+    const float slice_near = B->slice_near[z];
+    const float slice_far = B->slice_far[z];
+    const float* column_min = B->column_min + z*B->column_stride;
+    const float* column_max = B->column_max + z*B->column_stride;
+    uint32_t*   clusters = B->clusters + (z*B->tiles_y + I->first_row)*B->tiles_x*2;
+    int         num_tiles = (I->last_row - I->first_row + 1)*B->tiles_x;
+    uint32_t    total = 0;
+    int         fill, ii, x, y;
+
+    memset(clusters, 0, num_tiles*2*sizeof(uint32_t));
+    for(fill=0;fill<2;++fill) {
+        if(fill) {
+            for(ii=0;ii<num_tiles;++ii) {
+                clusters[ii*2] = total;
+                total += clusters[ii*2+1];
+                clusters[ii*2+1] = 0;
+            }
+            I->indices = (uint32_t*)_reserve(I->indices, &I->max_indices, (int)total, sizeof(uint32_t));
+            I->num_indices = (int)total;
+        }
+        for(ii=0;ii<I->num_lights;++ii) {
+            uint32_t    light = B->item_lights[I->first_light + ii];
+            float       cx = B->x[light];
+            float       cy = B->y[light];
+            float       cz = B->z[light];
+            float       r2 = B->radius[light]*B->radius[light];
+            int         x0 = B->range[0][light];
+            int         x1 = B->range[1][light];
+            int         y0 = B->range[2][light] > I->first_row ? B->range[2][light] : I->first_row;
+            int         y1 = B->range[3][light] < I->last_row ? B->range[3][light] : I->last_row;
+            float       dz = slice_near - cz, t = cz - slice_far;
+            float       dz2;
+
+            dz = dz > t ? dz : t;
+            dz = dz > 0.0f ? dz : 0.0f;
+            dz2 = dz*dz;
+            if(dz2 > r2)
+                continue;
+            for(y=y0;y<=y1;++y) {
+                uint32_t*   row = clusters + (y - I->first_row)*B->tiles_x*2;
+                float       dy = B->row_min[z*B->tiles_y + y] - cy;
+                float       dyz2;
+                t = cy - B->row_max[z*B->tiles_y + y];
+                dy = dy > t ? dy : t;
+                dy = dy > 0.0f ? dy : 0.0f;
+                dyz2 = dy*dy + dz2;
+                if(dyz2 > r2)
+                    continue;
+                x = x0;
+                if(simd) {
+#if defined(BIN_SSE)
+                    const __m128 vcx = _mm_set1_ps(cx);
+                    const __m128 vr2 = _mm_set1_ps(r2);
+                    const __m128 vdyz2 = _mm_set1_ps(dyz2);
+                    const __m128 zero = _mm_setzero_ps();
+                    for(;x<=x1;x+=4) {
+                        __m128  dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(column_min+x), vcx),
+                                                           _mm_sub_ps(vcx, _mm_loadu_ps(column_max+x))), zero);
+                        int     mask = _mm_movemask_ps(_mm_cmple_ps(_mm_add_ps(_mm_mul_ps(dx, dx), vdyz2), vr2));
+                        int     lane;
+                        for(lane=0;lane<4 && x+lane<=x1;++lane) {
+                            if(mask & (1 << lane))
+                                _add_light(I, row + (x+lane)*2, light, fill);
+                        }
+                    }
+#elif defined(BIN_NEON)
+                    const float32x4_t vcx = vdupq_n_f32(cx);
+                    const float32x4_t vr2 = vdupq_n_f32(r2);
+                    const float32x4_t vdyz2 = vdupq_n_f32(dyz2);
+                    const float32x4_t zero = vdupq_n_f32(0.0f);
+                    for(;x<=x1;x+=4) {
+                        float32x4_t dx = vmaxq_f32(vmaxq_f32(vsubq_f32(vld1q_f32(column_min+x), vcx),
+                                                             vsubq_f32(vcx, vld1q_f32(column_max+x))), zero);
+                        uint32x4_t  mask = vcleq_f32(vaddq_f32(vmulq_f32(dx, dx), vdyz2), vr2);
+                        uint32_t    lanes[4];
+                        int         lane;
+                        vst1q_u32(lanes, mask);
+                        for(lane=0;lane<4 && x+lane<=x1;++lane) {
+                            if(lanes[lane])
+                                _add_light(I, row + (x+lane)*2, light, fill);
+                        }
+                    }
+#endif
+                }
+                /* Remainder, or everything without SIMD */
+                for(;x<=x1;++x) {
+                    float dx = column_min[x] - cx;
+                    t = cx - column_max[x];
+                    dx = dx > t ? dx : t;
+                    dx = dx > 0.0f ? dx : 0.0f;
+                    if(dx*dx + dyz2 <= r2)
+                        _add_light(I, row + x*2, light, fill);
+                }
+            }
+        }
+    }
+}
+static void _bin_item_simd(LightBinner* B, int item)
+{
+    _bin_item(B, item, 1);
+}
+static void _bin_item_scalar(LightBinner* B, int item)
+{
+    _bin_item(B, item, 0);
+}
+/** Moves an item's indices into the shared list */
+static void _gather_item(LightBinner* B, int item)
+{
+    const BinItem* I = &B->items[item];
+    uint32_t*   clusters = B->clusters + (I->slice*B->tiles_y + I->first_row)*B->tiles_x*2;
+    int         num_tiles = (I->last_row - I->first_row + 1)*B->tiles_x;
+    int         ii;
+
+    for(ii=0;ii<num_tiles;++ii)
+        clusters[ii*2] += (uint32_t)I->base;
+    if(I->num_indices)
+        memcpy(B->indices + I->base, I->indices, I->num_indices*sizeof(uint32_t));
+}
+static LightBins _bin_lights(LightBinner* B, const LightGrid* grid,
+                             const float* x, const float* y, const float* z,
+                             const float* radius, int count, int simd)
+{
+    int         parallel = simd && count >= BIN_PARALLEL_LIGHTS;
+    int         num_chunks = (count + BIN_LIGHT_CHUNK - 1)/BIN_LIGHT_CHUNK;
+    int         num_clusters, num_items;
+    int         total = 0;
+    int         ii;
+    LightBins   bins;
+
+    _setup_grid(B, grid);
+    B->x = x;
+    B->y = y;
+    B->z = z;
+    B->radius = radius;
+    B->count = count;
+    if(count > B->max_lights) {
+        B->max_lights = count;
+        B->ranges = (int32_t*)realloc(B->ranges, count*6*sizeof(int32_t));
+        for(ii=0;ii<6;++ii)
+            B->range[ii] = B->ranges + ii*count;
+    }
+    num_clusters = B->tiles_x*B->tiles_y*grid->depth_slices;
+    B->clusters = (uint32_t*)_reserve(B->clusters, &B->max_clusters, num_clusters*2, sizeof(uint32_t));
+
+    _run_phase(B, simd ? _light_ranges : _light_ranges_scalar, num_chunks, parallel);
+    _assign_items(B);
+    num_items = grid->depth_slices*B->num_bands;
+    _run_phase(B, simd ? _bin_item_simd : _bin_item_scalar, num_items, parallel);
+
+    for(ii=0;ii<num_items;++ii) {
+        B->items[ii].base = total;
+        total += B->items[ii].num_indices;
+    }
+    B->indices = (uint32_t*)_reserve(B->indices, &B->max_indices, total, sizeof(uint32_t));
+    _run_phase(B, _gather_item, num_items, parallel);
+
+    bins.clusters = B->clusters;
+    bins.indices = B->indices;
+    bins.tiles_x = B->tiles_x;
+    bins.tiles_y = B->tiles_y;
+    bins.num_clusters = num_clusters;
+    bins.num_indices = total;
+    return bins;
+}
+
+/* External functions
+ */
+LightBinner* create_light_binner(int num_threads)
+{
+    LightBinner* B = (LightBinner*)calloc(1, sizeof(LightBinner));
+
+    if(num_threads <= 0)
+        num_threads = _num_cores();
+    if(num_threads > MAX_BIN_THREADS)
+        num_threads = MAX_BIN_THREADS;
+    pthread_mutex_init(&B->mutex, NULL);
+    pthread_cond_init(&B->start, NULL);
+    pthread_cond_init(&B->done, NULL);
+    B->num_threads = 1; /* The caller */
+    B->max_threads = num_threads;
+    return B;
+}
+void destroy_light_binner(LightBinner* B)
+{
+    int ii;
+
+    pthread_mutex_lock(&B->mutex);
+    B->quit = 1;
+    pthread_cond_broadcast(&B->start);
+    pthread_mutex_unlock(&B->mutex);
+    for(ii=1;ii<B->num_threads;++ii)
+        pthread_join(B->threads[ii], NULL);
+    pthread_cond_destroy(&B->done);
+    pthread_cond_destroy(&B->start);
+    pthread_mutex_destroy(&B->mutex);
+
+    for(ii=0;ii<B->max_items;++ii)
+        free(B->items[ii].indices);
+    free(B->items);
+    free(B->item_lights);
+    free(B->bounds);
+    free(B->ranges);
+    free(B->clusters);
+    free(B->indices);
+    free(B);
+}
+LightBins bin_lights(LightBinner* B, const LightGrid* grid,
+                     const float* x, const float* y, const float* z,
+                     const float* radius, int count)
+{
+    return _bin_lights(B, grid, x, y, z, radius, count, 1);
+}
+LightBins bin_lights_scalar(LightBinner* B, const LightGrid* grid,
+                            const float* x, const float* y, const float* z,
+                            const float* radius, int count)
+{
+    return _bin_lights(B, grid, x, y, z, radius, count, 0);
+}
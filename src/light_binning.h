@@ -0,0 +1,84 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __light_binning_h__
+#define __light_binning_h__
+
+#include <stdint.h>
+
+/** Lights are binned into a grid of screen tiles by exponentially spaced
+ *  view depth slices. Each light's screen and depth range is found four
+ *  lights at a time, then every cluster in the range is tested against the
+ *  light's sphere using the cluster's view space bounding box. The grid is
+ *  split into bands of rows per slice which are binned in parallel on a
+ *  small worker pool. Nothing here touches GL, so the kernel can be
+ *  benchmarked on its own.
+ */
+typedef struct LightBinner LightBinner;
+
+/** Below this many lights `bin_lights_scalar` is faster than `bin_lights`,
+ *  the SIMD setup and the worker hand off don't pay for themselves. See
+ *  tools/light_bin_benchmark.c.
+ */
+#define BIN_SIMD_MIN_LIGHTS 2048
+
+typedef struct LightGrid
+{
+    int     width;          /* Pixels */
+    int     height;
+    int     tile_size;      /* Pixels per tile side */
+    int     depth_slices;
+    float   proj_x;         /* Projection scale, proj.r0.x */
+    float   proj_y;         /* proj.r1.y */
+    float   near_plane;
+    float   far_plane;
+} LightGrid;
+
+/** Compact output, valid until the next `bin_lights` call. Clusters are
+ *  ordered by slice, then row, then column. Each cluster's light indices
+ *  are sorted.
+ */
+typedef struct LightBins
+{
+    const uint32_t* clusters;   /* First index and light count per cluster */
+    const uint32_t* indices;
+    int             tiles_x;
+    int             tiles_y;
+    int             num_clusters;
+    int             num_indices;
+} LightBins;
+
+/** @param num_threads Threads binning in parallel, including the caller. 0
+ *      uses one per core. The workers are started by the first parallel
+ *      `bin_lights`.
+ */
+LightBinner* create_light_binner(int num_threads);
+void destroy_light_binner(LightBinner* B);
+
+/** @brief Bins view space spheres, given as arrays of centers and radii,
+ *  using SSE or NEON and the worker pool
+ */
+LightBins bin_lights(LightBinner* B, const LightGrid* grid,
+                     const float* x, const float* y, const float* z,
+                     const float* radius, int count);
+/** @brief Single threaded scalar version of `bin_lights`, kept for
+ *  validation and benchmarks
+ */
+LightBins bin_lights_scalar(LightBinner* B, const LightGrid* grid,
+                            const float* x, const float* y, const float* z,
+                            const float* radius, int count);
+
+#endif /* include guard */
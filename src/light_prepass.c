@@ -16,15 +16,18 @@
 
 #include "light_prepass.h"
 #include <stdlib.h>
+#include <string.h>
 #include "gl_include.h"
 #include "mesh.h"
 #include "scene.h"
 #include "graphics.h"
 #include "program.h"
+#include "uniforms.h"
+#include "light_volume.h"
+#include "low_res_lighting.h"
 
 /* Defines
  */
-#define GetUniformLocation(R, pass, program, uniform) R->pass.uniform = glGetUniformLocation(R->pass.program, #uniform)
 
 /* Types
  */
@@ -32,119 +35,96 @@ struct LightPrepassRenderer
 {
     int width;
     int height;
+    int target_width;   /* Size of the targets, rendered to from the bottom left */
+    int target_height;
     int major_version;
     int minor_version;
 
-    GLuint  cube_vertex_buffer;
-    GLuint  cube_index_buffer;
+    LightVolume*    volume;
 
     GLuint  gbuffer_framebuffer;
     GLuint  gbuffer_color_texture;
     GLuint  gbuffer_depth_texture;
     GLuint  lighting_buffer;
 
-    /* Pass 1 */
     struct {
-        GLuint  program;
-
-        GLuint  u_World;
-        GLuint  u_View;
-        GLuint  u_Projection;
-
-        GLuint  u_SpecularPower;
-
-        GLuint  s_Normal;
-    } pass1;
-
-    /* Pass 2 */
-    struct {
-        GLuint  program;
-
-        GLuint  u_World;
-        GLuint  u_View;
-        GLuint  u_Projection;
-
-        GLuint  u_InvProj;
-        GLuint  u_Viewport;
-
-        GLuint  u_LightColor;
-        GLuint  u_LightPosition;
-        GLuint  u_LightSize;
-
-        GLuint  s_GBuffer;
-        GLuint  s_Depth;
-    } pass2;
-
-    /* Pass 3 */
-    struct {
-        GLuint  program;
-
-        GLuint  u_World;
-        GLuint  u_View;
-        GLuint  u_Projection;
-
-        GLuint  u_Viewport;
-
-        GLuint  s_GBuffer;
-        GLuint  s_Albedo;
-    } pass3;
+        GLuint          program;
+        UniformTable*   uniforms;
+    } pass1[2], pass2, fullscreen, pass3, stencil, /* pass1: [normal map], stencil: ES3 only */
+      low_res_pass2, low_res_fullscreen, low_res_pass3, downsample; /* With `low_res` only */
+
+    LowResLighting* low_res;    /* ES3 with float render targets only */
+    int     light_divisor;      /* Pass 2 lights at 1/light_divisor of the resolution */
+
+    int     programs_ready;
+    int     stencil_lights;         /* Non-zero to mask large light volumes with the stencil, ES3 only */
+    int     num_stencil_lights;     /* Drawn with a stencil pass last frame */
+    int     num_light_classes[MAX_LIGHT_CLASSES];   /* Drawn per LightClass last frame */
 };
 
 /* Constants
  */
- /* cube vertices
- *
- *               5---------4
- *              /|        /|
- *             / |       / |
- *            1---------0  |
- *            |  |      |  |
- *            |  6------|--7
- *            | /       | /
- *            |/        |/
- *            2---------3
- *
- *   front: { 0, 2, 1 }, { 0, 3, 2 }
- *   right: { 4, 3, 0 }, { 4, 7, 3 }
- *     top: { 4, 1, 5 }, { 4, 0, 1 }
- *    left: { 1, 6, 5 }, { 1, 2, 6 }
- *  bottom: { 3, 6, 2 }, { 3, 7, 6 }
- *    back: { 5, 7, 4 }, { 5, 6, 7 }
- *
- */
-static const Vec3 kCubeVertices[] =
-{
-    {  1.0f,  1.0f, -1.0f }, /* 0 */
-    { -1.0f,  1.0f, -1.0f }, /* 1 */
-    { -1.0f, -1.0f, -1.0f }, /* 2 */
-    {  1.0f, -1.0f, -1.0f }, /* 3 */
-    {  1.0f,  1.0f,  1.0f }, /* 4 */
-    { -1.0f,  1.0f,  1.0f }, /* 5 */
-    { -1.0f, -1.0f,  1.0f }, /* 6 */
-    {  1.0f, -1.0f,  1.0f }, /* 7 */
-};
-
-static const uint16_t kCubeIndices[] =
-{
-    0, 2, 1,   0, 3, 2,  /* front */
-    4, 3, 0,   4, 7, 3,  /* right */
-    4, 1, 5,   4, 0, 1,  /* top */
-    1, 6, 5,   1, 2, 6,  /* left */
-    3, 6, 2,   3, 7, 6,  /* bottom */
-    5, 7, 4,   5, 6, 7,  /* back */
-};
-
 /* Variables
  */
 
 /* Internal functions
  */
-static void _draw_point_light(LightPrepassRenderer* R)
+static GLenum _depth_attachment(const LightPrepassRenderer* R)
 {
-    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, R->cube_vertex_buffer));
-    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, R->cube_index_buffer));
-    ASSERT_GL(glVertexAttribPointer(kPositionSlot, 3, GL_FLOAT, GL_FALSE, sizeof(Vec3), (void*)0));
-    ASSERT_GL(glDrawElements(GL_TRIANGLES, sizeof(kCubeIndices)/sizeof(kCubeIndices[0]), GL_UNSIGNED_SHORT, NULL));
+    return R->major_version >= 3 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+}
+
+static int _init_programs(LightPrepassRenderer* R)
+{
+    int ii;
+
+    for(ii=0;ii<2;++ii) {
+        if(finish_program(R->pass1[ii].program) != 0)
+            return -1;
+    }
+    if(finish_program(R->pass2.program) != 0 ||
+       finish_program(R->fullscreen.program) != 0 ||
+       finish_program(R->pass3.program) != 0)
+        return -1;
+    if(R->stencil.program && finish_program(R->stencil.program) != 0)
+        return -1;
+    if(R->low_res && (finish_program(R->low_res_pass2.program) != 0 ||
+                      finish_program(R->low_res_fullscreen.program) != 0 ||
+                      finish_program(R->low_res_pass3.program) != 0 ||
+                      finish_program(R->downsample.program) != 0))
+        return -1;
+
+    for(ii=0;ii<2;++ii) {
+        R->pass1[ii].uniforms = create_uniform_table(R->pass1[ii].program);
+        set_uniform_int(R->pass1[ii].uniforms, "s_Normal", 0);
+    }
+    R->pass2.uniforms = create_uniform_table(R->pass2.program);
+    set_uniform_int(R->pass2.uniforms, "s_GBuffer", 0);
+    set_uniform_int(R->pass2.uniforms, "s_Depth", 1);
+    R->fullscreen.uniforms = create_uniform_table(R->fullscreen.program);
+    set_uniform_int(R->fullscreen.uniforms, "s_GBuffer", 0);
+    set_uniform_int(R->fullscreen.uniforms, "s_Depth", 1);
+    R->pass3.uniforms = create_uniform_table(R->pass3.program);
+    set_uniform_int(R->pass3.uniforms, "s_GBuffer", 0);
+    set_uniform_int(R->pass3.uniforms, "s_Albedo", 1);
+    if(R->stencil.program)
+        R->stencil.uniforms = create_uniform_table(R->stencil.program);
+    if(R->low_res) {
+        R->low_res_pass2.uniforms = create_uniform_table(R->low_res_pass2.program);
+        set_uniform_int(R->low_res_pass2.uniforms, "s_LowResDepth", 2);
+        R->low_res_fullscreen.uniforms = create_uniform_table(R->low_res_fullscreen.program);
+        set_uniform_int(R->low_res_fullscreen.uniforms, "s_LowResDepth", 2);
+        R->low_res_pass3.uniforms = create_uniform_table(R->low_res_pass3.program);
+        set_uniform_int(R->low_res_pass3.uniforms, "s_Normals", 0);
+        set_uniform_int(R->low_res_pass3.uniforms, "s_Albedo", 1);
+        set_uniform_int(R->low_res_pass3.uniforms, "s_LowResLight", 2);
+        set_uniform_int(R->low_res_pass3.uniforms, "s_LowResDepth", 3);
+        R->downsample.uniforms = create_uniform_table(R->downsample.program);
+        set_uniform_int(R->downsample.uniforms, "s_Normals", 0);
+        set_uniform_int(R->downsample.uniforms, "s_Depth", 1);
+    }
+    R->programs_ready = 1;
+    return 0;
 }
 
 /* External functions
@@ -157,33 +137,47 @@ LightPrepassRenderer* create_light_prepass_renderer(Graphics* G, int major_versi
         kTangentSlot,
         kBitangentSlot,
         kTexCoordSlot,
+        kWorldSlot,
         kEmptySlot
     };
     AttributeSlot pass2_slots[] = {
         kPositionSlot,
+        kLightPositionSlot,
+        kLightColorSlot,
+        kLightSizeSlot,
         kEmptySlot
     };
     AttributeSlot pass3_slots[] = {
         kPositionSlot,
         kTexCoordSlot,
+        kWorldSlot,
+        kEmptySlot
+    };
+    AttributeSlot downsample_slots[] = {
         kEmptySlot
     };
+    const char* instanced = major_version >= 3 ? "INSTANCED=1" : "INSTANCED=0";
+    const char* pass2_defines[] = { instanced, NULL };
+    const char* fullscreen_defines[] = { instanced, "FULLSCREEN=1", NULL };
+    const char* pass3_defines[] = { instanced, NULL };
+    const char* low_res_pass2_defines[] = { instanced, "LOW_RES=1", NULL };
+    const char* low_res_fullscreen_defines[] = { instanced, "FULLSCREEN=1", "LOW_RES=1", NULL };
+    const char* low_res_pass3_defines[] = { instanced, "LOW_RES=1", NULL };
+    const char* downsample_defines[] = { "GBUFFER_LAYOUT=0", NULL };
 
     LightPrepassRenderer* R = (LightPrepassRenderer*)calloc(1,sizeof(*R));
+    int ii;
     R->major_version = major_version;
     R->minor_version = minor_version;
 
-    /* Create vertex buffer */
-    ASSERT_GL(glGenBuffers(1, &R->cube_vertex_buffer));
-    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, R->cube_vertex_buffer));
-    ASSERT_GL(glBufferData(GL_ARRAY_BUFFER, sizeof(kCubeVertices), kCubeVertices, GL_STATIC_DRAW));
-    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    /* ES2 has no instancing, so leave the world matrix slot unbound */
+    if(major_version < 3) {
+        pass1_slots[5] = kEmptySlot;
+        pass2_slots[1] = kEmptySlot;
+        pass3_slots[2] = kEmptySlot;
+    }
 
-    /* Create index buffer */
-    ASSERT_GL(glGenBuffers(1, &R->cube_index_buffer));
-    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, R->cube_index_buffer));
-    ASSERT_GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(kCubeIndices), kCubeIndices, GL_STATIC_DRAW));
-    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+    R->volume = create_light_volume(major_version >= 3, graphics_max_lights(G));
 
     /* Create framebuffer */
     ASSERT_GL(glGenFramebuffers(1, &R->gbuffer_framebuffer));
@@ -215,111 +209,105 @@ LightPrepassRenderer* create_light_prepass_renderer(Graphics* G, int major_versi
 
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, 0));
 
-    /** Pass 1
-     */
-    R->pass1.program = create_program("shaders/light_prepass/Pass1Vertex.glsl", "shaders/light_prepass/Pass1Fragment.glsl", pass1_slots);
-
-    ASSERT_GL(GetUniformLocation(R, pass1, program, u_Projection));
-    ASSERT_GL(GetUniformLocation(R, pass1, program, u_View));
-    ASSERT_GL(GetUniformLocation(R, pass1, program, u_World));
-
-    ASSERT_GL(GetUniformLocation(R, pass1, program, u_SpecularPower));
-
-    ASSERT_GL(GetUniformLocation(R, pass1, program, s_Normal));
-
-    ASSERT_GL(glUseProgram(R->pass1.program));
-
-    ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kNormalSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kTangentSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kBitangentSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kTexCoordSlot));
-
-    ASSERT_GL(glUniform1i(R->pass1.s_Normal, 0));
-    ASSERT_GL(glUseProgram(0));
-
-    /** Pass 2
-     */
-    R->pass2.program = create_program("shaders/light_prepass/Pass2Vertex.glsl", "shaders/light_prepass/Pass2Fragment.glsl", pass2_slots);
-
-    ASSERT_GL(GetUniformLocation(R, pass2, program, u_Projection));
-    ASSERT_GL(GetUniformLocation(R, pass2, program, u_View));
-    ASSERT_GL(GetUniformLocation(R, pass2, program, u_World));
-
-    ASSERT_GL(GetUniformLocation(R, pass2, program, u_InvProj));
-    ASSERT_GL(GetUniformLocation(R, pass2, program, u_Viewport));
-
-    ASSERT_GL(GetUniformLocation(R, pass2, program, s_GBuffer));
-    ASSERT_GL(GetUniformLocation(R, pass2, program, s_Depth));
-
-
-    ASSERT_GL(GetUniformLocation(R, pass2, program, u_LightColor));
-    ASSERT_GL(GetUniformLocation(R, pass2, program, u_LightPosition));
-    ASSERT_GL(GetUniformLocation(R, pass2, program, u_LightSize));
+    /* Low resolution lighting, ES3 with float render targets only */
+    if(major_version >= 3)
+        R->low_res = create_low_res_lighting(G);
+    R->light_divisor = 1;
 
-    ASSERT_GL(glUseProgram(R->pass2.program));
-
-    ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
-
-    ASSERT_GL(glUniform1i(R->pass2.s_GBuffer, 0));
-    ASSERT_GL(glUniform1i(R->pass2.s_Depth, 1));
-    ASSERT_GL(glUseProgram(0));
-
-    /** Pass 3
+    /** Programs, finished on first use
      */
-    R->pass3.program = create_program("shaders/light_prepass/Pass3Vertex.glsl", "shaders/light_prepass/Pass3Fragment.glsl", pass3_slots);
-
-    ASSERT_GL(GetUniformLocation(R, pass3, program, u_Projection));
-    ASSERT_GL(GetUniformLocation(R, pass3, program, u_View));
-    ASSERT_GL(GetUniformLocation(R, pass3, program, u_World));
-
-    ASSERT_GL(GetUniformLocation(R, pass3, program, u_Viewport));
-
-    ASSERT_GL(GetUniformLocation(R, pass3, program, s_GBuffer));
-    ASSERT_GL(GetUniformLocation(R, pass3, program, s_Albedo));
-
-    ASSERT_GL(glUseProgram(R->pass3.program));
-
-    ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
-    ASSERT_GL(glEnableVertexAttribArray(kTexCoordSlot));
-
-
-    ASSERT_GL(glUniform1i(R->pass3.s_GBuffer, 0));
-    ASSERT_GL(glUniform1i(R->pass3.s_Albedo, 1));
-    ASSERT_GL(glUseProgram(0));
+    for(ii=0;ii<2;++ii) {
+        const char* defines[] = { ii ? "NORMAL_MAP=1" : "NORMAL_MAP=0", instanced, NULL };
+        R->pass1[ii].program = create_program_variant("shaders/light_prepass/Pass1Vertex.glsl",
+                                                      "shaders/light_prepass/Pass1Fragment.glsl",
+                                                      pass1_slots, defines);
+    }
+    R->pass2.program = create_program_variant("shaders/light_prepass/Pass2Vertex.glsl", "shaders/light_prepass/Pass2Fragment.glsl",
+                                              pass2_slots, pass2_defines);
+    R->fullscreen.program = create_program_variant("shaders/light_prepass/Pass2Vertex.glsl", "shaders/light_prepass/Pass2Fragment.glsl",
+                                                   pass2_slots, fullscreen_defines);
+    R->pass3.program = create_program_variant("shaders/light_prepass/Pass3Vertex.glsl", "shaders/light_prepass/Pass3Fragment.glsl",
+                                              pass3_slots, pass3_defines);
+    if(major_version >= 3)
+        R->stencil.program = create_program_variant("shaders/light_prepass/Pass2Vertex.glsl",
+                                                    "shaders/common/stencil_fragment.glsl",
+                                                    pass2_slots, pass2_defines);
+    if(R->low_res) {
+        R->low_res_pass2.program = create_program_variant("shaders/light_prepass/Pass2Vertex.glsl",
+                                                          "shaders/light_prepass/Pass2Fragment.glsl",
+                                                          pass2_slots, low_res_pass2_defines);
+        R->low_res_fullscreen.program = create_program_variant("shaders/light_prepass/Pass2Vertex.glsl",
+                                                               "shaders/light_prepass/Pass2Fragment.glsl",
+                                                               pass2_slots, low_res_fullscreen_defines);
+        R->low_res_pass3.program = create_program_variant("shaders/light_prepass/Pass3Vertex.glsl",
+                                                          "shaders/light_prepass/Pass3Fragment.glsl",
+                                                          pass3_slots, low_res_pass3_defines);
+        /* Pass 1 normals are spheremap encoded like G-buffer layout 0 */
+        R->downsample.program = create_program_variant("shaders/deferred/tiledvertex.glsl",
+                                                       "shaders/deferred/downsamplefragment.glsl",
+                                                       downsample_slots, downsample_defines);
+    }
 
     return R;
 }
 void destroy_light_prepass_renderer(LightPrepassRenderer* R)
 {
-    destroy_program(R->pass1.program);
+    int ii;
+    destroy_light_volume(R->volume);
+    for(ii=0;ii<2;++ii) {
+        destroy_uniform_table(R->pass1[ii].uniforms);
+        destroy_program(R->pass1[ii].program);
+    }
+    destroy_uniform_table(R->pass2.uniforms);
+    destroy_program(R->pass2.program);
+    destroy_uniform_table(R->fullscreen.uniforms);
+    destroy_program(R->fullscreen.program);
+    destroy_uniform_table(R->pass3.uniforms);
+    destroy_program(R->pass3.program);
+    if(R->stencil.program) {
+        destroy_uniform_table(R->stencil.uniforms);
+        destroy_program(R->stencil.program);
+    }
+    if(R->low_res) {
+        destroy_uniform_table(R->low_res_pass2.uniforms);
+        destroy_program(R->low_res_pass2.program);
+        destroy_uniform_table(R->low_res_fullscreen.uniforms);
+        destroy_program(R->low_res_fullscreen.program);
+        destroy_uniform_table(R->low_res_pass3.uniforms);
+        destroy_program(R->low_res_pass3.program);
+        destroy_uniform_table(R->downsample.uniforms);
+        destroy_program(R->downsample.program);
+        destroy_low_res_lighting(R->low_res);
+    }
     free(R);
 }
 void resize_light_prepass_renderer(LightPrepassRenderer* R, int width, int height)
 {
     GLenum framebuffer_status;
-    R->width = width;
-    R->height = height;
+    R->width = R->target_width = width;
+    R->height = R->target_height = height;
 
     /* Color buffer */
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->gbuffer_color_texture));
     ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0));
 
-    /* Depth buffer */
+    /* Depth buffer, with the stencil used to mask light volumes on ES3 */
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->gbuffer_depth_texture));
     if(R->major_version >= 3)
-        ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0));
+        ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH32F_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV, 0));
     else
         ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0));
     
     /* Lighting buffer */
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->lighting_buffer));
     ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0));
+    if(R->low_res)
+        resize_low_res_lighting(R->low_res, width, height);
 
     /* Framebuffer */
     ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, R->gbuffer_framebuffer));
     ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, R->gbuffer_color_texture, 0));
-    ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, R->gbuffer_depth_texture, 0));
+    ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, _depth_attachment(R), GL_TEXTURE_2D, R->gbuffer_depth_texture, 0));
 
     framebuffer_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
     if(framebuffer_status != GL_FRAMEBUFFER_COMPLETE) {
@@ -335,45 +323,98 @@ void resize_light_prepass_renderer(LightPrepassRenderer* R, int width, int heigh
 
 void render_light_prepass(LightPrepassRenderer* R, GLuint default_framebuffer,
                           Mat4 proj_matrix, Mat4 view_matrix,
-                          const Model* models, int num_models,
+                          const RenderQueue* queue,
                           const Light* lights, int num_lights)
 {
     Mat4 inv_proj = mat4_inverse(proj_matrix);
     float viewport[] = { R->width, R->height };
+    float target_scale[] = { R->width/(float)R->target_width, R->height/(float)R->target_height };
+    const Material* material = NULL;
+    const Mesh* mesh = NULL;
+    LightVolumeBatch volumes;
+    int low_res = R->light_divisor > 1;
+    GLuint pass3_program = low_res ? R->low_res_pass3.program : R->pass3.program;
+    UniformTable* pass3_uniforms;
+    int width = R->width;
+    int height = R->height;
+    int current = -1;
     int ii;
 
+    R->num_stencil_lights = 0;
+    memset(R->num_light_classes, 0, sizeof(R->num_light_classes));
+    if(!R->programs_ready && _init_programs(R) != 0)
+        return;
+    pass3_uniforms = low_res ? R->low_res_pass3.uniforms : R->pass3.uniforms;
+
     /** Pass 1
      */
     ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, R->gbuffer_framebuffer));
     ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, R->gbuffer_color_texture, 0));
+    /* Nothing is loaded, the normals and depth are stored for pass 2 */
     ASSERT_GL(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
-    ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+    ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT));
     ASSERT_GL(glDepthMask(GL_TRUE));
     ASSERT_GL(glDepthFunc(GL_LESS));
     ASSERT_GL(glCullFace(GL_BACK));
 
+    /* Camera and material uniforms only reach ES2 programs, ES3 programs
+     * read the shared uniform blocks and ignore them
+     */
+    for(ii=0;ii<2;++ii) {
+        set_uniform(R->pass1[ii].uniforms, "u_Projection", &proj_matrix);
+        set_uniform(R->pass1[ii].uniforms, "u_View", &view_matrix);
+    }
 
-    ASSERT_GL(glUseProgram(R->pass1.program));
-    ASSERT_GL(glUniformMatrix4fv(R->pass1.u_Projection, 1, GL_FALSE, (float*)&proj_matrix));
-    ASSERT_GL(glUniformMatrix4fv(R->pass1.u_View, 1, GL_FALSE, (float*)&view_matrix));
-
-    for(ii=0;ii<num_models;++ii) {
-        Mat4 world_matrix = transform_get_matrix(models[ii].transform);
+    for(ii=0;ii<queue->num_batches;++ii) {
+        const DrawBatch* batch = &queue->batches[ii];
+        const Model* model = batch->model;
+        int normal_map = model->material->normal != 0;
+        if(normal_map != current) {
+            current = normal_map;
+            material = NULL;
+            ASSERT_GL(glUseProgram(R->pass1[current].program));
+        }
         /* Material */
-        ASSERT_GL(glUniform1f(R->pass1.u_SpecularPower, models[ii].material->specular_power));
-        ASSERT_GL(glActiveTexture(GL_TEXTURE0));
-        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, models[ii].material->normal));
+        if(model->material != material) {
+            material = model->material;
+            bind_material_block(queue, batch);
+            set_uniform_float(R->pass1[current].uniforms, "u_SpecularPower", material->specular_power);
+            ASSERT_GL(glActiveTexture(GL_TEXTURE0));
+            ASSERT_GL(glBindTexture(GL_TEXTURE_2D, material->normal));
+        }
         /* Mesh */
-        ASSERT_GL(glUniformMatrix4fv(R->pass1.u_World, 1, GL_FALSE, (float*)&world_matrix));
-        draw_mesh(models[ii].mesh);
+        if(model->mesh != mesh) {
+            mesh = model->mesh;
+            bind_mesh(mesh);
+        }
+        draw_batch(queue, batch, R->pass1[current].uniforms);
     }
+    unbind_mesh();
 
     /** Pass 2
      */
-    ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, R->lighting_buffer, 0));
-    ASSERT_GL(glViewport(0, 0, R->width, R->height));
-    ASSERT_GL(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
-    ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT));
+    ASSERT_GL(glActiveTexture(GL_TEXTURE0));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->gbuffer_color_texture));
+    ASSERT_GL(glActiveTexture(GL_TEXTURE1));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->gbuffer_depth_texture));
+    if(low_res) {
+        /* The normals and depth are reduced and the lights add up in the
+         * low resolution buffer without a depth test, the lighting buffer
+         * is unused
+         */
+        ASSERT_GL(glUseProgram(R->downsample.program));
+        set_uniform_int(R->downsample.uniforms, "u_LightDivisor", R->light_divisor);
+        commit_uniforms(R->downsample.uniforms);
+        begin_low_res_lighting(R->low_res, R->width, R->height, R->light_divisor, 2);
+        low_res_lighting_size(R->low_res, &width, &height);
+        ASSERT_GL(glDisable(GL_DEPTH_TEST));
+    } else {
+        ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, R->lighting_buffer, 0));
+        ASSERT_GL(glViewport(0, 0, R->width, R->height));
+        /* The depth is loaded and stored again for pass 3 */
+        ASSERT_GL(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
+        ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT));
+    }
 
     ASSERT_GL(glEnable(GL_BLEND));
     ASSERT_GL(glBlendFunc(GL_ONE, GL_ONE));
@@ -381,32 +422,89 @@ void render_light_prepass(LightPrepassRenderer* R, GLuint default_framebuffer,
     ASSERT_GL(glDepthMask(GL_FALSE));
     ASSERT_GL(glDepthFunc(GL_GEQUAL));
 
-    ASSERT_GL(glUseProgram(R->pass2.program));
-    ASSERT_GL(glUniformMatrix4fv(R->pass2.u_Projection, 1, GL_FALSE, (float*)&proj_matrix));
-    ASSERT_GL(glUniformMatrix4fv(R->pass2.u_View, 1, GL_FALSE, (float*)&view_matrix));
-    ASSERT_GL(glUniformMatrix4fv(R->pass2.u_InvProj, 1, GL_FALSE, (float*)&inv_proj));
-    ASSERT_GL(glUniform2fv(R->pass2.u_Viewport, 1, viewport));
-    ASSERT_GL(glActiveTexture(GL_TEXTURE0));
-    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->gbuffer_color_texture));
-    ASSERT_GL(glActiveTexture(GL_TEXTURE1));
-    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->gbuffer_depth_texture));
-
-    for(ii=0;ii<num_lights;++ii) {
-        float size = lights[ii].size;
-        Mat4 world = mat4_identity;
-        Vec4 position = vec4_zero;
-
-        world = mat4_scalef(size,size,size);
-        world.r3 = vec4_from_vec3(lights[ii].position,1.0f);
-
-        position = vec4_from_vec3(lights[ii].position, 1.0f);
-        position = mat4_mul_vector(position, view_matrix);
+    for(ii=0;ii<2;++ii) {
+        UniformTable* uniforms = ii ? R->fullscreen.uniforms : R->pass2.uniforms;
+        set_uniform(uniforms, "u_Projection", &proj_matrix);
+        set_uniform(uniforms, "u_View", &view_matrix);
+        set_uniform(uniforms, "u_InvProj", &inv_proj);
+        set_uniform(uniforms, "u_Viewport", viewport);
+        set_uniform(uniforms, "u_TargetScale", target_scale);
+    }
 
-        ASSERT_GL(glUniformMatrix4fv(R->pass2.u_World, 1, GL_FALSE, (float*)&world));
-        ASSERT_GL(glUniform3fv(R->pass2.u_LightPosition, 1, (float*)&position));
-        ASSERT_GL(glUniform3fv(R->pass2.u_LightColor, 1, (float*)&lights[ii].color));
-        ASSERT_GL(glUniform1f(R->pass2.u_LightSize, lights[ii].size));
-        _draw_point_light(R);
+    if(low_res) {
+        set_uniform_int(R->low_res_fullscreen.uniforms, "u_LightDivisor", R->light_divisor);
+        set_uniform_int(R->low_res_pass2.uniforms, "u_LightDivisor", R->light_divisor);
+        ASSERT_GL(glUseProgram(R->low_res_fullscreen.program));
+        commit_uniforms(R->low_res_fullscreen.uniforms);
+        ASSERT_GL(glUseProgram(R->low_res_pass2.program));
+        commit_uniforms(R->low_res_pass2.uniforms);
+        volumes = stream_light_volumes(R->volume, queue->stream, lights, num_lights, view_matrix, proj_matrix,
+                                       width, height);
+        for(ii=0;ii<LIGHT_VOLUME_LEVELS;++ii) {
+            if(volumes.count[ii])
+                draw_light_volumes(R->volume, &volumes, ii, volumes.first[ii], volumes.count[ii]);
+            R->num_light_classes[kLightOutside] += volumes.count[ii];
+        }
+        if(volumes.num_scissored)
+            draw_scissored_lights(R->volume, &volumes, R->low_res_pass2.program, R->low_res_fullscreen.program, 0,
+                                  R->num_light_classes);
+        ASSERT_GL(glEnable(GL_DEPTH_TEST));
+    } else if(R->major_version >= 3) {
+        ASSERT_GL(glUseProgram(R->fullscreen.program));
+        commit_uniforms(R->fullscreen.uniforms);
+        ASSERT_GL(glUseProgram(R->pass2.program));
+        commit_uniforms(R->pass2.uniforms);
+        volumes = stream_light_volumes(R->volume, queue->stream, lights, num_lights, view_matrix, proj_matrix,
+                                       R->width, R->height);
+        for(ii=0;ii<LIGHT_VOLUME_LEVELS;++ii) {
+            if(volumes.count[ii])
+                draw_light_volumes(R->volume, &volumes, ii, volumes.first[ii], volumes.count[ii]);
+            R->num_light_classes[kLightOutside] += volumes.count[ii];
+        }
+        if(volumes.num_scissored)
+            R->num_stencil_lights += draw_scissored_lights(R->volume, &volumes, R->pass2.program, R->fullscreen.program,
+                                                           R->stencil_lights ? R->stencil.program : 0,
+                                                           R->num_light_classes);
+    } else {
+        /* Every light is its own draw here, so all of them are scissored */
+        ASSERT_GL(glEnable(GL_SCISSOR_TEST));
+        for(ii=0;ii<num_lights;++ii) {
+            float size = lights[ii].size;
+            Vec3 center = light_view_center(lights[ii], view_matrix);
+            Mat4 world = mat4_identity;
+            Vec4 position = vec4_zero;
+            LightBounds bounds;
+            UniformTable* uniforms;
+            int quad;
+
+            if(!light_bounds(center, size, proj_matrix, R->width, R->height, &bounds))
+                continue;
+            ASSERT_GL(glScissor(bounds.x, bounds.y, bounds.width, bounds.height));
+            R->num_light_classes[bounds.light_class]++;
+            quad = bounds.light_class != kLightOutside;
+            ASSERT_GL(glUseProgram(quad ? R->fullscreen.program : R->pass2.program));
+            uniforms = quad ? R->fullscreen.uniforms : R->pass2.uniforms;
+
+            world = mat4_scalef(size,size,size);
+            world.r3 = vec4_from_vec3(lights[ii].position,1.0f);
+
+            position = vec4_from_vec3(center, 1.0f);
+
+            set_uniform(uniforms, "u_World", &world);
+            set_uniform(uniforms, "u_LightPosition", &position);
+            set_uniform(uniforms, "u_LightColor", &lights[ii].color);
+            set_uniform_float(uniforms, "u_LightSize", lights[ii].size);
+            commit_uniforms(uniforms);
+            if(bounds.light_class == kLightNearPlane) {
+                ASSERT_GL(glDisable(GL_DEPTH_TEST));
+                draw_light_volume(R->volume, LIGHT_VOLUME_QUAD);
+                ASSERT_GL(glEnable(GL_DEPTH_TEST));
+            } else if(quad)
+                draw_light_volume(R->volume, LIGHT_VOLUME_QUAD);
+            else
+                draw_light_volume(R->volume, light_volume_level(light_screen_size(center, size, proj_matrix)));
+        }
+        ASSERT_GL(glDisable(GL_SCISSOR_TEST));
     }
 
     ASSERT_GL(glDisable(GL_BLEND));
@@ -417,27 +515,76 @@ void render_light_prepass(LightPrepassRenderer* R, GLuint default_framebuffer,
     /** Pass 3
      */
     ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, default_framebuffer));
-    ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, R->gbuffer_depth_texture, 0));
+    ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, _depth_attachment(R), GL_TEXTURE_2D, R->gbuffer_depth_texture, 0));
     ASSERT_GL(glViewport(0, 0, R->width, R->height));
+    /* Only the depth is loaded, for the equal test */
     ASSERT_GL(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
     ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT));
-    ASSERT_GL(glUseProgram(R->pass3.program));
-    ASSERT_GL(glUniformMatrix4fv(R->pass3.u_Projection, 1, GL_FALSE, (float*)&proj_matrix));
-    ASSERT_GL(glUniformMatrix4fv(R->pass3.u_View, 1, GL_FALSE, (float*)&view_matrix));
-    ASSERT_GL(glUniform2fv(R->pass3.u_Viewport, 1, viewport));
-    ASSERT_GL(glActiveTexture(GL_TEXTURE0));
-    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->lighting_buffer));
+    ASSERT_GL(glUseProgram(pass3_program));
+    set_uniform(pass3_uniforms, "u_Projection", &proj_matrix);
+    set_uniform(pass3_uniforms, "u_View", &view_matrix);
+    set_uniform(pass3_uniforms, "u_Viewport", viewport);
+    set_uniform(pass3_uniforms, "u_TargetScale", target_scale);
+    if(low_res) {
+        /* Upsampled with the pass 1 normals */
+        set_uniform_int(pass3_uniforms, "u_LightDivisor", R->light_divisor);
+        bind_low_res_lighting(R->low_res, 2);
+        ASSERT_GL(glActiveTexture(GL_TEXTURE0));
+        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->gbuffer_color_texture));
+    } else {
+        ASSERT_GL(glActiveTexture(GL_TEXTURE0));
+        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, R->lighting_buffer));
+    }
 
-    for(ii=0;ii<num_models;++ii) {
-        Mat4 world_matrix = transform_get_matrix(models[ii].transform);
+    material = NULL;
+    mesh = NULL;
+    for(ii=0;ii<queue->num_batches;++ii) {
+        const DrawBatch* batch = &queue->batches[ii];
+        const Model* model = batch->model;
         /* Material */
-        ASSERT_GL(glActiveTexture(GL_TEXTURE1));
-        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, models[ii].material->albedo));
+        if(model->material != material) {
+            material = model->material;
+            ASSERT_GL(glActiveTexture(GL_TEXTURE1));
+            ASSERT_GL(glBindTexture(GL_TEXTURE_2D, material->albedo));
+        }
         /* Mesh */
-        ASSERT_GL(glUniformMatrix4fv(R->pass3.u_World, 1, GL_FALSE, (float*)&world_matrix));
-        draw_mesh(models[ii].mesh);
+        if(model->mesh != mesh) {
+            mesh = model->mesh;
+            bind_mesh(mesh);
+        }
+        draw_batch(queue, batch, pass3_uniforms);
     }
-    
+    unbind_mesh();
+
     ASSERT_GL(glDepthMask(GL_TRUE));
     ASSERT_GL(glDepthFunc(GL_LESS));
 }
+void set_light_prepass_viewport(LightPrepassRenderer* R, int width, int height)
+{
+    assert(width <= R->target_width && height <= R->target_height);
+    R->width = width;
+    R->height = height;
+}
+void set_light_prepass_stencil_lights(LightPrepassRenderer* R, int enabled)
+{
+    R->stencil_lights = enabled && R->major_version >= 3;
+}
+int set_light_prepass_light_divisor(LightPrepassRenderer* R, int divisor)
+{
+    if(divisor < 1 || divisor > MAX_LIGHT_DIVISOR || (divisor > 1 && R->low_res == NULL))
+        return -1;
+    R->light_divisor = divisor;
+    return 0;
+}
+int light_prepass_light_divisor(const LightPrepassRenderer* R)
+{
+    return R->light_divisor;
+}
+int light_prepass_stencil_lights(const LightPrepassRenderer* R)
+{
+    return R->num_stencil_lights;
+}
+const int* light_prepass_light_classes(const LightPrepassRenderer* R)
+{
+    return R->num_light_classes;
+}
@@ -21,16 +21,36 @@
 #include "graphics.h"
 #include "scene.h"
 #include "mesh.h"
+#include "render_queue.h"
 
 typedef struct LightPrepassRenderer LightPrepassRenderer;
 
 LightPrepassRenderer* create_light_prepass_renderer(Graphics* G, int major_version, int minor_version);
 void destroy_light_prepass_renderer(LightPrepassRenderer* R);
 void resize_light_prepass_renderer(LightPrepassRenderer* R, int width, int height);
+/** @brief Renders to the bottom left `width` by `height` pixels of the
+ *  targets from the last resize
+ */
+void set_light_prepass_viewport(LightPrepassRenderer* R, int width, int height);
 
 void render_light_prepass(LightPrepassRenderer* R, GLuint default_framebuffer,
                           Mat4 proj_matrix, Mat4 view_matrix,
-                          const Model* models, int num_models,
+                          const RenderQueue* queue,
                           const Light* lights, int num_lights);
+/** @brief Enables stencil masking of light volumes covering at least
+ *  LARGE_LIGHT_SIZE of the screen, ES3 only
+ */
+void set_light_prepass_stencil_lights(LightPrepassRenderer* R, int enabled);
+/** @return The number of lights drawn with a stencil pass last frame */
+int light_prepass_stencil_lights(const LightPrepassRenderer* R);
+/** @return The number of lights drawn per LightClass last frame */
+const int* light_prepass_light_classes(const LightPrepassRenderer* R);
+/** @brief Lights pass 2 at 1/`divisor` of the resolution, up to
+ *  MAX_LIGHT_DIVISOR, and upsamples it in pass 3, see
+ *  `set_deferred_light_divisor`
+ *  @return 0 on success, -1 on ES2 or without float render targets
+ */
+int set_light_prepass_light_divisor(LightPrepassRenderer* R, int divisor);
+int light_prepass_light_divisor(const LightPrepassRenderer* R);
 
 #endif /* include guard */
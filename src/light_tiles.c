@@ -0,0 +1,311 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "light_tiles.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assert.h"
+#include "graphics.h"
+#include "system.h"
+
+/* Defines
+ */
+
+/* Types
+ */
+struct LightTiles
+{
+    int         tile_size;
+    int         depth_slices;
+    int         width;
+    int         height;
+    int         target_width;   /* Size the tile texture holds */
+    int         target_height;
+    int         tiles_x;
+    int         tiles_y;
+    float       near_plane;
+    float       far_plane;
+
+    /* CPU binning, max_lights per array */
+    int         max_lights;
+    Vec4*       light_data;     /* View position and size, color */
+    float*      light_x;        /* View space spheres */
+    float*      light_y;
+    float*      light_z;
+    float*      light_radius;
+
+    /* Light lists capped to fit the index texture, only allocated once
+     * the lights outgrow it
+     */
+    uint32_t*   capped_clusters;
+    uint32_t*   capped_indices;
+    int         capped_num_clusters;
+    int         capped_num_indices;
+    int         capped_logged;
+
+    /* GPU copies */
+    GLuint      tile_texture;
+    GLuint      index_texture;
+    int         index_rows;
+    int         max_index_rows; /* GL_MAX_TEXTURE_SIZE */
+    GLuint      light_texture;
+};
+
+/* Constants
+ */
+
+/* Variables
+ */
+
+/* Internal functions
+ */
+static void _create_texture(GLuint* texture)
+{
+    ASSERT_GL(glGenTextures(1, texture));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, *texture));
+    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+}
+/** Uploads `count` texels into rows of `width`, the last row partially */
+static void _upload_rows(GLuint texture, int width, int count, GLenum format, GLenum type,
+                         const void* data, int texel_size)
+{
+    int rows = count/width;
+    int remainder = count - rows*width;
+
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, texture));
+    if(rows)
+        ASSERT_GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, rows, format, type, data));
+    if(remainder)
+        ASSERT_GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, rows, remainder, 1, format, type,
+                                  (const char*)data + rows*width*texel_size));
+}
+/** Shortens every light list to at most the same length, as long as
+ *  possible while all of them fit in `capacity` indices. Lists keep their
+ *  lowest light indices.
+ */
+static LightBins _cap_light_lists(LightTiles* T, LightBins bins, int capacity)
+{
+    uint32_t    lo = 0;
+    uint32_t    hi = 0;
+    uint32_t    next = 0;
+    int         ii;
+
+    if(T->capped_num_clusters < bins.num_clusters) {
+        free(T->capped_clusters);
+        T->capped_clusters = (uint32_t*)malloc(bins.num_clusters*2*sizeof(uint32_t));
+        T->capped_num_clusters = T->capped_clusters ? bins.num_clusters : 0;
+    }
+    if(T->capped_num_indices < capacity) {
+        free(T->capped_indices);
+        T->capped_indices = (uint32_t*)malloc(capacity*sizeof(uint32_t));
+        T->capped_num_indices = T->capped_indices ? capacity : 0;
+    }
+    if(T->capped_clusters == NULL || T->capped_indices == NULL) {
+        /* Light nothing rather than read past the index texture */
+        bins.num_indices = 0;
+        return bins;
+    }
+
+    /* Binary search the longest list length that fits */
+    for(ii=0;ii<bins.num_clusters;++ii) {
+        if(bins.clusters[ii*2+1] > hi)
+            hi = bins.clusters[ii*2+1];
+    }
+    while(lo < hi) {
+        uint32_t    length = lo + (hi - lo + 1)/2;
+        size_t      total = 0;
+        for(ii=0;ii<bins.num_clusters;++ii)
+            total += bins.clusters[ii*2+1] < length ? bins.clusters[ii*2+1] : length;
+        if(total <= (size_t)capacity)
+            lo = length;
+        else
+            hi = length - 1;
+    }
+
+    for(ii=0;ii<bins.num_clusters;++ii) {
+        uint32_t count = bins.clusters[ii*2+1] < lo ? bins.clusters[ii*2+1] : lo;
+        memcpy(T->capped_indices + next, bins.indices + bins.clusters[ii*2], count*sizeof(uint32_t));
+        T->capped_clusters[ii*2] = next;
+        T->capped_clusters[ii*2+1] = count;
+        next += count;
+    }
+    if(!T->capped_logged) {
+        system_log("Light tiles: %d light indices don't fit the index texture, capping lists at %u lights\n",
+                   bins.num_indices, lo);
+        T->capped_logged = 1;
+    }
+    bins.clusters = T->capped_clusters;
+    bins.indices = T->capped_indices;
+    bins.num_indices = (int)next;
+    return bins;
+}
+
+/* External functions
+ */
+LightTiles* create_light_tiles(int tile_size, int depth_slices, int max_lights)
+{
+    LightTiles* T = (LightTiles*)calloc(1, sizeof(LightTiles));
+    int         data_rows = (max_lights*2 + LIGHT_DATA_WIDTH - 1)/LIGHT_DATA_WIDTH;
+
+    T->light_data = (Vec4*)malloc(max_lights*(2*sizeof(Vec4) + 4*sizeof(float)) + 1);
+    if(T->light_data == NULL) {
+        system_log("Allocating %d tiled lights failed\n", max_lights);
+        max_lights = 0;
+    }
+    T->max_lights = max_lights;
+    T->light_x = (float*)(T->light_data + max_lights*2);
+    T->light_y = T->light_x + max_lights;
+    T->light_z = T->light_y + max_lights;
+    T->light_radius = T->light_z + max_lights;
+    T->tile_size = tile_size;
+    T->depth_slices = depth_slices;
+    T->near_plane = 1.0f;
+    T->far_plane = 100.0f;
+    ASSERT_GL(glGetIntegerv(GL_MAX_TEXTURE_SIZE, &T->max_index_rows));
+
+    _create_texture(&T->tile_texture);
+    _create_texture(&T->index_texture);
+    _create_texture(&T->light_texture);
+    ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, LIGHT_DATA_WIDTH, data_rows > 0 ? data_rows : 1, 0, GL_RGBA, GL_FLOAT, NULL));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, 0));
+    return T;
+}
+void destroy_light_tiles(LightTiles* T)
+{
+    ASSERT_GL(glDeleteTextures(1, &T->tile_texture));
+    ASSERT_GL(glDeleteTextures(1, &T->index_texture));
+    ASSERT_GL(glDeleteTextures(1, &T->light_texture));
+    free(T->light_data);
+    free(T->capped_clusters);
+    free(T->capped_indices);
+    free(T);
+}
+void resize_light_tiles(LightTiles* T, int width, int height)
+{
+    T->target_width = width;
+    T->target_height = height;
+    set_light_tiles_viewport(T, width, height);
+
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, T->tile_texture));
+    ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, T->tiles_x, T->tiles_y*T->depth_slices,
+                           0, GL_RG_INTEGER, GL_UNSIGNED_INT, NULL));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, 0));
+}
+void set_light_tiles_viewport(LightTiles* T, int width, int height)
+{
+    assert(width <= T->target_width && height <= T->target_height);
+    T->width = width;
+    T->height = height;
+    T->tiles_x = (width + T->tile_size - 1)/T->tile_size;
+    T->tiles_y = (height + T->tile_size - 1)/T->tile_size;
+}
+void update_light_tiles(LightTiles* T, LightBinner* binner,
+                        const Light* lights, int num_lights,
+                        Mat4 view_matrix, Mat4 proj_matrix)
+{
+    LightGrid   grid;
+    LightBins   bins;
+    int         rows;
+    int         ii;
+
+    assert(num_lights <= T->max_lights);
+    if(num_lights > T->max_lights)
+        num_lights = T->max_lights;
+    /* The planes of a left handed perspective projection */
+    T->near_plane = -proj_matrix.r3.z/proj_matrix.r2.z;
+    T->far_plane = proj_matrix.r3.z/(1.0f - proj_matrix.r2.z);
+
+    for(ii=0;ii<num_lights;++ii) {
+        Vec4 position = mat4_mul_vector(vec4_from_vec3(lights[ii].position, 1.0f), view_matrix);
+        position.w = lights[ii].size;
+        T->light_data[ii*2] = position;
+        T->light_data[ii*2+1] = vec4_from_vec3(lights[ii].color, 0.0f);
+        T->light_x[ii] = position.x;
+        T->light_y[ii] = position.y;
+        T->light_z[ii] = position.z;
+        T->light_radius[ii] = position.w;
+    }
+    grid.width = T->width;
+    grid.height = T->height;
+    grid.tile_size = T->tile_size;
+    grid.depth_slices = T->depth_slices;
+    grid.proj_x = proj_matrix.r0.x;
+    grid.proj_y = proj_matrix.r1.y;
+    grid.near_plane = T->near_plane;
+    grid.far_plane = T->far_plane;
+    if(num_lights < BIN_SIMD_MIN_LIGHTS)
+        bins = bin_lights_scalar(binner, &grid, T->light_x, T->light_y, T->light_z, T->light_radius, num_lights);
+    else
+        bins = bin_lights(binner, &grid, T->light_x, T->light_y, T->light_z, T->light_radius, num_lights);
+
+    /* The index texture can't be taller than GL allows, past that the
+     * lists are shortened
+     */
+    rows = (bins.num_indices + LIGHT_INDEX_WIDTH - 1)/LIGHT_INDEX_WIDTH;
+    if(rows > T->max_index_rows) {
+        bins = _cap_light_lists(T, bins, T->max_index_rows*LIGHT_INDEX_WIDTH);
+        rows = (bins.num_indices + LIGHT_INDEX_WIDTH - 1)/LIGHT_INDEX_WIDTH;
+    }
+
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, T->tile_texture));
+    ASSERT_GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, T->tiles_x, T->tiles_y*T->depth_slices,
+                              GL_RG_INTEGER, GL_UNSIGNED_INT, bins.clusters));
+
+    if(rows > T->index_rows) {
+        while(T->index_rows < rows)
+            T->index_rows = T->index_rows ? T->index_rows*2 : 16;
+        if(T->index_rows > T->max_index_rows)
+            T->index_rows = T->max_index_rows;
+        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, T->index_texture));
+        ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, LIGHT_INDEX_WIDTH, T->index_rows, 0,
+                               GL_RED_INTEGER, GL_UNSIGNED_INT, NULL));
+    }
+    _upload_rows(T->index_texture, LIGHT_INDEX_WIDTH, bins.num_indices,
+                 GL_RED_INTEGER, GL_UNSIGNED_INT, bins.indices, sizeof(uint32_t));
+    _upload_rows(T->light_texture, LIGHT_DATA_WIDTH, num_lights*2,
+                 GL_RGBA, GL_FLOAT, T->light_data, sizeof(Vec4));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, 0));
+}
+void bind_light_tiles(const LightTiles* T, int first_unit)
+{
+    ASSERT_GL(glActiveTexture(GL_TEXTURE0 + first_unit));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, T->tile_texture));
+    ASSERT_GL(glActiveTexture(GL_TEXTURE0 + first_unit + 1));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, T->index_texture));
+    ASSERT_GL(glActiveTexture(GL_TEXTURE0 + first_unit + 2));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, T->light_texture));
+}
+Vec2 light_tile_slice_params(const LightTiles* T)
+{
+    /* slice = log(z/near)/log(far/near)*slices */
+    float scale = T->depth_slices/logf(T->far_plane/T->near_plane);
+    Vec2 params;
+    params.x = scale;
+    params.y = -logf(T->near_plane)*scale;
+    return params;
+}
+void light_tile_defines(const LightTiles* T, char defines[NUM_LIGHT_TILE_DEFINES][32])
+{
+    snprintf(defines[0], 32, "TILE_SIZE=%d", T->tile_size);
+    snprintf(defines[1], 32, "DEPTH_SLICES=%d", T->depth_slices);
+    snprintf(defines[2], 32, "LIGHT_INDEX_WIDTH=%d", LIGHT_INDEX_WIDTH);
+    snprintf(defines[3], 32, "LIGHT_DATA_WIDTH=%d", LIGHT_DATA_WIDTH);
+}
@@ -0,0 +1,82 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __light_tiles_h__
+#define __light_tiles_h__
+
+#include <stdint.h>
+#include "gl_include.h"
+#include "vec_math.h"
+#include "graphics_types.h"
+#include "light_binning.h"
+
+#define LIGHT_TILE_SIZE         16  /* Pixels per screen tile side for tiled shading */
+#define LIGHT_CLUSTER_SIZE      32  /* Pixels per cluster side for clustered shading */
+#define LIGHT_CLUSTER_SLICES    16  /* Depth slices per cluster column */
+#define LIGHT_INDEX_WIDTH       1024
+#define LIGHT_DATA_WIDTH        1024
+#define NUM_LIGHT_TILE_DEFINES  4
+
+/** Lights binned on the CPU into screen tiles, or with depth slices into
+ *  3D clusters, and uploaded as textures for the shaders in
+ *  shaders/common/light_tiles.glsl:
+ *
+ *      s_LightTiles        RG32UI, per tile: first index and light count.
+ *                          Tiles are row major from the bottom left, each
+ *                          depth slice stacked above the previous.
+ *      s_LightIndices      R32UI, light indices grouped by tile
+ *      s_LightData         RGBA32F, per light: view position and size, color
+ *
+ *  Depth slices are spaced exponentially between the near and far plane, so
+ *  they stay roughly cubic in view space.
+ */
+typedef struct LightTiles LightTiles;
+
+/** @param depth_slices 1 for screen tiles
+ *  @param max_lights Most lights `update_light_tiles` is given
+ */
+LightTiles* create_light_tiles(int tile_size, int depth_slices, int max_lights);
+void destroy_light_tiles(LightTiles* T);
+/** @brief Sizes the tiles for a `width` by `height` target and bins all of it */
+void resize_light_tiles(LightTiles* T, int width, int height);
+/** @brief Bins only the bottom left `width` by `height` pixels of the target,
+ *  for rendering to a sub-rect of it
+ */
+void set_light_tiles_viewport(LightTiles* T, int width, int height);
+
+/** @brief Bins the lights into the tiles their bounds overlap and uploads
+ *  the result
+ *  @param binner Shared between every LightTiles, Graphics owns it
+ *  @param proj The symmetric perspective projection the view is drawn with
+ */
+void update_light_tiles(LightTiles* T, LightBinner* binner,
+                        const Light* lights, int num_lights,
+                        Mat4 view_matrix, Mat4 proj_matrix);
+
+/** @brief Binds the three textures to consecutive units from `first_unit` */
+void bind_light_tiles(const LightTiles* T, int first_unit);
+
+/** @return Scale and bias turning log(view depth) into a depth slice, for
+ *  the u_LightSliceParams uniform
+ */
+Vec2 light_tile_slice_params(const LightTiles* T);
+
+/** @brief Writes the TILE_SIZE, DEPTH_SLICES, LIGHT_INDEX_WIDTH and
+ *  LIGHT_DATA_WIDTH shader defines
+ */
+void light_tile_defines(const LightTiles* T, char defines[NUM_LIGHT_TILE_DEFINES][32]);
+
+#endif /* include guard */
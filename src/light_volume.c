@@ -0,0 +1,394 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "light_volume.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "assert.h"
+#include "graphics.h"
+#include "system.h"
+#include "vertex.h"
+
+/* Defines
+ */
+#define MAX_VOLUME_VERTICES (12 + 42 + 162 + 4)
+#define MAX_VOLUME_INDICES  ((20 + 80 + 320 + 2)*3)
+#define LIGHT_VOLUME_SKIPPED (LIGHT_VOLUME_LEVELS+1)   /* Bucket of scissored lights off screen */
+
+/* Types
+ */
+struct LightVolume
+{
+    GLuint  vertex_buffer;
+    GLuint  index_buffer;
+    GLuint  vertex_array;   /* ES3 only */
+    int     first_index[LIGHT_VOLUME_LEVELS+1];  /* Levels then the quad */
+    int     num_indices[LIGHT_VOLUME_LEVELS+1];
+
+    uint8_t*    buckets;    /* Level of each streamed light */
+    LightBounds* scissored_bounds;  /* Per scissored light in the last batch */
+    int         max_lights;
+};
+
+/* Constants
+ */
+#define ICO_A 0.525731112f
+#define ICO_B 0.850650808f
+static const Vec3 kIcosahedronVertices[] =
+{
+    { -ICO_A,  ICO_B,  0.0f }, {  ICO_A,  ICO_B,  0.0f }, { -ICO_A, -ICO_B,  0.0f }, {  ICO_A, -ICO_B,  0.0f },
+    {  0.0f, -ICO_A,  ICO_B }, {  0.0f,  ICO_A,  ICO_B }, {  0.0f, -ICO_A, -ICO_B }, {  0.0f,  ICO_A, -ICO_B },
+    {  ICO_B,  0.0f, -ICO_A }, {  ICO_B,  0.0f,  ICO_A }, { -ICO_B,  0.0f, -ICO_A }, { -ICO_B,  0.0f,  ICO_A },
+};
+static const uint16_t kIcosahedronIndices[] =
+{
+    0, 11, 5,   0, 5, 1,    0, 1, 7,    0, 7, 10,   0, 10, 11,
+    1, 5, 9,    5, 11, 4,   11, 10, 2,  10, 7, 6,   7, 1, 8,
+    3, 9, 4,    3, 4, 2,    3, 2, 6,    3, 6, 8,    3, 8, 9,
+    4, 9, 5,    2, 4, 11,   6, 2, 10,   8, 6, 7,    9, 8, 1,
+};
+static const Vec3 kQuadVertices[] =
+{
+    { -1.0f, -1.0f, 0.0f }, {  1.0f, -1.0f, 0.0f }, {  1.0f,  1.0f, 0.0f }, { -1.0f,  1.0f, 0.0f },
+};
+static const uint16_t kQuadIndices[] =
+{
+    0, 1, 2,    0, 2, 3,
+};
+/** Screen sizes, from `light_screen_size`, up to which each level is used */
+static const float kLevelScreenSizes[LIGHT_VOLUME_LEVELS-1] = { 0.05f, 0.2f };
+
+/* Variables
+ */
+
+/* Internal functions
+ */
+/** @return The index of the unit vector halfway between two vertices,
+ *  adding it unless an earlier triangle sharing the edge already did
+ */
+static uint16_t _midpoint(Vec3* vertices, int first, int* count, uint16_t a, uint16_t b)
+{
+    Vec3 midpoint = vec3_normalize(vec3_add(vertices[a], vertices[b]));
+    int ii;
+    for(ii=first;ii<*count;++ii) {
+        if(vec3_distance_sq(vertices[ii], midpoint) < 1e-8f)
+            return (uint16_t)(ii - first);
+    }
+    vertices[(*count)++] = midpoint;
+    return (uint16_t)(*count - 1 - first);
+}
+/** Builds every level by splitting each triangle of the previous level in
+ *  four, then pushes the vertices out until the closest face plane touches
+ *  the unit sphere. Indices are relative to their level's first vertex
+ *  until the end.
+ */
+static int _build_spheres(LightVolume* V, Vec3* vertices, uint16_t* indices)
+{
+    int first_vertex[LIGHT_VOLUME_LEVELS];
+    int num_vertices = 0;
+    int num_indices = 0;
+    int level, ii;
+
+    memcpy(vertices, kIcosahedronVertices, sizeof(kIcosahedronVertices));
+    memcpy(indices, kIcosahedronIndices, sizeof(kIcosahedronIndices));
+    first_vertex[0] = 0;
+    num_vertices = sizeof(kIcosahedronVertices)/sizeof(kIcosahedronVertices[0]);
+    V->first_index[0] = 0;
+    V->num_indices[0] = sizeof(kIcosahedronIndices)/sizeof(kIcosahedronIndices[0]);
+    num_indices = V->num_indices[0];
+
+    for(level=1;level<LIGHT_VOLUME_LEVELS;++level) {
+        const Vec3*     parent_vertices = vertices + first_vertex[level-1];
+        const uint16_t* parent = indices + V->first_index[level-1];
+        int             parent_count = num_vertices - first_vertex[level-1];
+
+        first_vertex[level] = num_vertices;
+        memcpy(vertices + num_vertices, parent_vertices, parent_count*sizeof(Vec3));
+        num_vertices += parent_count;
+        V->first_index[level] = num_indices;
+        for(ii=0;ii<V->num_indices[level-1];ii+=3) {
+            uint16_t a = parent[ii+0] , b = parent[ii+1], c = parent[ii+2];
+            uint16_t ab = _midpoint(vertices, first_vertex[level], &num_vertices, (uint16_t)(first_vertex[level] + a), (uint16_t)(first_vertex[level] + b));
+            uint16_t bc = _midpoint(vertices, first_vertex[level], &num_vertices, (uint16_t)(first_vertex[level] + b), (uint16_t)(first_vertex[level] + c));
+            uint16_t ca = _midpoint(vertices, first_vertex[level], &num_vertices, (uint16_t)(first_vertex[level] + c), (uint16_t)(first_vertex[level] + a));
+            uint16_t* out = indices + num_indices;
+            out[0] = a;  out[1] = ab; out[2] = ca;
+            out[3] = ab; out[4] = b;  out[5] = bc;
+            out[6] = ca; out[7] = bc; out[8] = c;
+            out[9] = ab; out[10] = bc; out[11] = ca;
+            num_indices += 12;
+        }
+        V->num_indices[level] = num_indices - V->first_index[level];
+    }
+    assert(num_vertices <= MAX_VOLUME_VERTICES && num_indices <= MAX_VOLUME_INDICES);
+
+    for(level=0;level<LIGHT_VOLUME_LEVELS;++level) {
+        int         last_vertex = level+1 < LIGHT_VOLUME_LEVELS ? first_vertex[level+1] : num_vertices;
+        uint16_t*   level_indices = indices + V->first_index[level];
+        float       inradius = 1.0f;
+
+        for(ii=0;ii<V->num_indices[level];ii+=3) {
+            Vec3*   a = &vertices[first_vertex[level] + level_indices[ii+0]];
+            Vec3*   b = &vertices[first_vertex[level] + level_indices[ii+1]];
+            Vec3*   c = &vertices[first_vertex[level] + level_indices[ii+2]];
+            Vec3    normal = vec3_normalize(vec3_cross(vec3_sub(*b, *a), vec3_sub(*c, *a)));
+            float   distance = vec3_dot(normal, *a);
+
+            /* Face out like the clockwise front faces of the meshes */
+            if(distance < 0.0f) {
+                uint16_t swap = level_indices[ii+1];
+                level_indices[ii+1] = level_indices[ii+2];
+                level_indices[ii+2] = swap;
+                distance = -distance;
+            }
+            if(distance < inradius)
+                inradius = distance;
+        }
+        for(ii=first_vertex[level];ii<last_vertex;++ii)
+            vertices[ii] = vec3_mul_scalar(vertices[ii], 1.0f/inradius);
+        for(ii=0;ii<V->num_indices[level];++ii)
+            level_indices[ii] = (uint16_t)(level_indices[ii] + first_vertex[level]);
+    }
+    return num_vertices;
+}
+
+/* External functions
+ */
+LightVolume* create_light_volume(int vertex_arrays, int max_lights)
+{
+    LightVolume*    V = (LightVolume*)calloc(1, sizeof(LightVolume));
+    Vec3            vertices[MAX_VOLUME_VERTICES];
+    uint16_t        indices[MAX_VOLUME_INDICES];
+    int             num_vertices = _build_spheres(V, vertices, indices);
+    int             num_indices = V->first_index[LIGHT_VOLUME_LEVELS-1] + V->num_indices[LIGHT_VOLUME_LEVELS-1];
+    int             ii;
+
+    V->buckets = (uint8_t*)malloc(max_lights + 1);
+    V->scissored_bounds = (LightBounds*)malloc(max_lights*sizeof(LightBounds) + 1);
+    V->max_lights = max_lights;
+    if(V->buckets == NULL || V->scissored_bounds == NULL) {
+        system_log("Couldn't allocate light volumes for %d lights\n", max_lights);
+        V->max_lights = 0;
+    }
+    V->first_index[LIGHT_VOLUME_QUAD] = num_indices;
+    V->num_indices[LIGHT_VOLUME_QUAD] = sizeof(kQuadIndices)/sizeof(kQuadIndices[0]);
+    for(ii=0;ii<V->num_indices[LIGHT_VOLUME_QUAD];++ii)
+        indices[num_indices++] = (uint16_t)(kQuadIndices[ii] + num_vertices);
+    memcpy(vertices + num_vertices, kQuadVertices, sizeof(kQuadVertices));
+    num_vertices += sizeof(kQuadVertices)/sizeof(kQuadVertices[0]);
+
+    ASSERT_GL(glGenBuffers(1, &V->vertex_buffer));
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, V->vertex_buffer));
+    ASSERT_GL(glBufferData(GL_ARRAY_BUFFER, num_vertices*sizeof(Vec3), vertices, GL_STATIC_DRAW));
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+    ASSERT_GL(glGenBuffers(1, &V->index_buffer));
+    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, V->index_buffer));
+    ASSERT_GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices*sizeof(uint16_t), indices, GL_STATIC_DRAW));
+    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+
+    if(vertex_arrays) {
+        /* The light attributes are instanced, their pointers are set per draw */
+        ASSERT_GL(glGenVertexArrays(1, &V->vertex_array));
+        ASSERT_GL(glBindVertexArray(V->vertex_array));
+        ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, V->vertex_buffer));
+        ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, V->index_buffer));
+        ASSERT_GL(glVertexAttribPointer(kPositionSlot, 3, GL_FLOAT, GL_FALSE, sizeof(Vec3), (void*)0));
+        ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
+        ASSERT_GL(glEnableVertexAttribArray(kLightPositionSlot));
+        ASSERT_GL(glEnableVertexAttribArray(kLightColorSlot));
+        ASSERT_GL(glEnableVertexAttribArray(kLightSizeSlot));
+        ASSERT_GL(glVertexAttribDivisor(kLightPositionSlot, 1));
+        ASSERT_GL(glVertexAttribDivisor(kLightColorSlot, 1));
+        ASSERT_GL(glVertexAttribDivisor(kLightSizeSlot, 1));
+        ASSERT_GL(glBindVertexArray(0));
+        ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    }
+    return V;
+}
+void destroy_light_volume(LightVolume* V)
+{
+    if(V->vertex_array)
+        ASSERT_GL(glDeleteVertexArrays(1, &V->vertex_array));
+    ASSERT_GL(glDeleteBuffers(1, &V->vertex_buffer));
+    ASSERT_GL(glDeleteBuffers(1, &V->index_buffer));
+    free(V->buckets);
+    free(V->scissored_bounds);
+    free(V);
+}
+int light_volume_level(float screen_size)
+{
+    int level = 0;
+    while(level < LIGHT_VOLUME_LEVELS-1 && screen_size > kLevelScreenSizes[level])
+        ++level;
+    return level;
+}
+LightVolumeBatch stream_light_volumes(LightVolume* V, StreamBuffer* stream,
+                                      const Light* lights, int num_lights,
+                                      Mat4 view_matrix, Mat4 proj_matrix, int width, int height)
+{
+    uint8_t*        buckets = V->buckets;
+    LightBounds*    scissored_bounds = V->scissored_bounds;
+    int             next[LIGHT_VOLUME_LEVELS+1] = {0};
+    int             num_scissored = 0;
+    int             total = 0;
+    LightVolumeBatch batch;
+    GLintptr        offset;
+    Light*          data;
+    float           screen_pixels = (float)width*height;
+    int             ii;
+
+    memset(&batch, 0, sizeof(batch));
+    assert(num_lights <= V->max_lights);
+    if(num_lights > V->max_lights)
+        num_lights = V->max_lights;
+    if(num_lights == 0)
+        return batch;
+
+    /* Count the lights per level, those drawn alone in the last bucket.
+     * Their bounds are found here too, those off screen aren't streamed.
+     */
+    for(ii=0;ii<num_lights;++ii) {
+        Vec3  center = light_view_center(lights[ii], view_matrix);
+        float size = light_screen_size(center, lights[ii].size, proj_matrix);
+        if(size >= LARGE_LIGHT_SIZE || classify_light(center, lights[ii].size, proj_matrix) != kLightOutside) {
+            LightBounds* bounds = &scissored_bounds[num_scissored];
+            if(!light_bounds(center, lights[ii].size, proj_matrix, width, height, bounds)) {
+                buckets[ii] = LIGHT_VOLUME_SKIPPED;
+                continue;
+            }
+            buckets[ii] = LIGHT_VOLUME_LEVELS;
+            batch.pixels += (float)bounds->width*bounds->height;
+            num_scissored++;
+        } else {
+            float pixels = kPi*(size*height)*(size*height);
+            buckets[ii] = (uint8_t)light_volume_level(size);
+            batch.pixels += pixels < screen_pixels ? pixels : screen_pixels;
+        }
+        next[buckets[ii]]++;
+    }
+    for(ii=0;ii<=LIGHT_VOLUME_LEVELS;++ii) {
+        int count = next[ii];
+        if(ii < LIGHT_VOLUME_LEVELS) {
+            batch.first[ii] = total;
+            batch.count[ii] = count;
+        } else {
+            batch.first_scissored = total;
+        }
+        next[ii] = total;
+        total += count;
+    }
+
+    if(total == 0)
+        return batch;
+
+    data = (Light*)map_stream(stream, total*sizeof(Light), sizeof(float), &batch.buffer, &offset);
+    if(data == NULL) {
+        memset(&batch, 0, sizeof(batch));
+        return batch;
+    }
+    for(ii=0;ii<num_lights;++ii) {
+        if(buckets[ii] <= LIGHT_VOLUME_LEVELS)
+            data[next[buckets[ii]]++] = lights[ii];
+    }
+    unmap_stream(stream);
+    batch.num_scissored = num_scissored;
+    batch.base = (char*)0 + offset;
+    return batch;
+}
+void draw_light_volumes(const LightVolume* V, const LightVolumeBatch* batch, int level, int first, int count)
+{
+    char* base = batch->base + first*sizeof(Light);
+
+    /* The vertex array holds the sphere and enables the instance attributes,
+     * only their pointers into this frame's stream change
+     */
+    ASSERT_GL(glBindVertexArray(V->vertex_array));
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, batch->buffer));
+    ASSERT_GL(glVertexAttribPointer(kLightPositionSlot, 3, GL_FLOAT, GL_FALSE, sizeof(Light), base + offsetof(Light, position)));
+    ASSERT_GL(glVertexAttribPointer(kLightColorSlot, 3, GL_FLOAT, GL_FALSE, sizeof(Light), base + offsetof(Light, color)));
+    ASSERT_GL(glVertexAttribPointer(kLightSizeSlot, 1, GL_FLOAT, GL_FALSE, sizeof(Light), base + offsetof(Light, size)));
+    ASSERT_GL(glDrawElementsInstanced(GL_TRIANGLES, V->num_indices[level], GL_UNSIGNED_SHORT,
+                                      (char*)0 + V->first_index[level]*sizeof(uint16_t), count));
+    ASSERT_GL(glBindVertexArray(0));
+}
+int draw_scissored_lights(const LightVolume* V, const LightVolumeBatch* batch,
+                          GLuint light_program, GLuint fullscreen_program, GLuint stencil_program,
+                          int* num_light_classes)
+{
+    int num_stencil_lights = 0;
+    int ii;
+
+    ASSERT_GL(glEnable(GL_SCISSOR_TEST));
+    for(ii=0;ii<batch->num_scissored;++ii) {
+        const LightBounds* bounds = &V->scissored_bounds[ii];
+        int light = batch->first_scissored + ii;
+
+        ASSERT_GL(glScissor(bounds->x, bounds->y, bounds->width, bounds->height));
+        num_light_classes[bounds->light_class]++;
+        if(bounds->light_class == kLightInside) {
+            ASSERT_GL(glUseProgram(fullscreen_program));
+            draw_light_volumes(V, batch, LIGHT_VOLUME_QUAD, light, 1);
+        } else if(bounds->light_class == kLightNearPlane) {
+            ASSERT_GL(glUseProgram(fullscreen_program));
+            ASSERT_GL(glDisable(GL_DEPTH_TEST));
+            draw_light_volumes(V, batch, LIGHT_VOLUME_QUAD, light, 1);
+            ASSERT_GL(glEnable(GL_DEPTH_TEST));
+        } else if(stencil_program) {
+            /* Back faces behind the geometry increment the stencil and front
+             * faces behind it decrement again, leaving the pixels whose
+             * geometry lies inside the volume marked. Those are then shaded
+             * through the back faces, clearing their stencil for the next
+             * light.
+             */
+            ASSERT_GL(glEnable(GL_STENCIL_TEST));
+            ASSERT_GL(glUseProgram(stencil_program));
+            ASSERT_GL(glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE));
+            ASSERT_GL(glDisable(GL_CULL_FACE));
+            ASSERT_GL(glDepthFunc(GL_LESS));
+            ASSERT_GL(glStencilFunc(GL_ALWAYS, 0, 0xFF));
+            ASSERT_GL(glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP));
+            ASSERT_GL(glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP));
+            draw_light_volumes(V, batch, LIGHT_VOLUME_LEVELS-1, light, 1);
+
+            ASSERT_GL(glUseProgram(light_program));
+            ASSERT_GL(glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
+            ASSERT_GL(glEnable(GL_CULL_FACE));
+            ASSERT_GL(glDepthFunc(GL_ALWAYS));
+            ASSERT_GL(glStencilFunc(GL_NOTEQUAL, 0, 0xFF));
+            ASSERT_GL(glStencilOp(GL_KEEP, GL_ZERO, GL_ZERO));
+            draw_light_volumes(V, batch, LIGHT_VOLUME_LEVELS-1, light, 1);
+            ASSERT_GL(glDepthFunc(GL_GEQUAL));
+            ASSERT_GL(glDisable(GL_STENCIL_TEST));
+            num_stencil_lights++;
+        } else {
+            ASSERT_GL(glUseProgram(light_program));
+            draw_light_volumes(V, batch, LIGHT_VOLUME_LEVELS-1, light, 1);
+        }
+    }
+    ASSERT_GL(glDisable(GL_SCISSOR_TEST));
+    return num_stencil_lights;
+}
+void draw_light_volume(const LightVolume* V, int level)
+{
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, V->vertex_buffer));
+    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, V->index_buffer));
+    ASSERT_GL(glVertexAttribPointer(kPositionSlot, 3, GL_FLOAT, GL_FALSE, sizeof(Vec3), (void*)0));
+    ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
+    ASSERT_GL(glDrawElements(GL_TRIANGLES, V->num_indices[level], GL_UNSIGNED_SHORT,
+                             (char*)0 + V->first_index[level]*sizeof(uint16_t)));
+}
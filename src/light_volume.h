@@ -0,0 +1,93 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __light_volume_h__
+#define __light_volume_h__
+
+#include "gl_include.h"
+#include "vec_math.h"
+#include "graphics.h"
+
+/** Point light volumes drawn by the deferred renderers: icospheres at
+ *  several tessellation levels, scaled so every face lies outside the unit
+ *  sphere. The vertex shader scales them by the light size and moves them
+ *  to the light.
+ */
+#define LIGHT_VOLUME_LEVELS 3
+/** Not a level but a quad covering the screen, for FULLSCREEN=1 shaders */
+#define LIGHT_VOLUME_QUAD LIGHT_VOLUME_LEVELS
+
+typedef struct LightVolume LightVolume;
+
+/** Lights streamed as instance data, grouped by the level they are drawn
+ *  with. Lights covering at least LARGE_LIGHT_SIZE of the screen or not
+ *  entirely in front of the camera come last, for the renderer to draw one
+ *  at a time scissored to their bounds.
+ */
+typedef struct LightVolumeBatch
+{
+    GLuint  buffer;
+    char*   base;                           /* Offset of the first light in `buffer` */
+    int     first[LIGHT_VOLUME_LEVELS];
+    int     count[LIGHT_VOLUME_LEVELS];
+    int     first_scissored;
+    int     num_scissored;
+    float   pixels;                         /* Estimated pixels covered by every light */
+} LightVolumeBatch;
+
+/** @param vertex_arrays Non-zero on ES3, to capture the sphere and the
+ *      instanced light attributes in a vertex array
+ *  @param max_lights Most lights `stream_light_volumes` is given
+ */
+LightVolume* create_light_volume(int vertex_arrays, int max_lights);
+void destroy_light_volume(LightVolume* V);
+
+/** @return The coarsest level that stays close to a sphere at `screen_size`,
+ *      see `light_screen_size`
+ */
+int light_volume_level(float screen_size);
+
+/** @brief Sorts the lights by level and streams them
+ *
+ *  The bounds of each light drawn alone in a `width` by `height` target are
+ *  kept for `draw_scissored_lights`. Those entirely off screen are dropped.
+ */
+LightVolumeBatch stream_light_volumes(LightVolume* V, StreamBuffer* stream,
+                                      const Light* lights, int num_lights,
+                                      Mat4 view_matrix, Mat4 proj_matrix, int width, int height);
+/** @brief Draws `count` streamed lights from `first` with one instanced draw,
+ *  ES3 only
+ */
+void draw_light_volumes(const LightVolume* V, const LightVolumeBatch* batch, int level, int first, int count);
+/** @brief Draws the scissored lights of `batch` one at a time, ES3 only
+ *
+ *  Lights around the camera or cut by the near plane draw a quad with
+ *  `fullscreen_program` instead of their volume. Nothing is in front of an
+ *  inside light for the stencil to reject, and a clipped volume would leave
+ *  holes, so near plane lights also skip the depth test.
+ *  @param stencil_program Marks the pixels inside each remaining volume for
+ *      `light_program` to shade, 0 to shade every pixel it covers. Needs a
+ *      stencil buffer.
+ *  @param num_light_classes Incremented per LightClass drawn
+ *  @return Lights drawn with a stencil pass
+ */
+int draw_scissored_lights(const LightVolume* V, const LightVolumeBatch* batch,
+                          GLuint light_program, GLuint fullscreen_program, GLuint stencil_program,
+                          int* num_light_classes);
+/** @brief Draws a single volume with the current uniforms, for ES2 */
+void draw_light_volume(const LightVolume* V, int level);
+
+#endif /* include guard */
@@ -0,0 +1,142 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "low_res_lighting.h"
+#include <stdlib.h>
+#include "assert.h"
+#include "graphics.h"
+#include "system.h"
+
+/* Defines
+ */
+
+/* Types
+ */
+struct LowResLighting
+{
+    int width;          /* Rendered to, the bottom left of the buffers */
+    int height;
+    int target_width;   /* Size of the buffers, half the full resolution */
+    int target_height;
+
+    GLuint  depth_framebuffer;
+    GLuint  depth_texture;
+    GLuint  light_framebuffer;
+    GLuint  light_texture;
+};
+
+/* Constants
+ */
+
+/* Variables
+ */
+
+/* Internal functions
+ */
+static void _create_texture(GLuint* texture)
+{
+    ASSERT_GL(glGenTextures(1, texture));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, *texture));
+    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    ASSERT_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+}
+static void _attach_texture(GLuint framebuffer, GLuint texture)
+{
+    GLenum framebuffer_status;
+    ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+    ASSERT_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0));
+    framebuffer_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if(framebuffer_status != GL_FRAMEBUFFER_COMPLETE) {
+        system_log("%s:%d Framebuffer error: %s\n", __FILE__, __LINE__, _glStatusString(framebuffer_status));
+        assert(0);
+    }
+}
+
+/* External functions
+ */
+LowResLighting* create_low_res_lighting(const Graphics* G)
+{
+    LowResLighting* L;
+
+    if(!graphics_supports_float_targets(G))
+        return NULL;
+
+    L = (LowResLighting*)calloc(1, sizeof(LowResLighting));
+    ASSERT_GL(glGenFramebuffers(1, &L->depth_framebuffer));
+    ASSERT_GL(glGenFramebuffers(1, &L->light_framebuffer));
+    _create_texture(&L->depth_texture);
+    _create_texture(&L->light_texture);
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, 0));
+    return L;
+}
+void destroy_low_res_lighting(LowResLighting* L)
+{
+    if(L == NULL)
+        return;
+    ASSERT_GL(glDeleteFramebuffers(1, &L->depth_framebuffer));
+    ASSERT_GL(glDeleteFramebuffers(1, &L->light_framebuffer));
+    ASSERT_GL(glDeleteTextures(1, &L->depth_texture));
+    ASSERT_GL(glDeleteTextures(1, &L->light_texture));
+    free(L);
+}
+void resize_low_res_lighting(LowResLighting* L, int width, int height)
+{
+    L->width = L->target_width = (width + 1)/2;
+    L->height = L->target_height = (height + 1)/2;
+
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, L->depth_texture));
+    ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, L->target_width, L->target_height, 0, GL_RGBA, GL_HALF_FLOAT, 0));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, L->light_texture));
+    ASSERT_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, L->target_width, L->target_height, 0, GL_RGBA, GL_HALF_FLOAT, 0));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, 0));
+
+    _attach_texture(L->depth_framebuffer, L->depth_texture);
+    _attach_texture(L->light_framebuffer, L->light_texture);
+    ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+}
+void begin_low_res_lighting(LowResLighting* L, int width, int height, int divisor, int unit)
+{
+    L->width = (width + divisor - 1)/divisor;
+    L->height = (height + divisor - 1)/divisor;
+    assert(divisor >= 2 && L->width <= L->target_width && L->height <= L->target_height);
+
+    /* Every texel is written, nothing is loaded */
+    ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, L->depth_framebuffer));
+    ASSERT_GL(glViewport(0, 0, L->width, L->height));
+    ASSERT_GL(glDrawArrays(GL_TRIANGLES, 0, 3));
+
+    /* Lights add up from black */
+    ASSERT_GL(glBindFramebuffer(GL_FRAMEBUFFER, L->light_framebuffer));
+    ASSERT_GL(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
+    ASSERT_GL(glClear(GL_COLOR_BUFFER_BIT));
+    ASSERT_GL(glActiveTexture(GL_TEXTURE0+unit));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, L->depth_texture));
+}
+void bind_low_res_lighting(const LowResLighting* L, int first_unit)
+{
+    ASSERT_GL(glActiveTexture(GL_TEXTURE0+first_unit));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, L->light_texture));
+    ASSERT_GL(glActiveTexture(GL_TEXTURE0+first_unit+1));
+    ASSERT_GL(glBindTexture(GL_TEXTURE_2D, L->depth_texture));
+}
+void low_res_lighting_size(const LowResLighting* L, int* width, int* height)
+{
+    *width = L->width;
+    *height = L->height;
+}
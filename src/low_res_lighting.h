@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef __low_res_lighting_h__
+#define __low_res_lighting_h__
+
+#include "gl_include.h"
+#include "graphics.h"
+
+#define MAX_LIGHT_DIVISOR 4 /* Quarter resolution */
+
+/** Light accumulation below the screen resolution for the light volume
+ *  renderers. Diffuse point lighting changes slowly across a surface, so
+ *  it is lit at 1/divisor of the resolution and upsampled:
+ *
+ *      depth   RGBA16F, per block of divisor by divisor pixels: the min and
+ *              max view depth and the octahedral normal of the one lit.
+ *              Even checkerboard texels are lit at the min, odd ones at the
+ *              max, so both sides of a depth edge have samples nearby.
+ *      light   RGBA16F, the lights added up without a depth test, there
+ *              is no depth buffer at this size. Float so overlapping lights
+ *              don't saturate before the albedo is applied.
+ *
+ *  The full resolution pass upsamples with shaders/common/low_res_lighting.glsl,
+ *  which weights the nearest texels by how well their depth and normal match.
+ *  ES3 with a float color buffer extension only.
+ */
+typedef struct LowResLighting LowResLighting;
+
+/** @return NULL if the depth buffer format can't be rendered to, see
+ *  `graphics_supports_float_targets`
+ */
+LowResLighting* create_low_res_lighting(const Graphics* G);
+void destroy_low_res_lighting(LowResLighting* L);
+/** @brief Allocates the buffers for a `width` by `height` target at half
+ *  resolution, larger divisors render to the bottom left of them
+ */
+void resize_low_res_lighting(LowResLighting* L, int width, int height);
+
+/** @brief Reduces the bottom left `width` by `height` pixels of the
+ *  G-buffer by `divisor` with the bound program, a fullscreen triangle,
+ *  then binds the light buffer cleared to black with the reduced depth on
+ *  `unit` for the light shaders
+ */
+void begin_low_res_lighting(LowResLighting* L, int width, int height, int divisor, int unit);
+/** @brief Binds the light buffer to `first_unit` and the reduced depth to
+ *  the next, for upsampling
+ */
+void bind_low_res_lighting(const LowResLighting* L, int first_unit);
+
+/** @brief Gets the part of the light buffer the last
+ *  `begin_low_res_lighting` renders to
+ */
+void low_res_lighting_size(const LowResLighting* L, int* width, int* height);
+
+#endif /* include guard */
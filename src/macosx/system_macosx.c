@@ -35,6 +35,11 @@
 
 /* Internal functions
  */
+static void _cache_path(char* path, size_t path_size, const char* name)
+{
+    const char* directory = getenv("TMPDIR");
+    snprintf(path, path_size, "%s/%s", directory ? directory : "/tmp", name);
+}
 
 /* External functions
  */
@@ -60,6 +65,45 @@ void free_file_data(void* data)
 {
     free(data);
 }
+int load_cache_data(const char* name, void** data, size_t* data_size)
+{
+    char    path[512];
+    FILE*   file;
+    long    file_size;
+
+    _cache_path(path, sizeof(path), name);
+    file = fopen(path, "rb");
+    if(file == NULL)
+        return -1;
+
+    fseek(file, 0, SEEK_END);
+    file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    *data = malloc(file_size);
+    *data_size = file_size;
+    if(fread(*data, file_size, 1, file) != 1) {
+        free(*data);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    return 0;
+}
+int save_cache_data(const char* name, const void* data, size_t data_size)
+{
+    char    path[512];
+    FILE*   file;
+    size_t  written;
+
+    _cache_path(path, sizeof(path), name);
+    file = fopen(path, "wb");
+    if(file == NULL)
+        return -1;
+    written = fwrite(data, data_size, 1, file);
+    fclose(file);
+    return written == 1 ? 0 : -1;
+}
 void system_log(const char* format, ...)
 {
     va_list args;
@@ -27,7 +27,10 @@ struct Mesh
 {
     GLuint      vertex_buffer;
     GLuint      index_buffer;
+    GLuint      vertex_array;   /* Layout and buffers, 0 on ES2 */
     int         index_count;
+    Bounds      bounds;
+    int         id;
 };
 
 /* Constants
@@ -35,9 +38,50 @@ struct Mesh
 
 /* Variables
  */
+static int _next_mesh_id = 0;
 
 /* Internal functions
  */
+/** Binds the buffers and points and enables the Vertex attributes */
+static void _setup_layout(const Mesh* M)
+{
+    float* ptr = 0;
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, M->vertex_buffer));
+    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, M->index_buffer));
+    ASSERT_GL(glVertexAttribPointer(kPositionSlot,    3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(ptr+=0)));
+    ASSERT_GL(glVertexAttribPointer(kNormalSlot,      3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(ptr+=3)));
+    ASSERT_GL(glVertexAttribPointer(kTangentSlot,     3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(ptr+=3)));
+    ASSERT_GL(glVertexAttribPointer(kBitangentSlot,   3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(ptr+=3)));
+    ASSERT_GL(glVertexAttribPointer(kTexCoordSlot,    2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(ptr+=3)));
+    ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
+    ASSERT_GL(glEnableVertexAttribArray(kNormalSlot));
+    ASSERT_GL(glEnableVertexAttribArray(kTangentSlot));
+    ASSERT_GL(glEnableVertexAttribArray(kBitangentSlot));
+    ASSERT_GL(glEnableVertexAttribArray(kTexCoordSlot));
+}
+static Bounds _calculate_bounds(const Vertex* vertices, int vertex_count)
+{
+    Bounds  bounds = {{0,0,0},{0,0,0},0};
+    Vec3    min, max;
+    float   radius_sq = 0.0f;
+    int     ii;
+
+    if(vertex_count == 0)
+        return bounds;
+    min = max = vertices[0].position;
+    for(ii=1;ii<vertex_count;++ii) {
+        min = vec3_min(min, vertices[ii].position);
+        max = vec3_max(max, vertices[ii].position);
+    }
+    bounds.center = vec3_mul_scalar(vec3_add(min, max), 0.5f);
+    bounds.extents = vec3_mul_scalar(vec3_sub(max, min), 0.5f);
+
+    /* Sphere around the box center, tighter than the box's corner */
+    for(ii=0;ii<vertex_count;++ii)
+        radius_sq = fmaxf(radius_sq, vec3_distance_sq(vertices[ii].position, bounds.center));
+    bounds.radius = sqrtf(radius_sq);
+    return bounds;
+}
 
 /* External functions
  */
@@ -66,23 +110,64 @@ Mesh* create_mesh(const Vertex* vertex_data, size_t vertex_data_size,
     mesh->vertex_buffer = vertex_buffer;
     mesh->index_buffer = index_buffer;
     mesh->index_count = index_count;
+    mesh->bounds = _calculate_bounds(vertex_data, (int)(vertex_data_size/sizeof(Vertex)));
+    mesh->id = _next_mesh_id++;
+
+    /* Create vertex array. Every pass reads the same Vertex layout, plus the
+     * instanced world matrix whose pointer moves each batch
+     */
+    if(gl_major_version() >= 3) {
+        int ii;
+        ASSERT_GL(glGenVertexArrays(1, &mesh->vertex_array));
+        ASSERT_GL(glBindVertexArray(mesh->vertex_array));
+        _setup_layout(mesh);
+        for(ii=0;ii<4;++ii) {
+            ASSERT_GL(glEnableVertexAttribArray(kWorldSlot+ii));
+            ASSERT_GL(glVertexAttribDivisor(kWorldSlot+ii, 1));
+        }
+        ASSERT_GL(glBindVertexArray(0));
+        ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    }
 
     return mesh;
 }
 void draw_mesh(const Mesh* M)
 {
-    float* ptr = 0;
-    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, M->vertex_buffer));
-    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, M->index_buffer));
-    ASSERT_GL(glVertexAttribPointer(kPositionSlot,    3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(ptr+=0)));
-    ASSERT_GL(glVertexAttribPointer(kNormalSlot,      3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(ptr+=3)));
-    ASSERT_GL(glVertexAttribPointer(kTangentSlot,     3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(ptr+=3)));
-    ASSERT_GL(glVertexAttribPointer(kBitangentSlot,   3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(ptr+=3)));
-    ASSERT_GL(glVertexAttribPointer(kTexCoordSlot,    2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(ptr+=3)));
+    bind_mesh(M);
+    draw_bound_mesh(M);
+}
+void bind_mesh(const Mesh* M)
+{
+    if(M->vertex_array)
+        ASSERT_GL(glBindVertexArray(M->vertex_array));
+    else
+        _setup_layout(M);
+}
+void unbind_mesh(void)
+{
+    if(gl_major_version() >= 3)
+        ASSERT_GL(glBindVertexArray(0));
+}
+void draw_bound_mesh(const Mesh* M)
+{
     ASSERT_GL(glDrawElements(GL_TRIANGLES, M->index_count, GL_UNSIGNED_INT, NULL));
 }
+void draw_bound_mesh_instanced(const Mesh* M, int instance_count)
+{
+    ASSERT_GL(glDrawElementsInstanced(GL_TRIANGLES, M->index_count, GL_UNSIGNED_INT, NULL, instance_count));
+}
+Bounds mesh_bounds(const Mesh* M)
+{
+    return M->bounds;
+}
+int mesh_id(const Mesh* M)
+{
+    return M->id;
+}
 void destroy_mesh(Mesh* M)
 {
+    if(M->vertex_array)
+        ASSERT_GL(glDeleteVertexArrays(1,&M->vertex_array));
     ASSERT_GL(glDeleteBuffers(1,&M->vertex_buffer));
     ASSERT_GL(glDeleteBuffers(1,&M->index_buffer));
     free(M);
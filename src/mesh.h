@@ -27,6 +27,22 @@ Mesh* create_mesh(const Vertex* vertex_data, size_t vertex_data_size,
                   const uint32_t* index_data, size_t index_data_size,
                   int index_count);
 void draw_mesh(const Mesh* M);
+/** @brief Binds the mesh's vertex array, or on ES2 its buffers and vertex
+ *  layout, so consecutive draws of the same mesh can use `draw_bound_mesh`.
+ *  The vertex array also enables the instanced world matrix, whose pointer
+ *  the caller sets.
+ */
+void bind_mesh(const Mesh* M);
+/** @brief Binds the default vertex array after the last mesh draw, so later
+ *  attribute setup can't change a mesh's vertex array
+ */
+void unbind_mesh(void);
+void draw_bound_mesh(const Mesh* M);
+void draw_bound_mesh_instanced(const Mesh* M, int instance_count);
+/** @return Object space bounds, computed from the vertices at creation */
+Bounds mesh_bounds(const Mesh* M);
+/** @return A small unique id, in creation order */
+int mesh_id(const Mesh* M);
 void destroy_mesh(Mesh* M);
 
 #endif /* include guard */
@@ -15,16 +15,64 @@
 /////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "program.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "gl_include.h"
 #include "system.h"
 #include "vertex.h"
+#include "timer.h"
 #include "assert.h"
+#if defined(__ANDROID__)
+    #include <EGL/egl.h>
+#endif
 
 /* Defines
  */
+#define PROGRAM_CACHE_MAGIC 0x4e494250 /* "PBIN" */
+#define MAX_INCLUDE_DEPTH   8
+#define MAX_INCLUDED_FILES  32
+#define MAX_PENDING_PROGRAMS 64
 
 /* Types
  */
+typedef struct ProgramCacheHeader
+{
+    uint32_t    magic;
+    uint32_t    format;
+    uint32_t    length;
+    float       compile_time;   /* Seconds the source compile took */
+} ProgramCacheHeader;
+
+/** Shader source being assembled by the preprocessor */
+typedef struct ShaderSource
+{
+    char*   data;
+    size_t  size;
+    size_t  capacity;
+
+    char    included[MAX_INCLUDED_FILES][128];
+    int     num_included;
+} ShaderSource;
+
+/** Program that has been submitted to the driver but not yet checked or
+ *  warmed up
+ */
+typedef struct PendingProgram
+{
+    GLuint      program;
+    GLuint      vertex_shader;      /* 0 once linked, or if loaded from the cache */
+    GLuint      fragment_shader;
+    char        vertex_shader_filename[128];
+    char        fragment_shader_filename[128];
+    char*       vertex_source_files;    /* Source string legend for the compile log */
+    char*       fragment_source_files;
+    uint64_t    hash;
+    int         save_to_cache;
+    double      submit_time;
+} PendingProgram;
+
+typedef void (*MaxShaderCompilerThreadsProc)(GLuint count);
 
 /* Constants
  */
@@ -35,53 +83,446 @@ static const char* kAttributeSlotNames[] =
     "a_Tangent",    /* kTangentSlot */
     "a_Bitangent",  /* kBitangentSlot */
     "a_TexCoord",   /* kTexCoordSlot */
+    "a_World",      /* kWorldSlot */
+    NULL,           /* Remaining a_World columns */
+    NULL,
+    NULL,
+    "a_LightPosition",  /* kLightPositionSlot */
+    "a_LightColor",     /* kLightColorSlot */
+    "a_LightSize",      /* kLightSizeSlot */
 };
 
+/** ES3 contexts compile the GLSL ES 1.00 sources as 3.00, so they can use
+ *  uniform blocks. The prologue maps the 1.00 keywords and built-ins.
+ */
+static const char kVertexPrologue[] =
+    "#version 300 es\n"
+    "#define attribute in\n"
+    "#define varying out\n";
+static const char kFragmentPrologue[] =
+    "#version 300 es\n"
+    "#define varying in\n"
+    "#define texture2D texture\n"
+    "layout(location = 0) out mediump vec4 o_FragData[4];\n"
+    "#define gl_FragData o_FragData\n"
+    "#define gl_FragColor o_FragData[0]\n";
+
 /* Variables
  */
+static ProgramCacheStats _cache_stats = {0};
+static PendingProgram   _pending[MAX_PENDING_PROGRAMS];
+static int              _num_pending = 0;
+static Timer*           _submit_timer = NULL;
+static int              _parallel_compile = -1; /* -1 until the extension is queried */
+static double           _last_finish_time = 0.0;
+static GLuint*          _failed = NULL;     /* Failed to build, until destroyed */
+static int              _num_failed = 0;
+static int              _max_failed = 0;
 
 /* Internal functions
  */
-static GLuint _load_shader(const char* filename, GLenum type)
+static uint64_t _hash_data(uint64_t hash, const void* data, size_t size)
 {
-    char*   data = NULL;
+    const uint8_t* bytes = (const uint8_t*)data;
+    size_t ii;
+    /* FNV-1a */
+    for(ii=0;ii<size;++ii) {
+        hash ^= bytes[ii];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+static uint64_t _hash_string(uint64_t hash, const char* string)
+{
+    if(string == NULL)
+        return hash;
+    return _hash_data(hash, string, strlen(string) + 1);
+}
+/** Cache key: both sources, the attribute bindings and the driver identity.
+ *  A driver update changes GL_VERSION and invalidates every entry.
+ */
+static uint64_t _program_hash(const char* vertex_source, size_t vertex_size,
+                              const char* fragment_source, size_t fragment_size,
+                              const AttributeSlot* slots)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = _hash_data(hash, vertex_source, vertex_size);
+    hash = _hash_data(hash, fragment_source, fragment_size);
+    while(slots && *slots != kEmptySlot) {
+        hash = _hash_data(hash, slots, sizeof(*slots));
+        hash = _hash_string(hash, kAttributeSlotNames[*slots]);
+        ++slots;
+    }
+    hash = _hash_string(hash, (const char*)glGetString(GL_RENDERER));
+    hash = _hash_string(hash, (const char*)glGetString(GL_VERSION));
+    return hash;
+}
+static int _program_binaries_supported(void)
+{
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    glGetError(); /* Not an error on ES2 contexts, just no support */
+    return num_formats > 0;
+}
+static void _cache_name(char* name, size_t name_size, uint64_t hash)
+{
+    snprintf(name, name_size, "program_%08x%08x.bin", (uint32_t)(hash >> 32), (uint32_t)hash);
+}
+static GLuint _load_cached_program(uint64_t hash, float* compile_time)
+{
+    char    name[64];
+    void*   data = NULL;
     size_t  data_size = 0;
-    GLuint  shader = 0;
-    GLint   compile_status = 0;
-    int     result;
-    GLint   shader_size = 0;
-    GLint   info_length = 0;
+    GLuint  program = 0;
+    GLint   link_status = GL_FALSE;
+    ProgramCacheHeader header;
 
-    result = (int)load_file_data(filename, (void*)&data, &data_size);
-    if(result != 0) {
-        system_log("Loading shader %s failed", filename);
+    _cache_name(name, sizeof(name), hash);
+    if(load_cache_data(name, &data, &data_size) != 0)
         return 0;
+
+    memcpy(&header, data, data_size < sizeof(header) ? data_size : sizeof(header));
+    if(data_size >= sizeof(header) &&
+       header.magic == PROGRAM_CACHE_MAGIC &&
+       header.length == data_size - sizeof(header)) {
+        program = glCreateProgram();
+        glProgramBinary(program, header.format, (const char*)data + sizeof(header), header.length);
+        glGetError(); /* An invalid format is reported via the link status */
+        ASSERT_GL(glGetProgramiv(program, GL_LINK_STATUS, &link_status));
+        if(link_status == GL_FALSE) {
+            /* The driver rejected the binary, recompile from source */
+            ASSERT_GL(glDeleteProgram(program));
+            program = 0;
+            _cache_stats.rejected++;
+        }
+        *compile_time = header.compile_time;
+    }
+    free(data);
+    return program;
+}
+static void _save_cached_program(uint64_t hash, GLuint program, float compile_time)
+{
+    char    name[64];
+    GLint   length = 0;
+    GLenum  format = 0;
+    ProgramCacheHeader* header;
+
+    ASSERT_GL(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+    if(length <= 0)
+        return;
+
+    header = (ProgramCacheHeader*)malloc(sizeof(*header) + length);
+    ASSERT_GL(glGetProgramBinary(program, length, &length, &format, header + 1));
+    header->magic = PROGRAM_CACHE_MAGIC;
+    header->format = format;
+    header->length = (uint32_t)length;
+    header->compile_time = compile_time;
+
+    _cache_name(name, sizeof(name), hash);
+    if(save_cache_data(name, header, sizeof(*header) + length) != 0)
+        system_log("Writing program cache %s failed\n", name);
+    free(header);
+}
+static void _append_source(ShaderSource* S, const char* data, size_t size)
+{
+    if(S->size + size + 1 > S->capacity) {
+        while(S->size + size + 1 > S->capacity)
+            S->capacity = S->capacity ? S->capacity*2 : 4096;
+        S->data = (char*)realloc(S->data, S->capacity);
+    }
+    memcpy(S->data + S->size, data, size);
+    S->size += size;
+    S->data[S->size] = '\0';
+}
+static void _append_string(ShaderSource* S, const char* string)
+{
+    _append_source(S, string, strlen(string));
+}
+/** @return The source string number of `filename` if it still has to be
+ *      included, -1 if it already was or the include table is full
+ */
+static int _include_file(ShaderSource* S, const char* filename)
+{
+    int ii;
+    for(ii=0;ii<S->num_included;++ii) {
+        if(strcmp(S->included[ii], filename) == 0)
+            return -1;
+    }
+    if(S->num_included == MAX_INCLUDED_FILES) {
+        system_log("Too many shader includes, skipping %s\n", filename);
+        return -1;
+    }
+    strlcpy(S->included[S->num_included], filename, sizeof(S->included[0]));
+    return S->num_included++;
+}
+/** Copies `filename` into `S`, expanding `#include "file"` directives in
+ *  place. Include paths are relative to the asset root and every file is
+ *  only included once per shader. `#line` directives carry the file's
+ *  `source_index` so compile errors can be traced back to it.
+ */
+static int _preprocess_file(ShaderSource* S, const char* filename, int source_index, int depth)
+{
+    char*       file_data = NULL;
+    size_t      file_size = 0;
+    const char* curr;
+    const char* end;
+    int         line_number = 1;
+
+    if(depth > MAX_INCLUDE_DEPTH) {
+        system_log("Shader includes nested too deeply in %s\n", filename);
+        return -1;
+    }
+    if(load_file_data(filename, (void**)&file_data, &file_size) != 0) {
+        system_log("Loading shader %s failed", filename);
+        return -1;
     }
-    assert(result == 0);
-    shader_size = (GLint)data_size;
 
-    shader = glCreateShader(type);
-    ASSERT_GL(glShaderSource(shader, 1, (const char**)&data, &shader_size));
+    curr = file_data;
+    end = file_data + file_size;
+    while(curr < end) {
+        const char* line_end = (const char*)memchr(curr, '\n', end - curr);
+        const char* directive = curr;
+        size_t      line_size;
+
+        line_end = line_end ? line_end + 1 : end;
+        line_size = line_end - curr;
+        while(directive < line_end && (*directive == ' ' || *directive == '\t'))
+            ++directive;
+
+        if(line_end - directive > 8 && strncmp(directive, "#include", 8) == 0) {
+            char        include_name[128] = {0};
+            const char* name_start = (const char*)memchr(directive, '"', line_end - directive);
+            const char* name_end = name_start ? (const char*)memchr(name_start + 1, '"', line_end - name_start - 1) : NULL;
+            char        line_directive[32];
+            int         include_index;
+
+            if(name_end == NULL || (size_t)(name_end - name_start) >= sizeof(include_name)) {
+                system_log("%s:%d: malformed #include\n", filename, line_number);
+                free_file_data(file_data);
+                return -1;
+            }
+            memcpy(include_name, name_start + 1, name_end - name_start - 1);
+            include_index = _include_file(S, include_name);
+            if(include_index >= 0) {
+                snprintf(line_directive, sizeof(line_directive), "#line 1 %d\n", include_index);
+                _append_string(S, line_directive);
+                if(_preprocess_file(S, include_name, include_index, depth + 1) != 0) {
+                    free_file_data(file_data);
+                    return -1;
+                }
+            }
+            snprintf(line_directive, sizeof(line_directive), "\n#line %d %d\n", line_number + 1, source_index);
+            _append_string(S, line_directive);
+        } else {
+            _append_source(S, curr, line_size);
+        }
+        curr = line_end;
+        ++line_number;
+    }
+    free_file_data(file_data);
+    return 0;
+}
+/** Builds the final source: `#version` (if any) or the `prologue`, then the
+ *  injected defines, then the preprocessed file.
+ *  @param source_files Receives a "0: file, 1: include, ..." legend of the
+ *      source string numbers, free with `free`
+ */
+static char* _load_shader_source(const char* filename, const char* prologue,
+                                 const char* const* defines, size_t* source_size,
+                                 char** source_files)
+{
+    ShaderSource body;
+    ShaderSource source;
+    ShaderSource legend;
+    const char*  curr;
+    char         line_directive[32];
+    int          first_line = 1;
+    int          ii;
+
+    memset(&body, 0, sizeof(body));
+    memset(&source, 0, sizeof(source));
+    memset(&legend, 0, sizeof(legend));
+    _include_file(&body, filename);
+    if(_preprocess_file(&body, filename, 0, 0) != 0) {
+        free(body.data);
+        return NULL;
+    }
+    for(ii=0;ii<body.num_included;++ii) {
+        snprintf(line_directive, sizeof(line_directive), "%s%d: ", ii ? ", " : "", ii);
+        _append_string(&legend, line_directive);
+        _append_string(&legend, body.included[ii]);
+    }
+    *source_files = legend.data;
+
+    curr = body.data;
+    if(strncmp(curr, "#version", 8) == 0) {
+        const char* line_end = strchr(curr, '\n');
+        line_end = line_end ? line_end + 1 : curr + body.size;
+        _append_source(&source, curr, line_end - curr);
+        curr = line_end;
+        first_line = 2;
+    } else if(prologue) {
+        _append_string(&source, prologue);
+    }
+    while(defines && *defines) {
+        const char* value = strchr(*defines, '=');
+        _append_string(&source, "#define ");
+        if(value) {
+            _append_source(&source, *defines, value - *defines);
+            _append_string(&source, " ");
+            _append_string(&source, value + 1);
+        } else {
+            _append_string(&source, *defines);
+        }
+        _append_string(&source, "\n");
+        ++defines;
+    }
+    snprintf(line_directive, sizeof(line_directive), "#line %d 0\n", first_line);
+    _append_string(&source, line_directive);
+    _append_string(&source, curr);
+
+    free(body.data);
+    *source_size = source.size;
+    return source.data;
+}
+static int _has_parallel_compile(void)
+{
+    if(_parallel_compile < 0) {
+        const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+        MaxShaderCompilerThreadsProc max_threads = NULL;
+        _parallel_compile = extensions && strstr(extensions, "GL_KHR_parallel_shader_compile") != NULL;
+#if defined(__ANDROID__)
+        if(_parallel_compile)
+            max_threads = (MaxShaderCompilerThreadsProc)eglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+#endif
+        /* Let the driver pick the number of compiler threads */
+        if(max_threads)
+            ASSERT_GL(max_threads(0xFFFFFFFF));
+    }
+    return _parallel_compile;
+}
+static double _submit_time(void)
+{
+    if(_submit_timer == NULL)
+        _submit_timer = create_timer();
+    return get_running_time(_submit_timer);
+}
+static GLuint _submit_shader(const char* source, size_t source_size, GLenum type)
+{
+    GLuint  shader = glCreateShader(type);
+    GLint   shader_size = (GLint)source_size;
+    ASSERT_GL(glShaderSource(shader, 1, &source, &shader_size));
     ASSERT_GL(glCompileShader(shader));
+    return shader;
+}
+static int _check_shader(const char* filename, const char* source_files, GLuint shader)
+{
+    GLint   compile_status = 0;
+    GLint   info_length = 0;
+
     ASSERT_GL(glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status));
     if(compile_status == GL_FALSE) {
         char message[1024] = {0};
         ASSERT_GL(glGetShaderInfoLog(shader, sizeof(message), 0, message));
         system_log("Error compiling %s: %s", filename, message);
+        system_log("Source strings: %s\n", source_files ? source_files : filename);
         assert(compile_status != GL_FALSE);
-        free_file_data(data);
-        return 0;
+        return -1;
     }
     ASSERT_GL(glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_length));
-    if(info_length > 0) {
+    if(info_length > 1) {
         char info_log[1024] = {0};
         ASSERT_GL(glGetShaderInfoLog(shader, sizeof(info_log), NULL, info_log));
         system_log("Info compiling %s: %s", filename, info_log);
+        system_log("Source strings: %s\n", source_files ? source_files : filename);
+    }
+    return 0;
+}
+static PendingProgram* _find_pending(GLuint program)
+{
+    int ii;
+    for(ii=0;ii<_num_pending;++ii) {
+        if(_pending[ii].program == program)
+            return &_pending[ii];
     }
+    return NULL;
+}
+static void _remove_pending(PendingProgram* pending)
+{
+    int index = (int)(pending - _pending);
+    free(pending->vertex_source_files);
+    free(pending->fragment_source_files);
+    memmove(pending, pending + 1, (_num_pending - index - 1)*sizeof(*pending));
+    --_num_pending;
+}
+static int _find_failed(GLuint program)
+{
+    int ii;
+    for(ii=0;ii<_num_failed;++ii) {
+        if(_failed[ii] == program)
+            return ii;
+    }
+    return -1;
+}
+/** Remembers a broken program so `finish_program` keeps failing for it. The
+ *  GL program lives on until `destroy_program`, so its name isn't reused.
+ */
+static void _add_failed(GLuint program)
+{
+    if(_num_failed == _max_failed) {
+        int     max_failed = _max_failed ? _max_failed*2 : 8;
+        GLuint* failed = (GLuint*)realloc(_failed, max_failed*sizeof(GLuint));
+        if(failed == NULL) {
+            system_log("Can't record failed program %u\n", program);
+            return;
+        }
+        _failed = failed;
+        _max_failed = max_failed;
+    }
+    _failed[_num_failed++] = program;
+}
+static PendingProgram* _add_pending(GLuint program,
+                                    const char* vertex_shader_filename,
+                                    const char* fragment_shader_filename)
+{
+    PendingProgram* pending;
+    if(_num_pending == MAX_PENDING_PROGRAMS) {
+        /* Out of slots, retire the oldest without a warm up draw */
+        if(finish_program(_pending[0].program) == 0)
+            _remove_pending(&_pending[0]); /* Otherwise finish_program dropped it */
+    }
+    pending = &_pending[_num_pending++];
+    memset(pending, 0, sizeof(*pending));
+    pending->program = program;
+    pending->submit_time = _submit_time();
+    strlcpy(pending->vertex_shader_filename, vertex_shader_filename, sizeof(pending->vertex_shader_filename));
+    strlcpy(pending->fragment_shader_filename, fragment_shader_filename, sizeof(pending->fragment_shader_filename));
+    return pending;
+}
+/** Submits the compiles and link without waiting on either, the results are
+ *  checked in `finish_program`
+ */
+static GLuint _submit_program(const char* vertex_source, size_t vertex_size,
+                              const char* fragment_source, size_t fragment_size,
+                              const AttributeSlot* slots, int retrievable,
+                              GLuint* vertex_shader, GLuint* fragment_shader)
+{
+    GLuint  program;
 
-    free_file_data(data);
+    *vertex_shader = _submit_shader(vertex_source, vertex_size, GL_VERTEX_SHADER);
+    *fragment_shader = _submit_shader(fragment_source, fragment_size, GL_FRAGMENT_SHADER);
 
-    return shader;
+    program = glCreateProgram();
+    ASSERT_GL(glAttachShader(program, *vertex_shader));
+    ASSERT_GL(glAttachShader(program, *fragment_shader));
+    while(slots && *slots != kEmptySlot) {
+        ASSERT_GL(glBindAttribLocation(program, *slots,    kAttributeSlotNames[*slots]));
+        ++slots;
+    }
+    if(retrievable)
+        ASSERT_GL(glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+    ASSERT_GL(glLinkProgram(program));
+    return program;
 }
 
 /* External functions
@@ -90,46 +531,170 @@ Program create_program(const char* vertex_shader_filename,
                        const char* fragment_shader_filename,
                        const AttributeSlot* slots)
 {
-    GLuint  vertex_shader;
-    GLuint  fragment_shader;
-    GLuint  program;
-    GLint   link_status;
+    return create_program_variant(vertex_shader_filename, fragment_shader_filename, slots, NULL);
+}
+Program create_program_variant(const char* vertex_shader_filename,
+                               const char* fragment_shader_filename,
+                               const AttributeSlot* slots,
+                               const char* const* defines)
+{
+    char*   vertex_source = NULL;
+    char*   fragment_source = NULL;
+    char*   vertex_source_files = NULL;
+    char*   fragment_source_files = NULL;
+    size_t  vertex_size = 0;
+    size_t  fragment_size = 0;
+    GLuint  program = 0;
+    int     use_cache = _program_binaries_supported();
+    uint64_t hash = 0;
+    float   compile_time = 0.0f;
+    Timer*  timer;
 
-    /* Compile shaders */
-    vertex_shader = _load_shader(vertex_shader_filename, GL_VERTEX_SHADER);
-    fragment_shader = _load_shader(fragment_shader_filename, GL_FRAGMENT_SHADER);
+    vertex_source = _load_shader_source(vertex_shader_filename, gl_major_version() >= 3 ? kVertexPrologue : NULL,
+                                        defines, &vertex_size, &vertex_source_files);
+    fragment_source = _load_shader_source(fragment_shader_filename, gl_major_version() >= 3 ? kFragmentPrologue : NULL,
+                                          defines, &fragment_size, &fragment_source_files);
+    if(vertex_source == NULL || fragment_source == NULL) {
+        free(vertex_source);
+        free(fragment_source);
+        free(vertex_source_files);
+        free(fragment_source_files);
+        return 0;
+    }
 
-    /* Create program */
-    program = glCreateProgram();
-    ASSERT_GL(glAttachShader(program, vertex_shader));
-    ASSERT_GL(glAttachShader(program, fragment_shader));
-    while(slots && *slots != kEmptySlot) {
-        ASSERT_GL(glBindAttribLocation(program, *slots,    kAttributeSlotNames[*slots]));
-        ++slots;
+    _has_parallel_compile();
+    timer = create_timer();
+    if(use_cache) {
+        hash = _program_hash(vertex_source, vertex_size, fragment_source, fragment_size, slots);
+        program = _load_cached_program(hash, &compile_time);
     }
-    ASSERT_GL(glLinkProgram(program));
+    if(program) {
+        float load_time = (float)get_running_time(timer);
+        _cache_stats.hits++;
+        if(compile_time > load_time)
+            _cache_stats.time_saved += compile_time - load_time;
+        _add_pending(program, vertex_shader_filename, fragment_shader_filename);
+        free(vertex_source_files);
+        free(fragment_source_files);
+    } else {
+        GLuint vertex_shader, fragment_shader;
+        PendingProgram* pending;
+        program = _submit_program(vertex_source, vertex_size, fragment_source, fragment_size,
+                                  slots, use_cache, &vertex_shader, &fragment_shader);
+        pending = _add_pending(program, vertex_shader_filename, fragment_shader_filename);
+        pending->vertex_shader = vertex_shader;
+        pending->fragment_shader = fragment_shader;
+        pending->vertex_source_files = vertex_source_files;
+        pending->fragment_source_files = fragment_source_files;
+        pending->hash = hash;
+        pending->save_to_cache = use_cache;
+        if(use_cache)
+            _cache_stats.misses++;
+    }
+    destroy_timer(timer);
+
+    free(fragment_source);
+    free(vertex_source);
+
+    return program;
+}
+
+int finish_program(Program program)
+{
+    PendingProgram* pending = _find_pending(program);
+    GLint   link_status = GL_FALSE;
+    double  now;
+    float   compile_time;
+    int     result = 0;
+
+    if(program == 0 || _find_failed(program) >= 0)
+        return -1;
+    if(pending == NULL || pending->vertex_shader == 0)
+        return 0; /* Already finished, or loaded from a binary */
+
     ASSERT_GL(glGetProgramiv(program, GL_LINK_STATUS, &link_status));
+    /* Programs compile concurrently, only count the time since the later of
+     * the submit and the last finish so the totals add up to wall time
+     */
+    now = _submit_time();
+    compile_time = (float)(now - (pending->submit_time > _last_finish_time ? pending->submit_time : _last_finish_time));
+    _last_finish_time = now;
+    _cache_stats.compile_time += compile_time;
     if(link_status == GL_FALSE) {
-        char message[1024];
+        char message[1024] = {0};
+        _check_shader(pending->vertex_shader_filename, pending->vertex_source_files, pending->vertex_shader);
+        _check_shader(pending->fragment_shader_filename, pending->fragment_source_files, pending->fragment_shader);
         ASSERT_GL(glGetProgramInfoLog(program, sizeof(message), 0, message));
-        system_log("Creating program: %s--%s failed: %s\n", vertex_shader_filename, fragment_shader_filename, message);
-        //assert(link_status != GL_FALSE);
-        ASSERT_GL(glDetachShader(program, fragment_shader));
-        ASSERT_GL(glDetachShader(program, vertex_shader));
-        ASSERT_GL(glDeleteShader(fragment_shader));
-        ASSERT_GL(glDeleteShader(vertex_shader));
-        ASSERT_GL(glDeleteProgram(program));
-        return 0;
+        system_log("Creating program: %s--%s failed: %s\n",
+                   pending->vertex_shader_filename, pending->fragment_shader_filename, message);
+        result = -1;
+    } else {
+        _check_shader(pending->vertex_shader_filename, pending->vertex_source_files, pending->vertex_shader);
+        _check_shader(pending->fragment_shader_filename, pending->fragment_source_files, pending->fragment_shader);
+        if(pending->save_to_cache)
+            _save_cached_program(pending->hash, program, compile_time);
+    }
+    ASSERT_GL(glDetachShader(program, pending->fragment_shader));
+    ASSERT_GL(glDetachShader(program, pending->vertex_shader));
+    ASSERT_GL(glDeleteShader(pending->fragment_shader));
+    ASSERT_GL(glDeleteShader(pending->vertex_shader));
+    pending->vertex_shader = 0;
+    pending->fragment_shader = 0;
+    free(pending->vertex_source_files);
+    free(pending->fragment_source_files);
+    pending->vertex_source_files = NULL;
+    pending->fragment_source_files = NULL;
+    if(result != 0) {
+        _remove_pending(pending); /* Never warm up a broken program */
+        _add_failed(program);
     }
-    ASSERT_GL(glDetachShader(program, fragment_shader));
-    ASSERT_GL(glDetachShader(program, vertex_shader));
-    ASSERT_GL(glDeleteShader(fragment_shader));
-    ASSERT_GL(glDeleteShader(vertex_shader));
+    return result;
+}
+void warm_up_programs(void)
+{
+    double  start_time = _submit_time();
+    int     num_programs = _num_pending;
+    GLint   max_attributes = 0;
+    int     ii;
 
-    return program;
+    /* Drawing with every array disabled feeds each attribute a constant, so
+     * the triangle is degenerate and produces no fragments
+     */
+    glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_attributes);
+    for(ii=kPositionSlot;ii<NUM_ATTRIBUTE_SLOTS && ii<max_attributes;++ii)
+        ASSERT_GL(glDisableVertexAttribArray(ii));
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+
+    while(_num_pending) {
+        PendingProgram* pending = &_pending[0];
+        if(finish_program(pending->program) != 0)
+            continue; /* finish_program dropped it */
+        ASSERT_GL(glUseProgram(pending->program));
+        ASSERT_GL(glDrawArrays(GL_TRIANGLES, 0, 3));
+        _remove_pending(pending);
+    }
+    ASSERT_GL(glUseProgram(0));
+    system_log("Warmed up %d programs in %.1f ms (parallel compile: %s)\n", num_programs,
+               (_submit_time() - start_time)*1000.0, _has_parallel_compile() ? "yes" : "no");
 }
 
 void destroy_program(Program program)
 {
+    PendingProgram* pending = _find_pending(program);
+    int failed;
+    if(pending) {
+        finish_program(program);
+        pending = _find_pending(program);
+        if(pending)
+            _remove_pending(pending);
+    }
+    failed = _find_failed(program);
+    if(failed >= 0)
+        _failed[failed] = _failed[--_num_failed];
     glDeleteProgram(program);
 }
+ProgramCacheStats program_cache_stats(void)
+{
+    return _cache_stats;
+}
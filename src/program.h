@@ -22,9 +22,51 @@
 
 typedef uint32_t Program;
 
+/** Program binary cache counters, accumulated over every `create_program` */
+typedef struct ProgramCacheStats
+{
+    int     hits;
+    int     misses;
+    int     rejected;       /* Cached binaries the driver refused to load */
+    float   compile_time;   /* Seconds spent compiling from source */
+    float   time_saved;     /* Seconds saved by loading binaries instead */
+} ProgramCacheStats;
+
+/** Programs are created asynchronously: the compile and link are submitted
+ *  to the driver and only checked by `finish_program`. Submit every program
+ *  up front and finish them when first needed so the driver can overlap the
+ *  work, uniforms can't be queried until the program is finished.
+ */
 Program create_program(const char* vertex_shader_filename,
                        const char* fragment_shader_filename,
                        const AttributeSlot* slots);
+/** @brief Creates a specialized variant of a program
+ *  @param defines NULL terminated list of "NAME" or "NAME=VALUE" strings,
+ *      injected as `#define`s ahead of both shaders
+ *
+ *  Shader sources may `#include "path"` other files, relative to the asset
+ *  root. Each file is included at most once.
+ *
+ *  On ES3 contexts sources without a `#version` are compiled as GLSL ES 3.00
+ *  behind a prologue mapping the 1.00 keywords, shaders test `__VERSION__`
+ *  to use 3.00 features such as uniform blocks.
+ */
+Program create_program_variant(const char* vertex_shader_filename,
+                               const char* fragment_shader_filename,
+                               const AttributeSlot* slots,
+                               const char* const* defines);
 void destroy_program(Program program);
 
+/** @brief Waits for `program` to link and reports any compile or link errors
+ *  @return 0 on success, -1 if the program failed to build. A failed program
+ *      keeps returning -1 until it is destroyed, as does 0.
+ */
+int finish_program(Program program);
+/** @brief Finishes every submitted program and draws with each once, so
+ *  drivers that compile on first use do it now instead of in the first frame
+ */
+void warm_up_programs(void);
+
+ProgramCacheStats program_cache_stats(void);
+
 #endif /* include guard */
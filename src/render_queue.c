@@ -0,0 +1,143 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "render_queue.h"
+#include <string.h>
+#include "mesh.h"
+#include "vertex.h"
+
+/* Defines
+ */
+#define RADIX_BITS      8
+#define RADIX_BUCKETS   (1 << RADIX_BITS)
+#define RADIX_PASSES    (64/RADIX_BITS)
+
+#define SORT_KEY_DEPTH_SHIFT    0
+#define SORT_KEY_MESH_SHIFT     (SORT_KEY_DEPTH_SHIFT + SORT_KEY_DEPTH_BITS)
+#define SORT_KEY_MATERIAL_SHIFT (SORT_KEY_MESH_SHIFT + SORT_KEY_MESH_BITS)
+#define SORT_KEY_PROGRAM_SHIFT  (SORT_KEY_MATERIAL_SHIFT + SORT_KEY_MATERIAL_BITS)
+#define SORT_KEY_PASS_SHIFT     (SORT_KEY_PROGRAM_SHIFT + SORT_KEY_PROGRAM_BITS)
+
+#define SORT_KEY_FIELD(value, bits, shift) (((uint64_t)(value) & ((1ull << (bits)) - 1)) << (shift))
+
+/* Types
+ */
+
+/* Constants
+ */
+
+/* Variables
+ */
+
+/* Internal functions
+ */
+
+/* External functions
+ */
+uint64_t render_sort_key(RenderPass pass, int program, int material, int mesh, float depth)
+{
+    uint32_t quantized_depth;
+    if(depth < 0.0f)
+        depth = 0.0f;
+    if(depth > 1.0f)
+        depth = 1.0f;
+    quantized_depth = (uint32_t)(depth * ((1 << SORT_KEY_DEPTH_BITS) - 1));
+
+    return SORT_KEY_FIELD(pass, SORT_KEY_PASS_BITS, SORT_KEY_PASS_SHIFT) |
+           SORT_KEY_FIELD(program, SORT_KEY_PROGRAM_BITS, SORT_KEY_PROGRAM_SHIFT) |
+           SORT_KEY_FIELD(material, SORT_KEY_MATERIAL_BITS, SORT_KEY_MATERIAL_SHIFT) |
+           SORT_KEY_FIELD(mesh, SORT_KEY_MESH_BITS, SORT_KEY_MESH_SHIFT) |
+           SORT_KEY_FIELD(quantized_depth, SORT_KEY_DEPTH_BITS, SORT_KEY_DEPTH_SHIFT);
+}
+void radix_sort(uint64_t* keys, int* values, int count, uint64_t* temp_keys, int* temp_values)
+{
+    uint32_t    histograms[RADIX_PASSES][RADIX_BUCKETS];
+    uint64_t*   src_keys = keys;
+    int*        src_values = values;
+    uint64_t*   dst_keys = temp_keys;
+    int*        dst_values = temp_values;
+    int         pass, ii;
+
+    /* Build every histogram in a single read of the keys */
+    memset(histograms, 0, sizeof(histograms));
+    for(ii=0;ii<count;++ii) {
+        uint64_t key = keys[ii];
+        for(pass=0;pass<RADIX_PASSES;++pass)
+            histograms[pass][(key >> (pass*RADIX_BITS)) & (RADIX_BUCKETS-1)]++;
+    }
+
+    for(pass=0;pass<RADIX_PASSES;++pass) {
+        uint32_t*   histogram = histograms[pass];
+        uint32_t    offset = 0;
+        int         shift = pass*RADIX_BITS;
+        uint64_t*   swap_keys;
+        int*        swap_values;
+
+        /* All keys share this byte, the pass would not move anything */
+        if(count == 0 || histogram[(src_keys[0] >> shift) & (RADIX_BUCKETS-1)] == (uint32_t)count)
+            continue;
+
+        for(ii=0;ii<RADIX_BUCKETS;++ii) {
+            uint32_t bucket_count = histogram[ii];
+            histogram[ii] = offset;
+            offset += bucket_count;
+        }
+        for(ii=0;ii<count;++ii) {
+            uint32_t index = histogram[(src_keys[ii] >> shift) & (RADIX_BUCKETS-1)]++;
+            dst_keys[index] = src_keys[ii];
+            dst_values[index] = src_values[ii];
+        }
+        swap_keys = src_keys; src_keys = dst_keys; dst_keys = swap_keys;
+        swap_values = src_values; src_values = dst_values; dst_values = swap_values;
+    }
+
+    /* An odd number of passes leaves the result in the scratch buffers */
+    if(src_keys != keys) {
+        memcpy(keys, src_keys, count*sizeof(uint64_t));
+        memcpy(values, src_values, count*sizeof(int));
+    }
+}
+void bind_material_block(const RenderQueue* Q, const DrawBatch* batch)
+{
+    if(Q->material_buffer == 0)
+        return;
+    ASSERT_GL(glBindBufferRange(GL_UNIFORM_BUFFER, kPerMaterialBlock, Q->material_buffer,
+                                Q->material_offset + batch->material_block*Q->material_stride,
+                                sizeof(PerMaterialBlock)));
+}
+void draw_batch(const RenderQueue* Q, const DrawBatch* batch, UniformTable* uniforms)
+{
+    const Mesh* mesh = batch->model->mesh;
+    int         ii;
+
+    if(Q->instance_buffer) {
+        /* Each matrix row feeds one column of a_World */
+        char* offset = (char*)0 + Q->instance_offset + batch->first_instance*sizeof(Mat4);
+        ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, Q->instance_buffer));
+        for(ii=0;ii<4;++ii) {
+            ASSERT_GL(glVertexAttribPointer(kWorldSlot+ii, 4, GL_FLOAT, GL_FALSE, sizeof(Mat4),
+                                            offset + ii*sizeof(Vec4)));
+        }
+        commit_uniforms(uniforms);
+        draw_bound_mesh_instanced(mesh, batch->num_instances);
+        return;
+    }
+    for(ii=0;ii<batch->num_instances;++ii) {
+        set_uniform(uniforms, "u_World", &Q->world_matrices[batch->first_instance + ii]);
+        commit_uniforms(uniforms);
+        draw_bound_mesh(mesh);
+    }
+}
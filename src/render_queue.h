@@ -0,0 +1,93 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __render_queue_h__
+#define __render_queue_h__
+
+#include <stdint.h>
+#include "gl_include.h"
+#include "scene.h"
+#include "uniforms.h"
+#include "stream_buffer.h"
+
+/** 64 bit render sort keys, most significant field first:
+ *
+ *  63..60  pass        Passes draw in order
+ *  59..52  program     Shader variant, so program switches are grouped
+ *  51..38  material    Grouped to avoid rebinding textures and constants
+ *  37..24  mesh        Grouped to avoid rebinding vertex and index buffers
+ *  23..0   depth       Front to back within a batch, for early depth rejection
+ */
+#define SORT_KEY_PASS_BITS      4
+#define SORT_KEY_PROGRAM_BITS   8
+#define SORT_KEY_MATERIAL_BITS  14
+#define SORT_KEY_MESH_BITS      14
+#define SORT_KEY_DEPTH_BITS     24
+
+typedef enum {
+    kOpaquePass,
+
+    NUM_RENDER_PASSES
+} RenderPass;
+
+/** @brief Packs a sort key. Ids are masked to their field width.
+ *  @param depth View depth scaled to 0..1, clamped
+ */
+uint64_t render_sort_key(RenderPass pass, int program, int material, int mesh, float depth);
+
+/** @brief Stable LSD radix sort of `keys`, eight bits per pass, carrying
+ *  `values` along. Passes where every key has the same byte are skipped.
+ *  @param temp_keys Scratch space for `count` keys
+ *  @param temp_values Scratch space for `count` values
+ */
+void radix_sort(uint64_t* keys, int* values, int count, uint64_t* temp_keys, int* temp_values);
+
+/** Consecutive sorted render commands sharing a mesh and material */
+typedef struct DrawBatch
+{
+    const Model*    model;          /* Supplies the mesh and material */
+    int             first_instance; /* Into the queue's world matrices */
+    int             num_instances;
+    int             material_block; /* Into the queue's material buffer */
+} DrawBatch;
+
+/** The frame's draws, as handed to the renderers */
+typedef struct RenderQueue
+{
+    const DrawBatch*    batches;
+    int                 num_batches;
+    const Mat4*         world_matrices;     /* One per instance, in draw order */
+    GLuint              instance_buffer;    /* The world matrices on the GPU, 0 without instancing */
+    GLintptr            instance_offset;
+    GLuint              material_buffer;    /* PerMaterialBlocks, 0 without uniform buffers */
+    GLintptr            material_offset;
+    int                 material_stride;    /* Bytes between blocks, honors the offset alignment */
+    StreamBuffer*       stream;             /* For any other per-frame data the renderers upload */
+} RenderQueue;
+
+/** @brief Binds the batch's PerMaterial block range, if the queue has uniform
+ *  buffers. Without them the renderer sets the material uniforms itself.
+ */
+void bind_material_block(const RenderQueue* Q, const DrawBatch* batch);
+
+/** @brief Draws every instance of a batch whose mesh is bound. With an
+ *  instance buffer this points the mesh's world matrix attributes at the
+ *  batch and makes a single instanced draw, otherwise each instance sets
+ *  u_World and draws.
+ */
+void draw_batch(const RenderQueue* Q, const DrawBatch* batch, UniformTable* uniforms);
+
+#endif /* include guard */
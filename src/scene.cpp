@@ -20,11 +20,15 @@ extern "C" {
 #include "mesh.h"
 #include "utility.h"
 #include "system.h"
+#include "compression.h"
 #include "assert.h"
 #include "graphics.h"
+#include "bvh.h"
+#include "culling.h"
 }
 #include <stdlib.h>
 #include <string.h>
+#include <float.h>
 #include <vector>
 #include <map>
 #include <string>
@@ -134,6 +138,9 @@ struct Scene
     uint32_t        num_meshes;
     uint32_t        num_materials;
     uint32_t        num_models;
+
+    BVH*            bvh;            /* Over the world bounds of the models */
+    int*            visible_models;
 };
 
 /* Constants
@@ -152,7 +159,7 @@ static void _load_mtl_file(const char* path, const char* filename, SceneData* sc
     size_t file_size = 0;
     int matches;
 
-    load_file_data((path_string+filename).c_str(), (void**)&file_data, &file_size);
+    load_asset_data((path_string+filename).c_str(), (void**)&file_data, &file_size);
     original_data = file_data;
 
 
@@ -213,7 +220,7 @@ static void _load_mtl_file(const char* path, const char* filename, SceneData* sc
             assert(matches == 2);
         }
     }
-    free_file_data(original_data);
+    free_asset_data(original_data);
 }
 
 static Vertex* _calculate_tangets(const SimpleVertex* vertices, uint32_t num_vertices,
@@ -313,7 +320,7 @@ static void _load_obj(const char* path, const char* filename, SceneData* scene)
     size_t file_size = 0;
     int matches;
 
-    load_file_data((path_string+filename).c_str(), (void**)&file_data, &file_size);
+    load_asset_data((path_string+filename).c_str(), (void**)&file_data, &file_size);
     original_data = file_data;
 
     int orig_num_meshes = scene->num_meshes;
@@ -452,7 +459,7 @@ static void _load_obj(const char* path, const char* filename, SceneData* scene)
                                  &triangle[3].p, &triangle[3].t, &triangle[3].n);
                 if(matches != 10 && matches != 13) {
                     printf("Can't load this OBJ\n");
-                    free_file_data(original_data);
+                    free_asset_data(original_data);
                     exit(1);
                 }
             } else {
@@ -464,7 +471,7 @@ static void _load_obj(const char* path, const char* filename, SceneData* scene)
                                  &triangle[3].p, &triangle[3].n);
                 if(matches != 7 && matches != 9) {
                     printf("Can't load this OBJ\n");
-                    free_file_data(original_data);
+                    free_asset_data(original_data);
                     exit(1);
                 }
                 triangle[0].t = 0;
@@ -543,7 +550,7 @@ static void _load_obj(const char* path, const char* filename, SceneData* scene)
         current_model++;
         mesh_triangles++;
     }
-    free_file_data(original_data);
+    free_asset_data(original_data);
 }
 
 static void _scene_from_scenedata(const SceneData* data, Scene* scene)
@@ -566,10 +573,13 @@ static void _scene_from_scenedata(const SceneData* data, Scene* scene)
     scene->materials = (Material*)calloc(data->num_materials, sizeof(Material));
     for(ii=0;ii<data->num_materials;++ii) {
         scene->materials[ii].albedo = load_texture(data->materials[ii].albedo_tex);
-        scene->materials[ii].normal = load_texture(data->materials[ii].normal_tex);
+        /* Materials without a normal map use the NORMAL_MAP=0 shader variants */
+        if(data->materials[ii].normal_tex[0] != '\0')
+            scene->materials[ii].normal = load_texture(data->materials[ii].normal_tex);
         scene->materials[ii].specular_color = data->materials[ii].specular_color;
         scene->materials[ii].specular_power = data->materials[ii].specular_power;
         scene->materials[ii].specular_coefficient = data->materials[ii].specular_coefficient;
+        scene->materials[ii].id = ii;
     }
 
     /* Models */
@@ -597,6 +607,20 @@ static void _scene_from_scenedata(const SceneData* data, Scene* scene)
         scene->models[ii].transform = transform_zero;
     }
 }
+static Bounds _model_bounds(const Model* model)
+{
+    Bounds local = mesh_bounds(model->mesh);
+    return transform_bounds(&local, transform_get_matrix(model->transform));
+}
+static void _build_bvh(Scene* scene)
+{
+    Bounds* bounds = (Bounds*)calloc(scene->num_models + 1, sizeof(Bounds));
+    for(int ii=0;ii<scene->num_models;++ii)
+        bounds[ii] = _model_bounds(&scene->models[ii]);
+    scene->bvh = create_bvh(bounds, scene->num_models);
+    scene->visible_models = (int*)calloc(scene->num_models + 1, sizeof(int));
+    free(bounds);
+}
 
 /* External functions
  */
@@ -619,6 +643,7 @@ Scene* create_scene(const char* filename)
     } else if(strcmp(extension, "mesh") == 0) {
     } else if(strcmp(extension, "scene") == 0) {
     }
+    _build_bvh(scene);
 
     return scene;
 }
@@ -633,14 +658,33 @@ void destroy_scene(Scene* S)
     free(S->meshes);
     free(S->materials);
     free(S->models);
+    free(S->visible_models);
+    destroy_bvh(S->bvh);
     free(S);
 }
 void render_scene(Scene* S, Graphics* G)
 {
-    int ii;
-    for(ii=0;ii<S->num_models;++ii) {
-        add_render_command(G, S->models[ii]);
+    Frustum frustum = graphics_frustum(G);
+    int num_visible = query_bvh_frustum(S->bvh, &frustum, S->visible_models, S->num_models);
+    for(int ii=0;ii<num_visible;++ii) {
+        add_render_command(G, S->models[S->visible_models[ii]]);
     }
+    add_culled_models(G, S->num_models - num_visible);
+}
+void set_model_transform(Scene* S, int model, Transform transform)
+{
+    Bounds bounds;
+    S->models[model].transform = transform;
+    bounds = _model_bounds(&S->models[model]);
+    update_bvh_item(S->bvh, model, &bounds);
+}
+int pick_model(Scene* S, Vec3 origin, Vec3 direction, float* distance)
+{
+    return raycast_bvh(S->bvh, origin, direction, FLT_MAX, distance);
+}
+int models_near_point(Scene* S, Vec3 point, float radius, int* models, int max_models)
+{
+    return query_bvh_sphere(S->bvh, point, radius, models, max_models);
 }
 SceneData* _load_scene_data(const char* filename)
 {
@@ -664,7 +708,7 @@ void _free_scene_data(SceneData* S)
     free(S->models);
     free(S);
 }
-Model* get_model(Scene* S, int model)
+const Model* get_model(const Scene* S, int model)
 {
     assert(model < S->num_models);
     return &S->models[model];
@@ -31,6 +31,7 @@ typedef struct Material
     Vec3    specular_color;
     float   specular_power;
     float   specular_coefficient;
+    int     id;     /* Index within the scene, used in render sort keys */
 } Material;
 typedef struct Model
 {
@@ -44,7 +45,16 @@ Scene* create_scene(const char* filename);
 void destroy_scene(Scene* S);
 void render_scene(Scene* S, Graphics* G);
 
-Model* get_model(Scene* S, int model);
+/** Models are read only, move them with `set_model_transform` so the BVH
+ *  stays current
+ */
+const Model* get_model(const Scene* S, int model);
+/** @brief Moves a model, refitting the scene BVH */
+void set_model_transform(Scene* S, int model, Transform transform);
+/** @return The closest model whose bounds the ray hits, or -1 */
+int pick_model(Scene* S, Vec3 origin, Vec3 direction, float* distance);
+/** @return The number of models whose bounds touch the sphere */
+int models_near_point(Scene* S, Vec3 point, float radius, int* models, int max_models);
 
 SceneData* _load_scene_data(const char* filename);
 void _free_scene_data(SceneData* S);
@@ -0,0 +1,292 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "stream_buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assert.h"
+#include "system.h"
+#include "timer.h"
+
+/* Defines
+ */
+#define PROBE_FRAMES        32          /* Frames of map timings before deciding on a mode */
+#define SLOW_MAP_TIME       0.0002      /* Seconds per map and unmap that count as slow */
+#define WAIT_TIMEOUT        100000000   /* Nanoseconds per glClientWaitSync */
+
+/* Types
+ */
+struct StreamBuffer
+{
+    GLuint  buffer;
+    GLuint* retired;        /* Outgrown this frame, deleted when it ends */
+    int     num_retired;
+    int     max_retired;
+    size_t  frame_size;     /* Bytes per region */
+    size_t  head;           /* Next free byte in the current region */
+    int     frame;          /* Current region */
+    GLsync  fences[STREAM_FRAMES];
+    int     orphaning;
+
+    /* The allocation being written */
+    void*       mapped;
+    GLintptr    mapped_offset;
+    size_t      mapped_size;
+    void*       scratch;    /* Written instead of the buffer when orphaning */
+    size_t      scratch_size;
+
+    /* Map timings, to catch drivers where mapping is slow */
+    Timer*  timer;
+    double  map_time;
+    int     num_maps;
+    int     probe_frames;
+
+    StreamStats stats;
+    StreamStats last_stats;
+};
+
+/* Constants
+ */
+
+/* Variables
+ */
+
+/* Internal functions
+ */
+static size_t _align(size_t value, size_t alignment)
+{
+    if(alignment <= 1)
+        return value;
+    return (value + alignment - 1)/alignment*alignment;
+}
+static GLintptr _region_base(const StreamBuffer* S)
+{
+    return S->orphaning ? 0 : (GLintptr)(S->frame*S->frame_size);
+}
+/** (Re)specifies the store: one region when orphaning, all of them otherwise */
+static void _allocate_store(StreamBuffer* S)
+{
+    size_t size = S->orphaning ? S->frame_size : S->frame_size*STREAM_FRAMES;
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, S->buffer));
+    ASSERT_GL(glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW));
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+}
+static void _delete_fences(StreamBuffer* S)
+{
+    int ii;
+    for(ii=0;ii<STREAM_FRAMES;++ii) {
+        if(S->fences[ii])
+            ASSERT_GL(glDeleteSync(S->fences[ii]));
+        S->fences[ii] = 0;
+    }
+}
+static void _retire_buffer(StreamBuffer* S, GLuint buffer)
+{
+    if(S->num_retired == S->max_retired) {
+        int     max_retired = S->max_retired ? S->max_retired*2 : 4;
+        GLuint* retired = (GLuint*)realloc(S->retired, max_retired*sizeof(GLuint));
+        if(retired == NULL) {
+            /* Leaking the buffer is safer than deleting it mid-frame */
+            system_log("Stream buffer: can't retire buffer %u\n", buffer);
+            return;
+        }
+        S->retired = retired;
+        S->max_retired = max_retired;
+    }
+    S->retired[S->num_retired++] = buffer;
+}
+/** Moves to a new buffer large enough for `needed` bytes per frame. The old
+ *  one still holds this frame's earlier allocations, so it lives until the
+ *  frame ends.
+ */
+static void _grow(StreamBuffer* S, size_t needed)
+{
+    size_t size = S->frame_size;
+    while(size < needed)
+        size *= 2;
+
+    _retire_buffer(S, S->buffer);
+    ASSERT_GL(glGenBuffers(1, &S->buffer));
+    S->frame_size = size;
+    _allocate_store(S);
+    /* Nothing in flight uses the new store */
+    _delete_fences(S);
+    S->head = 0;
+    system_log("Stream buffer grown to %lu KB per frame\n", (unsigned long)(size/1024));
+}
+static void _switch_to_orphaning(StreamBuffer* S, const char* reason)
+{
+    system_log("Stream buffer: %s, orphaning instead of mapping\n", reason);
+    S->orphaning = 1;
+    _delete_fences(S);
+}
+/** Times the maps of a few frames after start up and stops mapping if the
+ *  driver makes it slower than orphaning
+ */
+static void _probe_map_time(StreamBuffer* S)
+{
+    if(S->orphaning || S->probe_frames > PROBE_FRAMES)
+        return;
+    if(++S->probe_frames <= PROBE_FRAMES)
+        return;
+    if(S->num_maps && S->map_time/S->num_maps > SLOW_MAP_TIME) {
+        char reason[64];
+        snprintf(reason, sizeof(reason), "mapping takes %.3f ms", S->map_time/S->num_maps*1000.0);
+        _switch_to_orphaning(S, reason);
+    }
+}
+
+/* External functions
+ */
+StreamBuffer* create_stream_buffer(size_t frame_size, int can_map)
+{
+    StreamBuffer* S = (StreamBuffer*)calloc(1, sizeof(*S));
+    S->frame_size = frame_size;
+    S->orphaning = !can_map;
+    S->timer = create_timer();
+    ASSERT_GL(glGenBuffers(1, &S->buffer));
+    _allocate_store(S);
+    S->stats.orphaning = S->orphaning;
+    return S;
+}
+void destroy_stream_buffer(StreamBuffer* S)
+{
+    if(S == NULL)
+        return;
+    if(S->num_retired)
+        ASSERT_GL(glDeleteBuffers(S->num_retired, S->retired));
+    ASSERT_GL(glDeleteBuffers(1, &S->buffer));
+    _delete_fences(S);
+    destroy_timer(S->timer);
+    free(S->retired);
+    free(S->scratch);
+    free(S);
+}
+void next_stream_frame(StreamBuffer* S)
+{
+    GLsync  fence;
+
+    assert(S->mapped == NULL);
+    if(S->num_retired)
+        ASSERT_GL(glDeleteBuffers(S->num_retired, S->retired));
+    S->num_retired = 0;
+    S->last_stats = S->stats;
+    memset(&S->stats, 0, sizeof(S->stats));
+    _probe_map_time(S);
+    S->stats.orphaning = S->orphaning;
+    S->head = 0;
+
+    if(S->orphaning) {
+        /* A new store each frame, the driver keeps the old one for the GPU */
+        _allocate_store(S);
+        return;
+    }
+
+    S->fences[S->frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    S->frame = (S->frame + 1) % STREAM_FRAMES;
+    fence = S->fences[S->frame];
+    if(fence) {
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if(status == GL_TIMEOUT_EXPIRED) {
+            /* The GPU is STREAM_FRAMES behind, wait for it */
+            double start = get_running_time(S->timer);
+            do {
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, WAIT_TIMEOUT);
+            } while(status == GL_TIMEOUT_EXPIRED);
+            S->stats.waits++;
+            S->stats.wait_time += (float)(get_running_time(S->timer) - start);
+        }
+        ASSERT_GL(glDeleteSync(fence));
+        S->fences[S->frame] = 0;
+    }
+}
+void* map_stream(StreamBuffer* S, size_t size, size_t alignment, GLuint* buffer, GLintptr* offset)
+{
+    size_t  start = _align(S->head, alignment);
+
+    assert(S->mapped == NULL && size > 0);
+    if(start + size > S->frame_size) {
+        _grow(S, start + size);
+        start = 0;
+    }
+    S->head = start + size;
+    S->mapped_offset = _region_base(S) + (GLintptr)start;
+    S->mapped_size = size;
+    S->stats.bytes += (int)size;
+    S->stats.allocations++;
+
+    if(!S->orphaning) {
+        double map_start = get_running_time(S->timer);
+        ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, S->buffer));
+        S->mapped = glMapBufferRange(GL_ARRAY_BUFFER, S->mapped_offset, size,
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        S->map_time += get_running_time(S->timer) - map_start;
+        if(S->mapped == NULL)
+            _switch_to_orphaning(S, "glMapBufferRange failed");
+    }
+    *buffer = S->buffer;
+    *offset = S->mapped_offset;
+    if(S->orphaning) {
+        if(size > S->scratch_size) {
+            void* scratch = realloc(S->scratch, size);
+            if(scratch == NULL) {
+                /* Keep the old scratch for the smaller allocations */
+                system_log("Stream buffer: can't allocate %u bytes of scratch\n", (unsigned)size);
+                return NULL;
+            }
+            S->scratch = scratch;
+            S->scratch_size = size;
+        }
+        S->mapped = S->scratch;
+    }
+    return S->mapped;
+}
+void unmap_stream(StreamBuffer* S)
+{
+    assert(S->mapped);
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, S->buffer));
+    if(S->orphaning) {
+        ASSERT_GL(glBufferSubData(GL_ARRAY_BUFFER, S->mapped_offset, S->mapped_size, S->scratch));
+    } else {
+        double unmap_start = get_running_time(S->timer);
+        ASSERT_GL(glUnmapBuffer(GL_ARRAY_BUFFER));
+        S->map_time += get_running_time(S->timer) - unmap_start;
+        S->num_maps++;
+    }
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    S->mapped = NULL;
+}
+GLintptr stream_data(StreamBuffer* S, const void* data, size_t size, size_t alignment, GLuint* buffer)
+{
+    GLintptr offset = 0;
+    void*    dest;
+
+    if(size == 0) {
+        *buffer = S->buffer;
+        return 0;
+    }
+    dest = map_stream(S, size, alignment, buffer, &offset);
+    if(dest == NULL)
+        return offset;
+    memcpy(dest, data, size);
+    unmap_stream(S);
+    return offset;
+}
+StreamStats stream_stats(const StreamBuffer* S)
+{
+    return S->last_stats;
+}
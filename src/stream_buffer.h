@@ -0,0 +1,80 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __stream_buffer_h__
+#define __stream_buffer_h__
+
+#include <stddef.h>
+#include "gl_include.h"
+
+/** Per-frame streaming of dynamic data (instance transforms, light lists,
+ *  uniform blocks, UI quads)
+ *
+ *  The buffer is split into STREAM_FRAMES regions used round robin. Each
+ *  region is fenced when its frame ends and only written again once the GPU
+ *  has passed the fence, so writes map it unsynchronized and never stall on
+ *  draws still in flight. Where mapping is unavailable (ES2) or measured to
+ *  be slow the buffer instead orphans its store every frame and writes with
+ *  glBufferSubData.
+ *
+ *  A frame that outgrows its region moves to a larger buffer, so
+ *  allocations always succeed. Earlier allocations keep their old buffer,
+ *  which is why every allocation reports the buffer it lives in.
+ */
+typedef struct StreamBuffer StreamBuffer;
+
+#define STREAM_FRAMES 3
+
+typedef struct StreamStats
+{
+    int     bytes;          /* Streamed during the frame */
+    int     allocations;
+    int     waits;          /* Times the CPU waited on a region's fence */
+    float   wait_time;      /* Seconds spent waiting */
+    int     orphaning;      /* Non-zero when mapping is not used */
+} StreamStats;
+
+/** @param frame_size Initial bytes per frame, regions grow as needed
+ *  @param can_map Non-zero if glMapBufferRange and fences are available
+ */
+StreamBuffer* create_stream_buffer(size_t frame_size, int can_map);
+void destroy_stream_buffer(StreamBuffer* S);
+
+/** @brief Ends the current frame and starts the next one. Fences the
+ *  finished region and waits, if needed, until the GPU is done with the
+ *  region that is about to be reused.
+ */
+void next_stream_frame(StreamBuffer* S);
+
+/** @brief Reserves `size` bytes, starting on a multiple of `alignment`, and
+ *  returns a pointer to write them through. Must be followed by
+ *  `unmap_stream` before the next allocation or draw.
+ *  @param buffer Receives the buffer the data lives in
+ *  @param offset Receives the byte offset of the data in `buffer`
+ *  @return NULL if out of memory, with nothing to unmap
+ */
+void* map_stream(StreamBuffer* S, size_t size, size_t alignment, GLuint* buffer, GLintptr* offset);
+void unmap_stream(StreamBuffer* S);
+
+/** @brief Copies `size` bytes into the stream, see `map_stream`
+ *  @return The byte offset of the data in `*buffer`
+ */
+GLintptr stream_data(StreamBuffer* S, const void* data, size_t size, size_t alignment, GLuint* buffer);
+
+/** @return Counters of the last finished frame */
+StreamStats stream_stats(const StreamBuffer* S);
+
+#endif /* include guard */
@@ -23,6 +23,11 @@
  */
 int load_file_data(const char* filename, void** data, size_t* data_size);
 void free_file_data(void* data);
+/** Reads and writes files in the application's writable cache directory
+ *  @return 0 on success, -1 on failure
+ */
+int load_cache_data(const char* name, void** data, size_t* data_size);
+int save_cache_data(const char* name, const void* data, size_t data_size);
 /** Prints a message to the systems log
  */
 void system_log(const char* format, ...);
@@ -16,6 +16,7 @@
 
 #include "texture.h"
 #include "system.h"
+#include "compression.h"
 #include "external/stb_image.h"
 #include "gl_include.h"
 
@@ -46,7 +47,7 @@ Texture load_texture(const char* filename)
     GLenum      format;
     int         result;
 
-    result = load_file_data(filename, &file_data, &file_size);
+    result = load_asset_data(filename, &file_data, &file_size);
     if(result != 0)
         system_log("Loading texture failed: %s\n", filename);
     assert(result == 0);
@@ -97,7 +98,7 @@ Texture load_texture(const char* filename)
     ASSERT_GL(glBindTexture(GL_TEXTURE_2D, 0));
 
     stbi_image_free(texture_data);
-    free_file_data(file_data);
+    free_asset_data(file_data);
 
     return texture;
 }
@@ -18,10 +18,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include "system.h"
 #include "Graphics.h"
 #include "gl_include.h"
 #include "program.h"
+#include "uniforms.h"
+#include "stream_buffer.h"
 
 /* Defines
  */
@@ -33,6 +36,7 @@ enum {
     kBMFontKerningBlock = 5
 };
 #define MAX_STRINGS 128
+#define MAX_GLYPHS  4096    /* Per frame, the quads share one index buffer */
 
 /* Types
  */
@@ -104,10 +108,16 @@ typedef struct FontData
     bmfont_kerning_pairs_t  kerning[256];
 } FontData;
 
+typedef struct GlyphVertex
+{
+    Vec3    pos;
+    Vec2    tex;
+} GlyphVertex;
+
 typedef struct Font {
     FontData    data;
     GLuint      textures[16];
-    GLuint      char_vertices[256];
+    GlyphVertex char_quads[256][4]; /* Unit scale, streamed per frame */
     GLuint      char_indices;
 } Font;
 
@@ -118,13 +128,11 @@ struct UI
     int     width;
     int     height;
 
-    GLuint  program;
-    GLuint  u_ViewProjection;
-    GLuint  u_World;
-    GLuint  u_Color;
-    GLuint  s_Texture;
+    GLuint          program;
+    UniformTable*   uniforms;
 
     Font    font;
+    uint8_t glyph_pages[MAX_GLYPHS];    /* Texture page of each streamed quad */
 
     struct {
         float x;
@@ -142,6 +150,7 @@ static const uint16_t kQuadIndices[] =
     0, 1, 2,
     2, 3, 0,
 };
+#define QUAD_INDEX_COUNT (sizeof(kQuadIndices)/sizeof(kQuadIndices[0]))
 
 /* Variables
  */
@@ -223,30 +232,31 @@ static FontData _load_font(const char* filename)
 
     return font;
 }
-static void _draw_string(UI* U, float x, float y, float scale, char* string)
+/** Appends the quads of a string, pre-transformed, and returns the new
+ *  glyph count
+ */
+static int _write_string(UI* U, GlyphVertex* vertices, int num_glyphs, float x, float y, float scale, const char* string)
 {
-    Vec4 color = {1.0f, 1.0f, 1.0f, 1.0f};
-    ASSERT_GL(glUniform4fv(U->u_Color, 1, (float*)&color));
-    while(string && *string) {
-        char c = *string;
+    while(string && *string && num_glyphs < MAX_GLYPHS) {
+        unsigned char c = (unsigned char)*string;
         bmfont_char_t glyph = U->font.data.chars[c];
 
-        if(c != ' ') {
-            float* ptr = 0;
-            Mat4 world = mat4_scalef(scale,scale,1.0f);
-            world.r3.x = x;
-            world.r3.y = y;
-
-            ASSERT_GL(glUniformMatrix4fv(U->u_World, 1, GL_FALSE, (float*)&world));
-            ASSERT_GL(glBindTexture(GL_TEXTURE_2D, U->font.textures[glyph.page]));
-            ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, U->font.char_vertices[c]));
-            ASSERT_GL(glVertexAttribPointer(kPositionSlot,    3, GL_FLOAT, GL_FALSE, sizeof(float)*5, (void*)(ptr+=0)));
-            ASSERT_GL(glVertexAttribPointer(kTexCoordSlot,    2, GL_FLOAT, GL_FALSE, sizeof(float)*5, (void*)(ptr+=3)));
-            ASSERT_GL(glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, NULL));
+        if(c != ' ' && glyph.id != 0) {
+            GlyphVertex* quad = vertices + num_glyphs*4;
+            int jj;
+            for(jj=0;jj<4;++jj) {
+                quad[jj].pos.x = U->font.char_quads[c][jj].pos.x*scale + x;
+                quad[jj].pos.y = U->font.char_quads[c][jj].pos.y*scale + y;
+                quad[jj].pos.z = U->font.char_quads[c][jj].pos.z;
+                quad[jj].tex = U->font.char_quads[c][jj].tex;
+            }
+            U->glyph_pages[num_glyphs] = glyph.page;
+            ++num_glyphs;
         }
         x += (glyph.xadvance/(float)U->font.data.common.lineHeight)*scale;
         ++string;
     }
+    return num_glyphs;
 }
 
 /* External functions
@@ -260,6 +270,7 @@ UI* create_ui(Graphics* G)
     };
     int ii = 0;
     UI* U = (UI*)calloc(1, sizeof(UI));
+    uint16_t* indices;
 
     U->G = G;
     U->font.data = _load_font("inconsolata.fnt");
@@ -271,11 +282,15 @@ UI* create_ui(Graphics* G)
         U->font.textures[ii] = load_texture(U->font.data.pages[ii].pageName);
     }
 
-    /* Create character index buffer */
+    /* Create character index buffer, covering every quad of a frame */
+    indices = (uint16_t*)malloc(MAX_GLYPHS*sizeof(kQuadIndices));
+    for(ii=0;ii<MAX_GLYPHS*(int)QUAD_INDEX_COUNT;++ii)
+        indices[ii] = (uint16_t)(kQuadIndices[ii%QUAD_INDEX_COUNT] + (ii/QUAD_INDEX_COUNT)*4);
     ASSERT_GL(glGenBuffers(1, &U->font.char_indices));
     ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, U->font.char_indices));
-    ASSERT_GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(kQuadIndices), kQuadIndices, GL_STATIC_DRAW));
+    ASSERT_GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, MAX_GLYPHS*sizeof(kQuadIndices), indices, GL_STATIC_DRAW));
     ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+    free(indices);
 
     /* Create character meshes */
     for(ii=0;ii<256;++ii) {
@@ -284,10 +299,7 @@ UI* create_ui(Graphics* G)
         Vec2 tex_scale;
         int jj;
         bmfont_char_t c = U->font.data.chars[ii];
-        struct {
-            Vec3    pos;
-            Vec2    tex;
-        } quad_vertices[] =
+        GlyphVertex quad_vertices[] =
         {
             0.0f,    c.height, 0.0f,     c.x,         c.y,          // TL
             c.width, c.height, 0.0f,     c.x+c.width, c.y,          // TR
@@ -308,26 +320,22 @@ UI* create_ui(Graphics* G)
             quad_vertices[jj].pos = vec3_div(quad_vertices[jj].pos, pos_scale);
             quad_vertices[jj].tex = vec2_div(quad_vertices[jj].tex, tex_scale);
         }
-        ASSERT_GL(glGenBuffers(1, &U->font.char_vertices[ii]));
-        ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, U->font.char_vertices[ii]));
-        ASSERT_GL(glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), quad_vertices, GL_STATIC_DRAW));
-        ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+        memcpy(U->font.char_quads[ii], quad_vertices, sizeof(quad_vertices));
     }
 
     /* Create shader */
     U->program = create_program("shaders/ui/vertex.glsl",
                                 "shaders/ui/fragment.glsl",
                                 slots);
-
-    ASSERT_GL(U->u_ViewProjection = glGetUniformLocation(U->program, "u_ViewProjection"));
-    ASSERT_GL(U->u_World = glGetUniformLocation(U->program, "u_World"));
-    ASSERT_GL(U->u_Color = glGetUniformLocation(U->program, "u_Color"));
-    ASSERT_GL(U->s_Texture = glGetUniformLocation(U->program, "s_Texture"));
+    finish_program(U->program);
+    U->uniforms = create_uniform_table(U->program);
 
     return U;
 }
 void destroy_ui(UI* U)
 {
+    destroy_uniform_table(U->uniforms);
+    destroy_program(U->program);
     free(U);
 }
 
@@ -348,19 +356,63 @@ void add_string(UI* U, float x, float y, float scale, const char* string)
 }
 void draw_ui(UI* U)
 {
-    int ii;
+    StreamBuffer*   stream = graphics_stream_buffer(U->G);
+    GlyphVertex*    vertices;
+    GLuint          buffer;
+    GLintptr        offset;
+    Vec4            color = {1.0f, 1.0f, 1.0f, 1.0f};
+    char*           base;
+    int             num_glyphs = 0;
+    int             max_glyphs = 0;
+    int             first;
+    int             ii;
+
+    /* Stream every quad of the frame at once, then draw a run per texture page */
+    for(ii=0;ii<U->num_strings;++ii)
+        max_glyphs += (int)strlen(U->strings[ii].string);
+    if(max_glyphs > MAX_GLYPHS)
+        max_glyphs = MAX_GLYPHS;
+    if(max_glyphs == 0) {
+        U->num_strings = 0;
+        return;
+    }
+    vertices = (GlyphVertex*)map_stream(stream, max_glyphs*4*sizeof(GlyphVertex), sizeof(float), &buffer, &offset);
+    if(vertices == NULL) {
+        U->num_strings = 0;
+        return;
+    }
+    for(ii=0;ii<U->num_strings && num_glyphs < max_glyphs;++ii) {
+        num_glyphs = _write_string(U, vertices, num_glyphs, U->strings[ii].x, U->strings[ii].y,
+                                   U->strings[ii].scale, U->strings[ii].string);
+    }
+    unmap_stream(stream);
+    U->num_strings = 0;
+
     ASSERT_GL(glDepthMask(GL_FALSE));
     ASSERT_GL(glDepthFunc(GL_ALWAYS));
     ASSERT_GL(glEnable(GL_BLEND));
     ASSERT_GL(glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA));
     ASSERT_GL(glUseProgram(U->program));
-    ASSERT_GL(glUniformMatrix4fv(U->u_ViewProjection, 1, GL_FALSE, (float*)&U->proj_matrix));
+    set_uniform(U->uniforms, "u_ViewProjection", &U->proj_matrix);
+    set_uniform(U->uniforms, "u_Color", &color);
+    commit_uniforms(U->uniforms);
+
+    base = (char*)0 + offset;
+    ASSERT_GL(glBindBuffer(GL_ARRAY_BUFFER, buffer));
     ASSERT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, U->font.char_indices));
+    ASSERT_GL(glVertexAttribPointer(kPositionSlot, 3, GL_FLOAT, GL_FALSE, sizeof(GlyphVertex), base + offsetof(GlyphVertex, pos)));
+    ASSERT_GL(glVertexAttribPointer(kTexCoordSlot, 2, GL_FLOAT, GL_FALSE, sizeof(GlyphVertex), base + offsetof(GlyphVertex, tex)));
+    ASSERT_GL(glEnableVertexAttribArray(kPositionSlot));
+    ASSERT_GL(glEnableVertexAttribArray(kTexCoordSlot));
     ASSERT_GL(glActiveTexture(GL_TEXTURE0));
-    for (ii=0; ii<U->num_strings; ++ii) {
-        _draw_string(U, U->strings[ii].x, U->strings[ii].y, U->strings[ii].scale, U->strings[ii].string);
+    for(first=0;first<num_glyphs;first=ii) {
+        for(ii=first+1;ii<num_glyphs && U->glyph_pages[ii] == U->glyph_pages[first];++ii)
+            ;
+        ASSERT_GL(glBindTexture(GL_TEXTURE_2D, U->font.textures[U->glyph_pages[first]]));
+        ASSERT_GL(glDrawElements(GL_TRIANGLES, (ii - first)*QUAD_INDEX_COUNT, GL_UNSIGNED_SHORT,
+                                 (char*)0 + first*sizeof(kQuadIndices)));
     }
-    U->num_strings = 0;
+
     ASSERT_GL(glDepthMask(GL_TRUE));
     ASSERT_GL(glDepthFunc(GL_LESS));
     ASSERT_GL(glDisable(GL_BLEND));
@@ -0,0 +1,291 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "uniforms.h"
+#include <stdlib.h>
+#include <string.h>
+#include "gl_include.h"
+
+/* Defines
+ */
+#define MAX_UNIFORM_NAME    64
+#define MAX_UNIFORM_BLOCKS  8
+
+/* Types
+ */
+typedef struct Uniform
+{
+    uint32_t    hash;
+    char        name[MAX_UNIFORM_NAME];
+    GLint       location;
+    GLenum      type;
+    int         components;     /* 4 byte values per element */
+    int         size;           /* Array elements */
+    int         offset;         /* Offset into the shadow values, in 4 byte units */
+    int         dirty_count;    /* Elements to upload on commit, 0 when clean */
+} Uniform;
+
+typedef struct UniformBlock
+{
+    uint32_t    hash;
+    char        name[MAX_UNIFORM_NAME];
+    int         index;
+    int         size;
+} UniformBlock;
+
+struct UniformTable
+{
+    Program     program;
+
+    Uniform*    uniforms;
+    int         num_uniforms;
+
+    UniformBlock    blocks[MAX_UNIFORM_BLOCKS];
+    int             num_blocks;
+
+    uint32_t*   values;         /* Shadow copy of what the program holds */
+};
+
+/* Constants
+ */
+static const char* kUniformBlockNames[NUM_UNIFORM_BLOCKS] =
+{
+    "PerFrame",     /* kPerFrameBlock */
+    "Lights",       /* kLightsBlock */
+    "PerMaterial",  /* kPerMaterialBlock */
+};
+
+/* Variables
+ */
+static int  _uploads = 0;
+static int  _skipped = 0;
+
+/* Internal functions
+ */
+static uint32_t _hash_name(const char* name)
+{
+    uint32_t hash = 0x811c9dc5;
+    while(*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+static int _type_components(GLenum type)
+{
+    switch(type) {
+    case GL_FLOAT_VEC2:
+    case GL_INT_VEC2:
+    case GL_BOOL_VEC2:
+        return 2;
+    case GL_FLOAT_VEC3:
+    case GL_INT_VEC3:
+    case GL_BOOL_VEC3:
+        return 3;
+    case GL_FLOAT_VEC4:
+    case GL_INT_VEC4:
+    case GL_BOOL_VEC4:
+    case GL_FLOAT_MAT2:
+        return 4;
+    case GL_FLOAT_MAT3:
+        return 9;
+    case GL_FLOAT_MAT4:
+        return 16;
+    default:
+        /* Scalars and samplers */
+        return 1;
+    }
+}
+static int _block_binding(const char* name)
+{
+    int ii;
+    for(ii=0;ii<NUM_UNIFORM_BLOCKS;++ii) {
+        if(strcmp(kUniformBlockNames[ii], name) == 0)
+            return ii;
+    }
+    return -1;
+}
+static Uniform* _find_uniform(const UniformTable* T, const char* name)
+{
+    uint32_t hash = _hash_name(name);
+    int ii;
+    for(ii=0;ii<T->num_uniforms;++ii) {
+        if(T->uniforms[ii].hash == hash && strcmp(T->uniforms[ii].name, name) == 0)
+            return &T->uniforms[ii];
+    }
+    return NULL;
+}
+static const UniformBlock* _find_block(const UniformTable* T, const char* name)
+{
+    uint32_t hash = _hash_name(name);
+    int ii;
+    for(ii=0;ii<T->num_blocks;++ii) {
+        if(T->blocks[ii].hash == hash && strcmp(T->blocks[ii].name, name) == 0)
+            return &T->blocks[ii];
+    }
+    return NULL;
+}
+static void _upload_uniform(const Uniform* U, const void* data)
+{
+    const float* f = (const float*)data;
+    const GLint* i = (const GLint*)data;
+    int count = U->dirty_count;
+
+    switch(U->type) {
+    case GL_FLOAT:      ASSERT_GL(glUniform1fv(U->location, count, f)); break;
+    case GL_FLOAT_VEC2: ASSERT_GL(glUniform2fv(U->location, count, f)); break;
+    case GL_FLOAT_VEC3: ASSERT_GL(glUniform3fv(U->location, count, f)); break;
+    case GL_FLOAT_VEC4: ASSERT_GL(glUniform4fv(U->location, count, f)); break;
+    case GL_FLOAT_MAT2: ASSERT_GL(glUniformMatrix2fv(U->location, count, GL_FALSE, f)); break;
+    case GL_FLOAT_MAT3: ASSERT_GL(glUniformMatrix3fv(U->location, count, GL_FALSE, f)); break;
+    case GL_FLOAT_MAT4: ASSERT_GL(glUniformMatrix4fv(U->location, count, GL_FALSE, f)); break;
+    case GL_INT_VEC2:
+    case GL_BOOL_VEC2:  ASSERT_GL(glUniform2iv(U->location, count, i)); break;
+    case GL_INT_VEC3:
+    case GL_BOOL_VEC3:  ASSERT_GL(glUniform3iv(U->location, count, i)); break;
+    case GL_INT_VEC4:
+    case GL_BOOL_VEC4:  ASSERT_GL(glUniform4iv(U->location, count, i)); break;
+    default:
+        /* int, bool and samplers */
+        ASSERT_GL(glUniform1iv(U->location, count, i));
+        break;
+    }
+}
+
+/* External functions
+ */
+UniformTable* create_uniform_table(Program program)
+{
+    UniformTable* T = (UniformTable*)calloc(1, sizeof(*T));
+    GLint   num_uniforms = 0;
+    int     num_values = 0;
+    int     es3 = gl_major_version() >= 3;
+    int     ii;
+
+    T->program = program;
+    ASSERT_GL(glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &num_uniforms));
+    T->uniforms = (Uniform*)calloc(num_uniforms ? num_uniforms : 1, sizeof(Uniform));
+
+    for(ii=0;ii<num_uniforms;++ii) {
+        Uniform*    U = &T->uniforms[T->num_uniforms];
+        GLint       size = 0;
+        GLenum      type = 0;
+        GLuint      index = (GLuint)ii;
+        char*       bracket;
+
+        ASSERT_GL(glGetActiveUniform(program, index, sizeof(U->name), NULL, &size, &type, U->name));
+        if(es3) {
+            /* Block members are set through buffers, not the table */
+            GLint block_index = -1;
+            ASSERT_GL(glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &block_index));
+            if(block_index != -1)
+                continue;
+        }
+        /* Arrays are reported as "name[0]" */
+        bracket = strchr(U->name, '[');
+        if(bracket)
+            *bracket = '\0';
+        U->hash = _hash_name(U->name);
+        U->location = glGetUniformLocation(program, U->name);
+        U->type = type;
+        U->size = size;
+        U->components = _type_components(type);
+        U->offset = num_values;
+        num_values += U->components * size;
+        T->num_uniforms++;
+    }
+    T->values = (uint32_t*)calloc(num_values ? num_values : 1, sizeof(uint32_t));
+
+    if(es3) {
+        GLint num_blocks = 0;
+        ASSERT_GL(glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &num_blocks));
+        for(ii=0;ii<num_blocks && ii<MAX_UNIFORM_BLOCKS;++ii) {
+            UniformBlock* B = &T->blocks[T->num_blocks++];
+            int binding;
+            ASSERT_GL(glGetActiveUniformBlockName(program, ii, sizeof(B->name), NULL, B->name));
+            ASSERT_GL(glGetActiveUniformBlockiv(program, ii, GL_UNIFORM_BLOCK_DATA_SIZE, &B->size));
+            B->hash = _hash_name(B->name);
+            B->index = ii;
+            binding = _block_binding(B->name);
+            if(binding >= 0)
+                ASSERT_GL(glUniformBlockBinding(program, ii, binding));
+        }
+    }
+    return T;
+}
+void destroy_uniform_table(UniformTable* T)
+{
+    if(T == NULL)
+        return;
+    free(T->values);
+    free(T->uniforms);
+    free(T);
+}
+void set_uniform_array(UniformTable* T, const char* name, const void* data, int count)
+{
+    Uniform*    U = _find_uniform(T, name);
+    uint32_t*   values;
+    size_t      bytes;
+
+    if(U == NULL)
+        return;
+    if(count > U->size)
+        count = U->size;
+    values = T->values + U->offset;
+    bytes = count * U->components * sizeof(uint32_t);
+    if(memcmp(values, data, bytes) == 0) {
+        _skipped++;
+        return;
+    }
+    memcpy(values, data, bytes);
+    if(count > U->dirty_count)
+        U->dirty_count = count;
+}
+void set_uniform_int(UniformTable* T, const char* name, int value)
+{
+    set_uniform_array(T, name, &value, 1);
+}
+void set_uniform_float(UniformTable* T, const char* name, float value)
+{
+    set_uniform_array(T, name, &value, 1);
+}
+void commit_uniforms(UniformTable* T)
+{
+    int ii;
+    for(ii=0;ii<T->num_uniforms;++ii) {
+        Uniform* U = &T->uniforms[ii];
+        if(U->dirty_count == 0)
+            continue;
+        _upload_uniform(U, T->values + U->offset);
+        U->dirty_count = 0;
+        _uploads++;
+    }
+}
+int uniform_block_index(const UniformTable* T, const char* name)
+{
+    const UniformBlock* B = _find_block(T, name);
+    return B ? B->index : -1;
+}
+int uniform_block_size(const UniformTable* T, const char* name)
+{
+    const UniformBlock* B = _find_block(T, name);
+    return B ? B->size : 0;
+}
+void uniform_upload_counts(int* uploads, int* skipped)
+{
+    *uploads = _uploads;
+    *skipped = _skipped;
+}
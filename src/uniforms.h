@@ -0,0 +1,105 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __uniforms_h__
+#define __uniforms_h__
+
+#include "program.h"
+#include "vec_math.h"
+
+/** Size of the light array in the Lights block, matches
+ *  shaders/common/light_array.glsl
+ */
+#define MAX_BLOCK_LIGHTS 256
+
+/** Uniform blocks shared by every program. Each block has a fixed binding
+ *  point, assigned when a program's table is created, so a buffer bound once
+ *  serves all programs.
+ */
+typedef enum {
+    kPerFrameBlock,
+    kLightsBlock,
+    kPerMaterialBlock,
+
+    NUM_UNIFORM_BLOCKS
+} UniformBlockBinding;
+
+/** CPU images of the blocks, in std140 layout */
+typedef struct PerFrameBlock
+{
+    Mat4    projection;
+    Mat4    view;
+    Mat4    inv_proj;
+    float   viewport[2];
+    float   target_scale[2];
+} PerFrameBlock;
+
+typedef struct LightsBlock
+{
+    Vec4    position_size[MAX_BLOCK_LIGHTS];   /* xyz: View space position, w: size */
+    Vec4    color[MAX_BLOCK_LIGHTS];
+    int     num_lights;
+    int     _pad[3];
+} LightsBlock;
+
+typedef struct PerMaterialBlock
+{
+    Vec3    specular_color;
+    float   specular_power;
+    float   specular_coefficient;
+    float   _pad[3];
+} PerMaterialBlock;
+
+/** Reflected uniform state of a program
+ *
+ *  The table is built from `glGetActiveUniform`, so renderers set uniforms by
+ *  name instead of keeping their own location tables. Values are shadowed on
+ *  the CPU and `commit_uniforms` only uploads the ones that changed since the
+ *  last commit for that program.
+ */
+typedef struct UniformTable UniformTable;
+
+/** @brief Reflects the active uniforms of `program`. The program must be
+ *  finished, see `finish_program`.
+ */
+UniformTable* create_uniform_table(Program program);
+void destroy_uniform_table(UniformTable* T);
+
+/** @brief Sets `count` array elements of a uniform, starting at the first.
+ *  Ints and samplers take `int` data, everything else takes `float` data.
+ *  Unknown names are ignored, the compiler may have dropped the uniform.
+ */
+void set_uniform_array(UniformTable* T, const char* name, const void* data, int count);
+#define set_uniform(T, name, data) set_uniform_array(T, name, data, 1)
+void set_uniform_int(UniformTable* T, const char* name, int value);
+void set_uniform_float(UniformTable* T, const char* name, float value);
+
+/** @brief Uploads every uniform changed since the last commit. The program
+ *  must be bound.
+ */
+void commit_uniforms(UniformTable* T);
+
+/** @return The index of a uniform block, or -1 if it is not active */
+int uniform_block_index(const UniformTable* T, const char* name);
+/** @return The size of a uniform block in bytes, or 0 if it is not active */
+int uniform_block_size(const UniformTable* T, const char* name);
+
+/** @brief Totals of uniform uploads issued, and skipped because the value
+ *  did not change
+ */
+void uniform_upload_counts(int* uploads, int* skipped);
+
+#endif /* include guard */
@@ -35,7 +35,12 @@ typedef enum AttributeSlot
     kTangentSlot,
     kBitangentSlot,
     kTexCoordSlot,
+    kWorldSlot,     /* Per-instance mat4, takes four consecutive slots */
+    kLightPositionSlot = kWorldSlot + 4,
+    kLightColorSlot,
+    kLightSizeSlot,
 
+    NUM_ATTRIBUTE_SLOTS,
     kEmptySlot = -1
 } AttributeSlot;
 
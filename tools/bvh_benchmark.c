@@ -0,0 +1,238 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Compares the scene BVH against linear scans for building, refitting and
+ *  frustum, sphere and ray queries as the model count grows.
+ *
+ *  Build:
+ *      make bvh_benchmark
+ *  Usage:
+ *      bvh_benchmark
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include "bvh.h"
+#include "culling.h"
+#include "timer.h"
+
+/* Defines
+ */
+#define ITERATIONS      16
+#define NUM_SPHERES     64
+#define NUM_RAYS        256
+#define WORLD_SIZE      500.0f
+#define MOVED_FRACTION  100     /* One in this many items moves per refit */
+
+/* Internal functions
+ */
+static float _random(float min, float max)
+{
+    return min + (max - min)*(rand()/(float)RAND_MAX);
+}
+static Bounds _random_bounds(void)
+{
+    Bounds b;
+    b.center = vec3_create(_random(-WORLD_SIZE, WORLD_SIZE), _random(0.0f, 10.0f), _random(-WORLD_SIZE, WORLD_SIZE));
+    b.extents = vec3_create(_random(0.5f, 2.0f), _random(0.5f, 2.0f), _random(0.5f, 2.0f));
+    b.radius = vec3_length(b.extents);
+    return b;
+}
+static int _compare_int(const void* a, const void* b)
+{
+    return *(const int*)a - *(const int*)b;
+}
+static int _sphere_touches(const Bounds* b, Vec3 c, float r)
+{
+    float dx = fmaxf(fabsf(c.x - b->center.x) - b->extents.x, 0.0f);
+    float dy = fmaxf(fabsf(c.y - b->center.y) - b->extents.y, 0.0f);
+    float dz = fmaxf(fabsf(c.z - b->center.z) - b->extents.z, 0.0f);
+    return dx*dx + dy*dy + dz*dz <= r*r;
+}
+static float _ray_distance(const Bounds* b, Vec3 o, Vec3 d, float max_distance)
+{
+    float   origin[3] = { o.x, o.y, o.z };
+    float   dir[3] = { d.x, d.y, d.z };
+    float   center[3] = { b->center.x, b->center.y, b->center.z };
+    float   extent[3] = { b->extents.x, b->extents.y, b->extents.z };
+    float   t_near = 0.0f, t_far = max_distance;
+    int     ii;
+    for(ii=0;ii<3;++ii) {
+        float t0 = (center[ii] - extent[ii] - origin[ii])/dir[ii];
+        float t1 = (center[ii] + extent[ii] - origin[ii])/dir[ii];
+        t_near = fmaxf(t_near, fminf(t0, t1));
+        t_far = fminf(t_far, fmaxf(t0, t1));
+    }
+    return t_near <= t_far ? t_near : FLT_MAX;
+}
+
+/* External functions
+ */
+int main(void)
+{
+    static const int kCounts[] = { 1000, 10000, 100000 };
+    Mat4    view = mat4_inverse(mat4_translatef(0.0f, 2.0f, -50.0f));
+    Mat4    proj = mat4_perspective_fov(kPiDiv2, 16.0f/9.0f, 1.0f, 100.0f);
+    Frustum frustum = frustum_from_matrix(mat4_multiply(view, proj));
+    int     ii;
+
+    printf("%8s | %9s %9s %9s | %18s | %18s | %18s\n", "models", "build", "update", "refit",
+           "frustum bvh/linear", "sphere bvh/linear", "ray bvh/linear");
+    for(ii=0;ii<(int)(sizeof(kCounts)/sizeof(kCounts[0]));++ii) {
+        int         count = kCounts[ii];
+        Bounds*     bounds = (Bounds*)malloc(count*sizeof(Bounds));
+        float*      soa = (float*)malloc(count*6*sizeof(float));
+        uint8_t*    visible = (uint8_t*)malloc(count);
+        int*        items = (int*)malloc(count*sizeof(int));
+        int*        reference = (int*)malloc(count*sizeof(int));
+        Vec3        spheres[NUM_SPHERES];
+        Vec3        ray_origins[NUM_RAYS];
+        Vec3        ray_dirs[NUM_RAYS];
+        float       ray_distance[NUM_RAYS];
+        double      build_time, update_time, refit_time;
+        double      frustum_time[2], sphere_time[2], ray_time[2];
+        int         num_items = 0, num_reference = 0;
+        BVH*        bvh = NULL;
+        Timer*      timer;
+        int         jj, kk;
+
+        for(jj=0;jj<count;++jj)
+            bounds[jj] = _random_bounds();
+        for(jj=0;jj<count;++jj) {
+            soa[jj + count*0] = bounds[jj].center.x;
+            soa[jj + count*1] = bounds[jj].center.y;
+            soa[jj + count*2] = bounds[jj].center.z;
+            soa[jj + count*3] = bounds[jj].extents.x;
+            soa[jj + count*4] = bounds[jj].extents.y;
+            soa[jj + count*5] = bounds[jj].extents.z;
+        }
+        for(jj=0;jj<NUM_SPHERES;++jj)
+            spheres[jj] = _random_bounds().center;
+        for(jj=0;jj<NUM_RAYS;++jj) {
+            ray_origins[jj] = vec3_create(_random(-WORLD_SIZE, WORLD_SIZE), 5.0f, _random(-WORLD_SIZE, WORLD_SIZE));
+            ray_dirs[jj] = vec3_normalize(vec3_create(_random(-1.0f, 1.0f), _random(-0.05f, 0.05f), _random(-1.0f, 1.0f)));
+        }
+
+        /* Build and refit */
+        timer = create_timer();
+        for(kk=0;kk<ITERATIONS;++kk) {
+            if(bvh)
+                destroy_bvh(bvh);
+            bvh = create_bvh(bounds, count);
+        }
+        build_time = get_running_time(timer)/ITERATIONS;
+
+        reset_timer(timer);
+        for(kk=0;kk<ITERATIONS;++kk) {
+            for(jj=kk;jj<count;jj+=MOVED_FRACTION) {
+                bounds[jj].center.y += (kk & 1) ? -0.25f : 0.25f;
+                update_bvh_item(bvh, jj, &bounds[jj]);
+            }
+        }
+        update_time = get_running_time(timer)/ITERATIONS;
+
+        reset_timer(timer);
+        for(kk=0;kk<ITERATIONS;++kk)
+            refit_bvh(bvh);
+        refit_time = get_running_time(timer)/ITERATIONS;
+        for(jj=0;jj<count;++jj)
+            soa[jj + count*1] = bounds[jj].center.y;
+
+        /* Frustum */
+        reset_timer(timer);
+        for(kk=0;kk<ITERATIONS;++kk)
+            num_items = query_bvh_frustum(bvh, &frustum, items, count);
+        frustum_time[0] = get_running_time(timer)/ITERATIONS;
+        reset_timer(timer);
+        for(kk=0;kk<ITERATIONS;++kk)
+            cull_boxes(&frustum, soa, soa+count, soa+count*2, soa+count*3, soa+count*4, soa+count*5, count, visible);
+        frustum_time[1] = get_running_time(timer)/ITERATIONS;
+
+        for(jj=0;jj<count;++jj)
+            if(visible[jj])
+                reference[num_reference++] = jj;
+        qsort(items, num_items, sizeof(int), _compare_int);
+        if(num_items != num_reference || memcmp(items, reference, num_items*sizeof(int)) != 0) {
+            printf("Frustum query differs for %d models: %d vs %d\n", count, num_items, num_reference);
+            return 1;
+        }
+
+        /* Spheres */
+        reset_timer(timer);
+        for(kk=0;kk<NUM_SPHERES;++kk)
+            query_bvh_sphere(bvh, spheres[kk], 10.0f, items, count);
+        sphere_time[0] = get_running_time(timer)/NUM_SPHERES;
+        reset_timer(timer);
+        for(kk=0;kk<NUM_SPHERES;++kk) {
+            num_reference = 0;
+            for(jj=0;jj<count;++jj)
+                if(_sphere_touches(&bounds[jj], spheres[kk], 10.0f))
+                    reference[num_reference++] = jj;
+        }
+        sphere_time[1] = get_running_time(timer)/NUM_SPHERES;
+        num_items = query_bvh_sphere(bvh, spheres[NUM_SPHERES-1], 10.0f, items, count);
+        qsort(items, num_items, sizeof(int), _compare_int);
+        if(num_items != num_reference || memcmp(items, reference, num_items*sizeof(int)) != 0) {
+            printf("Sphere query differs for %d models: %d vs %d\n", count, num_items, num_reference);
+            return 1;
+        }
+
+        /* Rays */
+        reset_timer(timer);
+        for(kk=0;kk<NUM_RAYS;++kk)
+            items[kk] = raycast_bvh(bvh, ray_origins[kk], ray_dirs[kk], FLT_MAX, &ray_distance[kk]);
+        ray_time[0] = get_running_time(timer)/NUM_RAYS;
+        reset_timer(timer);
+        for(kk=0;kk<NUM_RAYS;++kk) {
+            float closest = FLT_MAX;
+            reference[kk] = -1;
+            for(jj=0;jj<count;++jj) {
+                float t = _ray_distance(&bounds[jj], ray_origins[kk], ray_dirs[kk], closest);
+                if(t != FLT_MAX && (reference[kk] == -1 || t < closest)) {
+                    closest = t;
+                    reference[kk] = jj;
+                }
+            }
+        }
+        ray_time[1] = get_running_time(timer)/NUM_RAYS;
+        for(kk=0;kk<NUM_RAYS;++kk) {
+            /* Boxes can overlap, so compare the distances rather than the items */
+            if((items[kk] == -1) != (reference[kk] == -1) ||
+               (items[kk] != -1 && fabsf(ray_distance[kk] - _ray_distance(&bounds[reference[kk]], ray_origins[kk], ray_dirs[kk], FLT_MAX)) > 1e-3f)) {
+                printf("Ray %d differs for %d models: %d vs %d\n", kk, count, items[kk], reference[kk]);
+                return 1;
+            }
+        }
+        destroy_timer(timer);
+
+        printf("%8d | %6.3f ms %6.3f ms %6.3f ms | %7.3f/%7.3f ms | %7.4f/%7.4f ms | %7.4f/%7.4f ms\n", count,
+               build_time*1e3, update_time*1e3, refit_time*1e3,
+               frustum_time[0]*1e3, frustum_time[1]*1e3,
+               sphere_time[0]*1e3, sphere_time[1]*1e3,
+               ray_time[0]*1e3, ray_time[1]*1e3);
+        printf("%8s   %d nodes, depth %d\n", "", bvh_node_count(bvh), bvh_depth(bvh));
+
+        destroy_bvh(bvh);
+        free(reference);
+        free(items);
+        free(visible);
+        free(soa);
+        free(bounds);
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Converts assets into block compressed asset streams and reports the
+ *  compression ratio and decompression throughput.
+ *
+ *  Build:
+ *      make compress_asset
+ *  Usage:
+ *      compress_asset <input> <output>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compression.h"
+#include "system.h"
+#include "timer.h"
+
+/* Defines
+ */
+#define DECODE_ITERATIONS 16
+
+/* External functions
+ */
+int main(int argc, const char *argv[])
+{
+    void*   raw_data = NULL;
+    size_t  raw_size = 0;
+    void*   compressed = NULL;
+    size_t  compressed_size;
+    void*   decoded = NULL;
+    size_t  decoded_size = 0;
+    Timer*  timer;
+    double  seconds;
+    FILE*   file;
+    int     ii;
+
+    if(argc != 3) {
+        printf("Usage: %s <input> <output>\n", argv[0]);
+        return 1;
+    }
+    if(load_file_data(argv[1], &raw_data, &raw_size) != 0)
+        return 1;
+
+    compressed = malloc(compress_stream_bound(raw_size));
+    compressed_size = compress_stream(compressed, compress_stream_bound(raw_size), raw_data, raw_size);
+
+    /* Verify and time the round trip */
+    timer = create_timer();
+    for(ii=0;ii<DECODE_ITERATIONS;++ii) {
+        if(decompress_stream(&decoded, &decoded_size, compressed, compressed_size) != 0 ||
+           decoded_size != raw_size || memcmp(decoded, raw_data, raw_size) != 0) {
+            printf("%s: round trip failed\n", argv[1]);
+            return 1;
+        }
+        free(decoded);
+    }
+    seconds = get_running_time(timer)/DECODE_ITERATIONS;
+    destroy_timer(timer);
+
+    printf("%s: %lu -> %lu bytes (%.2f:1), decompression %.2f GB/s\n",
+           argv[1], (unsigned long)raw_size, (unsigned long)compressed_size,
+           raw_size/(double)compressed_size, raw_size/seconds*1e-9);
+
+    file = fopen(argv[2], "wb");
+    if(file == NULL)
+        return 1;
+    fwrite(compressed, compressed_size, 1, file);
+    fclose(file);
+
+    free(compressed);
+    free_file_data(raw_data);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Measures frustum culling cost as the model count grows, comparing the
+ *  SIMD and scalar box tests.
+ *
+ *  Build:
+ *      make cull_benchmark
+ *  Usage:
+ *      cull_benchmark
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "culling.h"
+#include "timer.h"
+
+/* Defines
+ */
+#define ITERATIONS  32
+#define WORLD_SIZE  500.0f
+
+/* Internal functions
+ */
+static float _random(float min, float max)
+{
+    return min + (max - min)*(rand()/(float)RAND_MAX);
+}
+
+/* External functions
+ */
+int main(void)
+{
+    static const int kCounts[] = { 1000, 10000, 100000 };
+    Mat4    view = mat4_inverse(mat4_translatef(0.0f, 2.0f, -50.0f));
+    Mat4    proj = mat4_perspective_fov(kPiDiv2, 16.0f/9.0f, 1.0f, 100.0f);
+    Frustum frustum = frustum_from_matrix(mat4_multiply(view, proj));
+    int     ii;
+
+    printf("%8s %10s %12s %12s %12s\n", "models", "visible", "transform", "scalar", "simd");
+    for(ii=0;ii<(int)(sizeof(kCounts)/sizeof(kCounts[0]));++ii) {
+        int         count = kCounts[ii];
+        Bounds*     local = (Bounds*)malloc(count*sizeof(Bounds));
+        Transform*  transforms = (Transform*)malloc(count*sizeof(Transform));
+        float*      soa = (float*)malloc(count*6*sizeof(float));
+        uint8_t*    visible = (uint8_t*)malloc(count);
+        uint8_t*    reference = (uint8_t*)malloc(count);
+        float*      center[3];
+        float*      extent[3];
+        double      transform_time, scalar_time, simd_time;
+        int         num_visible = 0;
+        int         jj, kk;
+        Timer*      timer;
+
+        for(jj=0;jj<3;++jj) {
+            center[jj] = soa + jj*count;
+            extent[jj] = soa + (jj+3)*count;
+        }
+        for(jj=0;jj<count;++jj) {
+            local[jj].center = vec3_create(0.0f, 0.5f, 0.0f);
+            local[jj].extents = vec3_create(_random(0.5f, 2.0f), 0.5f, _random(0.5f, 2.0f));
+            local[jj].radius = vec3_length(local[jj].extents);
+            transforms[jj] = transform_zero;
+            transforms[jj].orientation = quat_from_axis_anglef(0.0f, 1.0f, 0.0f, _random(0.0f, k2Pi));
+            transforms[jj].position = vec3_create(_random(-WORLD_SIZE, WORLD_SIZE), 0.0f, _random(-WORLD_SIZE, WORLD_SIZE));
+        }
+
+        timer = create_timer();
+        for(kk=0;kk<ITERATIONS;++kk) {
+            for(jj=0;jj<count;++jj) {
+                Bounds world = transform_bounds(&local[jj], transform_get_matrix(transforms[jj]));
+                center[0][jj] = world.center.x;
+                center[1][jj] = world.center.y;
+                center[2][jj] = world.center.z;
+                extent[0][jj] = world.extents.x;
+                extent[1][jj] = world.extents.y;
+                extent[2][jj] = world.extents.z;
+            }
+        }
+        transform_time = get_running_time(timer)/ITERATIONS;
+
+        reset_timer(timer);
+        for(kk=0;kk<ITERATIONS;++kk)
+            cull_boxes_scalar(&frustum, center[0], center[1], center[2], extent[0], extent[1], extent[2], count, reference);
+        scalar_time = get_running_time(timer)/ITERATIONS;
+
+        reset_timer(timer);
+        for(kk=0;kk<ITERATIONS;++kk)
+            num_visible = cull_boxes(&frustum, center[0], center[1], center[2], extent[0], extent[1], extent[2], count, visible);
+        simd_time = get_running_time(timer)/ITERATIONS;
+        destroy_timer(timer);
+
+        if(memcmp(visible, reference, count) != 0) {
+            printf("SIMD and scalar results differ for %d models\n", count);
+            return 1;
+        }
+        printf("%8d %10d %9.3f ms %9.3f ms %9.3f ms\n", count, num_visible,
+               transform_time*1000.0, scalar_time*1000.0, simd_time*1000.0);
+
+        free(reference);
+        free(visible);
+        free(soa);
+        free(transforms);
+        free(local);
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Measures light binning cost on a 1080p cluster grid as the light count
+ *  grows, comparing the scalar kernel with the SIMD one on one thread and
+ *  on the worker pool.
+ *
+ *  Build:
+ *      make light_bin_benchmark
+ *  Usage:
+ *      light_bin_benchmark
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "light_binning.h"
+#include "timer.h"
+
+/* Defines
+ */
+#define ITERATIONS  16
+#define WORLD_SIZE  100.0f
+
+/* Internal functions
+ */
+static float _random(float min, float max)
+{
+    return min + (max - min)*(rand()/(float)RAND_MAX);
+}
+static int _bins_equal(const LightBins* a, const LightBins* b)
+{
+    return a->num_clusters == b->num_clusters && a->num_indices == b->num_indices &&
+           memcmp(a->clusters, b->clusters, a->num_clusters*2*sizeof(uint32_t)) == 0 &&
+           memcmp(a->indices, b->indices, a->num_indices*sizeof(uint32_t)) == 0;
+}
+
+/* External functions
+ */
+int main(void)
+{
+    static const int kCounts[] = { 1000, 10000, 100000 };
+    LightGrid       grid;
+    LightBinner*    scalar = create_light_binner(1);
+    LightBinner*    single = create_light_binner(1);
+    LightBinner*    pool = create_light_binner(0);
+    int             ii;
+
+    /* The clustered forward grid at 1080p, 90 degree vertical field of view */
+    grid.width = 1920;
+    grid.height = 1080;
+    grid.tile_size = 32;
+    grid.depth_slices = 16;
+    grid.proj_x = 1.0f/(16.0f/9.0f);
+    grid.proj_y = 1.0f;
+    grid.near_plane = 1.0f;
+    grid.far_plane = 100.0f;
+
+    printf("%8s %12s %12s %12s %12s\n", "lights", "indices", "scalar", "simd", "threaded");
+    for(ii=0;ii<(int)(sizeof(kCounts)/sizeof(kCounts[0]));++ii) {
+        int         count = kCounts[ii];
+        float*      soa = (float*)malloc(count*4*sizeof(float));
+        float*      x = soa;
+        float*      y = soa + count;
+        float*      z = soa + count*2;
+        float*      radius = soa + count*3;
+        double      scalar_time, simd_time, threaded_time;
+        LightBins   reference, bins;
+        int         jj;
+        Timer*      timer;
+
+        /* View space lights scattered through and around the frustum */
+        for(jj=0;jj<count;++jj) {
+            z[jj] = _random(-5.0f, WORLD_SIZE);
+            x[jj] = _random(-WORLD_SIZE, WORLD_SIZE);
+            y[jj] = _random(-WORLD_SIZE*0.5f, WORLD_SIZE*0.5f);
+            radius[jj] = _random(1.0f, 8.0f);
+        }
+
+        timer = create_timer();
+        for(jj=0;jj<ITERATIONS;++jj)
+            reference = bin_lights_scalar(scalar, &grid, x, y, z, radius, count);
+        scalar_time = get_running_time(timer)/ITERATIONS;
+
+        reset_timer(timer);
+        for(jj=0;jj<ITERATIONS;++jj)
+            bins = bin_lights(single, &grid, x, y, z, radius, count);
+        simd_time = get_running_time(timer)/ITERATIONS;
+        if(!_bins_equal(&bins, &reference)) {
+            printf("SIMD and scalar results differ for %d lights\n", count);
+            return 1;
+        }
+
+        reset_timer(timer);
+        for(jj=0;jj<ITERATIONS;++jj)
+            bins = bin_lights(pool, &grid, x, y, z, radius, count);
+        threaded_time = get_running_time(timer)/ITERATIONS;
+        destroy_timer(timer);
+        if(!_bins_equal(&bins, &reference)) {
+            printf("Threaded and scalar results differ for %d lights\n", count);
+            return 1;
+        }
+
+        printf("%8d %12d %9.3f ms %9.3f ms %9.3f ms\n", count, reference.num_indices,
+               scalar_time*1000.0, simd_time*1000.0, threaded_time*1000.0);
+        free(soa);
+    }
+    destroy_light_binner(pool);
+    destroy_light_binner(single);
+    destroy_light_binner(scalar);
+    return 0;
+}